@@ -34,6 +34,7 @@
 
 #include "cat_model.h"
 #include "findfile.h"
+#include "geomcache.h"
 #include "partiviewc.h"
 
 #include "specks.h"	/* just for tokenize() -- ugh */
@@ -149,15 +150,6 @@ Model *Model::find( char *name )
   return m ? m : maybe;
 }
 
-time_t fmodtime(char *fname)
-{
-  struct stat st;
-
-  if(stat(fname, &st) < 0)
-    return 0;
-  return st.st_mtime;
-}
-
 /*
  * Do we have an up-to-date copy of "file"?
  * Returns 1 if yes, 0 if not seen, -1 if out-of-date.
@@ -303,6 +295,7 @@ void WavFaces::init()
   ap = NULL;
   obj = NULL;
   next = NULL;
+  els = NULL;
 }
 
 
@@ -324,24 +317,33 @@ int agetfloats( float *v, int max, int a0, int ac, char **av )
 WavObj *WavObj::addObj( char *name, char *group )
 {
     WavObj *obj;
-    char fullname[256];
 
     obj = new WavObj();
     *obj = *this;
 
-    sprintf(fullname, group ? "%.127s:%.127s" : "%.127s", name, group);
-    obj->name = shmstrdup(fullname);
-
     obj->pt.trim(0);
     obj->tx.trim(0);
     obj->norm.trim(0);
-
-    obj->add();		/* Add new object to public list */
-
     for(WavFaces *wf = obj->faces; wf != NULL; wf = wf->next) {
 	wf->nfv.trim(0);
 	wf->fv.trim(0);
-	wf->obj = obj;
+    }
+    obj->publish( name, group, fname );
+    return obj;
+}
+
+/* Name a new object, add it to the public list, and check its materials. */
+void WavObj::publish( char *name, char *group, char *srcfname )
+{
+    char fullname[256];
+
+    sprintf(fullname, group ? "%.127s:%.127s" : "%.127s", name, group);
+    this->name = shmstrdup(fullname);
+
+    add();		/* Add new object to public list */
+
+    for(WavFaces *wf = faces; wf != NULL; wf = wf->next) {
+	wf->obj = this;
 
 	/*
 	 * Check that we found all the material-types we need.
@@ -349,10 +351,10 @@ WavObj *WavObj::addObj( char *name, char *group )
 	 */
 	if(!wf->ap) {
 	    msg("Warning: %s: no material for group of %d faces?",
-		    fname, wf->nfv.count);
+		    srcfname, wf->nfv.count);
 	} else if(!wf->ap->defined) {
 	    msg("Warning: %s: found no def'n for material %s",
-		    fname, wf->ap->name );
+		    srcfname, wf->ap->name );
 	    wf->ap->defined = 1;
 	    wf->ap->lighted = 0;
 	    wf->ap->Kd = 1;
@@ -363,7 +365,91 @@ WavObj *WavObj::addObj( char *name, char *group )
 	    wf->ap->loadTextures();
 	}
     }
-    return obj;
+}
+
+/*
+ * Geometry cache for .obj files (see geomcache.h).  Each object (one per
+ * "group") saves its points, texture coords, normals and face clumps;
+ * each clump remembers its material by name, to be found again in the scene.
+ */
+void WavObj::saveCache( GeomCache *gc, int objno, char *group )
+{
+    char sname[64];
+    int j = 0;
+
+    if(gc == NULL)
+	return;
+    sprintf(sname, "o%d.group", objno);
+    geomcache_put( gc, sname, group, 1, group ? strlen(group)+1 : 0 );
+    sprintf(sname, "o%d.pt", objno);
+    geomcache_put( gc, sname, pt.v, sizeof(Point), pt.count );
+    sprintf(sname, "o%d.tx", objno);
+    geomcache_put( gc, sname, tx.v, sizeof(Point), tx.count );
+    sprintf(sname, "o%d.norm", objno);
+    geomcache_put( gc, sname, norm.v, sizeof(Point), norm.count );
+    for(WavFaces *wf = faces; wf != NULL; wf = wf->next, j++) {
+	sprintf(sname, "o%d.f%d.ap", objno, j);
+	geomcache_put( gc, sname, wf->ap ? wf->ap->name : NULL, 1,
+			wf->ap ? strlen(wf->ap->name)+1 : 0 );
+	sprintf(sname, "o%d.f%d.nfv", objno, j);
+	geomcache_put( gc, sname, wf->nfv.v, sizeof(int), wf->nfv.count );
+	sprintf(sname, "o%d.f%d.fv", objno, j);
+	geomcache_put( gc, sname, wf->fv.v, sizeof(int), wf->fv.count );
+    }
+    sprintf(sname, "o%d.nfaces", objno);
+    geomcache_put( gc, sname, &j, sizeof(int), 1 );
+}
+
+/* Point vv at a cache section, in place (except with CAVE shared memory). */
+template <class T>
+static void cachevvec( vvec<T> &vv, GeomCache *gc, char *sname )
+{
+    int n;
+    T *p = static_cast<T *>(geomcache_get( gc, sname, sizeof(T), &n ));
+    vv.use( p, n );
+    vv.count = n;
+#if CAVE
+    vv.trim(0);
+#endif
+}
+
+int WavObj::readCache( GeomCache *gc, char *name, WavObj *me )
+{
+    char sname[64];
+    int k, j, n, *nobj, *nfaces;
+
+    nobj = static_cast<int *>(geomcache_get( gc, "nobj", sizeof(int), &n ));
+    if(nobj == NULL || n != 1)
+	return 0;
+
+    for(k = 0; k < *nobj; k++) {
+	WavObj *obj = new WavObj();
+	WavFaces **tail = &obj->faces;
+
+	obj->scene = me->scene;
+	sprintf(sname, "o%d.pt", k);	cachevvec( obj->pt, gc, sname );
+	sprintf(sname, "o%d.tx", k);	cachevvec( obj->tx, gc, sname );
+	sprintf(sname, "o%d.norm", k);	cachevvec( obj->norm, gc, sname );
+
+	sprintf(sname, "o%d.nfaces", k);
+	nfaces = static_cast<int *>(geomcache_get( gc, sname, sizeof(int), &n ));
+	for(j = 0; nfaces != NULL && j < *nfaces; j++) {
+	    WavFaces *wf = WavFaces::create();
+	    sprintf(sname, "o%d.f%d.ap", k, j);
+	    char *apname = static_cast<char *>(geomcache_get( gc, sname, 1, &n ));
+	    if(n > 0)
+		wf->ap = Appearance::find( &me->scene->aps, apname );
+	    sprintf(sname, "o%d.f%d.nfv", k, j);	cachevvec( wf->nfv, gc, sname );
+	    sprintf(sname, "o%d.f%d.fv", k, j);	cachevvec( wf->fv, gc, sname );
+	    *tail = wf;
+	    tail = &wf->next;
+	}
+
+	sprintf(sname, "o%d.group", k);
+	char *group = static_cast<char *>(geomcache_get( gc, sname, 1, &n ));
+	obj->publish( name, n > 0 ? group : NULL, me->fname );
+    }
+    return 1;
 }
 
 int WavObj::readFile( char *name, char *fname, char *scenename, int complain )
@@ -402,6 +488,18 @@ int WavObj::readFile( char *name, char *fname, char *scenename, int complain )
 
     me.scene->readScene( scenename, complain );
 
+    GeomCache *gc = geomcache_open( fname, "obj" );
+    if(gc != NULL) {
+	int cached = readCache( gc, name, &me );
+	geomcache_close( gc );
+	if(cached) {
+	    fclose(inf);
+	    return 1;
+	}
+    }
+    gc = geomcache_create( fname, "obj" );
+    int nobj = 0;
+
     /*
      * Use auto vars for default space.
      */
@@ -455,7 +553,7 @@ int WavObj::readFile( char *name, char *fname, char *scenename, int complain )
 
 	} else if(!strcmp(s, "group")) {
 	    if(me.pt.count > 0) {
-		me.addObj( name, group );
+		me.addObj( name, group )->saveCache( gc, nobj++, group );
 
 		me.faces = NULL;
 		me.pt.count = me.tx.count = me.norm.count = 0;
@@ -577,8 +675,11 @@ int WavObj::readFile( char *name, char *fname, char *scenename, int complain )
 	me.fmtime = fmodtime(me.fname);
 	me.defined = 1;
 
-	me.addObj( name, group );
+	me.addObj( name, group )->saveCache( gc, nobj++, group );
+	geomcache_put( gc, "nobj", &nobj, sizeof(int), 1 );
+	geomcache_save( gc );
     }
+    geomcache_close( gc );
     return ok;
 }
 
@@ -859,6 +960,67 @@ void Appearance::loadTextures()
   }
 }
 
+/*
+ * Lay out our faces for elements_draw(): one vertex per face-vertex, and a
+ * group of indices per primitive type, with polygons split into triangles.
+ * Face-vertices lacking a normal or texture coord inherit the previous one,
+ * as they would have with glNormal()/glTexCoord().
+ */
+void WavFaces::prepareElements( WavObj *o )
+{
+    static Point zero = {{0,0,0}}, zaxis = {{0,0,1}};
+    int npts = 0, nlines = 0, ntris = 0, nquads = 0, nv = 0;
+    int hastx = 0, hasnorm = 0;
+    int i, k, *fvp, *nfvp;
+
+    for(i = 0, nfvp = nfv.v; i < nfv.count; i += 2, nfvp += 2) {
+	switch(nfvp[0]) {
+	case 1: npts++; break;
+	case 2: nlines++; break;
+	case 4: nquads++; break;
+	default: if(nfvp[0] >= 3) ntris += nfvp[0] - 2; break;
+	}
+	for(k = 0, fvp = &fv.v[ nfvp[1] ]; k < nfvp[0]; k++, fvp += 3) {
+	    if(fvp[1] >= 0) hastx = 1;
+	    if(fvp[2] >= 0) hasnorm = 1;
+	}
+	nv += nfvp[0];
+    }
+
+    ElementSet *es = elements_create( hastx && hasnorm ? GL_T2F_N3F_V3F
+				: hastx ? GL_T2F_V3F
+				: hasnorm ? GL_N3F_V3F : GL_V3F,
+				nv, 4, npts + 2*nlines + 3*ntris + 4*nquads );
+    int *pix = elements_add( es, GL_POINTS, npts );
+    int *lix = elements_add( es, GL_LINES, 2*nlines );
+    int *tix = elements_add( es, GL_TRIANGLES, 3*ntris );
+    int *qix = elements_add( es, GL_QUADS, 4*nquads );
+
+    Point *ctx = &zero, *cnorm = &zaxis;
+    nv = 0;
+    for(i = 0, nfvp = nfv.v; i < nfv.count; i += 2, nfvp += 2) {
+	int v0 = nv;
+	for(k = 0, fvp = &fv.v[ nfvp[1] ]; k < nfvp[0]; k++, fvp += 3, nv++) {
+	    if(fvp[1] >= 0) ctx = &o->tx.v[ fvp[1] ];
+	    if(fvp[2] >= 0) cnorm = &o->norm.v[ fvp[2] ];
+	    elements_setvert( es, nv, ctx, cnorm, &o->pt.v[ fvp[0] ] );
+	}
+	switch(nfvp[0]) {
+	case 1: *pix++ = v0; break;
+	case 2: *lix++ = v0; *lix++ = v0+1; break;
+	case 4: for(k = 0; k < 4; k++) *qix++ = v0+k; break;
+	default:
+	    for(k = 2; k < nfvp[0]; k++) {
+		*tix++ = v0;
+		*tix++ = v0+k-1;
+		*tix++ = v0+k;
+	    }
+	    break;
+	}
+    }
+    els = es;
+}
+
 void WavObj::render()
 {
     WavFaces *wf;
@@ -876,6 +1038,11 @@ void WavObj::render()
 	if(wf->ap)
 	    wf->ap->applyOGL(wf);
 
+	if(wf->els == NULL)
+	    wf->prepareElements( this );
+	if(elements_draw( wf->els, 0 ))
+	    continue;
+
 	nfvp = wf->nfv.v;
 	for(i = 0, nfvp = wf->nfv.v; i < wf->nfv.count; i += 2, nfvp += 2) {
 	    int nverts = nfvp[0];
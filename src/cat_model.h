@@ -161,12 +161,14 @@ class WavFaces : public Shmem {
 	Appearance *ap;	/* with this appearance */
 	WavObj *obj;	/* reference back to our parent object */
 	WavFaces *next; /* next group of faces */
+	struct elementset *els;	/* our faces, ready for elements_draw(), or NULL */
 
 	WavFaces();
 	~WavFaces();
 
 	static WavFaces *create();
 	void init();
+	void prepareElements( WavObj *obj );
 };
 
 /* Wavefront object, read from .obj file,
@@ -201,6 +203,9 @@ class WavObj : public Model {
 
   private:
 	WavObj *addObj( char *name, char *group );
+	void publish( char *name, char *group, char *srcfname );
+	void saveCache( struct geomcache *gc, int objno, char *group );
+	static int readCache( struct geomcache *gc, char *name, WavObj *me );
 };
 
 class HappyFace : public Model {
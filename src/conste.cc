@@ -10,6 +10,7 @@
 #endif
 
 #include "futil.h"
+#include "shmem.h"
 
 #ifdef __APPLE__
 # include <OpenGL/gl.h>
@@ -34,13 +35,23 @@ extern "C" {
 struct conste
 {
     char name[64];
-    GLuint line_index;  /* OpenGL display list index for line */
-    GLuint fig_index;   /* OpenGL display list index for figure */
     char line_filename[256];
     char fig_filename[256];
     float lnear;
     float lfar;
     int state;
+
+    int nlinev;         /* line vertices, 3 floats each */
+    float *linev;
+    int nstrips;        /* ... in strips of strip[i] vertices */
+    int *strip;
+
+    int fig_ok;         /* figure: read OK? */
+    float pos[3], size, rot;
+    int numPoints;      /* 2-D points, */
+    float *points;
+    int numIndexes;     /* drawn in this order, with -1 separating strips */
+    int *indexes;
 };
 
 struct constestuff {
@@ -48,6 +59,9 @@ struct constestuff {
     int num_constes;
     float line_color[3];
     float fig_color[3];
+    GLuint line_list;   /* OpenGL display lists for all shown lines */
+    GLuint fig_list;    /* ... and figures */
+    int dirty;          /* CONSTE_LINE|CONSTE_FIG: must recompile that list */
 };
 
 
@@ -59,97 +73,67 @@ extern "C" {
  }
 }
 
-int conste_build_line(conste *_cd)
+int conste_read_fig(conste *_cd)
 {
     FILE *fp;
-    char line[256];
-    char token[256];
-    float vec0[3];
 
-    if (!_cd->line_filename) return 0;
+    if (_cd->fig_filename[0] == '\0') return 0;
 
-    fp = fopen(_cd->line_filename,"r");
+    fp = fopen(_cd->fig_filename,"rb");
     if (!fp) {
-        msg("Data file %s not found.",_cd->line_filename);
+        msg("Data file %s not found.",_cd->fig_filename);
         return 0;
     }
 
-    while (fgets(line,256,fp) != NULL)
-    {
-        sscanf(line,"%s",token);
-        if (strcmp(token,"Lines:") == 0) {
-            _cd->line_index = glGenLists(1);
-            glNewList(_cd->line_index,GL_COMPILE_AND_EXECUTE);
-            glBegin(GL_LINE_STRIP);
-            while (fgets(line,256,fp) != NULL && line[0] != '}')
-            {
-                if (sscanf(line,"%f %f %f",&vec0[0],&vec0[1],&vec0[2]) < 3) {
-                    glEnd();
-                    glBegin(GL_LINE_STRIP);
-                } else {
-                    glVertex3fv(vec0);
-                }
-            }
-            glEnd();
-            glEndList();
-        }
+    fgetnf(fp, 3, _cd->pos, F_BINARY_LE);
+    fgetnf(fp, 1, &_cd->size, F_BINARY_LE);
+    fgetnf(fp, 1, &_cd->rot, F_BINARY_LE);
+    _cd->numPoints = -1;
+    fgetni(fp, 1, &_cd->numPoints, F_BINARY_LE);
+    if(_cd->numPoints < 0 || _cd->numPoints > 65535) {
+	msg("constellation file %s garbled", _cd->fig_filename);
+	fclose(fp);
+	return 0;
     }
+    _cd->points = new float[_cd->numPoints*2];
+    fgetnf(fp, _cd->numPoints*2, _cd->points, F_BINARY_LE);
+    _cd->numIndexes = 0;
+    fgetni(fp, 1, &_cd->numIndexes, F_BINARY_LE);
+    if(_cd->numIndexes < 0)
+	_cd->numIndexes = 0;
+    _cd->indexes = new int[_cd->numIndexes];
+    if(fgetni(fp, _cd->numIndexes, _cd->indexes, F_BINARY_LE) < _cd->numIndexes)
+	_cd->numIndexes = 0;
+    for (int i=0;i<_cd->numIndexes;i++)
+	if (_cd->indexes[i] >= _cd->numPoints)
+	    _cd->indexes[i] = -1;
 
     fclose(fp);
 
+    _cd->fig_ok = 1;
     return 1;
 }
 
-int conste_build_fig(conste *_cd)
+/* Issue GL calls for one figure (as conste_draw() compiles them) */
+static void conste_emit_fig(conste *_cd)
 {
-    FILE *fp;
-    float pos[3];
-    float size,rot;
-    float *points;
-    int numPoints;
-    int *indexes;
-    int numIndexes;
+    float scale = (_cd->lnear + _cd->lfar) / 2.0f;
     int i;
 
-    if (!_cd->fig_filename) return 0;
-
-    fp = fopen(_cd->fig_filename,"rb");
-    if (!fp) {
-        msg("Data file %s not found.",_cd->fig_filename);
-        return 0;
-    }
-
-    _cd->fig_index = glGenLists(1);
-    glNewList(_cd->fig_index,GL_COMPILE);
-
-    fgetnf(fp, 3, pos, F_BINARY_LE);
-    fgetnf(fp, 1, &size, F_BINARY_LE);
-    fgetnf(fp, 1, &rot, F_BINARY_LE);
-    numPoints = -1;
-    fgetni(fp, 1, &numPoints, F_BINARY_LE);
-    if(numPoints < 0 || numPoints > 65535) {
-	msg("constellation file %s garbled", _cd->fig_filename);
-	return 0;
-    }
-    points = new float[numPoints*2];
-    fgetnf(fp, numPoints*2, points, F_BINARY_LE);
-    fgetni(fp, 1, &numIndexes, F_BINARY_LE);
-    indexes = new int[numIndexes];
-    fgetni(fp, numIndexes, indexes, F_BINARY_LE);
-
     glPushMatrix();
+    glScalef(scale, scale, scale);
 /*    glMultMatrixf((float *)sssim2gview);*/
     glRotatef(90.0f,0.0f,0.0f,-1.0f);
     glRotatef(90.0f,0.0f,-1.0f,0.0f);
-    if (size != 1.0f)
+    if (_cd->size != 1.0f)
     {
         Point from,to;
         from.x[0] = 0.0f;
         from.x[1] = 0.0f;
         from.x[2] = 1.0f;
-        to.x[0] = 0.5f * pos[0];
-        to.x[1] = 0.5f * pos[1];
-        to.x[2] = 0.5f * pos[2];
+        to.x[0] = 0.5f * _cd->pos[0];
+        to.x[1] = 0.5f * _cd->pos[1];
+        to.x[2] = 0.5f * _cd->pos[2];
         float cpdist = sqrtf(to.x[0]*to.x[0]+to.x[1]*to.x[1]+to.x[2]*to.x[2]);
         to.x[0] /= cpdist;
         to.x[1] /= cpdist;
@@ -158,14 +142,14 @@ int conste_build_fig(conste *_cd)
         Matrix mat;
         grotation(&mat,&from,&to);
         glMultMatrixf(mat.m);
-        glScalef(size/cpdist,size/cpdist,1.0);
-        glRotatef(rot,0.0f,0.0f,1.0f);
+        glScalef(_cd->size/cpdist,_cd->size/cpdist,1.0);
+        glRotatef(_cd->rot,0.0f,0.0f,1.0f);
     }
     glBegin(GL_LINE_STRIP);
-    for (i=0;i<numIndexes;i++)
+    for (i=0;i<_cd->numIndexes;i++)
     {
-        if (indexes[i] >= 0) {
-            glVertex2f(-points[indexes[i]*2],points[indexes[i]*2+1]);
+        if (_cd->indexes[i] >= 0) {
+            glVertex2f(-_cd->points[_cd->indexes[i]*2],_cd->points[_cd->indexes[i]*2+1]);
         } else {
             glEnd();
             glBegin(GL_LINE_STRIP);
@@ -173,15 +157,41 @@ int conste_build_fig(conste *_cd)
     }
     glEnd();
     glPopMatrix();
+}
 
-    delete [] points;
-    delete [] indexes;
-
-    glEndList();
+static void conste_emit_lines(conste *_cd)
+{
+    float *v = _cd->linev;
+    int i, k;
+
+    for (i=0;i<_cd->nstrips;i++) {
+        glBegin(GL_LINE_STRIP);
+        for (k=0;k<_cd->strip[i];k++,v+=3)
+            glVertex3fv(v);
+        glEnd();
+    }
+}
 
-    fclose(fp);
+/* (Re)compile the display list of all shown lines or figures */
+static void conste_compile(constestuff *cs, int interest)
+{
+    GLuint *listp = (interest == CONSTE_LINE) ? &cs->line_list : &cs->fig_list;
+    int i;
 
-    return 1;
+    if (*listp == 0)
+        *listp = glGenLists(1);
+    glNewList(*listp,GL_COMPILE);
+    for (i=0;i<cs->num_constes;i++) {
+        conste *cd = &cs->constes[i];
+        if (!(cd->state & interest))
+            continue;
+        if (interest == CONSTE_LINE)
+            conste_emit_lines(cd);
+        else if (cd->fig_ok)
+            conste_emit_fig(cd);
+    }
+    glEndList();
+    cs->dirty &= ~interest;
 }
 
 int conste_read_data(conste *_cd,char *_filename)
@@ -193,13 +203,13 @@ int conste_read_data(conste *_cd,char *_filename)
     char *start;
     float x,y,z;
     float lnear,lfar,dist;
+    int room = 0, strooms = 0;
 
     lnear = 0.0f;
     lfar = 0.0f;
     dist = 0.0f;
 
-    _cd->line_index = 0;
-    _cd->fig_index = 0;
+    memset(_cd, 0, sizeof(*_cd));
     _cd->state = CONSTE_LINE | CONSTE_FIG;
     strcpy(_cd->line_filename,_filename);
 
@@ -225,12 +235,33 @@ int conste_read_data(conste *_cd,char *_filename)
                 strcpy(_cd->fig_filename,filename);
         }
         else if (strcmp(token,"Lines:") == 0) {
+            int instrip = 0;
             while (fgets(line,256,fp) != NULL && line[0] != '}')
             {
                 if (sscanf(line,"%f %f %f",&x,&y,&z) == 3) {
                     dist = x*x+y*y+z*z;
                     if (lnear == 0.0f || dist < lnear) lnear = dist; 
                     if (lfar == 0.0f || dist > lfar) lfar = dist; 
+
+                    if (_cd->nlinev >= room) {
+                        room = 2*room + 64;
+                        _cd->linev = RenewN( _cd->linev, float, 3*room );
+                    }
+                    _cd->linev[3*_cd->nlinev] = x;
+                    _cd->linev[3*_cd->nlinev+1] = y;
+                    _cd->linev[3*_cd->nlinev+2] = z;
+                    _cd->nlinev++;
+                    if (!instrip) {
+                        if (_cd->nstrips >= strooms) {
+                            strooms = 2*strooms + 16;
+                            _cd->strip = RenewN( _cd->strip, int, strooms );
+                        }
+                        _cd->strip[_cd->nstrips++] = 0;
+                        instrip = 1;
+                    }
+                    _cd->strip[_cd->nstrips-1]++;
+                } else {
+                    instrip = 0;        /* anything else starts a new strip */
                 }
             }
         }
@@ -240,6 +271,8 @@ int conste_read_data(conste *_cd,char *_filename)
 
     fclose(fp);
 
+    conste_read_fig(_cd);
+
     return 1;
 }
 
@@ -266,11 +299,13 @@ int conste_read(struct stuff **_stp, int argc, char *argv[], char *_filename, vo
     }
 
     constestuff *cs = new constestuff;
+    memset(cs, 0, sizeof(*cs));
     if(fscanf(fp,"%i",&cs->num_constes) <= 0) {
 	msg("conste %s: expected num_constes", argv[1]);
 	return 0;
     }
     cs->constes = new conste[cs->num_constes];
+    memset(cs->constes, 0, cs->num_constes * sizeof(conste));
 
     for (i=0;i<cs->num_constes;i++) {
         if(fscanf(fp,"%255s",data_filename) <= 0) {
@@ -292,6 +327,8 @@ int conste_read(struct stuff **_stp, int argc, char *argv[], char *_filename, vo
     cs->fig_color[1] = 0.500000f;
     cs->fig_color[2] = 0.500000f;
 
+    cs->dirty = CONSTE_LINE | CONSTE_FIG;
+
     _st->conste = 1;
     _st->constedata = cs;
     _st->textsize = 1.0f;
@@ -303,41 +340,29 @@ int conste_read(struct stuff **_stp, int argc, char *argv[], char *_filename, vo
 
 void conste_draw(struct stuff *_st)
 {
-    int i;
-
     glPushMatrix();
     glRotatef(90.0f,0.0f,0.0f,1.0f);
     glRotatef(90.0f,1.0f,0.0f,0.0f);
 
     constestuff *cs = (reinterpret_cast<constestuff *>(_st->constedata));
 
+    /* Everything shown is compiled into one list each for lines and figures;
+     * we recompile only when "conste ... show/hide" changes what's shown.
+     */
     if (_st->usepoly)
     {
         glColor3fv(cs->line_color);
-        for (i=0;i<cs->num_constes;i++) {
-            if (cs->constes[i].state & CONSTE_LINE) {
-                if (cs->constes[i].line_index == 0)
-                    conste_build_line(&cs->constes[i]);
-                glCallList(cs->constes[i].line_index);
-            }
-        }
+        if (cs->line_list == 0 || (cs->dirty & CONSTE_LINE))
+            conste_compile(cs, CONSTE_LINE);
+        glCallList(cs->line_list);
     }
 
     if (_st->usetextures)
     {
         glColor3fv(cs->fig_color);
-        for (i=0;i<cs->num_constes;i++) {
-            if (cs->constes[i].state & CONSTE_FIG) {
-                if (cs->constes[i].fig_index == 0)
-                    conste_build_fig(&cs->constes[i]);
-                glPushMatrix();
-                glScalef((cs->constes[i].lnear + cs->constes[i].lfar) / 2.0f,
-                         (cs->constes[i].lnear + cs->constes[i].lfar) / 2.0f,
-                         (cs->constes[i].lnear + cs->constes[i].lfar) / 2.0f);
-                glCallList(cs->constes[i].fig_index);
-                glPopMatrix();
-            }
-        }
+        if (cs->fig_list == 0 || (cs->dirty & CONSTE_FIG))
+            conste_compile(cs, CONSTE_FIG);
+        glCallList(cs->fig_list);
     }
 
     glPopMatrix();
@@ -387,6 +412,7 @@ int conste_parse_args(struct stuff **_stp,int _argc,char *_argv[], char *_filena
                             }
                 }
             }
+            cs->dirty |= interest;
             msg(result);
         }
         else if (!strcmp(_argv[1],"hide")) {
@@ -411,6 +437,7 @@ int conste_parse_args(struct stuff **_stp,int _argc,char *_argv[], char *_filena
                             }
                 }
             }
+            cs->dirty |= interest;
             msg(result);
         }
         else if (!strcmp(_argv[1],"color")) {
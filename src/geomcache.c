@@ -0,0 +1,314 @@
+/*
+ * Binary geometry cache.
+ * Parsing big ASCII models takes a while, so after parsing one we save
+ * its arrays in a cache file; next time, if the source file's path,
+ * mtime and size still match, we mmap the cache and use it in place.
+ *
+ * Cache files live beside their source, as .NAME.TAG.pvgc, or in
+ * $PARTIVIEW_GEOMCACHE if that names a directory.  If we can't write
+ * there, we just don't cache.
+ *
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+# include "winjunk.h"
+#else
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+#endif
+
+#include "shmem.h"
+#include "geomcache.h"
+
+#if !defined(WIN32) && !CAVE
+# define GCMMAP 1	/* map files, rather than reading them into (shared) memory */
+#endif
+
+#define GCMAGIC		"PVGEOM\n"
+#define GCVERSION	1
+#define GCORDER		0x01020304	/* tells us if the file has our byte order */
+#define GCALIGN		16		/* section alignment */
+#define GCNAMELEN	64
+
+struct gchead {
+  char magic[8];
+  int order, version;
+  long long mtime, size;	/* source file's */
+  int nsect;
+  int pathlen;			/* source path follows the section table */
+};
+
+struct gcsect {
+  char name[GCNAMELEN];
+  int elsize, count;
+  long long offset;		/* from start of file */
+};
+
+struct geomcache {
+  char *srcpath;
+  char *cachepath;
+  int nsect, sectroom;
+  struct gcsect *sect;
+  char **data;			/* for writing: our copies of each section */
+  char *base;			/* for reading: the whole file */
+  long long len;
+  long long mtime, size;	/* for writing: source file's, before we parsed it */
+};
+
+int geomcache_enabled = -1;	/* -1: not yet checked environment */
+
+time_t fmodtime( CONST char *fname )
+{
+  struct stat st;
+
+  if(stat(fname, &st) < 0)
+    return 0;
+  return st.st_mtime;
+}
+
+int geomcache_active( void )
+{
+  if(geomcache_enabled < 0) {
+    char *env = getenv("PARTIVIEW_GEOMCACHE");
+    geomcache_enabled = !(env && (!strcmp(env, "off") || !strcmp(env, "0")));
+  }
+  return geomcache_enabled;
+}
+
+static char *gc_cachepath( CONST char *srcpath, CONST char *tag )
+{
+  char *env = getenv("PARTIVIEW_GEOMCACHE");
+  CONST char *tail = strrchr( srcpath, '/' );
+  struct stat st;
+  unsigned int hash = 2166136261u;
+  CONST char *cp;
+  char *path;
+
+  tail = tail ? tail+1 : srcpath;
+  if(env && stat(env, &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR) {
+    /* shared cache directory: tell same-named files apart by hashing their paths */
+    for(cp = srcpath; *cp; cp++)
+	hash = (hash ^ (unsigned char)*cp) * 16777619u;
+    path = NewN( char, strlen(env) + strlen(tail) + strlen(tag) + 24 );
+    sprintf(path, "%s/%s.%s.%08x.pvgc", env, tail, tag, hash);
+  } else {
+    int dirlen = tail - srcpath;
+    path = NewN( char, strlen(srcpath) + strlen(tag) + 8 );
+    sprintf(path, "%.*s.%s.%s.pvgc", dirlen, srcpath, tail, tag);
+  }
+  return path;
+}
+
+static GeomCache *gc_new( CONST char *srcpath, CONST char *tag )
+{
+  GeomCache *gc = NewN( GeomCache, 1 );
+  memset( gc, 0, sizeof(*gc) );
+  gc->srcpath = shmstrdup( (char *)srcpath );
+  gc->cachepath = gc_cachepath( srcpath, tag );
+  return gc;
+}
+
+GeomCache *geomcache_open( CONST char *srcpath, CONST char *tag )
+{
+  GeomCache *gc;
+  struct gchead *h;
+  struct stat sst, cst;
+  FILE *f;
+  int i;
+
+  if(srcpath == NULL || !geomcache_active() || stat(srcpath, &sst) < 0)
+    return NULL;
+
+  gc = gc_new( srcpath, tag );
+  if((f = fopen(gc->cachepath, "rb")) == NULL
+		|| fstat(fileno(f), &cst) < 0
+		|| cst.st_size < (long long)sizeof(struct gchead))
+    goto fail;
+  gc->len = cst.st_size;
+
+#if GCMMAP
+  gc->base = (char *)mmap( NULL, gc->len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fileno(f), 0 );
+  if(gc->base == (char *)MAP_FAILED) {
+    gc->base = NULL;
+    goto fail;
+  }
+#else
+  gc->base = NewN( char, gc->len );
+  if(fread( gc->base, gc->len, 1, f ) != 1)
+    goto fail;
+#endif
+  fclose(f);
+  f = NULL;
+
+  h = (struct gchead *)gc->base;
+  if(memcmp( h->magic, GCMAGIC, sizeof(h->magic) ) != 0
+	|| h->order != GCORDER || h->version != GCVERSION
+	|| h->mtime != (long long)sst.st_mtime || h->size != (long long)sst.st_size
+	|| h->nsect < 0
+	|| sizeof(*h) + h->nsect*sizeof(struct gcsect) + h->pathlen > gc->len)
+    goto fail;
+  gc->nsect = h->nsect;
+  gc->sect = (struct gcsect *)(h + 1);
+  if(strlen(srcpath) != h->pathlen
+	|| memcmp( (char *)&gc->sect[gc->nsect], srcpath, h->pathlen ) != 0)
+    goto fail;
+  for(i = 0; i < gc->nsect; i++) {
+    struct gcsect *s = &gc->sect[i];
+    if(s->offset < 0 || s->elsize < 0 || s->count < 0
+		|| s->offset + (long long)s->elsize * s->count > gc->len)
+	goto fail;
+  }
+  return gc;
+
+ fail:
+  if(f) fclose(f);
+  if(gc->base) {
+#if GCMMAP
+    munmap( gc->base, gc->len );
+#else
+    Free( gc->base );
+#endif
+    gc->base = NULL;
+  }
+  gc->sect = NULL;		/* pointed into base */
+  gc->nsect = 0;
+  geomcache_close( gc );
+  return NULL;
+}
+
+void *geomcache_get( GeomCache *gc, CONST char *name, int elsize, int *countp )
+{
+  int i;
+
+  for(i = 0; i < gc->nsect; i++) {
+    struct gcsect *s = &gc->sect[i];
+    if(!strncmp( s->name, name, GCNAMELEN ) && s->elsize == elsize) {
+	if(countp) *countp = s->count;
+	return gc->base + s->offset;
+    }
+  }
+  if(countp) *countp = 0;
+  return NULL;
+}
+
+/* Call this before parsing srcpath, so a change during parsing makes the cache stale. */
+GeomCache *geomcache_create( CONST char *srcpath, CONST char *tag )
+{
+  GeomCache *gc;
+  struct stat sst;
+
+  if(srcpath == NULL || !geomcache_active() || stat(srcpath, &sst) < 0)
+    return NULL;
+  gc = gc_new( srcpath, tag );
+  gc->mtime = sst.st_mtime;
+  gc->size = sst.st_size;
+  return gc;
+}
+
+void geomcache_put( GeomCache *gc, CONST char *name, CONST void *data, int elsize, int count )
+{
+  struct gcsect *s;
+  int nbytes = elsize * count;
+
+  if(gc == NULL)
+    return;
+  if(gc->nsect >= gc->sectroom) {
+    gc->sectroom = 2*gc->sectroom + 8;
+    gc->sect = RenewN( gc->sect, struct gcsect, gc->sectroom );
+    gc->data = RenewN( gc->data, char *, gc->sectroom );
+  }
+  s = &gc->sect[gc->nsect];
+  memset( s, 0, sizeof(*s) );
+  strncpy( s->name, name, GCNAMELEN-1 );
+  s->elsize = elsize;
+  s->count = count;
+  gc->data[gc->nsect] = NewN( char, nbytes + 1 );
+  if(nbytes > 0)
+    memcpy( gc->data[gc->nsect], data, nbytes );
+  gc->nsect++;
+}
+
+int geomcache_save( GeomCache *gc )
+{
+  static char zeros[GCALIGN];
+  struct gchead h;
+  char *tmppath;
+  long long off;
+  FILE *f;
+  int i, ok;
+
+  if(gc == NULL || gc->base != NULL)
+    return 0;
+
+  memset( &h, 0, sizeof(h) );
+  memcpy( h.magic, GCMAGIC, sizeof(h.magic) );
+  h.order = GCORDER;
+  h.version = GCVERSION;
+  h.mtime = gc->mtime;
+  h.size = gc->size;
+  h.nsect = gc->nsect;
+  h.pathlen = strlen(gc->srcpath);
+
+  off = sizeof(h) + gc->nsect * sizeof(struct gcsect) + h.pathlen;
+  for(i = 0; i < gc->nsect; i++) {
+    off = (off + GCALIGN-1) & ~(long long)(GCALIGN-1);
+    gc->sect[i].offset = off;
+    off += (long long)gc->sect[i].elsize * gc->sect[i].count;
+  }
+
+  /* Write a temp file and rename it, so readers never see a partial cache */
+  tmppath = NewN( char, strlen(gc->cachepath) + 16 );
+  sprintf(tmppath, "%s.%d", gc->cachepath, (int)getpid());
+  if((f = fopen(tmppath, "wb")) == NULL) {
+    Free(tmppath);
+    return 0;
+  }
+  ok = fwrite( &h, sizeof(h), 1, f ) == 1
+	&& (gc->nsect == 0 || fwrite( gc->sect, sizeof(struct gcsect), gc->nsect, f ) == gc->nsect)
+	&& fwrite( gc->srcpath, 1, h.pathlen, f ) == h.pathlen;
+  off = sizeof(h) + gc->nsect * sizeof(struct gcsect) + h.pathlen;
+  for(i = 0; i < gc->nsect && ok; i++) {
+    int pad = gc->sect[i].offset - off;
+    int nbytes = gc->sect[i].elsize * gc->sect[i].count;
+    ok = (pad == 0 || fwrite( zeros, 1, pad, f ) == pad)
+	&& (nbytes == 0 || fwrite( gc->data[i], 1, nbytes, f ) == nbytes);
+    off = gc->sect[i].offset + nbytes;
+  }
+  if(fclose(f) != 0)
+    ok = 0;
+  if(ok)
+    ok = (rename( tmppath, gc->cachepath ) == 0);
+  if(!ok)
+    unlink( tmppath );
+  Free(tmppath);
+  return ok;
+}
+
+/* Discard gc.  A cache that was read stays mapped, since callers may point into it. */
+void geomcache_close( GeomCache *gc )
+{
+  int i;
+
+  if(gc == NULL)
+    return;
+  if(gc->base == NULL && gc->sect != NULL) {
+    for(i = 0; i < gc->nsect; i++)
+	Free( gc->data[i] );
+    Free( gc->data );
+    Free( gc->sect );
+  }
+  Free( gc->srcpath );
+  Free( gc->cachepath );
+  Free( gc );
+}
@@ -0,0 +1,51 @@
+#ifndef _GEOMCACHE_H
+#define _GEOMCACHE_H
+/*
+ * Binary cache of parsed geometry (.obj models, mesh blocks, ...),
+ * kept in a file keyed on the source file's path and modification time.
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONST
+# ifdef __cplusplus
+#  define CONST const
+# else
+#  define CONST
+# endif
+#endif
+
+typedef struct geomcache GeomCache;
+
+extern int geomcache_enabled;	/* "geomcache on|off"; env PARTIVIEW_GEOMCACHE=off too */
+
+extern int geomcache_active( void );	/* geomcache_enabled, after checking env */
+extern time_t fmodtime( CONST char *fname );
+
+	/* Reading: returns NULL if there's no cache, or it's out of date.
+	 * Sections are mapped (or read) in place; pointers into them
+	 * stay valid even after geomcache_close().
+	 */
+extern GeomCache *geomcache_open( CONST char *srcpath, CONST char *tag );
+extern void *geomcache_get( GeomCache *gc, CONST char *name, int elsize, int *countp );
+
+	/* Writing: sections are copied by geomcache_put(), and written
+	 * (atomically, or not at all) by geomcache_save().
+	 */
+extern GeomCache *geomcache_create( CONST char *srcpath, CONST char *tag );
+extern void  geomcache_put( GeomCache *gc, CONST char *name, CONST void *data, int elsize, int count );
+extern int   geomcache_save( GeomCache *gc );
+
+extern void  geomcache_close( GeomCache *gc );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_GEOMCACHE_H*/
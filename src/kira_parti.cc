@@ -349,10 +349,11 @@ struct vald {
 };
 
 struct trailhead {
-    int maxtrail, ntrails;
+    int ring;		/* which ring of worldstuff's trailp[]/trailrgba[], or -1 */
+    int ntrails;	/* points in ring */
     int next;		/* ring buffer next-slot-to-use */
+    int nbrk;		/* newest nbrk points follow a time gap; 0 if none in ring */
     real lasttime;
-    struct speck *specks;
 };
 
 struct kirastuff {
@@ -478,6 +479,10 @@ struct worldstuff {
     int slvalid;
     struct specklist *bufsl[2], *bufmarksl[2];  // double-buffers
     int bufno;
+    int layoutgen;		// bumped each time kira_layout() assigns stars to slots
+    int buflayout[2];		// layoutgen each of bufsl[] was filled with
+    int relayout;		// force kira_layout() next time
+    pdyn **slotnode, **marknode; // tree node for each slot, this time
     vec center_pos;
     vec center_vel;
     int centered;
@@ -491,9 +496,22 @@ struct worldstuff {
     SelOp intsrc;		// for all particles matching intsrc,
     SelOp intdest;		//   then turn on intdest bit(s).
 
-    struct trailhead *trails;	// per-star specklist of recent history
+    struct trailhead *trails;	// per-star ring buffer of recent history
+    int ntrailheads;		// room in trails[]
     int maxtrail;
     int maxtrailno;
+    int trailcap;		// points per ring, >= maxtrail
+    int nrings, ringroom;	// rings in use or free, and room for
+    Point *trailp;		// all rings' points, trailp[ring*trailcap + k]
+    int *trailrgba;		// ... and their colors
+    int *freering, nfreering;
+    float trailalphaset;	// trailalpha that trailrgba[]'s alpha bytes hold
+    int trailseq, trailidxseq;	// bumped when trails change; trailidx[] made for
+    int trailidxmax;		// maxtrail, when trailidx[] made
+    GLuint *trailidx;		// GL_LINES segments, then GL_POINTS, to draw
+    int ntrailseg, ntrailpt, trailidxroom;
+    int *trailfirst;		// each trail's segments are trailidx[trailfirst[i] ...
+    int *trailnseg;		//   ... + 2*trailnseg[i]]
     SelOp trailsel;
     float trailalpha;
     float trailpsize;
@@ -546,12 +564,29 @@ struct worldstuff {
 	bufsl[0] = bufsl[1] = NULL;
 	bufmarksl[0] = bufmarksl[1] = NULL;
 	bufno = 0;
+	layoutgen = 0;
+	buflayout[0] = buflayout[1] = 0;
+	relayout = 0;
+	slotnode = marknode = NULL;
 	maxstars = maxmarks = 0;
 	slvalid = 0;
 
 	trails = NULL;
+	ntrailheads = 0;
 	maxtrail = 50;
 	maxtrailno = 0;
+	trailcap = 0;
+	nrings = ringroom = 0;
+	trailp = NULL;
+	trailrgba = NULL;
+	freering = NULL;
+	nfreering = 0;
+	trailalphaset = 0;
+	trailseq = trailidxseq = 0;
+	trailidxmax = 0;
+	trailidx = NULL;
+	ntrailseg = ntrailpt = trailidxroom = 0;
+	trailfirst = trailnseg = NULL;
 	trailonly = 0;
 	trailalpha = 0.6;
 	trailpsize = 1.0;
@@ -571,14 +606,14 @@ struct worldstuff {
     }
 };
 
-extern void kira_add_trail( struct stuff *st, struct worldstuff *, int id, struct speck * );
+extern void kira_add_trail( struct stuff *st, struct worldstuff *, int id, struct specklist *, struct speck *, int );
 extern void kira_erase_trail( struct stuff *st, struct worldstuff *, int id );
 extern void kira_track_break( struct worldstuff *ww, Point *newtrack );
 
 void kira_invalidate( struct dyndata *dd, struct stuff *st ) {
     if(st->sl) st->sl->used = -1000000;
     worldstuff *ww = (worldstuff *)dd->data;
-    if(ww) ww->slvalid = 0;
+    if(ww) ww->slvalid = 0, ww->relayout = 1;
 }
 
 int kira_read( struct stuff **stp, int argc, char *argv[], char *fname, void * ) {
@@ -919,11 +954,12 @@ static float netTL( pdyn *b, float *totlum ) {	// temp-weighted lum
     return totTL;
 }
 
-speck *add_speck(pdyn *b, pdyn *top, int addr, speck *sp, specklist *sl, worldstuff *ww)
+// Fill in the fields of sp which depend only on node b, which is at (absolute) pos.
+static void kira_speck_vals(speck *sp, pdyn *b, const vec &pos, worldstuff *ww)
 {
-    sp->p.x[0] = b->get_pos()[0];
-    sp->p.x[1] = b->get_pos()[1];
-    sp->p.x[2] = b->get_pos()[2];
+    sp->p.x[0] = pos[0];
+    sp->p.x[1] = pos[1];
+    sp->p.x[2] = pos[2];
 
     if(ww->centered) {
 	sp->p.x[0] -= ww->center_pos[0];
@@ -931,6 +967,93 @@ speck *add_speck(pdyn *b, pdyn *top, int addr, speck *sp, specklist *sl, worldst
 	sp->p.x[2] -= ww->center_pos[2];
     }
 
+    if(b->is_leaf()) {
+	sp->val[SPECK_ID] = b->get_index();
+	sp->val[SPECK_TLOG] = log10_of( b->get_temperature() );
+	sp->val[SPECK_LUM] = b->get_luminosity();
+    } else {
+	sp->val[SPECK_ID] = -b->get_worldline_index();	// distinguish CM nodes
+
+	float totL = 0, totTL;
+	totTL = netTL( b, &totL );
+	sp->val[SPECK_LUM] = totL;
+	sp->val[SPECK_TLOG] = log10_of( totL == 0 ? 0 : totTL / totL );
+    }
+
+    sp->val[SPECK_MASS] = b->get_mass() * ww->massscale;
+    sp->val[SPECK_SQRTMASS] = sqrtf( sp->val[SPECK_MASS] );
+    sp->val[SPECK_STYPE] = b->get_stellar_type();	/* see starlab/inc/star_support.h */
+
+    sp->val[SPECK_ISMEMBER] = is_member( ww->curwb, b );
+}
+
+// Ring and tree-arc parameters for the marker for CM node b.
+static void kira_mark_vals(speck *marksp, pdyn *b, worldstuff *ww)
+{
+    // find our two children
+
+    pdyn *b1 = b->get_oldest_daughter();
+    pdyn *b2 = b1 ? b1->get_younger_sister() : NULL;
+    if(b2) {
+	vec sep = b1->get_pos() - b2->get_pos();
+	real dist = sqrt(sep * sep);
+	real mass = b->get_mass();	// = sum of b1&b2 masses.
+
+	real size = 0;
+	switch(ww->ringsizer) {
+	case KIRA_RINGSEP:
+	    size = 0.5 * dist;
+	    break;
+	case KIRA_RINGA:
+	  {
+	    vec vel = b1->get_vel() - b2->get_vel();
+	    real speed2 = vel * vel;
+	    real E = 0.5 * speed2 - mass / dist;
+	    size = -mass / (2*E);	// semimajor axis
+	  }
+	}
+	marksp->val[SPECK_RINGSIZE] = size;
+	marksp->val[SPECK_MU] = b1->get_mass() / mass;
+	marksp->val[SPECK_SEPVEC] = sep[0];
+	marksp->val[SPECK_SEPVEC+1] = sep[1];
+	marksp->val[SPECK_SEPVEC+2] = sep[2];
+    }
+}
+
+// The tracked particle is now at (uncentered) pos: follow it.
+static void kira_track(worldstuff *ww, const vec &pos)
+{
+    Point newpos;
+    newpos.x[0] = pos[0];
+    newpos.x[1] = pos[1];
+    newpos.x[2] = pos[2];
+    if(ww->wastracking) {
+	Point delta;
+	vsub( &delta, &newpos,&ww->trackpos );
+	parti_nudge_camera( &delta );
+    } else {
+	kira_track_break( ww, &newpos );
+    }
+    ww->trackpos = newpos;
+    ww->wastracking = 1;
+}
+
+// Extend (or erase) the trail of the star in speck tsp (sl's i'th).
+static void kira_trail(struct stuff *st, worldstuff *ww, specklist *sl, speck *tsp, int i)
+{
+    int id = (int)tsp->val[SPECK_ID];
+    int slotno = id < 0 ? ww->maxstars + id : id;
+
+    if(ww->trailsel.use != SEL_NONE && slotno >= 0 && slotno < ww->nleafsel &&
+	    SELECTED( ww->leafsel[slotno], &ww->trailsel )) {
+	kira_add_trail( st, ww, id, sl, tsp, i );
+    } else if(ww->trailonly) {
+	kira_erase_trail( st, ww, id );
+    }
+}
+
+speck *add_speck(pdyn *b, pdyn *top, int addr, speck *sp, specklist *sl, worldstuff *ww)
+{
     int id = b->get_index();
     if(b->is_leaf()) {
 	if(id < ww->nleafsel) {
@@ -938,9 +1061,6 @@ speck *add_speck(pdyn *b, pdyn *top, int addr, speck *sp, specklist *sl, worldst
 	    if(SELECTED(ww->leafsel[id], &ww->intsrc))
 		ww->interactsel = ww->intdest.wanton;
 	}
-	sp->val[SPECK_ID] = id;
-	sp->val[SPECK_TLOG] = log10_of( b->get_temperature() );
-	sp->val[SPECK_LUM] = b->get_luminosity();
     } else {
 	id = -b->get_worldline_index();
 	if(id >= 0 || id + ww->maxstars < ww->maxleaves) {
@@ -951,20 +1071,11 @@ speck *add_speck(pdyn *b, pdyn *top, int addr, speck *sp, specklist *sl, worldst
 	    int slotno = ww->maxstars + id;
 	    ww->unionsel |= ww->leafsel[slotno];
 	}
-	sp->val[SPECK_ID] = id;		// distinguish CM nodes
-
-	float totL = 0, totTL;
-	totTL = netTL( b, &totL );
-	sp->val[SPECK_LUM] = totL;
-	sp->val[SPECK_TLOG] = log10_of( totL == 0 ? 0 : totTL / totL );
     }
 
-    sp->val[SPECK_MASS] = b->get_mass() * ww->massscale;
-    sp->val[SPECK_SQRTMASS] = sqrtf( sp->val[SPECK_MASS] );
-    sp->val[SPECK_STYPE] = b->get_stellar_type();	/* see starlab/inc/star_support.h */
+    kira_speck_vals( sp, b, b->get_pos(), ww );
 
-    sp->val[SPECK_ISMEMBER] = is_member( ww->curwb, b );
-    sp->val[SPECK_NCLUMP] = 0;		// complete (add n_leaves) in kira_to_parti
+    sp->val[SPECK_NCLUMP] = 0;		// complete (add n_leaves) in kira_layout
 
     // DON'T offset unperturbed binaries by 100 in "nclump" field.
 
@@ -986,21 +1097,8 @@ speck *add_speck(pdyn *b, pdyn *top, int addr, speck *sp, specklist *sl, worldst
 
     sp->val[SPECK_RINGSIZE] = 0;
 
-    if(id != 0 && ww->tracking == id) {
-	Point newpos;
-	newpos.x[0] = b->get_pos()[0];
-	newpos.x[1] = b->get_pos()[1];
-	newpos.x[2] = b->get_pos()[2];
-	if(ww->wastracking) {
-	    Point delta;
-	    vsub( &delta, &newpos,&ww->trackpos );
-	    parti_nudge_camera( &delta );
-	} else {
-	    kira_track_break( ww, &newpos );
-	}
-	ww->trackpos = newpos;
-	ww->wastracking = 1;
-    }
+    if(id != 0 && ww->tracking == id)
+	kira_track( ww, b->get_pos() );
 
     sl->nspecks++;
     sp = NextSpeck(sp, sl, 1);
@@ -1031,35 +1129,7 @@ speck *assign_specks(pdyn *b, pdyn *top, int addr, speck *sp, specklist *sl, wor
 
 	struct speck *marksp = ww->marksp;
 	ww->marksp = add_speck(b, top, addr, marksp, ww->marksl, ww);
-
-	// find our two children
-
-	pdyn *b1 = b->get_oldest_daughter();
-	pdyn *b2 = b1 ? b1->get_younger_sister() : NULL;
-	if(b2) {
-	    vec sep = b1->get_pos() - b2->get_pos();
-	    real dist = sqrt(sep * sep);
-	    real mass = b->get_mass();	// = sum of b1&b2 masses.
-
-	    real size = 0;
-	    switch(ww->ringsizer) {
-	    case KIRA_RINGSEP:
-		size = 0.5 * dist;
-		break;
-	    case KIRA_RINGA:
-	      {
-		vec vel = b1->get_vel() - b2->get_vel();
-		real speed2 = vel * vel;
-		real E = 0.5 * speed2 - mass / dist;
-		size = -mass / (2*E);	// semimajor axis
-	      }
-	    }
-	    marksp->val[SPECK_RINGSIZE] = size;
-	    marksp->val[SPECK_MU] = b1->get_mass() / mass;
-	    marksp->val[SPECK_SEPVEC] = sep[0];
-	    marksp->val[SPECK_SEPVEC+1] = sep[1];
-	    marksp->val[SPECK_SEPVEC+2] = sep[2];
-	}
+	kira_mark_vals( marksp, b, ww );
     }
 
     // Recursion.
@@ -1074,6 +1144,254 @@ speck *assign_specks(pdyn *b, pdyn *top, int addr, speck *sp, specklist *sl, wor
     return sp;
 }
 
+// Lay out the whole tree anew: assign every star (and marker) its slot.
+static int kira_layout(pdyn *root, struct stuff *st, worldstuff *ww, specklist *sl, specklist *marksl)
+{
+    struct speck *sp = sl->specks;
+    struct vald *vd;
+    int i, ntotal = 0;
+
+    sl->nspecks = 0;
+    marksl->nspecks = 0;
+    ww->marksp = marksl->specks;
+    ww->leafcount = 0;
+
+    for_all_daughters(pdyn, root, b) {
+	int ns = sl->nspecks;
+	int mns = marksl->nspecks;
+	int nl = ww->leafcount;
+	speck *tsp = sp;
+	speck *msp = ww->marksp;
+
+	ww->interactsel = ww->unionsel = 0;
+	sp = assign_specks(b, b, !b->is_leaf(), sp, sl, ww);
+
+	int k;
+	int nleaves = ww->leafcount - nl;
+	int count = sl->nspecks - ns;
+
+	ww->unionsel |= ww->interactsel;
+
+	/* For all nodes in this subtree, ... */
+	for(k = 0; k < count; k++) {
+	    tsp->val[SPECK_NCLUMP] += nleaves;
+	    int id = (int)tsp->val[SPECK_ID];
+	    if(id < 0) {
+		/* For CM nodes, negate nclump value. */
+		tsp->val[SPECK_NCLUMP] = -tsp->val[SPECK_NCLUMP];
+		/* Also, propagate all leaves' set membership to CM nodes */
+		sl->sel[ntotal] = ww->unionsel;
+
+	    } else if(ww->interactsel && id < ww->nleafsel) {
+		/* For leaf nodes, if at least one star in this
+		 * group is in the interaction set,
+		 * then add all other group members to it.
+		 */
+		sl->sel[ntotal] = ww->leafsel[id] |= ww->interactsel;
+		/* Making trails? */
+	    }
+	    kira_trail( st, ww, sl, tsp, ntotal );
+	    for(i = 0, vd = ww->vd; i <= SPECK_STYPE; i++, vd++) {
+		float v = tsp->val[i];
+		if(vd->min > v) vd->min = v;
+		if(vd->max < v) vd->max = v;
+		vd->sum += v;
+	    }
+	    ntotal++;
+	    tsp = NextSpeck(tsp, sl, 1);
+	}
+
+	/* For all marks (rings, etc.) in this subtree */
+	count = marksl->nspecks - mns;
+	for(k = 0; k < count; k++) {
+	    msp->val[SPECK_NCLUMP] += nleaves;
+	    if(msp->val[0] < 0)
+		msp->val[SPECK_NCLUMP] = -msp->val[SPECK_NCLUMP]; // negate nclump for CM nodes
+	    marksl->sel[mns+k] = ww->unionsel;
+	    msp = NextSpeck(msp, sl, 1);
+	}
+    }
+
+    ww->buflayout[ww->bufno] = ++ww->layoutgen;
+    ww->relayout = 0;
+    return ntotal;
+}
+
+/*
+ * When the tree has the same shape as last time -- same stars, same
+ * binaries and clumps -- each star keeps its slot, and we just update
+ * positions and the other per-node fields in place, in parallel.
+ */
+#define KIRACHUNK 4096		// slots per job
+
+struct kiramatch {
+    worldstuff *ww;
+    specklist *osl, *omarksl;	// as laid out last time
+    int ns, nm;
+};
+
+// Does the subtree at b lay out just as in osl/omarksl?  If so, note each slot's node.
+static int kira_match(pdyn *b, pdyn *top, int addr, struct kiramatch *km)
+{
+    worldstuff *ww = km->ww;
+    float id = b->is_leaf() ? b->get_index() : -b->get_worldline_index();
+    float rootid = top->is_leaf() ? top->get_index() : -top->get_worldline_index();
+    speck *sp;
+
+    if(b->is_leaf()
+		|| ww->treenodes == KIRA_ON
+		|| (ww->treenodes == KIRA_ROOTS && b == top)) {
+	if(km->ns >= km->osl->nspecks)
+	    return 0;
+	sp = NextSpeck(km->osl->specks, km->osl, km->ns);
+	if(sp->val[SPECK_ID] != id || sp->val[SPECK_ROOTID] != rootid
+		|| sp->val[SPECK_TREEADDR] != (float)addr)
+	    return 0;
+	ww->slotnode[km->ns++] = b;
+    }
+
+    if(!b->is_leaf() &&
+		(ww->treerings == KIRA_ON || ww->treearcs != KIRA_OFF
+		 || (ww->treerings == KIRA_ROOTS && b == top))) {
+	if(km->nm >= km->omarksl->nspecks)
+	    return 0;
+	sp = NextSpeck(km->omarksl->specks, km->omarksl, km->nm);
+	if(sp->val[SPECK_ID] != id || sp->val[SPECK_ROOTID] != rootid
+		|| sp->val[SPECK_TREEADDR] != (float)addr)
+	    return 0;
+	ww->marknode[km->nm++] = b;
+    }
+
+    addr *= 2;
+    for_all_daughters(pdyn, b, bb)
+	if(!kira_match(bb, top, addr++, km))
+	    return 0;
+    return 1;
+}
+
+struct kirajob {
+    worldstuff *ww;
+    pdyn *root;
+    specklist *sl;
+    pdyn **node;
+    int i0, i1;
+    int marks;			// slots are in marksl
+    struct vald vd[SPECK_STYPE+1];
+};
+
+static void kira_update_job(void *arg, int jobno)
+{
+    struct kirajob *j = &((struct kirajob *)arg)[jobno];
+    worldstuff *ww = j->ww;
+    struct vald *vd;
+    int i, k;
+
+    for(k = 0, vd = j->vd; k <= SPECK_STYPE; k++, vd++) {
+	vd->min = 1e9;
+	vd->max = -1e9;
+	vd->sum = 0;
+    }
+    for(i = j->i0; i < j->i1; i++) {
+	pdyn *b = j->node[i];
+	speck *sp = NextSpeck(j->sl->specks, j->sl, i);
+
+	// absolute position: kira's are relative to the parent node
+	vec pos = b->get_pos();
+	for(pdyn *p = b->get_parent(); p != NULL && p != j->root; p = p->get_parent())
+	    pos += p->get_pos();
+
+	kira_speck_vals( sp, b, pos, ww );
+	if(j->marks) {
+	    kira_mark_vals( sp, b, ww );
+	    continue;
+	}
+	for(k = 0, vd = j->vd; k <= SPECK_STYPE; k++, vd++) {
+	    float v = sp->val[k];
+	    if(vd->min > v) vd->min = v;
+	    if(vd->max < v) vd->max = v;
+	    vd->sum += v;
+	}
+    }
+}
+
+// Update sl and marksl in place, if the layout still fits; returns -1 if not.
+static int kira_update(pdyn *root, struct stuff *st, worldstuff *ww, specklist *sl, specklist *marksl)
+{
+    specklist *osl = ww->bufsl[1 - ww->bufno];
+    specklist *omarksl = ww->bufmarksl[1 - ww->bufno];
+    int i, k, njobs;
+
+    if(ww->relayout || ww->layoutgen == 0 || osl == NULL
+		|| ww->buflayout[1 - ww->bufno] != ww->layoutgen)
+	return -1;
+
+    if(ww->slotnode == NULL) {
+	ww->slotnode = NewN( pdyn *, ww->maxstars );
+	ww->marknode = NewN( pdyn *, ww->maxmarks );
+    }
+    struct kiramatch km = { ww, osl, omarksl, 0, 0 };
+    for_all_daughters(pdyn, root, b)
+	if(!kira_match(b, b, !b->is_leaf(), &km))
+	    return -1;
+    if(km.ns != osl->nspecks || km.nm != omarksl->nspecks)
+	return -1;
+
+    if(ww->buflayout[ww->bufno] != ww->layoutgen) {
+	// This buffer's from an older layout; start from the other one's.
+	memcpy( sl->specks, osl->specks, osl->nspecks * osl->bytesperspeck );
+	memcpy( marksl->specks, omarksl->specks, omarksl->nspecks * omarksl->bytesperspeck );
+	sl->nspecks = osl->nspecks;
+	marksl->nspecks = omarksl->nspecks;
+	ww->buflayout[ww->bufno] = ww->layoutgen;
+    }
+
+    njobs = (sl->nspecks + KIRACHUNK-1) / KIRACHUNK
+	  + (marksl->nspecks + KIRACHUNK-1) / KIRACHUNK;
+    struct kirajob *jobs = NewN( struct kirajob, njobs+1 );
+    njobs = 0;
+    for(k = 0; k < 2; k++) {
+	specklist *tsl = k ? marksl : sl;
+	for(i = 0; i < tsl->nspecks; i += KIRACHUNK) {
+	    struct kirajob *j = &jobs[njobs++];
+	    j->ww = ww;
+	    j->root = root;
+	    j->sl = tsl;
+	    j->node = k ? ww->marknode : ww->slotnode;
+	    j->i0 = i;
+	    j->i1 = (i + KIRACHUNK < tsl->nspecks) ? i + KIRACHUNK : tsl->nspecks;
+	    j->marks = k;
+	}
+    }
+    specks_parallel( kira_update_job, jobs, njobs, sl->nspecks + marksl->nspecks );
+
+    for(k = 0; k < njobs; k++) {
+	struct vald *jvd, *vd;
+	if(jobs[k].marks)
+	    continue;
+	for(i = 0, vd = ww->vd, jvd = jobs[k].vd; i <= SPECK_STYPE; i++, vd++, jvd++) {
+	    if(vd->min > jvd->min) vd->min = jvd->min;
+	    if(vd->max < jvd->max) vd->max = jvd->max;
+	    vd->sum += jvd->sum;
+	}
+    }
+    Free( jobs );
+
+    // Trails and tracking touch shared state, so do them here.
+    if(ww->trailsel.use == SEL_NONE && !ww->trailonly && ww->tracking == 0)
+	return sl->nspecks;
+    speck *sp = sl->specks;
+    for(i = 0; i < sl->nspecks; i++, sp = NextSpeck(sp, sl, 1)) {
+	kira_trail( st, ww, sl, sp, i );
+	if(ww->tracking != 0 && (int)sp->val[SPECK_ID] == ww->tracking) {
+	    vec pos( sp->p.x[0], sp->p.x[1], sp->p.x[2] );
+	    if(ww->centered)
+		pos += ww->center_pos;
+	    kira_track( ww, pos );
+	}
+    }
+    return sl->nspecks;
+}
+
 struct specklist *kira_to_parti(pdyn *root, struct dyndata *dd, struct stuff *st, struct worldstuff *ww)
 {
 
@@ -1133,8 +1451,15 @@ struct specklist *kira_to_parti(pdyn *root, struct dyndata *dd, struct stuff *st
 	    memset( ww->bufleafsel[ww->bufno], 0, ww->maxstars*sizeof(SelMask) );
 	}
 
-	ww->trails = NewN( trailhead, ww->maxstars );
-	memset(ww->trails, 0, ww->maxstars*sizeof(trailhead));
+	if(ww->ntrailheads < ww->maxstars) {	// keep trails across buffers
+	    ww->trails = RenewN( ww->trails, trailhead, ww->maxstars );
+	    memset(&ww->trails[ww->ntrailheads], 0, (ww->maxstars - ww->ntrailheads)*sizeof(trailhead));
+	    for(int i = ww->ntrailheads; i < ww->maxstars; i++)
+		ww->trails[i].ring = -1;
+	    ww->trailfirst = RenewN( ww->trailfirst, int, ww->maxstars );
+	    ww->trailnseg = RenewN( ww->trailnseg, int, ww->maxstars );
+	    ww->ntrailheads = ww->maxstars;
+	}
 
 	selinit( &ww->intdest );
 	selinit( &ww->intsrc );
@@ -1148,6 +1473,7 @@ struct specklist *kira_to_parti(pdyn *root, struct dyndata *dd, struct stuff *st
     ww->sl = sl;
     ww->marksl = marksl;
 
+    int regather = 0;
     if(ww->myselseq < sl->selseq && sl->sel != NULL) {
 	// somebody changed something in the global select bits, so
 	// gather all stars' sel-bits back into our local copy.
@@ -1164,17 +1490,14 @@ struct specklist *kira_to_parti(pdyn *root, struct dyndata *dd, struct stuff *st
 	    tsp = NextSpeck(tsp, sl, 1);
 	}
 	ww->myselseq = sl->selseq;
+	regather = 1;		// sel-bits may spread differently, so lay out anew
     }
 
 
-    struct speck *sp = sl->specks;
-
-    sl->nspecks = 0;
     sl->colorseq = sl->sizeseq = sl->threshseq = 0;
     marksl->colorseq = marksl->sizeseq = marksl->threshseq = 0;
-    marksl->nspecks = 0;
-    ww->marksp = marksl->specks;
-    ww->leafcount = 0;
+    specks_changed( sl );		// rewriting specks in place
+    specks_changed( marksl );
     ww->leafsel = ww->bufleafsel[ww->bufno];
 
     int i;
@@ -1184,70 +1507,12 @@ struct specklist *kira_to_parti(pdyn *root, struct dyndata *dd, struct stuff *st
 	vd->max = -1e9;
 	vd->sum = 0;
     }
-    int ntotal = 0;
 
     if(ww->wastracking) ww->wastracking = -1;
 
-    for_all_daughters(pdyn, root, b) {
-	int ns = sl->nspecks;
-	int mns = marksl->nspecks;
-	int nl = ww->leafcount;
-	speck *tsp = sp;
-	speck *msp = ww->marksp;
-
-	ww->interactsel = ww->unionsel = 0;
-	sp = assign_specks(b, b, !b->is_leaf(), sp, sl, ww);
-
-	int k;
-	int nleaves = ww->leafcount - nl;
-	int count = sl->nspecks - ns;
-
-	ww->unionsel |= ww->interactsel;
-
-	/* For all nodes in this subtree, ... */
-	for(k = 0; k < count; k++) {
-	    tsp->val[SPECK_NCLUMP] += nleaves;
-	    int id = (int)tsp->val[SPECK_ID];
-	    if(id < 0) {
-		/* For CM nodes, negate nclump value. */
-		tsp->val[SPECK_NCLUMP] = -tsp->val[SPECK_NCLUMP];
-		/* Also, propagate all leaves' set membership to CM nodes */
-		sl->sel[ntotal] = ww->unionsel;
-
-	    } else if(ww->interactsel && id < ww->nleafsel) {
-		/* For leaf nodes, if at least one star in this
-		 * group is in the interaction set,
-		 * then add all other group members to it.
-		 */
-		sl->sel[ntotal] = ww->leafsel[id] |= ww->interactsel;
-		/* Making trails? */
-	    }
-	    if(ww->trailsel.use != SEL_NONE &&
-		    SELECTED( ww->leafsel[id], &ww->trailsel )) {
-		kira_add_trail( st, ww, id, tsp );
-	    } else if(ww->trailonly) {
-		kira_erase_trail( st, ww, id );
-	    }
-	    for(i = 0, vd = ww->vd; i <= SPECK_STYPE; i++, vd++) {
-		float v = tsp->val[i];
-		if(vd->min > v) vd->min = v;
-		if(vd->max < v) vd->max = v;
-		vd->sum += v;
-	    }
-	    ntotal++;
-	    tsp = NextSpeck(tsp, sl, 1);
-	}
-
-	/* For all marks (rings, etc.) in this subtree */
-	count = marksl->nspecks - mns;
-	for(k = 0; k < count; k++) {
-	    msp->val[SPECK_NCLUMP] += nleaves;
-	    if(msp->val[0] < 0)
-		msp->val[SPECK_NCLUMP] = -msp->val[SPECK_NCLUMP]; // negate nclump for CM nodes
-	    marksl->sel[mns+k] = ww->unionsel;
-	    msp = NextSpeck(msp, sl, 1);
-	}
-    }
+    int ntotal = regather ? -1 : kira_update(root, st, ww, sl, marksl);
+    if(ntotal < 0)
+	ntotal = kira_layout(root, st, ww, sl, marksl);
 
     if(ww->wastracking < 0) ww->wastracking = 0;	// Detach if tracked pcle not found now
 
@@ -1323,49 +1588,80 @@ struct specklist *kira_get_parti( struct dyndata *dd, struct stuff *st, double r
     return ww->sl;
 }
 
-#define TRAILGAP 1		/* bit in alpha byte of rgba -> "don't draw from prev pt to here" */
+/*
+ * Trails live in rings of trailcap points each, all in one block
+ * (structure-of-arrays: positions in trailp[], colors in trailrgba[]),
+ * handed out to stars as they start trails.  A trail keeps at most one
+ * time-gap break: if another gap comes, we drop what's before the first.
+ */
+
+static void kira_trail_regrow( worldstuff *ww, int newcap );
+
+static int kira_new_ring( worldstuff *ww )
+{
+    if(ww->nfreering > 0)
+	return ww->freering[--ww->nfreering];
+    if(ww->nrings >= ww->ringroom) {
+	ww->ringroom = 2*ww->ringroom + 64;
+	ww->trailp = RenewN( ww->trailp, Point, ww->ringroom * ww->trailcap );
+	ww->trailrgba = RenewN( ww->trailrgba, int, ww->ringroom * ww->trailcap );
+	ww->freering = RenewN( ww->freering, int, ww->ringroom );
+    }
+    return ww->nrings++;
+}
 
-void kira_add_trail( struct stuff *st, worldstuff *ww, int id, struct speck *sp )
+void kira_add_trail( struct stuff *st, worldstuff *ww, int id, struct specklist *sl, struct speck *sp, int i )
 {
     if(id < 0) id = ww->maxstars + id;
-    if(id <= 0 || id > ww->maxstars || ww->maxtrail <= 0) return;
+    if(id <= 0 || id >= ww->maxstars || ww->maxtrail <= 0) return;
 
     struct trailhead *th = &ww->trails[id];
-    int bps = ww->sl->bytesperspeck;
-    if(th->maxtrail <= 0) {
-	th->maxtrail = ww->maxtrail;
-	th->specks = (struct speck *)NewN( char, th->maxtrail*bps );
+    if(ww->trailcap < ww->maxtrail)
+	kira_trail_regrow( ww, ww->maxtrail );
+    if(th->ring < 0) {
+	th->ring = kira_new_ring( ww );
 	th->ntrails = 0;
 	th->next = 0;
+	th->nbrk = 0;
     }
-    if(th->ntrails > th->maxtrail)
-	th->ntrails = th->maxtrail;
-    if(th->next < 0 || th->next >= th->maxtrail)
-	th->next = 0;
-    struct speck *tsp = (struct speck *)(((char *)th->specks) + th->next*bps);
-    memcpy( tsp, sp, bps );
-    vsub( &tsp->p, &tsp->p, &ww->trackpos );
-    if(fabs(th->lasttime - ww->treq) > ww->maxtrailgap) {
-	((char *)&tsp->rgba)[3] = TRAILGAP;	/* alpha "1" bit is on for post-gap trail points */
-    } else {
-	((char *)&tsp->rgba)[3] = 0;
+
+    int gap = th->ntrails > 0 && fabs(th->lasttime - ww->treq) > ww->maxtrailgap;
+    if(gap) {
+	if(th->nbrk > 0)
+	    th->ntrails = th->nbrk;	// only room for one break
+	th->nbrk = 0;
     }
-    tsp->val[0] = ww->treq;
+
+    int k = th->ring * ww->trailcap + th->next;
+    vsub( &ww->trailp[k], &sp->p, &ww->trackpos );
+    ww->trailrgba[k] = SPECKRGB(st, sl, sp, i);
+    ((unsigned char *)&ww->trailrgba[k])[3] = (int) (255 * ww->trailalphaset);
+
     th->lasttime = ww->treq;
-    if(++th->next >= th->maxtrail)
+    if(++th->next >= ww->trailcap)
 	th->next = 0;
-    if(++th->ntrails > th->maxtrail)
-	th->ntrails = th->maxtrail;
+    if(++th->ntrails > ww->trailcap)
+	th->ntrails = ww->trailcap;
+    if(gap || th->nbrk > 0) {
+	if(++th->nbrk >= th->ntrails)
+	    th->nbrk = 0;	// anything before the gap has been overwritten
+    }
     if(id >= ww->maxtrailno)
 	ww->maxtrailno = id+1;
+    ww->trailseq++;
 }
 
 void kira_erase_trail( struct stuff *st, worldstuff *ww, int id )
 {
     if(id < 0) id = ww->maxstars + id;
-    if(id <= 0 || id > ww->maxstars || ww->maxtrail <= 0) return;
+    if(id <= 0 || id >= ww->maxstars || ww->maxtrail <= 0) return;
     struct trailhead *th = &ww->trails[id];
-    th->next = th->ntrails = 0;
+    if(th->ring >= 0) {
+	ww->freering[ww->nfreering++] = th->ring;
+	th->ring = -1;
+	ww->trailseq++;
+    }
+    th->next = th->ntrails = th->nbrk = 0;
     if(id+1 == ww->maxtrailno) {
 	while(ww->maxtrailno > 0 && ww->trails[ww->maxtrailno-1].ntrails == 0)
 	    ww->maxtrailno--;
@@ -1376,54 +1672,98 @@ void kira_track_break( struct worldstuff *ww, Point *newtrack )
 {
     Point incr;
     vsub( &incr, newtrack, &ww->trackpos );
-    for(int id = 0; id < ww->maxstars; id++) {
-	struct trailhead *th = &ww->trails[id];
-	if(th->ntrails > 0) {
-	    struct speck *sp = th->specks;
-	    for(int i = 0; i < th->maxtrail; i++) {
-		vsub( &sp->p, &sp->p, &incr );
-		sp = NextSpeck(sp, ww->sl, 1);
-	    }
-	}
-    }
+    for(int k = 0; k < ww->nrings * ww->trailcap; k++)
+	vsub( &ww->trailp[k], &ww->trailp[k], &incr );
     // ww->trackpos = *newtrack;  no, let caller do that.
 }
 
+/* Shrinking maxtrail just shows fewer points; only growing past trailcap copies. */
 void kira_maxtrail( struct dyndata *dd, struct stuff *st, int newmax )
 {
-    int i;
     struct worldstuff *ww = (struct worldstuff *)dd->data;
     ww->maxtrail = newmax;
-    if(ww->trails == NULL) return;
-    int bps = ww->sl->bytesperspeck;
-    char *spare = (char *)malloc( bps * newmax );
+    ww->trailseq++;
+    if(newmax > ww->trailcap)
+	kira_trail_regrow( ww, newmax );
+}
 
-    for(i = 0; i < ww->maxstars; i++) {
+static void kira_trail_regrow( worldstuff *ww, int newmax )
+{
+    int i, k;
+    int oldcap = ww->trailcap;
+    Point *oldp = ww->trailp;
+    int *oldrgba = ww->trailrgba;
+
+    ww->trailcap = newmax;
+    ww->trailp = ww->ringroom > 0 ? NewN( Point, ww->ringroom * newmax ) : NULL;
+    ww->trailrgba = ww->ringroom > 0 ? NewN( int, ww->ringroom * newmax ) : NULL;
+    if(ww->trails == NULL)
+	return;
+    for(i = 0; i < ww->ntrailheads; i++) {
 	struct trailhead *th = &ww->trails[i];
-	if(th->maxtrail == 0)
+	if(th->ring < 0)
 	    continue;
-	if(th->ntrails > newmax) th->ntrails = newmax;
-	int first = (th->next + th->maxtrail - th->ntrails) % th->maxtrail;
-	char *base = (char *)th->specks;
-	if(first < th->next) {
-	    memmove( spare, base + first*bps, th->ntrails*bps ); 
-	} else {
-	    /* rearrange two pieces: 0..next-1  first..max-1
-	     * into 0..keep-1  keep..keep+next-1
-	     */
-	    int keep = th->maxtrail - first;
-	    memcpy( spare, base + first*bps, keep*bps );
-	    memmove( spare + keep*bps, base, th->next*bps );
+	int first = (th->next + oldcap - th->ntrails) % oldcap;
+	for(k = 0; k < th->ntrails; k++) {
+	    int from = th->ring * oldcap + (first + k) % oldcap;
+	    ww->trailp[ th->ring * newmax + k ] = oldp[from];
+	    ww->trailrgba[ th->ring * newmax + k ] = oldrgba[from];
 	}
-	Free( th->specks );
-	th->specks = (struct speck *)NewN( char, newmax*bps );
-	memcpy( th->specks, spare, th->ntrails*bps );
 	th->next = th->ntrails;
-	th->maxtrail = newmax;
     }
-    free(spare);
+    if(oldp) Free( oldp );
+    if(oldrgba) Free( oldrgba );
 }
 
+/* List the segments (and post-gap points) of all trails, as indices into trailp[]. */
+static void kira_trail_indices( worldstuff *ww )
+{
+    int i, j, n, nseg, npt;
+
+    for(i = nseg = npt = 0; i < ww->maxtrailno; i++) {
+	struct trailhead *th = &ww->trails[i];
+	if(th->ring >= 0 && th->ntrails > 1) {
+	    nseg += th->ntrails - 1;
+	    npt++;
+	}
+    }
+    if(2*nseg + npt > ww->trailidxroom) {
+	ww->trailidxroom = 2*nseg + npt + 1024;
+	if(ww->trailidx) Free( ww->trailidx );
+	ww->trailidx = NewN( GLuint, ww->trailidxroom );
+    }
+
+    GLuint *seg = ww->trailidx;
+    GLuint *pts = ww->trailidx + 2*nseg;
+    int cap = ww->trailcap;
+    for(i = nseg = npt = 0; i < ww->maxtrailno; i++) {
+	struct trailhead *th = &ww->trails[i];
+	ww->trailfirst[i] = 2*nseg;
+	ww->trailnseg[i] = 0;
+	if(th->ring < 0 || th->ntrails == 0)
+	    continue;
+	n = th->ntrails < ww->maxtrail ? th->ntrails : ww->maxtrail;
+	int base = th->ring * cap;
+	int start = (th->next + cap - n) % cap;
+	int brk = (th->nbrk > 0 && th->nbrk < n) ? n - th->nbrk : 0;
+	for(j = 1; j < n; j++) {
+	    if(j == brk)
+		continue;	// don't join across the time gap
+	    seg[2*nseg]   = base + (start + j-1) % cap;
+	    seg[2*nseg+1] = base + (start + j) % cap;
+	    nseg++;
+	}
+	ww->trailnseg[i] = nseg - ww->trailfirst[i]/2;
+	if(brk > 0)
+	    pts[npt++] = base + (start + brk) % cap;
+    }
+    ww->ntrailseg = nseg;
+    ww->ntrailpt = npt;
+    if(npt > 0)
+	memmove( ww->trailidx + 2*nseg, pts, npt*sizeof(GLuint) );
+    ww->trailidxseq = ww->trailseq;
+    ww->trailidxmax = ww->maxtrail;
+}
 
 int kira_draw( struct dyndata *dd, struct stuff *st, struct specklist *slhead, Matrix *Tc2w, float radperpix )
 {
@@ -1485,8 +1825,9 @@ int kira_draw( struct dyndata *dd, struct stuff *st, struct specklist *slhead, M
 		    float rring = ringpixels * unitperpix;
 		    int step = ringpixels>20 ? 1 : ringpixels>8 ? 2 : 3;
 
+		    int rgb = SPECKRGB(st, sl, sp, i);
 		    if(inpick) glLoadName(i);
-		    else glColor3ubv( (GLubyte *)&sp->rgba );
+		    else glColor3ubv( (GLubyte *)&rgb );
 		    glBegin( GL_LINE_LOOP );
 		    for(int k = 0; k < nring; k+=step)
 			glVertex3f( sp->p.x[0] + rring*fan[k].x[0],
@@ -1498,8 +1839,9 @@ int kira_draw( struct dyndata *dd, struct stuff *st, struct specklist *slhead, M
 		    float mu = sp->val[SPECK_MU];
 		    float *sep = &sp->val[SPECK_SEPVEC];
 
+		    int rgb = SPECKRGB(st, sl, sp, i);
 		    if(inpick) glLoadName(i);
-		    else glColor3ubv( (GLubyte *)&sp->rgba );
+		    else glColor3ubv( (GLubyte *)&rgb );
 		    glBegin( GL_LINES );
 
 		    if(ww->treearcs != KIRA_TICK) {
@@ -1540,9 +1882,16 @@ int kira_draw( struct dyndata *dd, struct stuff *st, struct specklist *slhead, M
     glEnable( GL_BLEND );
     glBlendFunc( GL_SRC_ALPHA, GL_ONE );
 
-    int alpha = 0, rgbmask = ~0;
-    ((GLubyte *)&alpha)[3] = (int) (255 * ww->trailalpha);
-    ((GLubyte *)&rgbmask)[3] = 0;
+    if(ww->trailalphaset != ww->trailalpha) {
+	int k, alpha = (int) (255 * ww->trailalpha);
+	for(k = 0; k < ww->nrings * ww->trailcap; k++)
+	    ((GLubyte *)&ww->trailrgba[k])[3] = alpha;
+	ww->trailalphaset = ww->trailalpha;
+    }
+    if(ww->trails != NULL &&
+		(ww->trailidxseq != ww->trailseq || ww->trailidxmax != ww->maxtrail))
+	kira_trail_indices( ww );
+
     if(inpick) {
 	glPushName( specks_slno );
 	glPushName( 0 );
@@ -1551,67 +1900,27 @@ int kira_draw( struct dyndata *dd, struct stuff *st, struct specklist *slhead, M
     glPointSize( 1.5 );
     glPushMatrix();
     glTranslatef( ww->trackpos.x[0], ww->trackpos.x[1], ww->trackpos.x[2] );
-    for(i = 0; i < ww->maxtrailno; i++) {
-	struct trailhead *th = &ww->trails[i];
-	if(th->ntrails == 0 || th->maxtrail <= 0)
-	    continue;
-	if(inpick)
-	    glLoadName( i );
-	glBegin( GL_LINE_STRIP );
-	int first = (th->next + th->maxtrail - th->ntrails) % th->maxtrail;
-	int k, rgb = 0, rgba = 0;
-	struct speck *sp;
-	char *base = (char *)th->specks;
-	int bps = ww->sl->bytesperspeck;
-	int from1 = first;
-	int to1 = (first < th->next) ? th->next : th->maxtrail;
-	int from2 = 0;
-        int to2 = (first < th->next) ? 0 : th->next;
-	int wasgap = 0, ingap = 0;
-	Point *prev = NULL;
-	for(k = from1; k < to1; k++) {
-	    sp = (struct speck *)(base + k*bps);
-	    ingap = ((char *)&sp->rgba)[3] & TRAILGAP;
-	    if(wasgap != ingap) {
-		glEnd();
-		if(ingap) {
-		    glBegin( GL_POINTS );
-		} else {
-		    glBegin( GL_LINE_STRIP );
-		    glVertex3fv( prev->x );
-		}
-		wasgap = ingap;
-	    }
-	    if(rgb != (sp->rgba & rgbmask)) {
-		rgb = sp->rgba & rgbmask;
-		rgba = rgb | alpha;
-		glColor4ubv( (GLubyte *)&rgba );
-	    }
-	    glVertex3fv( sp->p.x );
-	    prev = &sp->p;
-	}
-	for(k = from2; k < to2; k++) {
-	    sp = (struct speck *)(base + k*bps);
-	    ingap = ((char *)&sp->rgba)[3] & TRAILGAP;
-	    if(wasgap != ingap) {
-		glEnd();
-		if(ingap) {
-		    glBegin( GL_POINTS );
-		} else {
-		    glBegin( GL_LINE_STRIP );
-		    glVertex3fv( prev->x );
-		}
-		wasgap = ingap;
-	    }
-	    if(rgb != (sp->rgba & rgbmask)) {
-		rgb = sp->rgba & rgbmask;
-		rgba = rgb | alpha;
-		glColor4ubv( (GLubyte *)&rgba );
+    if(ww->ntrailseg + ww->ntrailpt > 0) {
+	glEnableClientState( GL_VERTEX_ARRAY );
+	glVertexPointer( 3, GL_FLOAT, sizeof(Point), ww->trailp );
+	if(inpick) {
+	    for(i = 0; i < ww->maxtrailno; i++) {
+		if(ww->trailnseg[i] == 0)
+		    continue;
+		glLoadName( i );
+		glDrawElements( GL_LINES, 2*ww->trailnseg[i], GL_UNSIGNED_INT,
+				ww->trailidx + ww->trailfirst[i] );
 	    }
-	    glVertex3fv( sp->p.x );
-	    prev = &sp->p;
+	} else {
+	    glEnableClientState( GL_COLOR_ARRAY );
+	    glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof(int), ww->trailrgba );
+	    glDrawElements( GL_LINES, 2*ww->ntrailseg, GL_UNSIGNED_INT, ww->trailidx );
+	    if(ww->ntrailpt > 0)
+		glDrawElements( GL_POINTS, ww->ntrailpt, GL_UNSIGNED_INT,
+				ww->trailidx + 2*ww->ntrailseg );
+	    glDisableClientState( GL_COLOR_ARRAY );
 	}
-	glEnd();
+	glDisableClientState( GL_VERTEX_ARRAY );
     }
     glPopMatrix();
     if(inpick) {
@@ -1782,6 +2091,7 @@ int kira_parse_args( struct dyndata *dd, struct stuff *st, int argc, char **argv
 	if(what != 3)
 	    selsrc2dest( st, &ww->intsrc, &ww->intdest );
 	ww->intdest.wanted &= ~ww->intdest.wanton;	/* interact always OR's into existing set */
+	ww->relayout = 1;
 
 	msg("kiractl interact %s", show_selexpr(st, &ww->intdest, &ww->intsrc));
 
@@ -1942,7 +2252,7 @@ void kira_HRplot( Fl_Plot *plot, struct stuff *st, struct dyndata *dd )
 	for(int i = 0; i < ns; i++, sp = NextSpeck(sp, sl, 1)) {
 	    if(sp->val[SPECK_MU] != 0 || sp->val[SPECK_LUM] <= 0)
 		continue;	/* leaf nodes only */
-	    int rgba = sp->rgba;
+	    int rgba = SPECKRGB(st, sl, sp, i);
 	    if( !SELECTED(sl->sel[i], &st->seesel) )
 		continue;
 	    if(inpick) {
@@ -110,7 +110,16 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+# define USE_EPOLL 1
+# include <sys/epoll.h>
+#else
+# include <poll.h>
+#endif
 
 #include <signal.h>
 
@@ -1121,46 +1130,130 @@ static int has_tfm;
 static Point pmin, pmax;
 static Matrix pT;
 
-static void report( FILE *outf, struct dyndata *dyn, struct stuff *st )
+/*
+ * Encoded responses, cached by everything that goes into them: time,
+ * output format and transform.  Many display nodes polling the same
+ * time then cost one evaluation, and each client's output is just
+ * a queue of references to shared snapshots.
+ */
+#define NSNAPCACHE	16		/* snapshots kept */
+#define SNAPMAXBYTES	(256<<20)	/* ... and most bytes kept in them */
+
+enum { FMT_REPORT, FMT_SDB, FMT_SPECK };
+
+struct snapkey {			/* memset() first: compared with memcmp() */
+    int format;
+    double realtime, dt;
+    Matrix T0;
+    int has_T0;
+    char axis;
+    float turnrate;
+    double turntime0;
+    float mag0, colorscale, masslum;
+    int group, type, idbase, oldtree;
+    struct logTmap *tmap;
+};
+
+struct snapshot {
+    struct snapkey key;
+    char *buf;
+    int len, room;
+    int refs;		/* one for the cache, one per queued reply */
+    int used;		/* for LRU */
+};
+
+static struct snapshot *snapcache[NSNAPCACHE];
+static int snapclock;
+static long snapbytes;
+
+static void snap_room( struct snapshot *sn, int more )
+{
+    if(sn->len + more > sn->room) {
+	sn->room = 2*(sn->len + more) + 4096;
+	sn->buf = RenewN( sn->buf, char, sn->room );
+    }
+}
+
+static void snap_write( struct snapshot *sn, const void *data, int len )
+{
+    snap_room( sn, len );
+    memcpy( sn->buf + sn->len, data, len );
+    sn->len += len;
+}
+
+static void snap_printf( struct snapshot *sn, CONST char *fmt, ... )
+{
+    va_list args;
+    int len;
+
+    snap_room( sn, 256 );
+    va_start(args, fmt);
+    len = vsnprintf( sn->buf + sn->len, sn->room - sn->len, fmt, args );
+    va_end(args);
+    if(len >= sn->room - sn->len) {
+	snap_room( sn, len+1 );
+	va_start(args, fmt);
+	vsnprintf( sn->buf + sn->len, sn->room - sn->len, fmt, args );
+	va_end(args);
+    }
+    sn->len += len;
+}
+
+static void snap_unref( struct snapshot *sn )
+{
+    if(--sn->refs > 0)
+	return;
+    Free( sn->buf );
+    Free( sn );
+}
+
+static void snap_evict( int k )
+{
+    snapbytes -= snapcache[k]->len;
+    snap_unref( snapcache[k] );
+    snapcache[k] = NULL;
+}
+
+static void report( struct snapshot *sn, struct dyndata *dyn, struct stuff *st )
 {
     double tmin, tmax;
     kira_get_trange( &st->dyn, st, &tmin, &tmax );
-    fprintf(outf, "time %lg  in  %lg .. %lg\n",
+    snap_printf(sn, "time %lg  in  %lg .. %lg\n",
 	curstate.realtime, tmin, tmax);
-    fprintf(outf, "nspecks %d\n", nspecks);
+    snap_printf(sn, "nspecks %d\n", nspecks);
     if(curstate.idbase != 0)
-	fprintf(outf, "idbase %d\n", curstate.idbase);
+	snap_printf(sn, "idbase %d\n", curstate.idbase);
     if(smass > 0) {
-	fprintf(outf, "CM %lg %lg %lg\n", sx/smass, sy/smass, sz/smass);
-	fprintf(outf, "bbox center %g %g %g  radius %g %g %g\n",
+	snap_printf(sn, "CM %lg %lg %lg\n", sx/smass, sy/smass, sz/smass);
+	snap_printf(sn, "bbox center %g %g %g  radius %g %g %g\n",
 	    .5*(pmax.x[0]+pmin.x[0]), .5*(pmax.x[1]+pmin.x[1]), .5*(pmax.x[2]+pmin.x[2]),
 	    .5*(pmax.x[0]-pmin.x[0]), .5*(pmax.x[1]-pmin.x[1]), .5*(pmax.x[2]-pmin.x[2]));
 	Point cen;
 	kira_get_center( &cen, dyn, st );
-	fprintf(outf, "Center %g %g %g", cen.x[0],cen.x[1],cen.x[2]);
+	snap_printf(sn, "Center %g %g %g", cen.x[0],cen.x[1],cen.x[2]);
 	if(has_tfm) {
 	    Point wcen;
 	    vtfmpoint( &wcen, &cen, &pT );
-	    fprintf(outf, " -> %g %g %g", wcen.x[0],wcen.x[1],wcen.x[2]);
+	    snap_printf(sn, " -> %g %g %g", wcen.x[0],wcen.x[1],wcen.x[2]);
 	}
-	fprintf(outf, "\n");
+	snap_printf(sn, "\n");
     }
-    fprintf(outf, "transformation: out = in");
+    snap_printf(sn, "transformation: out = in");
     if(curstate.turnrate != 0)
-	fprintf(outf, " * %cRotation(%g*(time-%g))",
+	snap_printf(sn, " * %cRotation(%g*(time-%g))",
 		curstate.axis, curstate.turnrate, curstate.turntime0);
     if(curstate.has_T0) {
 	float *fp = curstate.T0.m;
-	fprintf(outf, " * [%g %g %g %g  %g %g %g %g  %g %g %g %g  %g %g %g %g]",
+	snap_printf(sn, " * [%g %g %g %g  %g %g %g %g  %g %g %g %g  %g %g %g %g]",
 		fp[0],fp[1],fp[2],fp[3],
 		fp[4],fp[5],fp[6],fp[7],
 		fp[8],fp[9],fp[10],fp[11],
 		fp[12],fp[13],fp[14],fp[15]);
     }
     else if(curstate.turnrate == 0)
-	fprintf(outf, " (identity transform)");
-    fprintf(outf, "\n");
-    fprintf(outf, "group %d  type %d\n", curstate.group, curstate.type);
+	snap_printf(sn, " (identity transform)");
+    snap_printf(sn, "\n");
+    snap_printf(sn, "group %d  type %d\n", curstate.group, curstate.type);
 }
 
 float specklum( struct speck *sp ) {
@@ -1168,12 +1261,13 @@ float specklum( struct speck *sp ) {
 				     sp->val[SPECK_LUM];
 }
 
-int serveonce(char *req, FILE *outf)
+/* Evaluate the snapshot for curstate, and encode it as sn->key.format says. */
+static int encode( struct snapshot *sn )
 {
-    int as_sdb = 0, as_speck = 0;
+    int as_sdb = (sn->key.format == FMT_SDB);
+    int as_speck = (sn->key.format == FMT_SPECK);
     Point p;
     db_star star;
-    char *cp;
     struct stuff *st = curstate.st;
 
     nspecks=0;
@@ -1182,33 +1276,6 @@ int serveonce(char *req, FILE *outf)
     pmin.x[0]=pmin.x[1]=pmin.x[2] = 1e20;
     pmax.x[0]=pmax.x[1]=pmax.x[2] = -1e20;
 
-    if(curstate.verbose)
-	fprintf(stdout, "REQ: %s\n", req);
-
-    if(outf == NULL || req == NULL) {
-	msg("kira server: get lost!");
-	if(outf) fclose(outf);
-	return 0;
-    }
-
-    if(strstr(req, "sdb"))  as_sdb = 1;
-    else if(strstr(req, "speck")) as_speck = 1;
-
-    char *eqp;
-    for(eqp = req; (eqp = strchr(eqp, '=')) != NULL; ) {
-	char *optp, *argp;
-	for(optp = eqp; isalpha(optp[-1]); optp--)
-	    ;
-	argp = eqp+1;
-	cp = strpbrk(argp, ";&");
-	if(cp) {
-	    eqp = cp+1;
-	    *cp = '\0';
-	}
-	scanopt( optp, argp );
-	if(cp == NULL) break;
-    }
-
     memset(&star, 0, sizeof(star));
 
     star.group = curstate.group;
@@ -1233,10 +1300,12 @@ int serveonce(char *req, FILE *outf)
 	pT = curstate.T0;
     }
 
+    if(as_sdb)
+	snap_room( sn, sl->nspecks * sizeof(db_star) );
+
     nspecks = 0;
     for(int i = 0; i < sl->nspecks; i++) {
 	struct speck *sp = NextSpeck(sl->specks, sl, i);
-	int wrote = 0;
 	if(sp->val[SPECK_NCLUMP] < 0)
 	    continue;
 	nspecks++;
@@ -1267,9 +1336,9 @@ int serveonce(char *req, FILE *outf)
 	    }
 	    star.num = (int) sp->val[SPECK_ID] + curstate.idbase;
 	    starswap(&star);
-	    wrote = fwrite(&star, sizeof(star), 1, outf);
+	    snap_write(sn, &star, sizeof(star));
 	} else if(as_speck) {
-	    wrote = fprintf(outf, "%g %g %g %g %g %g\n",
+	    snap_printf(sn, "%g %g %g %g %g %g\n",
 		p.x[0],p.x[1],p.x[2], 
 		specklum(sp), sp->val[SPECK_TLOG], sp->val[SPECK_ID] + curstate.idbase);
 	} else {
@@ -1285,20 +1354,138 @@ int serveonce(char *req, FILE *outf)
 	    if(pmax.x[1] < p.x[1]) pmax.x[1] = p.x[1];
 	    if(pmax.x[2] < p.x[2]) pmax.x[2] = p.x[2];
 	}
-	if(wrote < 0)			/* SIGPIPE? Anyway, quit writing. */
-	    break;
     }
     if(!as_sdb && !as_speck) {
-	report( outf, &st->dyn, st );
+	report( sn, &st->dyn, st );
+    }
+    return 1;
+}
+
+/*
+ * Apply req's options to curstate, and return a reference to
+ * the snapshot it asks for -- cached, or newly encoded -- or NULL.
+ * Caller must snap_unref() it.
+ */
+struct snapshot *snapget(char *req)
+{
+    struct snapkey key;
+    struct snapshot *sn;
+    char *cp;
+    int k, hit;
+
+    if(curstate.verbose)
+	fprintf(stdout, "REQ: %s\n", req);
+
+    if(req == NULL) {
+	msg("kira server: get lost!");
+	return NULL;
     }
+
+    memset(&key, 0, sizeof(key));
+    if(strstr(req, "sdb"))  key.format = FMT_SDB;
+    else if(strstr(req, "speck")) key.format = FMT_SPECK;
+    else key.format = FMT_REPORT;
+
+    char *eqp;
+    for(eqp = req; (eqp = strchr(eqp, '=')) != NULL; ) {
+	char *optp, *argp;
+	for(optp = eqp; optp > req && isalpha(optp[-1]); optp--)
+	    ;
+	argp = eqp+1;
+	cp = strpbrk(argp, ";&");
+	if(cp) {
+	    eqp = cp+1;
+	    *cp = '\0';
+	}
+	scanopt( optp, argp );
+	if(cp == NULL) break;
+    }
+
+    key.realtime = curstate.realtime;
+    key.dt = curstate.dt;
+    key.T0 = curstate.T0;
+    key.has_T0 = curstate.has_T0;
+    key.axis = curstate.axis;
+    key.turnrate = curstate.turnrate;
+    key.turntime0 = curstate.turntime0;
+    key.mag0 = curstate.mag0;
+    key.colorscale = curstate.colorscale;
+    key.masslum = curstate.masslum;
+    key.group = curstate.group;
+    key.type = curstate.type;
+    key.idbase = curstate.idbase;
+    key.oldtree = curstate.oldtree;
+    key.tmap = myTmap;
+
+    sn = NULL;
+    for(k = 0; k < NSNAPCACHE; k++) {
+	if(snapcache[k] && !memcmp( &snapcache[k]->key, &key, sizeof(key) )) {
+	    sn = snapcache[k];
+	    break;
+	}
+    }
+    hit = (sn != NULL);
+
+    if(sn == NULL) {
+	sn = NewN( struct snapshot, 1 );
+	memset( sn, 0, sizeof(*sn) );
+	sn->key = key;
+	if(!encode( sn )) {
+	    Free( sn->buf );
+	    Free( sn );
+	    return NULL;
+	}
+
+	/* Cache it, evicting least-recently-used ones to make room */
+	while(sn->len <= SNAPMAXBYTES) {
+	    int slot = -1, old = -1;
+	    for(k = 0; k < NSNAPCACHE; k++) {
+		if(snapcache[k] == NULL)
+		    slot = k;
+		else if(old < 0 || snapcache[k]->used < snapcache[old]->used)
+		    old = k;
+	    }
+	    if(old >= 0 && (slot < 0 || snapbytes + sn->len > SNAPMAXBYTES))
+		snap_evict( old );
+	    else {
+		snapcache[slot] = sn;
+		snapbytes += sn->len;
+		sn->refs++;
+		break;
+	    }
+	}
+    }
+    sn->used = ++snapclock;
+    sn->refs++;
+
     if(curstate.verbose) {
 	char *cp = strchr(req, '\n');
 	if(cp) *cp = '\0';
-	fprintf(stdout, "REQ: %s\n", req);
-	report( stdout, &st->dyn, st );
+	fprintf(stdout, "REQ: %s%s\n", req, hit ? "  (cached)" : "");
+	if(!hit) {
+	    struct snapshot rep;
+	    memset(&rep, 0, sizeof(rep));
+	    report( &rep, &curstate.st->dyn, curstate.st );
+	    fwrite( rep.buf, rep.len, 1, stdout );
+	    Free( rep.buf );
+	}
 	fflush(stdout);
     }
-    return nspecks;
+    return sn;
+}
+
+int serveonce(char *req, FILE *outf)
+{
+    struct snapshot *sn;
+
+    if(outf == NULL)
+	return 0;
+    sn = snapget( req );
+    if(sn == NULL)
+	return 0;
+    fwrite( sn->buf, sn->len, 1, outf );
+    snap_unref( sn );
+    return 1;
 }
 
 int serverlisten( int port ) {
@@ -1329,12 +1516,219 @@ int serverlisten( int port ) {
     return lsock;
 }
 
-void serverloop( int lsock ) {
+/*
+ * The network server: one thread, nonblocking sockets, and epoll
+ * (or poll(), where there's no epoll) to juggle many clients at once.
+ * Each client keeps its own settings, and a queue of replies --
+ * references to cached snapshots -- which go out by writev()
+ * as fast as the client takes them.
+ */
+#define REQMAX		1280	/* longest request line */
+#define MAXQUEUED	32	/* don't read more requests while this many replies wait */
+#define MAXIOV		64
+#define MAXEV		64
+
+#define EV_IN	1
+#define EV_OUT	2
+
+struct client {
+    int fd;
+    struct state cs;		/* this client's curstate */
+    char req[REQMAX];		/* partial request line(s) */
+    int reqlen;
+    int eof;
+    struct snapshot **q;	/* replies to send */
+    int nq, qroom;
+    int qoff;			/* bytes of q[0] already sent */
+    int events;			/* EV_IN|EV_OUT we're waiting for */
+};
+
+static struct client **clients;	/* indexed by fd */
+static int clientroom;
+
+#if USE_EPOLL
+
+static int epfd = -1;
+
+static int evinit( void ) {
+    epfd = epoll_create( MAXEV );
+    return epfd;
+}
+
+static void evwatch( int fd, int was, int now ) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = ((now & EV_IN) ? EPOLLIN : 0) | ((now & EV_OUT) ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    epoll_ctl( epfd, was == 0 ? EPOLL_CTL_ADD : now == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD,
+		fd, &ev );
+}
+
+static int evwait( int *fds, int *what ) {
+    struct epoll_event ev[MAXEV];
+    int i, n = epoll_wait( epfd, ev, MAXEV, -1 );
+    for(i = 0; i < n; i++) {
+	fds[i] = ev[i].data.fd;
+	what[i] = ((ev[i].events & EPOLLIN) ? EV_IN : 0)
+		| ((ev[i].events & EPOLLOUT) ? EV_OUT : 0)
+		| ((ev[i].events & (EPOLLHUP|EPOLLERR)) ? EV_IN|EV_OUT : 0);
+    }
+    return n;
+}
+
+#else /* !USE_EPOLL */
+
+static struct pollfd *pfd;
+static int npfd, pfdroom;
+
+static int evinit( void ) {
+    return 0;
+}
+
+static void evwatch( int fd, int was, int now ) {
+    int i;
+    for(i = 0; i < npfd && pfd[i].fd != fd; i++)
+	;
+    if(now == 0) {
+	if(i < npfd)
+	    pfd[i] = pfd[--npfd];
+	return;
+    }
+    if(i == npfd) {
+	if(npfd >= pfdroom) {
+	    pfdroom = 2*pfdroom + 32;
+	    pfd = RenewN( pfd, struct pollfd, pfdroom );
+	}
+	npfd++;
+    }
+    pfd[i].fd = fd;
+    pfd[i].events = ((now & EV_IN) ? POLLIN : 0) | ((now & EV_OUT) ? POLLOUT : 0);
+    pfd[i].revents = 0;
+}
+
+static int evwait( int *fds, int *what ) {
+    int i, n = poll( pfd, npfd, -1 );
+    if(n <= 0)
+	return n;
+    for(i = n = 0; i < npfd && n < MAXEV; i++) {
+	int re = pfd[i].revents;
+	if(re == 0)
+	    continue;
+	fds[n] = pfd[i].fd;
+	what[n++] = ((re & POLLIN) ? EV_IN : 0)
+		  | ((re & POLLOUT) ? EV_OUT : 0)
+		  | ((re & (POLLHUP|POLLERR|POLLNVAL)) ? EV_IN|EV_OUT : 0);
+    }
+    return n;
+}
+
+#endif /* !USE_EPOLL */
+
+static void setnonblock( int fd ) {
+    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK );
+}
+
+static void client_close( struct client *c ) {
+    int i;
+    for(i = 0; i < c->nq; i++)
+	snap_unref( c->q[i] );
+    Free( c->q );
+    evwatch( c->fd, c->events, 0 );
+    close( c->fd );
+    clients[c->fd] = NULL;
+    Free( c );
+}
+
+static void client_request( struct client *c, char *req ) {
+    struct state saved = curstate;
+    struct snapshot *sn;
+
+    curstate = c->cs;
+    sn = snapget( req );
+    c->cs = curstate;
+    curstate = saved;
+
+    if(sn == NULL)
+	return;
+    if(c->nq >= c->qroom) {
+	c->qroom = 2*c->qroom + MAXQUEUED;
+	c->q = RenewN( c->q, struct snapshot *, c->qroom );
+    }
+    c->q[c->nq++] = sn;
+}
+
+/* Serve each whole line (or overlong or final fragment) we've received. */
+static void client_serve( struct client *c ) {
+    char line[REQMAX];
+    char *nl;
+    int len;
+
+    while(c->nq < MAXQUEUED && c->reqlen > 0) {
+	nl = (char *)memchr( c->req, '\n', c->reqlen );
+	if(nl != NULL)
+	    len = nl+1 - c->req;
+	else if(c->reqlen >= REQMAX-1 || c->eof)
+	    len = c->reqlen;
+	else
+	    break;
+	memcpy( line, c->req, len );
+	line[len] = '\0';
+	c->reqlen -= len;
+	memmove( c->req, c->req + len, c->reqlen );
+	client_request( c, line );
+    }
+}
+
+static int client_read( struct client *c ) {
+    for(;;) {
+	client_serve( c );
+	if(c->eof || c->nq >= MAXQUEUED)
+	    return 0;
+	int got = read( c->fd, c->req + c->reqlen, REQMAX-1 - c->reqlen );
+	if(got > 0) {
+	    c->reqlen += got;
+	} else if(got == 0) {
+	    c->eof = 1;
+	} else if(errno != EINTR) {
+	    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+	}
+    }
+}
+
+static int client_write( struct client *c ) {
+    struct iovec iov[MAXIOV];
+    int i, n;
+
+    while(c->nq > 0) {
+	n = (c->nq < MAXIOV) ? c->nq : MAXIOV;
+	for(i = 0; i < n; i++) {
+	    iov[i].iov_base = c->q[i]->buf;
+	    iov[i].iov_len = c->q[i]->len;
+	}
+	iov[0].iov_base = c->q[0]->buf + c->qoff;
+	iov[0].iov_len -= c->qoff;
+
+	long sent = writev( c->fd, iov, n );
+	if(sent < 0) {
+	    if(errno == EINTR)
+		continue;
+	    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+	}
+	sent += c->qoff;
+	for(i = 0; i < n && sent >= c->q[i]->len; i++) {
+	    sent -= c->q[i]->len;
+	    snap_unref( c->q[i] );
+	}
+	c->nq -= i;
+	memmove( c->q, c->q + i, c->nq * sizeof(struct snapshot *) );
+	c->qoff = sent;
+    }
+    return 0;
+}
+
+static void client_accept( int lsock, struct state *defaults ) {
     for(;;) {
 	struct sockaddr_in from;
-	FILE *inf, *outf;
-	char req[1280];
-	
 #if sgi
 	int fromlen = sizeof(from);
 #else
@@ -1344,22 +1738,77 @@ void serverloop( int lsock ) {
 	if(s < 0) {
 	    if(errno == EINTR)
 		continue;
-	    perror("accept");
+	    if(errno != EAGAIN && errno != EWOULDBLOCK)
+		perror("accept");
 	    return;
 	}
-	inf = fdopen(s, "r");
-	if(fgets(req, sizeof(req), inf) == NULL) {
-	    perror("fgets");
-	} else {
-	    outf = fdopen(s, "w");
-	    do {
-		serveonce( req, outf );
-		fflush(outf);
-	    } while(fgets(req, sizeof(req), inf) != NULL);
-	    fclose(outf);
+	setnonblock( s );
+	if(s >= clientroom) {
+	    int was = clientroom;
+	    clientroom = s + 64;
+	    clients = RenewN( clients, struct client *, clientroom );
+	    memset( &clients[was], 0, (clientroom - was) * sizeof(struct client *) );
+	}
+	struct client *c = NewN( struct client, 1 );
+	memset( c, 0, sizeof(*c) );
+	c->fd = s;
+	c->cs = *defaults;
+	c->events = EV_IN;
+	clients[s] = c;
+	evwatch( s, 0, EV_IN );
+    }
+}
+
+void serverloop( int lsock ) {
+    struct state defaults = curstate;	/* each client starts with these */
+    int fds[MAXEV], what[MAXEV];
+    int i, n;
+
+    setnonblock( lsock );
+    if(evinit() < 0) {
+	perror("epoll_create");
+	return;
+    }
+    evwatch( lsock, 0, EV_IN );
+
+    for(;;) {
+	n = evwait( fds, what );
+	if(n < 0) {
+	    if(errno == EINTR)
+		continue;
+	    perror("kiraserver: waiting for clients");
+	    return;
+	}
+	for(i = 0; i < n; i++) {
+	    if(fds[i] == lsock) {
+		client_accept( lsock, &defaults );
+		continue;
+	    }
+	    struct client *c = (fds[i] < clientroom) ? clients[fds[i]] : NULL;
+	    if(c == NULL)
+		continue;
+
+	    /* Read what we can, then try sending replies right away */
+	    if(((what[i] & EV_IN) && client_read( c ) < 0)
+			|| client_write( c ) < 0) {
+		client_close( c );
+		continue;
+	    }
+	    client_serve( c );		/* any requests that were waiting for queue room */
+	    if(client_write( c ) < 0) {
+		client_close( c );
+		continue;
+	    }
+
+	    int want = ((!c->eof && c->nq < MAXQUEUED) ? EV_IN : 0)
+		     | (c->nq > 0 ? EV_OUT : 0);
+	    if(want == 0 && c->reqlen == 0) {
+		client_close( c );	/* all done */
+	    } else if(want != c->events) {
+		evwatch( c->fd, c->events, want );
+		c->events = want;
+	    }
 	}
-	fclose(inf);
-	close(s);
     }
 }
 
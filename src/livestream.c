@@ -0,0 +1,539 @@
+/*
+ * Live particle stream from a running simulation, over TCP.
+ *
+ *   stream :PORT  [-keep N] [-queue N] [-drop]	  listen for a producer
+ *   stream HOST:PORT  [...]			  connect to one
+ *   stream stop
+ *   stream follow on|off	  jump to each new frame as it arrives (default on)
+ *   stream			  report counters
+ *
+ * A receiver thread decodes frames into specklists and queues up to
+ * -queue of them (default 4).  When the queue's full it stops reading,
+ * so TCP pushes back on the producer; with -drop it instead throws away
+ * the oldest queued frame.  Each display frame, specks_set_timestep()
+ * takes whatever's queued and inserts it into timesteps 0..keep-1
+ * (default 64), used cyclically.
+ *
+ * Protocol, all in network byte order, one frame after another:
+ *   header: "PVSF", u32 version (1), u32 frameno, u32 nspecks,
+ *	     u32 ncols, u32 flags (1: end of stream), f64 time
+ *   ncols names, 16 bytes each, NUL-padded
+ *   3+ncols columns of nspecks f32's: x, y, z, then val[0..ncols-1]
+ * See streamfeed.c for a test producer.
+ *
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "specks.h"
+#include "partiviewc.h"
+#include "plugins.h"
+
+#if defined(HAVE_THREADS) && defined(HAVE_PTHREAD_H)
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "shmem.h"
+#include "tcpsocket.h"
+
+#define STREAMMAGIC	"PVSF"
+#define STREAMVERSION	1
+#define STREAMHEAD	32
+#define STREAMNAMELEN	16
+#define STREAMEND	0x1	/* flags: producer is done */
+#define STREAMMAXSPECKS	(1<<26)
+#define STREAMMAXBYTES	((size_t)1<<30)	/* of specks per frame; keeps offsets within an int */
+
+struct streamframe {
+  struct specklist *sl;
+  int frameno, ncols;
+  double time;
+  char name[MAXVAL][STREAMNAMELEN];
+  float min[MAXVAL], max[MAXVAL], sum[MAXVAL];
+};
+
+struct livestream {
+  struct stuff *st;
+  int dataset;
+  char *host;			/* NULL: listen on port */
+  int port;
+  int keep;			/* timesteps in the ring */
+  int dropold;			/* queue full: drop oldest, rather than stall */
+  int follow;			/* set clock to each new frame */
+  int nextslot;			/* display's own */
+  float scale;			/* st->spacescale when we started */
+
+  pthread_t th;
+  pthread_mutex_t mut;
+  pthread_cond_t room;
+  int wake[2];			/* receiver -> display: "frames ready" */
+  volatile int stop;
+
+	/* under mut */
+  struct streamframe **q;	/* ring of qroom decoded frames */
+  int qroom, qhead, qcount;
+  int connected, done;
+  long received, inserted, dropped, missed, stalls;
+  double bytes;
+  int lastframe;
+  double lasttime;
+
+	/* receiver's own */
+  float *col;
+  int colroom;
+};
+
+static void stream_freeframe( struct streamframe *fr )
+{
+  if(fr == NULL)
+    return;
+  if(fr->sl != NULL) {
+    if(fr->sl->specks) Free( fr->sl->specks );
+    if(fr->sl->sel) Free( fr->sl->sel );
+    Free( fr->sl );
+  }
+  Free( fr );
+}
+
+static void stream_poke( struct livestream *ls )
+{
+  char c = 0;
+  if(write( ls->wake[1], &c, 1 ) < 0 && errno != EAGAIN)
+    perror("stream: write");
+}
+
+/* Read exactly n bytes, checking now and then whether we've been told to stop. */
+static int stream_read( struct livestream *ls, struct TCPsocket *ts, void *buf, int n )
+{
+  int got = 0, fd = tcpfd( ts );
+
+  while(got < n) {
+    int r;
+    if(ls->stop)
+	return 0;
+    if(!tcpawait( ts, 250000 ))
+	continue;
+    r = read( fd, (char *)buf + got, n - got );
+    if(r < 0 && errno == EINTR)
+	continue;
+    if(r <= 0)
+	return 0;
+    got += r;
+  }
+  pthread_mutex_lock( &ls->mut );
+  ls->bytes += n;
+  pthread_mutex_unlock( &ls->mut );
+  return 1;
+}
+
+static unsigned int getu32( unsigned char *b )
+{
+  return ((unsigned int)b[0]<<24) | (b[1]<<16) | (b[2]<<8) | b[3];
+}
+
+static struct streamframe *stream_decode( struct livestream *ls, struct TCPsocket *ts )
+{
+  unsigned char h[STREAMHEAD];
+  unsigned int nspecks, ncols, flags, v;
+  unsigned long long tbits;
+  struct streamframe *fr;
+  struct specklist *sl;
+  struct speck *sp;
+  int i, k;
+
+  if(!stream_read( ls, ts, h, sizeof(h) ))
+    return NULL;
+  if(memcmp( h, STREAMMAGIC, 4 ) != 0 || getu32(h+4) != STREAMVERSION) {
+    msg("stream: bad frame header -- not a partiview stream?");
+    return NULL;
+  }
+  nspecks = getu32(h+12);
+  ncols = getu32(h+16);
+  flags = getu32(h+20);
+  if(flags & STREAMEND)
+    return NULL;
+  if(ncols > MAXVAL || nspecks > STREAMMAXSPECKS
+	|| (size_t)SMALLSPECKSIZE(ncols) * nspecks > STREAMMAXBYTES) {
+    msg("stream: frame %u has %u specks, %u columns -- can't take more than %d, %d, or %lu bytes",
+	getu32(h+8), nspecks, ncols, STREAMMAXSPECKS, MAXVAL, (unsigned long)STREAMMAXBYTES);
+    return NULL;
+  }
+
+  fr = NewN( struct streamframe, 1 );
+  memset( fr, 0, sizeof(*fr) );
+  fr->frameno = getu32(h+8);
+  fr->ncols = ncols;
+  tbits = ((unsigned long long)getu32(h+24) << 32) | getu32(h+28);
+  memcpy( &fr->time, &tbits, sizeof(fr->time) );
+  if(ncols > 0 && !stream_read( ls, ts, fr->name, ncols*STREAMNAMELEN )) {
+    Free( fr );
+    return NULL;
+  }
+  for(k = 0; k < ncols; k++)
+    fr->name[k][STREAMNAMELEN-1] = '\0';
+
+  sl = fr->sl = NewN( struct specklist, 1 );
+  memset( sl, 0, sizeof(*sl) );
+  sl->bytesperspeck = SMALLSPECKSIZE( ncols );
+  sl->specks = (struct speck *)NewN( char, (size_t)sl->bytesperspeck * nspecks );
+  memset( sl->specks, 0, (size_t)sl->bytesperspeck * nspecks );
+  sl->sel = NewN( SelMask, nspecks+1 );
+  memset( sl->sel, 0, nspecks*sizeof(SelMask) );
+  sl->nsel = nspecks;
+  sl->nspecks = nspecks;
+  sl->scaledby = ls->scale;
+
+  if(nspecks > ls->colroom) {
+    if(ls->col) Free( ls->col );
+    ls->colroom = nspecks + nspecks/4;
+    ls->col = NewN( float, ls->colroom );
+  }
+
+  /* One column at a time: x, y, z, val[0], ... */
+  for(k = 0; k < 3 + (int)ncols; k++) {
+    float *col = ls->col;
+    float *dst;
+    float scl = (k < 3) ? ls->scale : 1;
+    float min = 0, max = 0, sum = 0;
+
+    if(nspecks > 0 && !stream_read( ls, ts, col, nspecks*sizeof(float) )) {
+	stream_freeframe( fr );
+	return NULL;
+    }
+    for(i = 0, sp = sl->specks; i < nspecks; i++, sp = NextSpeck(sp, sl, 1)) {
+	float f;
+	v = ntohl( ((unsigned int *)col)[i] );
+	memcpy( &f, &v, sizeof(f) );
+	dst = (k < 3) ? &sp->p.x[k] : &sp->val[k-3];
+	*dst = f * scl;
+	if(i == 0) {
+	    min = max = f;
+	} else {
+	    if(min > f) min = f;
+	    else if(max < f) max = f;
+	}
+	sum += f;
+    }
+    if(k >= 3) {
+	fr->min[k-3] = min;
+	fr->max[k-3] = max;
+	fr->sum[k-3] = sum;
+    }
+  }
+  return fr;
+}
+
+/* Queue a decoded frame, waiting for room unless we drop old ones instead. */
+static void stream_enqueue( struct livestream *ls, struct streamframe *fr )
+{
+  struct streamframe *old = NULL;
+
+  pthread_mutex_lock( &ls->mut );
+  if(ls->qcount >= ls->qroom) {
+    if(ls->dropold) {
+	old = ls->q[ls->qhead];
+	ls->qhead = (ls->qhead + 1) % ls->qroom;
+	ls->qcount--;
+	ls->dropped++;
+    } else {
+	ls->stalls++;
+	while(ls->qcount >= ls->qroom && !ls->stop)
+	    pthread_cond_wait( &ls->room, &ls->mut );
+    }
+  }
+  if(ls->stop) {
+    pthread_mutex_unlock( &ls->mut );
+    stream_freeframe( fr );
+    return;
+  }
+  if(ls->lastframe >= 0 && fr->frameno > ls->lastframe + 1)
+    ls->missed += fr->frameno - ls->lastframe - 1;
+  ls->lastframe = fr->frameno;
+  ls->lasttime = fr->time;
+  ls->q[ (ls->qhead + ls->qcount) % ls->qroom ] = fr;
+  ls->qcount++;
+  ls->received++;
+  pthread_mutex_unlock( &ls->mut );
+
+  stream_freeframe( old );
+  stream_poke( ls );
+}
+
+static void stream_feed( struct livestream *ls, struct TCPsocket *ts )
+{
+  struct streamframe *fr;
+
+  pthread_mutex_lock( &ls->mut );
+  ls->connected = 1;
+  ls->lastframe = -1;
+  pthread_mutex_unlock( &ls->mut );
+
+  while((fr = stream_decode( ls, ts )) != NULL)
+    stream_enqueue( ls, fr );
+
+  pthread_mutex_lock( &ls->mut );
+  ls->connected = 0;
+  pthread_mutex_unlock( &ls->mut );
+}
+
+static void *stream_thread( void *arg )
+{
+  struct livestream *ls = (struct livestream *)arg;
+  struct TCPsocket *ts, *lt;
+
+  if(ls->host != NULL) {
+    ts = tcpconnect( ls->host, ls->port, 0 );
+    if(tcpvalid( ts ) && tcpbe_connected( ts ))
+	stream_feed( ls, ts );
+    tcpclose( ts );
+
+  } else {
+    lt = tcplisten( ls->port, 0, 1, 0 );
+    while(tcplistening( lt ) && !ls->stop) {
+	if(!tcpawait( lt, 250000 ))
+	    continue;
+	ts = tcpaccept( lt, 0 );
+	if(tcpvalid( ts ))
+	    stream_feed( ls, ts );
+	tcpclose( ts );
+    }
+    tcpclose( lt );
+  }
+
+  pthread_mutex_lock( &ls->mut );
+  ls->done = 1;
+  pthread_mutex_unlock( &ls->mut );
+  stream_poke( ls );
+  return NULL;
+}
+
+#if !CAVEMENU
+static void stream_woke( int fd, void *arg )
+{
+  char buf[256];
+  while(read( fd, buf, sizeof(buf) ) > 0)
+    ;
+  parti_redraw();
+}
+#endif
+
+/* Called by specks_set_timestep(): install any frames the receiver has ready. */
+void specks_stream_frame( struct stuff *st )
+{
+  struct livestream *ls = st->stream;
+  struct streamframe *ready[64];
+  int i, k, n, slot = -1;
+
+  for(;;) {
+    pthread_mutex_lock( &ls->mut );
+    for(n = 0; n < COUNT(ready) && ls->qcount > 0; n++) {
+	ready[n] = ls->q[ls->qhead];
+	ls->qhead = (ls->qhead + 1) % ls->qroom;
+	ls->qcount--;
+    }
+    if(n > 0)
+	pthread_cond_signal( &ls->room );
+    pthread_mutex_unlock( &ls->mut );
+    if(n == 0)
+	break;
+
+    for(i = 0; i < n; i++) {
+	struct streamframe *fr = ready[i];
+	struct specklist *sl = fr->sl;
+	struct valdesc *vdp = &st->vdesc[ls->dataset][0];
+
+	slot = ls->nextslot++ % ls->keep;
+	specks_ensuretime( st, ls->dataset, slot );
+	if(st->sl != NULL && st->sl == specks_timespecks( st, ls->dataset, slot ))
+	    st->sl = NULL;
+	specks_clearspecks( st, ls->dataset, slot );
+	sl->speckseq = ++st->speckseq;
+	specks_insertspecks( st, ls->dataset, slot, sl );
+
+	for(k = 0; k < fr->ncols; k++, vdp++) {
+	    if(vdp->name[0] == '\0' && fr->name[k][0] != '\0') {
+		strncpy( vdp->name, fr->name[k], sizeof(vdp->name)-1 );
+		vdp->name[sizeof(vdp->name)-1] = '\0';
+	    }
+	    if(sl->nspecks == 0)
+		continue;
+	    if(vdp->nsamples == 0 || vdp->min > fr->min[k]) vdp->min = fr->min[k];
+	    if(vdp->nsamples == 0 || vdp->max < fr->max[k]) vdp->max = fr->max[k];
+	    vdp->nsamples += sl->nspecks;
+	    vdp->sum += fr->sum[k];
+	    vdp->mean = vdp->sum / vdp->nsamples;
+	}
+	fr->sl = NULL;
+	stream_freeframe( fr );
+    }
+    pthread_mutex_lock( &ls->mut );
+    ls->inserted += n;
+    pthread_mutex_unlock( &ls->mut );
+  }
+
+  if(slot >= 0 && ls->follow)
+    clock_set_time( st->clk, slot );
+}
+
+static void stream_free( struct livestream *ls )
+{
+  int i;
+
+#if !CAVEMENU
+  parti_unwatchfd( ls->wake[0] );
+#endif
+  close( ls->wake[0] );
+  close( ls->wake[1] );
+  for(i = 0; i < ls->qcount; i++)
+    stream_freeframe( ls->q[ (ls->qhead + i) % ls->qroom ] );
+  Free( ls->q );
+  if(ls->col) Free( ls->col );
+  if(ls->host) Free( ls->host );
+  pthread_mutex_destroy( &ls->mut );
+  pthread_cond_destroy( &ls->room );
+  Free( ls );
+}
+
+static void stream_stop( struct stuff *st )
+{
+  struct livestream *ls = st->stream;
+
+  if(ls == NULL)
+    return;
+  pthread_mutex_lock( &ls->mut );
+  ls->stop = 1;
+  pthread_cond_broadcast( &ls->room );
+  pthread_mutex_unlock( &ls->mut );
+  pthread_join( ls->th, NULL );
+  st->stream = NULL;
+  stream_free( ls );
+}
+
+static void stream_report( struct stuff *st )
+{
+  struct livestream *ls = st->stream;
+
+  if(ls == NULL) {
+    msg("stream: not running");
+    return;
+  }
+  pthread_mutex_lock( &ls->mut );
+  msg("stream %s:%d (%s%s): %ld received, %ld inserted, %ld dropped, %ld missed, %ld stalls, %.3g MB; "
+	"last frame %d time %g; %d queued, ring of %d%s",
+	ls->host ? ls->host : "", ls->port,
+	ls->done ? "done" : ls->connected ? "connected" : "waiting",
+	ls->dropold ? ", -drop" : "",
+	ls->received, ls->inserted, ls->dropped, ls->missed, ls->stalls, ls->bytes / 1048576,
+	ls->lastframe, ls->lasttime, ls->qcount, ls->keep,
+	ls->follow ? ", following" : "");
+  pthread_mutex_unlock( &ls->mut );
+}
+
+static int stream_parse_args( struct stuff **stp, int argc, char *argv[], char *fname, void *etc )
+{
+  struct stuff *st = *stp;
+  struct livestream *ls;
+  char *where, *colon;
+  int i, keep = 64, queue = 4, dropold = 0;
+
+  if(argc < 1 || strcmp( argv[0], "stream" ) != 0)
+    return 0;
+
+  if(argc == 1) {
+    stream_report( st );
+    return 1;
+  }
+  if(!strcmp( argv[1], "stop" ) || !strcmp( argv[1], "off" )) {
+    stream_stop( st );
+    return 1;
+  }
+  if(!strcmp( argv[1], "follow" )) {
+    if(st->stream != NULL)
+	st->stream->follow = getbool( argc>2 ? argv[2] : NULL, !st->stream->follow );
+    return 1;
+  }
+
+  where = NULL;
+  for(i = 1; i < argc; i++) {
+    if(!strcmp( argv[i], "-keep" ) && i+1 < argc)
+	keep = atoi( argv[++i] );
+    else if(!strcmp( argv[i], "-queue" ) && i+1 < argc)
+	queue = atoi( argv[++i] );
+    else if(!strcmp( argv[i], "-drop" ))
+	dropold = 1;
+    else if(argv[i][0] != '-' && where == NULL)
+	where = argv[i];
+    else
+	where = NULL, i = argc+1;
+  }
+  if(where == NULL || (colon = strrchr( where, ':' )) == NULL || atoi(colon+1) <= 0
+		|| keep < 1 || queue < 1) {
+    msg("Usage: stream [HOST]:PORT [-keep NTIMES] [-queue NFRAMES] [-drop] | stop | follow on|off");
+    return 1;
+  }
+
+  stream_stop( st );
+
+  ls = NewN( struct livestream, 1 );
+  memset( ls, 0, sizeof(*ls) );
+  ls->st = st;
+  ls->dataset = st->curdata;
+  ls->port = atoi( colon+1 );
+  if(colon > where) {
+    ls->host = NewN( char, colon - where + 1 );
+    memcpy( ls->host, where, colon - where );
+    ls->host[colon - where] = '\0';
+  }
+  ls->keep = keep;
+  ls->qroom = queue;
+  ls->q = NewN( struct streamframe *, queue );
+  ls->dropold = dropold;
+  ls->follow = 1;
+  ls->scale = st->spacescale;
+  ls->lastframe = -1;
+
+  if(pipe( ls->wake ) < 0) {
+    msg("stream: pipe: %s", strerror(errno));
+    Free( ls->q );
+    if(ls->host) Free( ls->host );
+    Free( ls );
+    return 1;
+  }
+  fcntl( ls->wake[0], F_SETFL, fcntl( ls->wake[0], F_GETFL ) | O_NONBLOCK );
+  fcntl( ls->wake[1], F_SETFL, fcntl( ls->wake[1], F_GETFL ) | O_NONBLOCK );
+  pthread_mutex_init( &ls->mut, NULL );
+  pthread_cond_init( &ls->room, NULL );
+
+#if !CAVEMENU
+  parti_watchfd( ls->wake[0], stream_woke, ls );
+#endif
+  if(pthread_create( &ls->th, NULL, stream_thread, ls ) != 0) {
+    msg("stream: pthread_create: %s", strerror(errno));
+    stream_free( ls );
+    return 1;
+  }
+  st->stream = ls;
+  return 1;
+}
+
+void stream_init() {
+  parti_add_reader( stream_parse_args, "stream", NULL );
+  parti_add_commands( stream_parse_args, "stream", NULL );
+}
+
+#else /* no threads */
+
+void specks_stream_frame( struct stuff *st ) { }
+
+void stream_init() { }
+
+#endif
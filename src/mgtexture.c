@@ -18,6 +18,8 @@ geom.umn.edu; email: software@geom.umn.edu. */
  * Illinois Open Source License; see the file LICENSE.partiview for details.
  */
 
+#include "config.h"
+
 #include <ctype.h>
 #undef isalnum		/* Hacks for Irix 6.5.x */
 #undef isspace
@@ -48,6 +50,10 @@ geom.umn.edu; email: software@geom.umn.edu. */
 #include <signal.h>
 #include <string.h>
 
+#ifdef HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+
 
 enum _format {
 	TF_BYTE,
@@ -62,32 +68,40 @@ struct xyc {
     enum _format format;
     int maxval;		/* For PNM TF_ASCII files */
     int *rleoff;	/* For TF_SGIRLE: offsets[z][y], then lengths[z][y] */
-    char *rledata;	/* For TF_SGIRLE: all data (don't fseek so we can read from pipe)*/
 };
 
-static FILE *
-gimme(char *fname, int *dopclose, struct xyc *size)
+/*
+ * We read the whole (decompressed) image file into memory, then decode it
+ * from there -- no stdio, no signals -- so several textures can be
+ * decoded at once, in different threads.
+ */
+struct imgbuf {
+    unsigned char *data;	/* whole file */
+    unsigned char *p, *end;	/* read pointer; end of data */
+    int eof;			/* tried to read past end? */
+};
+
+#define MGETC(b)  ((b)->p < (b)->end ? *(b)->p++ : ((b)->eof = 1, EOF))
+#define BE16(p)   (((p)[0] << 8) | (p)[1])
+#define BE32(p)   (((p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3])
+
+#define GZIPCMD "gzip -dc "
+
+/* Which filter command, if any, turns fname into an image file? */
+static char *
+txfilter(char *fname)
 {
-    char cmd[2048];
-    char *suf, *p, *q;
-    int i, c, len, slen;
-    char *prefix = NULL;
-    char *msg = NULL;
-    FILE *f = NULL;
     static char *suffixes[] = {
 	"\0zcat ", "Z",
-	"\0gzip -dc ", "z", "gz",
+	"\0" GZIPCMD, "z", "gz",
 	"\0tifftopnm ", "tiff", "tif",
 	"\0giftoppm ", "gif",
 	"\0",
 	NULL
     };
-    
+    char *suf, *prefix = "";
+    int i, len, slen;
 
-    size->zsize = 1;
-    size->rleoff = NULL;  size->rledata = NULL;
-    if(fname == NULL)
-	goto nope;
     len = strlen(fname);
     for(i = 0; (suf = suffixes[i]) != NULL; i++) {
 	if(suf[0] == '\0') {
@@ -100,12 +114,52 @@ gimme(char *fname, int *dopclose, struct xyc *size)
 		break;
 	}
     }
+    return prefix;
+}
+
+/* Can we decode fname ourselves, without running some other program? */
+int
+mg_texture_native(char *fname)
+{
+    char *prefix;
+    if(fname == NULL)
+	return 1;
+    prefix = txfilter(fname);
+#ifdef HAVE_ZLIB_H
+    if(strcmp(prefix, GZIPCMD) == 0)
+	return 1;
+#endif
+    return prefix[0] == '\0';
+}
+
+static int
+slurp(char *fname, struct imgbuf *b)
+{
+    char cmd[2048];
+    char *prefix, *p, *q;
+    int n, len = 0, room = 65536;
+    int dopclose = 0;
+    FILE *f = NULL;
+#ifdef HAVE_ZLIB_H
+    gzFile gz = NULL;
+#endif
+#if defined(unix) || defined(__unix)
+    void (*oldsigchld)(int) = SIG_DFL;
+#endif
+
+    memset(b, 0, sizeof(*b));
     if(access(fname, R_OK) < 0) {
 	fprintf(stderr, "%s: Can't read texture image: %s", fname, strerror(errno));
-	goto nope;
+	return 0;
     }
-    if(prefix == NULL || prefix[0] == '\0') {
-	*dopclose = 0;
+    prefix = txfilter(fname);
+    strcpy(cmd, fname);
+#ifdef HAVE_ZLIB_H
+    if(strcmp(prefix, GZIPCMD) == 0) {
+	gz = gzopen(fname, "rb");
+    } else
+#endif
+    if(prefix[0] == '\0') {
 	f = fopen(fname, "rb");
 #if defined(unix) || defined(__unix)
     } else {
@@ -116,106 +170,184 @@ gimme(char *fname, int *dopclose, struct xyc *size)
 	    *p++ = *q++;
 	}
 	*p = '\0';
-	*dopclose = 1;
+	dopclose = 1;
+	oldsigchld = (void ((*)(int)))signal(SIGCHLD, SIG_DFL);
 	f = popen(cmd, "r");
 #endif
     }
+#ifdef HAVE_ZLIB_H
+    if(f == NULL && gz == NULL) {
+#else
     if(f == NULL) {
+#endif
 	fprintf(stderr, "mg_inhaletexture: Can't %s %s: %s",
-			*dopclose ? "invoke" : "open", cmd, strerror(errno));
-	goto nope;
+			dopclose ? "invoke" : "open", cmd, strerror(errno));
+#if defined(unix) || defined(__unix)
+	if(dopclose)
+	    signal(SIGCHLD, oldsigchld);
+#endif
+	return 0;
+    }
+
+    b->data = NewN( unsigned char, room );
+    for(;;) {
+	if(len == room) {
+	    room *= 2;
+	    b->data = RenewN( b->data, unsigned char, room );
+	}
+#ifdef HAVE_ZLIB_H
+	if(gz)
+	    n = gzread(gz, b->data + len, room - len);
+	else
+#endif
+	    n = fread(b->data + len, 1, room - len, f);
+	if(n <= 0)
+	    break;
+	len += n;
+    }
+
+#ifdef HAVE_ZLIB_H
+    if(gz)
+	gzclose(gz);
+    else
+#endif
+#if defined(unix) || defined(__unix)
+    if(dopclose) {
+	pclose(f);
+	signal(SIGCHLD, oldsigchld);
+    } else
+#endif
+	fclose(f);
+
+    b->p = b->data;
+    b->end = b->data + len;
+    return 1;
+}
+
+/* Read a decimal integer, skipping white space and #-comments (as in PNM headers) */
+static int
+mgetint(struct imgbuf *b, int *vp)
+{
+    int v = 0, any = 0;
+
+    while(b->p < b->end) {
+	if(*b->p == '#') {
+	    while(b->p < b->end && *b->p != '\n')
+		b->p++;
+	} else if(isspace(*b->p)) {
+	    b->p++;
+	} else {
+	    break;
+	}
+    }
+    while(b->p < b->end && *b->p >= '0' && *b->p <= '9') {
+	v = v*10 + (*b->p++ - '0');
+	any = 1;
     }
-    c = fgetc(f);
-    if(c == 0x01 && (c = fgetc(f)) == 0xDA) {
-	/* SGI image file */
-	short shorts[3];
-	int storage = fgetc(f);
-	int bpp = fgetc(f);
+    if(any)
+	*vp = v;
+    return any;
+}
+
+static int
+gimme(char *fname, struct imgbuf *b, struct xyc *size)
+{
+    char *msg = NULL;
+    unsigned char *h;
+    int i, c;
+
+    memset(b, 0, sizeof(*b));
+    size->zsize = 1;
+    size->rleoff = NULL;
+    if(fname == NULL || !slurp(fname, b))
+	goto nope;
+
+    h = b->data;
+    c = MGETC(b);
+    if(c == 0x01 && MGETC(b) == 0xDA) {
+	/* SGI image file: 512-byte header, then maybe RLE tables, then data */
+	int storage = h[2];
+	int bpp = h[3];
+	msg = "%s: truncated SGI image header";
+	if(b->end - h < 512)
+	    goto nope;
 	if(bpp != 1) {
 	    msg = "%s: must have 8-bit image values";
 	    goto nope;
 	}
-	fgetc(f); fgetc(f);		/* Skip "dimension" */
-	fgetns(f, 3, shorts, 1);	/* Read big-endian 16-bit values */
-	size->xsize = shorts[0];
-	size->ysize = shorts[1];
-	size->channels = shorts[2];
-	for(i = 0; i < 4+4+492; i++)	/* Skip min, max, pad data */
-	    getc(f);
+	size->xsize = BE16(h+6);
+	size->ysize = BE16(h+8);
+	size->channels = BE16(h+10);
+	b->p = h + 512;
 	size->format = (storage==0x01) ? TF_SGIRLE : TF_SGIRAW;
 	if(size->format == TF_SGIRLE) {
 	    /* Inhale offset&length table */
 	    int n = size->ysize*size->channels;
-	    int max = 0;
-	    size->rleoff = OOGLNewNE(int, n*2, "TF_SGIRLE offsets");
 	    msg = "%s: can't read RLE offsets";
-	    if(fgetni(f, n*2, size->rleoff, 1) != n*2)
+	    if(b->end - b->p < n*2*4)
 		goto nope;
-	    if(ftell(f) < 0) {
-		for(i = 0; i < n; i++)
-		    if(max < size->rleoff[i])
-			max = size->rleoff[i] + size->rleoff[i+n];
-		size->rledata = OOGLNewNE(char, max+1, "TF_SGIRLE data");
-		if(fread(size->rledata, max, 1, f) <= 0)
-		    goto nope;
-	    }
+	    size->rleoff = OOGLNewNE(int, n*2, "TF_SGIRLE offsets");
+	    for(i = 0; i < n*2; i++, b->p += 4)
+		size->rleoff[i] = BE32(b->p);
 	}
     } else if(c == 'P') {
-        if((c = fgetc(f)) >= '1' && c <= '6') {
+        if((c = MGETC(b)) >= '1' && c <= '6') {
 	    msg = "%s: Bad header on PNM image";
 	    size->channels = (c == '3' || c == '6') ? 3 : 1;
-	    if(fgetni(f, 2, &size->xsize, 0) != 2)
+	    if(!mgetint(b, &size->xsize) || !mgetint(b, &size->ysize))
 		goto nope;
 	    size->maxval = 1;
 	    if(c != '1' && c != '4')
-		if(fgetni(f, 1, &size->maxval, 0) <= 0)
+		if(!mgetint(b, &size->maxval) || size->maxval <= 0)
 		    goto nope;
 	    switch(c) {
 	    case '1': case '2': case '3':	size->format = TF_ASCII; break;
 	    case '4':			size->format = TF_BIT; break;
 	    case '5': case '6':		size->format = TF_BYTE; break;
 	    }
-	    while((c = fgetc(f)) != '\n' && c != EOF)
+	    while((c = MGETC(b)) != '\n' && c != EOF)
 		;
 	} else if(c >= '7' && c <= '9') {
 	    /* 3D image */
 	    msg = "%s: Bad header on PNM-3D image";
 	    size->channels = (c == '9') ? 3 : 1;
-	    if(fgetni(f, 3, &size->xsize, 0) != 3)
+	    if(!mgetint(b, &size->xsize) || !mgetint(b, &size->ysize)
+			|| !mgetint(b, &size->zsize))
+		goto nope;
+	    if(!mgetint(b, &size->maxval))
 		goto nope;
-	    size->maxval = 1;
-	    if(c != '1' && c != '4')
-		if(fgetni(f, 1, &size->maxval, 0) <= 0)
-		    goto nope;
 	    size->format = TF_BYTE;
-	    while((c = fgetc(f)) != '\n' && c != EOF)
+	    while((c = MGETC(b)) != '\n' && c != EOF)
 		;
+	} else {
+	    msg = "%s: Unknown texture image file format";
+	    goto nope;
 	}
     } else {
 	msg = "%s: Unknown texture image file format";
 	goto nope;
     }
-    return f;
+    b->eof = 0;
+    return 1;
 
   nope:
     size->xsize = size->ysize = size->channels = 0;
-    if(f)
-#if defined(unix) || defined(__unix)
-	if(*dopclose)
-	    pclose(f);
-	else
-#endif
-	    fclose(f);
+    if(size->rleoff)
+	OOGLFree(size->rleoff);
+    size->rleoff = NULL;
+    if(b->data)
+	OOGLFree(b->data);
+    b->data = NULL;
     if(msg)
 	fprintf(stderr, msg, fname);
 
-    return NULL;
+    return 0;
 }
 
 int
-readimage(Texture *tx, int offset, int rowsize, struct xyc *size, FILE *f, char *fname)
+readimage(Texture *tx, int offset, int rowsize, struct xyc *size, struct imgbuf *b, char *fname)
 {
-    int val, bit, i=0, j, k;
+    int val, bit, i=0, j, k, count;
     int stride = tx->channels;
     int nrows = size->ysize * size->zsize;
 
@@ -228,45 +360,47 @@ readimage(Texture *tx, int offset, int rowsize, struct xyc *size, FILE *f, char
 		char *pix = tx->data + offset + k + rowsize * i;
 		j = size->xsize;
 		do {
-		    *pix = getc(f);
+		    *pix = MGETC(b);
 		    pix += stride;
 		} while(--j > 0);
 	    }
-	    if(feof(f))
+	    if(b->eof)
 		goto nope;
 	}
     } else if(size->format == TF_SGIRLE) {
         int yup = size->rleoff[0] < size->rleoff[1];
-	int rlebase = 512 + size->channels*size->ysize*4;
 	for(k = 0; k < size->channels; k++) {
 	    for(i = 0; i < size->ysize; i++) {
-		char *rle = NULL;
 		int row = (yup ? i : size->ysize-i-1);
 		char *pix = tx->data + offset + k + rowsize * row;
 		int foff = size->rleoff[k*size->ysize + row];
-		int count;
-		j = size->xsize;
-		if(size->rledata)
-		    rle = size->rledata + foff - rlebase;
-		else
-		    fseek(f, foff, SEEK_SET);
-		while((count = rle ? *rle++ : getc(f)) > 0) {
-		    if(count & 0x80) {
-			count &= 0x7F;
-			do {
-			    *pix = rle ? *rle++ : getc(f);
+		unsigned char *rle;
+
+		if(foff < 512 || foff >= b->end - b->data)
+		    goto nope;
+		rle = b->data + foff;
+		j = size->xsize;	/* pixels left in this row */
+		while(rle < b->end && (count = *rle++ & 0x7F) > 0) {
+		    if(count > j)
+			count = j;
+		    j -= count;
+		    if(rle[-1] & 0x80) {
+			if(b->end - rle < count)
+			    goto nope;
+			while(--count >= 0) {
+			    *pix = *rle++;
 			    pix += stride;
-			} while(--count > 0);
+			}
 		    } else {
-			int val = rle ? *rle++ : getc(f);
-			do {
+			if(rle >= b->end)
+			    goto nope;
+			val = *rle++;
+			while(--count >= 0) {
 			    *pix = val;
 			    pix += stride;
-			} while(--count > 0);
+			}
 		    }
 		}
-		if(feof(f))
-		    goto nope;
 	    }
 	}
     } else {
@@ -274,18 +408,24 @@ readimage(Texture *tx, int offset, int rowsize, struct xyc *size, FILE *f, char
 	for(i = 0; i < nrows; i++) {
 	    char *row = tx->data + rowsize * (nrows - i - 1) + offset;
 	    if(tx->channels == size->channels && size->format == TF_BYTE) {
-		j = fread(row, size->channels, size->xsize, f);
+		j = size->channels * size->xsize;
+		if(b->end - b->p < j) {
+		    j = b->end - b->p;
+		    b->eof = 1;
+		}
+		memcpy(row, b->p, j);
+		b->p += j;
 	    } else {
 		register char *pix = row;
 		j = size->xsize;
 		switch(size->format) {
 		case TF_BYTE:
 		    switch(size->channels) {
-		    case 1: do { *pix = getc(f); pix += stride; } while(--j); break;
+		    case 1: do { *pix = MGETC(b); pix += stride; } while(--j); break;
 		    case 3: do {
-			      pix[0] = getc(f);
-			      pix[1] = getc(f);
-			      pix[2] = getc(f);
+			      pix[0] = MGETC(b);
+			      pix[1] = MGETC(b);
+			      pix[2] = MGETC(b);
 			      pix += stride;
 			    } while(--j);
 			    break;
@@ -296,7 +436,7 @@ readimage(Texture *tx, int offset, int rowsize, struct xyc *size, FILE *f, char
 		    do {
 			if(--bit < 0) {
 			    bit = 7;
-			    k = getc(f);
+			    k = MGETC(b);
 			}
 			*pix = (k >> bit) & 1;
 			pix += stride;
@@ -305,15 +445,18 @@ readimage(Texture *tx, int offset, int rowsize, struct xyc *size, FILE *f, char
 		case TF_ASCII:
 		    do {
 			for(k = 0; k < size->channels; k++) {
-			    fgetni(f, 1, &val, 0);
+			    if(!mgetint(b, &val))
+				b->eof = 1;
 			    pix[k] = val * 255 / size->maxval;
 			}
 			pix += stride;
 		    } while(--j > 0);
 		    break;
+		default:
+		    break;
 		}
 	    }
-	    if(feof(f))
+	    if(b->eof)
 		break;
 	}
     }
@@ -321,10 +464,7 @@ readimage(Texture *tx, int offset, int rowsize, struct xyc *size, FILE *f, char
  nope:
     if(size->rleoff)
 	OOGLFree(size->rleoff);
-    if(size->rledata)
-	OOGLFree(size->rledata);
     size->rleoff = NULL;
-    size->rledata = NULL;
 
     if(i < nrows) {
 	fprintf(stderr, "%s: Error reading texture image row %d of %d",
@@ -378,11 +518,10 @@ mg_same_texture(Texture *tx1, Texture *tx2)
 int
 mg_inhaletexture(Texture *tx, int rgba)
 {
-    FILE *f = NULL, *alphaf = NULL;
+    struct imgbuf b, alphab;
     struct xyc size, alphasize;
-    int dopclose, alphapclose;
-    int i, rowsize, ok, wantchans;
-    void (*oldsigchld)(int);
+    int i, rowsize, ok, havef, havealpha;
+    int wantchans;
 
     if(tx == NULL)
 	return 0;
@@ -396,14 +535,11 @@ mg_inhaletexture(Texture *tx, int rgba)
 
     wantchans = tx->channels;
 
-#if defined(unix) || defined(__unix)
-    oldsigchld = (void ((*)(int)))signal(SIGCHLD, SIG_DFL);
-#endif
-    f = gimme(tx->filename, &dopclose, &size);
+    havef = gimme(tx->filename, &b, &size);
     alphasize.channels = 0;	/* Ensure valid for later, even if no alpha */
-    alphaf = gimme(tx->alphafilename, &alphapclose, &alphasize);
-    if(f == NULL) {
-	if(alphaf) {
+    havealpha = gimme(tx->alphafilename, &alphab, &alphasize);
+    if(!havef) {
+	if(havealpha) {
 	    size = alphasize;
 	    size.channels = 0;
 	} else {
@@ -419,7 +555,7 @@ mg_inhaletexture(Texture *tx, int rgba)
     if(tx->zsize > 1)
 	tx->flags |= TXF_3D;
 
-    if(alphaf) {
+    if(havealpha) {
 	if(size.xsize != alphasize.xsize || size.ysize != alphasize.ysize
 		|| size.zsize != alphasize.zsize) {
 	    fprintf(stderr, "Texture data file (%s) is %dx%d, but alphafile (%s) is %dx%d: ignoring it",
@@ -440,10 +576,10 @@ mg_inhaletexture(Texture *tx, int rgba)
     rowsize = (rowsize + 3) & ~3;	/* Round up to 4-byte boundary */
     tx->data = OOGLNewNE(char, rowsize * tx->ysize * tx->zsize, "Texture data");
 
-    ok = readimage(tx, 0, rowsize, &size, f, tx->filename);
-    if(alphaf)
+    ok = havef ? readimage(tx, 0, rowsize, &size, &b, tx->filename) : 1;
+    if(havealpha)
 	ok &= readimage(tx, tx->channels - alphasize.channels, rowsize, &alphasize,
-				alphaf, tx->alphafilename);
+				&alphab, tx->alphafilename);
     if(!ok) {
 	OOGLFree(tx->data);
 	tx->data = NULL;
@@ -508,16 +644,9 @@ mg_inhaletexture(Texture *tx, int rgba)
     } else {
 	tx->flags |= TXF_RGBA;
     }
-    if(f) {
-	if(dopclose) pclose(f);
-	else fclose(f);
-    }
-    if(alphaf) {
-	if(alphapclose) pclose(alphaf);
-	else fclose(alphaf);
-    }
-#ifdef SIGCHLD
-    signal(SIGCHLD, oldsigchld);
-#endif
+    if(havef)
+	OOGLFree(b.data);
+    if(havealpha)
+	OOGLFree(alphab.data);
     return ok;
 }
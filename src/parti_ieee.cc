@@ -99,12 +99,11 @@ void specks_ieee_open( struct stuff *st, char *fname, int dataset, int starttime
   strcpy(dupfname, fname);
 
   /* Preallocate room for timesteps */
-  (void) specks_timespecksptr( st, nd, starttime + ntimes - 1 );
+  specks_ensuretime( st, nd, starttime + ntimes - 1 );
 
   for(int i = 0; i < ntimes; i++) {
 
-    specks_discard( st, &st->anima[nd][i+starttime] );	/* free any scrap */
-    /* st->anima[nd][i+starttime] = NULL; */
+    specks_clearspecks( st, nd, i+starttime );	/* free any scrap */
     st->datafile[nd][i+starttime] = (void *)infile;
     st->fname[nd][i+starttime] = dupfname;
   }
@@ -289,10 +288,8 @@ if(getenv("RANGE"))
 
   /* If we had any data in this slot before, scrap it now. */
 
-  specks_discard( st, &st->anima[curdata][curtime] );
-		/* Is this safe?  Do we need an interlock? */
-
-  st->anima[curdata][curtime] = sl;
+  specks_clearspecks( st, curdata, curtime );
+  specks_insertspecks( st, curdata, curtime, sl );
 
   return sl;
 }
@@ -584,6 +584,7 @@ extern void *alloca(int);
 
 #if unix
 # include <unistd.h>
+# include <fcntl.h>
 # include <sys/types.h>
 # include <netinet/in.h>  /* for htonl */
 # include <time.h>
@@ -641,7 +642,9 @@ extern void *alloca(int);
 #endif
 
 #include "shmem.h"	/* NewN(), etc. */
+#include "taskpool.h"
 #include "futil.h"
+#include "geomcache.h"
 
 #include "specks.h"
 
@@ -797,6 +800,8 @@ specks_init( int argc, char *argv[] )
   st->dyn.draw = NULL;
   st->dyn.trange = NULL;
   st->dyn.help = NULL;
+  st->dyn.pool = NULL;
+  st->dyn.async = 0;
   st->dyn.ctlcmd = NULL;
   st->dyn.free = NULL;
   st->speckseq = 0;
@@ -864,6 +869,7 @@ specks_init( int argc, char *argv[] )
   st->boxlinewidth = 0.75;
 
   st->depthsort = 0;
+  st->usecols = 1;
 
   st->clk = NewN(SClock, 1);
   clock_init(st->clk);
@@ -874,6 +880,7 @@ specks_init( int argc, char *argv[] )
   memset(st->datafile, 0, sizeof(st->datafile));
   memset(st->fname, 0, sizeof(st->fname));
   memset(st->meshes, 0, sizeof(st->meshes));
+  specks_lock_init( st );
 
 #if CAVE
   shmrecycler( specks_purge, st );
@@ -887,47 +894,307 @@ specks_init( int argc, char *argv[] )
   return st;
 }
 
-void specks_rethresh( struct stuff *st, struct specklist *sl, int by )
-{
+struct thixent {
+  float v;
   int i;
-  int curdata = st->curdata;
-  int nel = sl->nspecks;
-  float threshmin = st->thresh[0], threshmax = st->thresh[1];
-  struct speck *p = sl->specks;
+};
+
+static int thixcmp( const void *a, const void *b )
+{
+  float va = ((struct thixent *)a)->v, vb = ((struct thixent *)b)->v;
+  return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+void specks_free_threshindex( struct specklist *sl )
+{
+  if(sl->thix != NULL) {
+    if(sl->thix->order != NULL)
+	Free(sl->thix->order);
+    Free(sl->thix);
+    sl->thix = NULL;
+  }
+}
+
+static void specks_free_cix( struct specklist *sl )
+{
+  if(sl->cix != NULL) {
+    Free(sl->cix);
+    sl->cix = NULL;
+    sl->ncix = 0;
+  }
+}
+
+void specks_free_derived( struct specklist *sl )
+{
+  specks_free_threshindex( sl );
+  specks_free_cix( sl );
+  specks_free_cols( sl );
+  specks_free_labelgeom( sl );
+}
+
+static void thix_build( struct specklist *sl, struct threshindex *tx, int by )
+{
+  int i, n;
+  struct speck *p;
+  struct thixent *ents = NewN( struct thixent, sl->nspecks+1 );
+  float *col = specks_col_valid( sl, SPECKCOL_VAL(by) );
+
+  for(i = n = 0, p = sl->specks; i < sl->nspecks; i++, p = NextSpeck( p, sl, 1 )) {
+    float v = SPECKCOLVAL( col, 0, p, by, i );
+    if(v == v) {	/* NaNs are never thresholded out */
+	ents[n].v = v;
+	ents[n].i = i;
+	n++;
+    }
+  }
+  qsort( ents, n, sizeof(*ents), thixcmp );
+
+  tx->order = NewN( int, n+1 );
+  for(i = 0; i < n; i++)
+    tx->order[i] = ents[i].i;
+  tx->nsorted = n;
+  Free(ents);
+}
+
+/*
+ * First position in tx->order[] whose value is > v (if above)
+ * or >= v (if !above).
+ */
+static int thix_bound( struct specklist *sl, struct threshindex *tx, float v, int above )
+{
+  int lo = 0, hi = tx->nsorted;
+  float *col = specks_col_valid( sl, SPECKCOL_VAL(tx->by) );
+  while(lo < hi) {
+    int mid = (lo + hi) >> 1, i = tx->order[mid];
+    float mv = col ? col[i] : NextSpeck( sl->specks, sl, i )->val[tx->by];
+    if(above ? mv <= v : mv < v)
+	lo = mid+1;
+    else
+	hi = mid;
+  }
+  return lo;
+}
+
+/* Range order[*lop .. *hip-1] of specks which pass the given thresholds */
+static void thix_span( struct specklist *sl, struct threshindex *tx,
+		int usemin, float tmin, int usemax, float tmax, int *lop, int *hip )
+{
+  int lo = usemin ? thix_bound( sl, tx, tmin, 0 ) : 0;
+  int hi = usemax ? thix_bound( sl, tx, tmax, 1 ) : tx->nsorted;
+  *lop = lo;
+  *hip = hi < lo ? lo : hi;
+}
+
+static int thix_reselect( struct specklist *sl, struct threshindex *tx,
+		int from, int to, int lo, int hi, SelOp *dest )
+{
+  int k, changed = 0;
   SelMask *sel = sl->sel;
-  SelOp threshseldest;
-  int changed = 0;
+
+  for(k = from; k < to; k++) {
+    int i = tx->order[k];
+    SelMask was = sel[i];
+    if(k >= lo && k < hi) {
+	SELSET( sel[i], dest );
+    } else {
+	SELUNSET( sel[i], dest );
+    }
+    changed |= was ^ sel[i];
+  }
+  return changed;
+}
+
+/*
+ * specks_rethresh(), specks_recolor() and specks_resize() are each split
+ * into a "prep" step, which runs serially, works out per-specklist
+ * parameters and may touch shared state (st->vdesc[][], sl->thix, ...),
+ * and a per-speck loop over any range of specks [i0, i1) which touches
+ * only that range.  specks_reupdate() preps all stale passes for all
+ * specklists, then runs the loops -- fused, one visit per speck --
+ * in parallel.
+ *
+ * For the display, specks_current_frame() may run them in the background
+ * instead (see struct updasync).  Then the plan's sl is a private copy of
+ * the real list, osl, and the loops leave osl alone, writing new colors,
+ * sizes and sel[] bits into shadow arrays until the display swaps them in.
+ */
+enum RGBCode { RGBCMAP, RGB565, RGB888, RGBCONST };
+
+struct updplan {
+  struct specklist *sl;
+  struct specklist *osl;	/* if non-NULL, sl is &shadow, copied from it */
+  struct specklist shadow;
+
+  int dothresh;		/* rethresh prepped, needs thresh_finish() */
+  int tfull;		/* ... and a full pass over the specks */
+  int tby, tmin_on, tmax_on;
+  float tmin, tmax;
+  SelOp tdest;
+  int oldseq;
+  int changed;		/* did any sel[] bits change? */
+  float *tcol;		/* val[tby] column, if st->usecols */
+  int tfill;		/* ... which the loop should fill in */
+
+  int docolor;
+  int cby, cexact, ncmap, crgba;
+  enum RGBCode rgbcode;
+  float cmin, cnormal;
+  struct cment *cmap;
+  unsigned char (*rgbmap)[256];
+  unsigned short *cix;
+  float *ccol;
+  int cfill;
+  int *rgbout;		/* if shadowed, new rgba, less EXTRABITS */
+
+  int dosize;
+  int sby, sconst, labs, emph;
+  float lmin, lnormal, lbase, lconst, emphfactor;
+  SelOp emphsel;
+  float *scol;
+  int sfill;
+  float *sizeout;	/* if shadowed, new sizes */
+};
+
+/* Columns filled in by the per-speck loops are now complete. */
+static void updplan_cols_done( struct updplan *u )
+{
+  if(u->tfill) specks_col_done( u->sl, SPECKCOL_VAL(u->tby) );
+  if(u->cfill) specks_col_done( u->sl, SPECKCOL_VAL(u->cby) );
+  if(u->sfill) specks_col_done( u->sl, SPECKCOL_VAL(u->sby) );
+}
+
+static void thresh_prep( struct stuff *st, struct specklist *sl, int by, struct updplan *u )
+{
+  int nel = sl->nspecks;
+  struct threshindex *tx = sl->thix;
   int min, max;
 
+  u->oldseq = sl->threshseq;
   sl->threshseq = st->threshseq;
 
   if(sl->text != NULL)	/* specklists with labels shouldn't be thresholded */
     return;
 
-  if(curdata >= st->ndata)
-    curdata = 0;
-
   min = (SMALLSPECKSIZE(by)>=sl->bytesperspeck) ? 0 : st->usethresh&P_THRESHMIN;
   max = (SMALLSPECKSIZE(by)>=sl->bytesperspeck) ? 0 : st->usethresh&P_THRESHMAX;
- 
 
-  threshseldest = st->threshsel;
+  u->dothresh = 1;
+  if(u->osl != NULL)		/* thresholds go into a copy of sel[] */
+    sl->sel = NewN( SelMask, nel+1 );
+  u->tby = by;
+  u->tmin_on = min;
+  u->tmax_on = max;
+  u->tmin = st->thresh[0];
+  u->tmax = st->thresh[1];
+  u->tdest = st->threshsel;
+
+  if(tx != NULL && u->oldseq != 0 && tx->threshseq == u->oldseq
+	&& tx->selseq == sl->selseq && tx->nspecks == nel && tx->by == by
+	&& (min || max)
+	&& tx->dest.wanted == u->tdest.wanted
+	&& tx->dest.wanton == u->tdest.wanton) {
+
+    /* Same data, same variable, same selection bits as last time.
+     * Only specks lying between the old and new bounds can change.
+     */
+    int lo0, hi0, lo1, hi1;
+
+    if(u->osl != NULL)
+	memcpy( sl->sel, u->osl->sel, nel*sizeof(SelMask) );
+    if(tx->order == NULL)
+	thix_build( sl, tx, by );
+
+    thix_span( sl, tx, tx->usemin, tx->tmin, tx->usemax, tx->tmax, &lo0, &hi0 );
+    thix_span( sl, tx, min, u->tmin, max, u->tmax, &lo1, &hi1 );
+
+    u->changed |= thix_reselect( sl, tx, lo0<lo1 ? lo0 : lo1, lo0<lo1 ? lo1 : lo0,
+			lo1, hi1, &u->tdest );
+    u->changed |= thix_reselect( sl, tx, hi0<hi1 ? hi0 : hi1, hi0<hi1 ? hi1 : hi0,
+			lo1, hi1, &u->tdest );
+
+  } else {
+
+    u->tfull = 1;
+    if(st->usecols && (min || max) && u->osl == NULL)
+	u->tcol = specks_col_begin( sl, SPECKCOL_VAL(by), &u->tfill );
+
+    /* Data or variable may have changed, so any sorted index is stale */
+    if(tx != NULL && tx->order != NULL && (tx->by != by || u->oldseq == 0
+		|| tx->threshseq != u->oldseq || tx->nspecks != nel)) {
+	Free(tx->order);
+	tx->order = NULL;
+    }
+  }
+}
+
+static int thresh_range( struct updplan *u, int i0, int i1 )
+{
+  struct specklist *sl = u->sl;
+  SelMask *sel = sl->sel;
+  struct speck *p = NextSpeck( sl->specks, sl, i0 );
+  int i, by = u->tby, min = u->tmin_on, max = u->tmax_on;
+  float threshmin = u->tmin, threshmax = u->tmax;
+  int changed = 0;
 
-  for(i = 0, p = sl->specks; i < nel; i++, p = NextSpeck( p, sl, 1 )) {
+  for(i = i0; i < i1; i++, p = NextSpeck( p, sl, 1 )) {
     SelMask was = sel[i];
-    if((min&&p->val[by]<threshmin) || (max&&p->val[by]>threshmax)) {
+    float v = (min || max) ? SPECKCOLVAL( u->tcol, u->tfill, p, by, i ) : 0;
+    if((min&&v<threshmin) || (max&&v>threshmax)) {
 	/* p->rgba |= THRESHBIT; */
-	SELUNSET( sel[i], &threshseldest );
+	SELUNSET( sel[i], &u->tdest );
     } else {
 	/* p->rgba &= ~THRESHBIT; */
-	SELSET( sel[i], &threshseldest );
+	SELSET( sel[i], &u->tdest );
     }
     changed |= was ^ sel[i];
   }
-  if(changed) {
+  return changed;
+}
+
+static void thresh_finish( struct stuff *st, struct updplan *u )
+{
+  struct specklist *sl = u->sl;
+  struct threshindex *tx;
+
+  if(u->changed) {
     sl->selseq++;
     if(st->selseq < sl->selseq) st->selseq = sl->selseq;
   }
+
+  if(st->threshseq == 0) {
+    /* can't tell a fresh specklist from this state, so don't remember it */
+    specks_free_threshindex( sl );
+    return;
+  }
+
+  tx = sl->thix;
+  if(tx == NULL) {
+    tx = sl->thix = NewN( struct threshindex, 1 );
+    memset( tx, 0, sizeof(*tx) );
+  }
+  tx->by = u->tby;
+  tx->usemin = u->tmin_on;
+  tx->usemax = u->tmax_on;
+  tx->tmin = u->tmin;
+  tx->tmax = u->tmax;
+  tx->dest = u->tdest;
+  tx->nspecks = sl->nspecks;
+  tx->threshseq = sl->threshseq;
+  tx->selseq = sl->selseq;
+}
+
+void specks_rethresh( struct stuff *st, struct specklist *sl, int by )
+{
+  struct updplan u;
+
+  memset( &u, 0, sizeof(u) );
+  u.sl = sl;
+  thresh_prep( st, sl, by, &u );
+  if(u.tfull)
+    u.changed |= thresh_range( &u, 0, sl->nspecks );
+  if(u.dothresh)
+    thresh_finish( st, &u );
+  updplan_cols_done( &u );
 }
 
 int specks_cookcment( struct stuff *st, int cment )
@@ -970,28 +1237,82 @@ void specks_rgbremap( struct stuff *st )
     for (i = 0; i < st->nchromacm; i++)
 	st->chromacm[i].cooked = specks_cookcment(st, st->chromacm[i].raw);
   }
-  st->colorseq++;
+  st->cmapseq++;	/* palette-indexed specks needn't be recolored */
+}
+
+/* Colormap used for palette-indexed specks, given current coloredby */
+static struct cment *specks_palette_cmap( struct stuff *st, int *ncmapp )
+{
+  int curdata = st->curdata;
+  int by = st->coloredby;
+  struct valdesc *vd;
+
+  if(curdata < 0 || curdata >= st->ndata)
+    curdata = 0;
+  if(by >= MAXVAL || by < 0)
+    by = 0;
+  vd = &st->vdesc[curdata][by];
+  if(vd->vncmap > 0) {
+    if(ncmapp) *ncmapp = vd->vncmap;
+    return vd->vcmap;
+  }
+  if(ncmapp) *ncmapp = st->ncmap;
+  return st->cmap;
+}
+
+static int updasync_busy( struct stuff *st );
+
+/*
+ * Rebuild st->palette[] from the current colormap -- O(ncmap) work,
+ * regardless of how many specks refer to it through sl->cix[].
+ * Entries beyond the colormap's end repeat its last color,
+ * in case some not-yet-reindexed specklist refers to them.
+ */
+void specks_repalette( struct stuff *st )
+{
+  int i, ncmap;
+  struct cment *cmap;
+
+  if(st->palette != NULL && st->palcolorseq == st->colorseq
+			 && st->palcmapseq == st->cmapseq)
+    return;
+  if(st->palette != NULL && updasync_busy( st ))
+    return;		/* lists on display still have their old cix[] */
+
+  if(st->palette == NULL) {
+    st->palette = NewN( int, MAXPALETTE );
+    for(i = 0; i < MAXPALETTE; i++)
+	st->palette[i] = RGBWHITE;
+    st->npalette = 0;
+  }
+  cmap = specks_palette_cmap( st, &ncmap );
+  if(ncmap > MAXPALETTE) ncmap = MAXPALETTE;
+  for(i = 0; i < ncmap; i++)
+    st->palette[i] = cmap[i].cooked;
+  for( ; i < st->npalette; i++)
+    st->palette[i] = cmap[ncmap-1].cooked;
+  if(st->npalette < ncmap)
+    st->npalette = ncmap;
+
+  st->palcolorseq = st->colorseq;
+  st->palcmapseq = st->cmapseq;
 }
 
 
 Point e;
 
-void specks_recolor( struct stuff *st, struct specklist *sl, int by )
+static void color_prep( struct stuff *st, struct specklist *sl, int by, struct updplan *u )
 {
   struct valdesc *vd;
-  int i;
   int curdata = st->curdata;
   int nel = sl->nspecks;
-  struct speck *sp = sl->specks;
-  float cmin, cmax, normal;
+  float cmin, cmax;
   int ncmap = st->ncmap;
   struct cment *cmap = st->cmap;
-  int index;
-  enum RGBCode { NONE, RGB565, RGB888 } rgbcode;
-  unsigned char (*rgbmap)[256];
 
   sl->coloredby = by;
   sl->colorseq = st->colorseq;
+  sl->cmapseq = st->cmapseq;
 
   if(sl->text != NULL)	/* specklists with labels shouldn't be recolored */
     return;
@@ -999,10 +1320,14 @@ void specks_recolor( struct stuff *st, struct specklist *sl, int by )
   if(curdata >= st->ndata)
     curdata = 0;
 
+  u->docolor = 1;
+  if(u->osl != NULL)
+    u->rgbout = NewN( int, nel+1 );
+
   if(by == CONSTVAL) {
     /* Hack -- color by given RGB value */
     char crgba[4];
-    int r, g, b, rgba;
+    int r, g, b;
     vd = &st->vdesc[curdata][CONSTVAL];
     r = (vd->cmin<=0) ? 0 : vd->cmin>=1 ? 255 : (int)(255.99f * vd->cmin);
     g = (vd->cmax<=0) ? 0 : vd->cmax>=1 ? 255 : (int)(255.99f * vd->cmax);
@@ -1011,16 +1336,15 @@ void specks_recolor( struct stuff *st, struct specklist *sl, int by )
     crgba[1] = st->rgbmap[1][g];
     crgba[2] = st->rgbmap[2][b];
     crgba[3] = 0;
-    rgba = *(int *)&crgba[0];	/* XXX 64-bit bug? */
-    for(i = 0; i < nel; i++, sp = NextSpeck(sp, sl, 1)) {
-	sp->rgba = rgba | (sp->rgba & EXTRABITS);
-    }
-    return; 
+    u->crgba = *(int *)&crgba[0];	/* XXX 64-bit bug? */
+    u->rgbcode = RGBCONST;
+    specks_free_cix( sl );
+    return;
   }
 
   if(by >= MAXVAL || by < 0 || SMALLSPECKSIZE(by) > sl->bytesperspeck)
 	by = 0;
-	
+
   vd = &st->vdesc[curdata][by];
 
   if(vd->vncmap > 0) {
@@ -1035,10 +1359,52 @@ void specks_recolor( struct stuff *st, struct specklist *sl, int by )
     vd->cmax = cmax = vd->max;
   }
 
-  normal = (cmax != cmin && ncmap>2) ? (ncmap-2)/(cmax - cmin) : 0;
-  rgbcode = NONE;
-  if(0==strcmp(vd->name, "rgb565") || 0==strcmp(vd->name, "colors565")) rgbcode = RGB565;
-  else if(0==strcmp(vd->name, "rgb888") || 0==strcmp(vd->name, "colors888")) rgbcode = RGB888;
+  u->cby = by;
+  u->cmin = cmin;
+  u->cexact = vd->cexact;
+  u->cnormal = (cmax != cmin && ncmap>2) ? (ncmap-2)/(cmax - cmin) : 0;
+  u->ncmap = ncmap;
+  u->cmap = cmap;
+  u->rgbmap = &st->rgbmap[0];
+  u->rgbcode = RGBCMAP;
+  if(0==strcmp(vd->name, "rgb565") || 0==strcmp(vd->name, "colors565")) u->rgbcode = RGB565;
+  else if(0==strcmp(vd->name, "rgb888") || 0==strcmp(vd->name, "colors888")) u->rgbcode = RGB888;
+
+  /* If we're indexing into the same colormap that st->palette[] is built from,
+   * remember each speck's colormap index too.  Then later colormap edits
+   * just rebuild the palette, without visiting every speck.
+   */
+  if(u->rgbcode == RGBCMAP && ncmap <= MAXPALETTE
+		&& cmap == specks_palette_cmap( st, NULL )) {
+    if(sl->cix == NULL || sl->ncix < nel) {
+	specks_free_cix( sl );
+	sl->cix = NewN( unsigned short, nel+1 );
+	sl->ncix = nel;
+    }
+  } else {
+    specks_free_cix( sl );
+  }
+  u->cix = sl->cix;
+  if(st->usecols && u->osl == NULL)
+    u->ccol = specks_col_begin( sl, SPECKCOL_VAL(by), &u->cfill );
+}
+
+static void color_range( struct updplan *u, int i0, int i1 )
+{
+  struct specklist *sl = u->sl;
+  struct speck *sp = NextSpeck( sl->specks, sl, i0 );
+  int i, index, by = u->cby, ncmap = u->ncmap;
+  float cmin = u->cmin, normal = u->cnormal;
+  struct cment *cmap = u->cmap;
+  unsigned char (*rgbmap)[256] = u->rgbmap;
+  unsigned short *cix = u->cix;
+  float *col = u->ccol;
+  int fill = u->cfill;
+  int rgba;
+  /* where the results go:  sp->rgba, or u->rgbout[] */
+  char *out = u->rgbout ? (char *)&u->rgbout[i0] : (char *)&sp->rgba;
+  int stride = u->rgbout ? sizeof(int) : sl->bytesperspeck;
+  int keep = u->rgbout ? 0 : EXTRABITS;
 
   /* cexact field means:
    *   0 (default): scale data range to cmap index 1..ncmap-2;
@@ -1046,49 +1412,59 @@ void specks_recolor( struct stuff *st, struct specklist *sl, int by )
    *
    *   1 ("exact"): use data value as literal colormap index, 0..ncmap-1.
    */
-  rgbmap = &st->rgbmap[0];
-  for(i = 0; i < nel; i++, sp = NextSpeck(sp, sl, 1)) {
-    switch(rgbcode) {
+  for(i = i0; i < i1; i++, sp = NextSpeck(sp, sl, 1), out += stride) {
+    switch(u->rgbcode) {
+    case RGBCONST:
+	rgba = u->crgba;
+	break;
     case RGB565:
-	index = sp->val[by];
-	sp->rgba = PACKRGBA(
+	index = SPECKCOLVAL( col, fill, sp, by, i );
+	rgba = PACKRGBA(
 			rgbmap[0][(index&0xF800)>>(11-(8-5))],
 			rgbmap[1][(index&0x07E0)>>(5-(8-6))],
 			rgbmap[2][(index&0x1F)<<(8-5)],
-			0 )
-		  | (sp->rgba & EXTRABITS);
+			0 );
 	break;
     case RGB888:
-	index = sp->val[by];
-	sp->rgba = PACKRGBA(
+	index = SPECKCOLVAL( col, fill, sp, by, i );
+	rgba = PACKRGBA(
 			rgbmap[0][(index>>16)&0xFF],
 			rgbmap[1][(index>>8)&0xFF],
 			rgbmap[2][index&0xFF],
-			0 )
-		 | (sp->rgba & EXTRABITS);
+			0 );
     	break;
 
     default:
-	index = vd->cexact  ?   sp->val[by] + cmin
-			    :  (sp->val[by] - cmin) * normal + 1;
+	index = u->cexact  ?   SPECKCOLVAL( col, fill, sp, by, i ) + cmin
+			   :  (SPECKCOLVAL( col, fill, sp, by, i ) - cmin) * normal + 1;
 
 	if(index < 0) index = 0;
 	else if(index >= ncmap) index = ncmap-1;
 
-	sp->rgba = cmap[index].cooked | (sp->rgba & EXTRABITS);
+	rgba = cmap[index].cooked;
+	if(cix) cix[i] = index;
     }
+    *(int *)out = rgba | (sp->rgba & keep);
   }
 }
 
-void specks_resize( struct stuff *st, struct specklist *sl, int by )
+void specks_recolor( struct stuff *st, struct specklist *sl, int by )
+{
+  struct updplan u;
+
+  memset( &u, 0, sizeof(u) );
+  u.sl = sl;
+  color_prep( st, sl, by, &u );
+  if(u.docolor)
+    color_range( &u, 0, sl->nspecks );
+  updplan_cols_done( &u );
+}
+
+static void size_prep( struct stuff *st, struct specklist *sl, int by, struct updplan *u )
 {
-  int i;
-  int nel = sl->nspecks;
-  struct speck *sp = sl->specks;
   int curdata = st->curdata;
   struct valdesc *vd;
-  float lmin, lmax, normal, lbase;
-  int labs;
+  float lmin, lmax;
 
   sl->sizedby = by;
   sl->sizeseq = st->sizeseq;
@@ -1099,14 +1475,17 @@ void specks_resize( struct stuff *st, struct specklist *sl, int by )
   if(curdata < 0 || curdata >= st->ndata)
     curdata = 0;
 
+  u->dosize = 1;
+  if(u->osl != NULL)
+    u->sizeout = NewN( float, sl->nspecks+1 );
+  u->emphsel = st->emphsel;
+  u->emphfactor = st->emphfactor;
+
   if(by == CONSTVAL) {
     vd = &st->vdesc[curdata][CONSTVAL];
-    for(i = 0; i < nel; i++, sp = NextSpeck(sp, sl, 1)) {
-	sp->size = vd->lmin;
-	if(SELECTED(sl->sel[i], &st->emphsel)) {
-	    sp->size *= st->emphfactor;
-	}
-    }
+    u->sconst = 1;
+    u->lconst = vd->lmin;
+    u->emph = 1;
     return;
   }
 
@@ -1115,39 +1494,73 @@ void specks_resize( struct stuff *st, struct specklist *sl, int by )
 
   vd = &st->vdesc[curdata][by];
 
-  lbase = vd->lbase;
-  labs = (vd->lop == L_ABS);
+  u->sby = by;
+  u->lbase = vd->lbase;
+  u->labs = (vd->lop == L_ABS);
   lmin = vd->lmin, lmax = vd->lmax;
   if(lmin == lmax && lmin == 0 || vd->lall) {
 	vd->lmin = lmin = vd->min;
 	vd->lmax = lmax = vd->max;
   }
+  u->lmin = lmin;
 
   if(lmax == lmin)
-    normal = 1;
+    u->lnormal = 1;
   else
-    normal = 1 / (lmax - lmin);
+    u->lnormal = 1 / (lmax - lmin);
+
+  u->emph = (st->useemph && st->emphsel.use != SEL_NONE);
+  if(st->usecols && u->osl == NULL)
+    u->scol = specks_col_begin( sl, SPECKCOL_VAL(by), &u->sfill );
+}
 
+static void size_range( struct updplan *u, int i0, int i1 )
+{
+  struct specklist *sl = u->sl;
+  struct speck *sp = NextSpeck( sl->specks, sl, i0 );
+  int i, by = u->sby;
+  float lmin = u->lmin, normal = u->lnormal, lbase = u->lbase;
+  float *col = u->scol;
+  int fill = u->sfill;
+  /* where the results go:  sp->size, or u->sizeout[] */
+  char *out0 = u->sizeout ? (char *)&u->sizeout[i0] : (char *)&sp->size;
+  int stride = u->sizeout ? sizeof(float) : sl->bytesperspeck;
+  char *out = out0;
+
+  if(u->sconst) {
+    for(i = i0; i < i1; i++, out += stride)
+	*(float *)out = u->lconst;
+
+  } else if(u->labs) {
+    for(i = i0; i < i1; i++, sp = NextSpeck(sp, sl, 1), out += stride)
+	*(float *)out = fabsf(SPECKCOLVAL( col, fill, sp, by, i ) - lmin) * normal + lbase;
 
-  if(st->useemph && st->emphsel.use != SEL_NONE) {
-    for(i = 0; i < nel; i++, sp = NextSpeck(sp, sl, 1)) {
-	sp->size = (labs ? fabsf(sp->val[by] - lmin) : (sp->val[by] - lmin)) * normal + lbase;
-	if(SELECTED(sl->sel[i], &st->emphsel)) {
-	    sp->size *= st->emphfactor;
-	}
-    }
   } else {
     /* normal case */
-      if(labs) {
-	for(i = 0; i < nel; i++, sp = NextSpeck(sp, sl, 1))
-	    sp->size = fabsf(sp->val[by] - lmin) * normal + lbase;
-      } else {
-	for(i = 0; i < nel; i++, sp = NextSpeck(sp, sl, 1))
-	    sp->size = (sp->val[by] - lmin) * normal + lbase;
-      }
+    for(i = i0; i < i1; i++, sp = NextSpeck(sp, sl, 1), out += stride)
+	*(float *)out = (SPECKCOLVAL( col, fill, sp, by, i ) - lmin) * normal + lbase;
+  }
+
+  if(u->emph) {
+    for(i = i0, out = out0; i < i1; i++, out += stride) {
+	if(SELECTED(sl->sel[i], &u->emphsel))
+	    *(float *)out *= u->emphfactor;
+    }
   }
 }
 
+void specks_resize( struct stuff *st, struct specklist *sl, int by )
+{
+  struct updplan u;
+
+  memset( &u, 0, sizeof(u) );
+  u.sl = sl;
+  size_prep( st, sl, by, &u );
+  if(u.dosize)
+    size_range( &u, 0, sl->nspecks );
+  updplan_cols_done( &u );
+}
+
 void specks_datawait(struct stuff *st) {
 #if USE_IEEEIO
     while(st->fetching && st->fetchpid > 0
@@ -1210,6 +1623,265 @@ void specks_set_fspeed( struct stuff *st, double newspeed ) {
   /* or maybe use fspeed to specify finite clock resolution */
 }
 
+#ifdef HAVE_PTHREAD_H
+/*
+ * "dynasync on": evaluate st->dyn.getspecks() on a background thread,
+ * for the time we predict the display will want by the time it's done --
+ * from the clock's recent rate, the frame rate, and how long getspecks()
+ * takes.  Results come back through a one-slot mailbox,
+ * swapped with an atomic exchange, so the display never waits for them;
+ * it shows whatever's newest.  Only for providers which set dyn.async.
+ *
+ * The worker owns the provider's slpool: chains the display is done with
+ * go back by way of da->retired, and are released there.
+ */
+#define DYNAHEAD 8	/* predict at most this many frames ahead */
+
+struct dynresult {
+  struct specklist *sl;
+  double time;
+  int gen;
+};
+
+struct dynasync {
+  int on;
+  pthread_t th;
+  pthread_mutex_t mut;
+  pthread_cond_t wake, idle;
+  int busy;			/* worker is in getspecks() */
+
+	/* display -> worker, under mut */
+  double want, step;		/* time shown now, and recent time per frame */
+  double frametime;		/* recent wall-clock seconds per frame */
+  int gen;			/* bumped when provider says its data changed */
+  struct specklist **retired;
+  int nretired, retroom;
+
+	/* worker -> display, lock-free */
+  struct dynresult *volatile post;
+
+	/* worker's own */
+  struct dynresult res[2];
+  int nextres;
+  double evaltime;		/* wall-clock seconds per getspecks() */
+  double done[2];		/* last two times evaluated ... */
+  int ndone, donegen;		/* ... for generation donegen */
+
+	/* display's own */
+  struct specklist **toretire;	/* retirees not yet handed over */
+  int ntoretire, toroom;
+  double lastreal, lastwall;
+};
+
+static int dynasync_done( struct dynasync *da, double t )
+{
+  return da->gen == da->donegen
+	&& ((da->ndone > 0 && da->done[0] == t) || (da->ndone > 1 && da->done[1] == t));
+}
+
+static void dynasync_release( struct stuff *st, struct dynasync *da )
+{
+  int i;
+  for(i = 0; i < da->nretired; i++)
+    specks_pool_release( st->dyn.pool, da->retired[i] );
+  da->nretired = 0;
+}
+
+static void *dynasync_worker( void *vst )
+{
+  struct stuff *st = (struct stuff *)vst;
+  struct dynasync *da = st->dynasync;
+  struct dynresult *r;
+  double t, t0;
+  int gen, ahead;
+
+  pthread_mutex_lock( &da->mut );
+  for(;;) {
+    dynasync_release( st, da );
+    if(!da->on || da->post != NULL) {
+	/* wait till turned on, or till the display takes our last result */
+	pthread_cond_wait( &da->wake, &da->mut );
+	continue;
+    }
+    t = da->want;
+    if(da->step != 0) {
+	/* Clock's running: aim for where it'll be when we're done */
+	ahead = 1;
+	if(da->frametime > 0 && da->evaltime < DYNAHEAD * da->frametime)
+	    ahead += (int)(da->evaltime / da->frametime);
+	t += ahead * da->step;
+    }
+    if(dynasync_done( da, t )) {
+	pthread_cond_wait( &da->wake, &da->mut );
+	continue;
+    }
+    gen = da->gen;
+    da->busy = 1;
+    pthread_mutex_unlock( &da->mut );
+
+    r = &da->res[ da->nextres ];
+    da->nextres ^= 1;
+    t0 = wallclock_time();
+    r->sl = (*st->dyn.getspecks)( &st->dyn, st, t );
+    r->time = t;
+    r->gen = gen;
+    da->evaltime = wallclock_time() - t0;
+
+    pthread_mutex_lock( &da->mut );
+    da->busy = 0;
+    pthread_cond_signal( &da->idle );
+    if(da->donegen != gen)
+	da->ndone = 0;
+    da->donegen = gen;
+    da->done[ da->ndone & 1 ] = t;
+    da->ndone++;
+    if(r->sl != NULL)
+	__sync_bool_compare_and_swap( &da->post, NULL, r );
+  }
+  return NULL;
+}
+
+static void dynasync_retire( struct dynasync *da, struct specklist *sl )
+{
+  if(da->ntoretire >= da->toroom) {
+    da->toroom = 2*da->toroom + 4;
+    da->toretire = RenewN( da->toretire, struct specklist *, da->toroom );
+  }
+  da->toretire[ da->ntoretire++ ] = sl;
+}
+
+/* Per frame, from specks_set_timestep(): show the newest result, and say what we want next. */
+static void dynasync_frame( struct stuff *st, double realtime )
+{
+  struct dynasync *da = st->dynasync;
+  struct dynresult *r = __sync_lock_test_and_set( &da->post, NULL );
+  double now;
+
+  if(r != NULL) {
+    if(st->dyn.pool != NULL && st->sl != NULL && st->sl != r->sl)
+	dynasync_retire( da, st->sl );
+    r->sl->used = 1;
+    st->sl = r->sl;
+    st->currealtime = r->time;
+    st->curtime = r->time;
+    parti_set_timestep( st, r->time );
+  }
+
+  /* If the worker's in the middle of handing over, catch it next frame. */
+  if(pthread_mutex_trylock( &da->mut ) == 0) {
+    if(da->ntoretire > 0) {
+	if(da->nretired + da->ntoretire > da->retroom) {
+	    da->retroom = da->nretired + da->ntoretire + 4;
+	    da->retired = RenewN( da->retired, struct specklist *, da->retroom );
+	}
+	memcpy( &da->retired[da->nretired], da->toretire, da->ntoretire * sizeof(struct specklist *) );
+	da->nretired += da->ntoretire;
+	da->ntoretire = 0;
+    }
+    if(!st->dyn.slvalid) {
+	da->gen++;
+	st->dyn.slvalid = 1;
+    }
+    now = wallclock_time();
+    da->step = realtime - da->lastreal;
+    da->frametime = now - da->lastwall;
+    da->want = realtime;
+    da->lastreal = realtime;
+    da->lastwall = now;
+    pthread_cond_signal( &da->wake );
+    pthread_mutex_unlock( &da->mut );
+  }
+}
+
+/* Turn the worker off, waiting for it to finish, and take back anything it's holding. */
+static void dynasync_stop( struct stuff *st )
+{
+  struct dynasync *da = st->dynasync;
+  struct dynresult *r;
+
+  if(da == NULL || !da->on)
+    return;
+  pthread_mutex_lock( &da->mut );
+  da->on = 0;
+  while(da->busy)
+    pthread_cond_wait( &da->idle, &da->mut );
+  r = __sync_lock_test_and_set( &da->post, NULL );
+  if(r != NULL) {
+    if(st->sl != NULL && st->sl != r->sl)
+	specks_pool_release( st->dyn.pool, st->sl );
+    r->sl->used = 1;
+    st->sl = r->sl;
+  }
+  dynasync_release( st, da );
+  for( ; da->ntoretire > 0; da->ntoretire--)
+    specks_pool_release( st->dyn.pool, da->toretire[da->ntoretire-1] );
+  da->ndone = 0;
+  pthread_mutex_unlock( &da->mut );
+  st->dyn.slvalid = 0;		/* get the current time's data, synchronously */
+}
+
+/* Keep the worker out of the provider while we reconfigure it. */
+static int dynasync_hold( struct stuff *st )
+{
+  struct dynasync *da = st->dynasync;
+
+  if(da == NULL || !da->on)
+    return 0;
+  pthread_mutex_lock( &da->mut );
+  while(da->busy)
+    pthread_cond_wait( &da->idle, &da->mut );
+  return 1;
+}
+
+static void dynasync_unhold( struct stuff *st, int held )
+{
+  if(held)
+    pthread_mutex_unlock( &st->dynasync->mut );
+}
+
+static int dynasync_start( struct stuff *st )
+{
+  struct dynasync *da = st->dynasync;
+
+  if(da == NULL) {
+    da = NewN( struct dynasync, 1 );
+    memset( da, 0, sizeof(*da) );
+    pthread_mutex_init( &da->mut, NULL );
+    pthread_cond_init( &da->wake, NULL );
+    pthread_cond_init( &da->idle, NULL );
+    da->lastreal = st->currealtime;
+    da->lastwall = wallclock_time();
+    st->dynasync = da;
+    if(pthread_create( &da->th, NULL, dynasync_worker, st ) != 0) {
+	perror("dynasync: pthread_create");
+	st->dynasync = NULL;
+	Free( da );
+	return 0;
+    }
+  }
+  pthread_mutex_lock( &da->mut );
+  da->on = 1;
+  da->gen++;
+  pthread_cond_signal( &da->wake );
+  pthread_mutex_unlock( &da->mut );
+  return 1;
+}
+
+#endif /*HAVE_PTHREAD_H*/
+
+static int specks_dyn_ctlcmd( struct stuff *st, int argc, char **argv )
+{
+  int ok;
+#ifdef HAVE_PTHREAD_H
+  int held = dynasync_hold( st );
+#endif
+  ok = (*st->dyn.ctlcmd)( &st->dyn, st, argc, argv );
+#ifdef HAVE_PTHREAD_H
+  dynasync_unhold( st, held );
+#endif
+  return ok;
+}
+
 void specks_set_timestep( struct stuff *st )
 {
   struct specklist *sl = st->sl;
@@ -1218,6 +1890,10 @@ void specks_set_timestep( struct stuff *st )
   int timestep;
 
   st->used++;
+  specks_reclaim( st );		/* free anima[][] lists nobody can see now */
+
+  if(st->stream != NULL)
+    specks_stream_frame( st );
 
   tmin = st->clk->tmin;
   tmax = st->clk->tmax;
@@ -1236,11 +1912,22 @@ void specks_set_timestep( struct stuff *st )
   if(st->dyn.enabled > 0 && st->dyn.getspecks) {
     struct specklist *sl;
 
+#ifdef HAVE_PTHREAD_H
+    if(st->dynasync != NULL && st->dynasync->on) {
+	if(st->dyn.async) {
+	    dynasync_frame( st, realtime );
+	    return;
+	}
+	dynasync_stop( st );	/* provider changed under us */
+    }
+#endif
     if(realtime == st->currealtime && st->sl != NULL && st->dyn.slvalid && st->sl->used >= 0)
 	return;
     sl = (*st->dyn.getspecks)(&st->dyn, st, realtime);
     if(sl == NULL)
 	return;
+    if(st->dyn.pool != NULL && st->sl != NULL && st->sl != sl)
+	specks_pool_release( st->dyn.pool, st->sl );	/* done with previous frame */
     st->dyn.slvalid = 1;
     sl->used = 1;
     st->currealtime = realtime;
@@ -1721,44 +2408,520 @@ double specks_get_realtime( struct stuff *st )
   return st->currealtime;
 }
 
-void specks_reupdate( struct stuff *st, struct specklist *sl )
-{
-  struct specklist *tsl;
+/*
+ * Frame preparation for specks_reupdate() and specks_parallel(), on the
+ * shared task pool (taskpool.c) at TASK_FRAME priority.
+ * Stale passes are cut into jobs of at most UPDCHUNK specks.
+ * specks_reupdate() works too, and waits until every job is done,
+ * so nothing is drawn half-updated; for the display, big updates
+ * may be left to finish in the background (struct updasync).
+ */
+#define UPDCHUNK	16384	/* specks per job */
+#define UPDMINPAR	65536	/* don't bother with threads for less than this */
+#define MAXUPDTHREADS	32
+
+struct updasync;
+
+struct updjob {
+  struct updplan *u;
+  int i0, i1;
+  int changed;
+  void (*func)( void *arg, int jobno );	/* if non-NULL, just call func(arg, i0) */
+  void *arg;
+  struct updasync *ua;		/* background update we're part of, if any */
+};
 
-  if(sl != NULL && sl->threshseq != st->threshseq) {
-    for(tsl = sl; tsl != NULL; tsl = tsl->next)
-	specks_rethresh( st, tsl, st->threshvar );
-  }
+static void updjob_run( struct updjob *j )
+{
+  struct updplan *u = j->u;
 
-  if(sl != NULL && sl->colorseq != st->colorseq) {
-    for(tsl = sl; tsl != NULL; tsl = tsl->next)
-	specks_recolor( st, tsl, st->coloredby );
+  if(j->func != NULL) {
+    (*j->func)( j->arg, j->i0 );
+    return;
   }
-
-  if(sl != NULL && sl->sizeseq != st->sizeseq) {
-    for(tsl = sl; tsl != NULL; tsl = tsl->next)
-	specks_resize( st, tsl, st->sizedby );
+  if(u->tfull) {
+    if(u->osl != NULL)		/* shadow sel[] starts as the real one */
+	memcpy( &u->sl->sel[j->i0], &u->osl->sel[j->i0], (j->i1 - j->i0) * sizeof(SelMask) );
+    j->changed = thresh_range( u, j->i0, j->i1 );
   }
+  if(u->docolor)
+    color_range( u, j->i0, j->i1 );
+  if(u->dosize)
+    size_range( u, j->i0, j->i1 );
 }
 
-static int specks_nonempty_timestep( struct stuff *st, int timestep ) {
-  
-  if(specks_timespecks( st, st->curdata, timestep ) != NULL)
-    return 1;
-
-  if((st->datafile[st->curdata] != NULL &&
-		st->datafile[st->curdata][timestep] != NULL))
-    return 1;
-
-  if(timestep >= 0 && timestep < st->ntimes &&
-		st->meshes[st->curdata][timestep] != NULL)
-    return 1;
+#ifdef HAVE_PTHREAD_H
+static void updasync_jobdone( struct updasync *ua );
+#endif
 
-  if(timestep >= 0 && timestep < st->boxtimes &&
-		st->boxes[timestep] != NULL)
-    return 1;
+static void updjob_task( void *vj )
+{
+  struct updjob *j = (struct updjob *)vj;
 
-  return 0;
+  updjob_run( j );
+#ifdef HAVE_PTHREAD_H
+  if(j->ua != NULL)
+    updasync_jobdone( j->ua );
+#endif
+}
+
+static int updthreads = -1;	/* "updthreads" command; -1 => one per CPU */
+
+static int specks_updthreads( void )
+{
+  int n = updthreads;
+#if defined(HAVE_PTHREAD_H) && defined(_SC_NPROCESSORS_ONLN)
+  if(n < 0)
+    n = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+  return n < 1 ? 1 : n > MAXUPDTHREADS ? MAXUPDTHREADS : n;
+}
+
+static int updjobs_parallel( int njobs, int nitems )
+{
+  return nitems >= UPDMINPAR && njobs > 1 && specks_updthreads() > 1;
+}
+
+/* Run them all, in parallel if it's worth it. */
+static void updjobs_run( struct updjob *jobs, int njobs, int nitems )
+{
+  int k;
+
+  if(updjobs_parallel( njobs, nitems )) {
+    TaskGroup *g = taskgroup_new();
+    for(k = 0; k < njobs; k++)
+	task_submit( g, TASK_FRAME, updjob_task, &jobs[k] );
+    taskgroup_free( g );		/* helps, and waits for the rest */
+  } else {
+    for(k = 0; k < njobs; k++)
+	updjob_run( &jobs[k] );
+  }
+}
+
+/*
+ * Call func(arg, jobno) for jobno = 0 .. njobs-1, on the task pool
+ * unless there are fewer than UPDMINPAR items of work in all.
+ */
+void specks_parallel( void (*func)( void *, int ), void *arg, int njobs, int nitems )
+{
+  struct updjob *jobs;
+  int k;
+
+  if(!updjobs_parallel( njobs, nitems )) {
+    for(k = 0; k < njobs; k++)
+	(*func)( arg, k );
+    return;
+  }
+  jobs = NewN( struct updjob, njobs );
+  memset( jobs, 0, njobs * sizeof(*jobs) );
+  for(k = 0; k < njobs; k++) {
+    jobs[k].func = func;
+    jobs[k].arg = arg;
+    jobs[k].i0 = k;
+  }
+  updjobs_run( jobs, njobs, nitems );
+  Free(jobs);
+}
+
+/* Cut the plans' per-speck loops into jobs.  Returns how many. */
+static int updjobs_make( struct updplan *plans, int nplans, struct updjob **jobsp, int *totalp )
+{
+  int k, i0, njobs = 0, total = 0;
+  struct updjob *jobs;
+
+  for(k = 0; k < nplans; k++) {
+    struct updplan *u = &plans[k];
+    if(u->tfull || u->docolor || u->dosize) {
+	njobs += (u->sl->nspecks + UPDCHUNK-1) / UPDCHUNK;
+	total += u->sl->nspecks;
+    }
+  }
+  *jobsp = NULL;
+  *totalp = total;
+  if(njobs == 0)
+    return 0;
+
+  jobs = NewN( struct updjob, njobs );
+  memset( jobs, 0, njobs * sizeof(*jobs) );
+  njobs = 0;
+  for(k = 0; k < nplans; k++) {
+    struct updplan *u = &plans[k];
+    if(!(u->tfull || u->docolor || u->dosize))
+	continue;
+    for(i0 = 0; i0 < u->sl->nspecks; i0 += UPDCHUNK) {
+	jobs[njobs].u = u;
+	jobs[njobs].i0 = i0;
+	jobs[njobs].i1 = (i0+UPDCHUNK < u->sl->nspecks) ? i0+UPDCHUNK : u->sl->nspecks;
+	njobs++;
+    }
+  }
+  *jobsp = jobs;
+  return njobs;
+}
+
+static void updjobs_collect( struct updjob *jobs, int njobs )
+{
+  int k;
+  for(k = 0; k < njobs; k++)
+    jobs[k].u->changed |= jobs[k].changed;
+}
+
+/*
+ * Prep every stale pass for every list on sl's chain.  Returns the plans,
+ * or NULL if nothing's stale.  If shadow, the passes are to run off-thread:
+ * each plan preps a private copy of its list (see struct updplan).
+ */
+static struct updplan *updplans_prep( struct stuff *st, struct specklist *sl, int shadow, int *nplansp )
+{
+  struct specklist *tsl;
+  struct updplan *plans;
+  int k, nplans;
+  int dothresh, docolor, dosize;
+
+  dothresh = (sl != NULL && sl->threshseq != st->threshseq);
+  docolor = (sl != NULL && (sl->colorseq != st->colorseq || sl->cmapseq != st->cmapseq));
+  dosize = (sl != NULL && sl->sizeseq != st->sizeseq);
+
+  *nplansp = 0;
+  if(!(dothresh || docolor || dosize))
+    return NULL;
+
+  for(nplans = 0, tsl = sl; tsl != NULL; tsl = tsl->next)
+    nplans++;
+  plans = NewN( struct updplan, nplans );
+  memset( plans, 0, nplans * sizeof(*plans) );
+
+  for(k = 0, tsl = sl; tsl != NULL; k++, tsl = tsl->next) {
+    struct updplan *u = &plans[k];
+    if(shadow) {
+	u->osl = tsl;
+	u->shadow = *tsl;
+	u->shadow.cix = NULL;	/* color_prep() makes a new one if needed */
+	u->shadow.ncix = 0;
+	u->shadow.cols = NULL;
+	u->sl = &u->shadow;
+    } else {
+	u->sl = tsl;
+    }
+    if(dothresh)
+	thresh_prep( st, u->sl, st->threshvar, u );
+    if(docolor) {
+	if(tsl->colorseq != st->colorseq || tsl->cix == NULL)
+	    color_prep( st, u->sl, st->coloredby, u );
+	else
+	    u->sl->cmapseq = st->cmapseq;	/* palette indices still good */
+    }
+    if(dosize)
+	size_prep( st, u->sl, st->sizedby, u );
+  }
+  *nplansp = nplans;
+  return plans;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+/*
+ * One update of the displayed chain at a time may run in the background,
+ * for specks_current_frame().  Until it's done the display goes on drawing
+ * the lists as they were.  The last job pokes the display, which checks
+ * the lists weren't changed meanwhile and swaps the new colors, sizes and
+ * sel[] bits in; if they were, it drops the results and updates in place.
+ *
+ * Only lists from anima[][] qualify:  we stay pinned, so they can't be
+ * freed under us, and nothing else rewrites them wholesale.  Their specks
+ * are interleaved records, maybe shared with other lists, so they can't be
+ * swapped whole; swapping in is a parallel pass copying rgba and size back.
+ */
+struct updasync {
+  struct specklist *sl;		/* chain being updated, or NULL */
+  int threshseq, colorseq, cmapseq, sizeseq;	/* st's, when we started */
+  int pin;
+  struct updplan *plans;
+  int nplans;
+  struct updjob *jobs;
+  int njobs, total;
+  volatile int left;		/* jobs not yet finished */
+  TaskGroup *g;
+  int wake[2];			/* pipe; the last job writes a byte to it */
+};
+
+static void updasync_jobdone( struct updasync *ua )
+{
+  char c = 0;
+
+  if(__sync_sub_and_fetch( &ua->left, 1 ) == 0 && ua->wake[1] >= 0)
+    if(write( ua->wake[1], &c, 1 ) < 0 && errno != EAGAIN)
+	perror("updasync: write");
+}
+
+#if !CAVEMENU
+static void updasync_woke( int fd, void *arg )
+{
+  char buf[256];
+  while(read( fd, buf, sizeof(buf) ) > 0)
+    ;
+  parti_redraw();
+}
+#endif
+
+static int updasync_current( struct stuff *st, struct specklist *sl )
+{
+  struct updasync *ua = st->updasync;
+
+  return ua->sl == sl
+	&& ua->threshseq == st->threshseq && ua->colorseq == st->colorseq
+	&& ua->cmapseq == st->cmapseq && ua->sizeseq == st->sizeseq;
+}
+
+/* Is u->osl as it was when u was prepped? */
+static int updplan_unchanged( struct updplan *u )
+{
+  struct specklist *sl = u->osl, *sh = &u->shadow;
+
+  return sl->specks == sh->specks && sl->nspecks == sh->nspecks
+	&& sl->bytesperspeck == sh->bytesperspeck && sl->nsel == sh->nsel
+	&& sl->dataseq == sh->dataseq && sl->selseq == sh->selseq;
+}
+
+static void updjob_install( void *vua, int jobno )
+{
+  struct updjob *j = &((struct updasync *)vua)->jobs[jobno];
+  struct updplan *u = j->u;
+  struct specklist *sl = u->osl;
+  struct speck *sp = NextSpeck( sl->specks, sl, j->i0 );
+  int i;
+
+  if(u->rgbout != NULL) {
+    for(i = j->i0; i < j->i1; i++, sp = NextSpeck( sp, sl, 1 ))
+	sp->rgba = u->rgbout[i] | (sp->rgba & EXTRABITS);
+    sp = NextSpeck( sl->specks, sl, j->i0 );
+  }
+  if(u->sizeout != NULL) {
+    for(i = j->i0; i < j->i1; i++, sp = NextSpeck( sp, sl, 1 ))
+	sp->size = u->sizeout[i];
+  }
+}
+
+/* Hand over what's in the shadow to the real list, once specks are done. */
+static void updplan_install( struct stuff *st, struct updplan *u )
+{
+  struct specklist *sl = u->osl, *sh = u->sl;
+
+  if(u->dothresh) {
+    thresh_finish( st, u );
+    memcpy( sl->sel, sh->sel, sl->nspecks * sizeof(SelMask) );
+    Free( sh->sel );
+  }
+  sl->thix = sh->thix;
+  sl->threshseq = sh->threshseq;
+  sl->selseq = sh->selseq;
+
+  if(u->docolor) {
+    specks_free_cix( sl );
+    sl->cix = sh->cix;
+    sl->ncix = sh->ncix;
+  }
+  sl->coloredby = sh->coloredby;
+  sl->colorseq = sh->colorseq;
+  sl->cmapseq = sh->cmapseq;
+  sl->sizedby = sh->sizedby;
+  sl->sizeseq = sh->sizeseq;
+}
+
+static void updplan_drop( struct updplan *u )
+{
+  if(u->dothresh)
+    Free( u->sl->sel );
+  if(u->sl->cix != NULL)
+    Free( u->sl->cix );
+}
+
+/*
+ * Done with the background update:  wait for any jobs still running,
+ * then swap in the results if install and the lists are as they were,
+ * else drop them.  Returns 1 if installed.
+ */
+static int updasync_end( struct stuff *st, int install )
+{
+  struct updasync *ua = st->updasync;
+  int k, ok = install;
+
+  if(!install)
+    taskgroup_cancel( ua->g );
+  taskgroup_free( ua->g );
+  ua->g = NULL;
+
+  for(k = 0; k < ua->nplans && ok; k++)
+    ok = updplan_unchanged( &ua->plans[k] );
+
+  if(ok) {
+    updjobs_collect( ua->jobs, ua->njobs );
+    specks_parallel( updjob_install, ua, ua->njobs, ua->total );
+    for(k = 0; k < ua->nplans; k++)
+	updplan_install( st, &ua->plans[k] );
+  } else {
+    for(k = 0; k < ua->nplans; k++)
+	updplan_drop( &ua->plans[k] );
+  }
+  for(k = 0; k < ua->nplans; k++) {
+    if(ua->plans[k].rgbout) Free( ua->plans[k].rgbout );
+    if(ua->plans[k].sizeout) Free( ua->plans[k].sizeout );
+  }
+  specks_unpin( st, ua->pin );
+  Free( ua->plans );
+  if(ua->jobs) Free( ua->jobs );
+  ua->plans = NULL;
+  ua->jobs = NULL;
+  ua->sl = NULL;
+  return ok;
+}
+
+/* Start updating sl's chain in the background, if it qualifies and it's worth it. */
+static int updasync_start( struct stuff *st, struct specklist *sl )
+{
+  struct updasync *ua = st->updasync;
+  struct specklist *tsl;
+  int k, total = 0;
+
+  if(sl == NULL || st->dyn.enabled > 0 || st->stream != NULL
+		|| sl != specks_timespecks( st, st->curdata, st->curtime ))
+    return 0;
+  for(tsl = sl; tsl != NULL; tsl = tsl->next)
+    total += tsl->nspecks;
+  if(!updjobs_parallel( (total + UPDCHUNK-1) / UPDCHUNK, total ))
+    return 0;
+
+  if(ua == NULL) {
+    ua = st->updasync = NewN( struct updasync, 1 );
+    memset( ua, 0, sizeof(*ua) );
+    ua->wake[0] = ua->wake[1] = -1;
+#if !CAVEMENU
+    if(pipe( ua->wake ) < 0) {
+	perror("updasync: pipe");
+	ua->wake[0] = ua->wake[1] = -1;
+    } else {
+	fcntl( ua->wake[0], F_SETFL, fcntl( ua->wake[0], F_GETFL ) | O_NONBLOCK );
+	fcntl( ua->wake[1], F_SETFL, fcntl( ua->wake[1], F_GETFL ) | O_NONBLOCK );
+	parti_watchfd( ua->wake[0], updasync_woke, ua );
+    }
+#endif
+  }
+
+  ua->plans = updplans_prep( st, sl, 1, &ua->nplans );
+  if(ua->plans == NULL)
+    return 0;
+  ua->sl = sl;
+  ua->threshseq = st->threshseq;
+  ua->colorseq = st->colorseq;
+  ua->cmapseq = st->cmapseq;
+  ua->sizeseq = st->sizeseq;
+  ua->pin = specks_pin( st );
+  ua->njobs = updjobs_make( ua->plans, ua->nplans, &ua->jobs, &ua->total );
+  if(ua->njobs == 0) {
+    updasync_end( st, 1 );	/* nothing to wait for */
+    return 0;
+  }
+  ua->left = ua->njobs;
+  ua->g = taskgroup_new();
+  for(k = 0; k < ua->njobs; k++) {
+    ua->jobs[k].ua = ua;
+    task_submit( ua->g, TASK_FRAME, updjob_task, &ua->jobs[k] );
+  }
+  return 1;
+}
+
+static int updasync_busy( struct stuff *st )
+{
+  return st->updasync != NULL && st->updasync->sl != NULL;
+}
+
+/* Before updating in place:  finish the background update if it's for sl, else drop it. */
+static void updasync_finish( struct stuff *st, struct specklist *sl )
+{
+  if(updasync_busy( st ))
+    updasync_end( st, updasync_current( st, sl ) );
+}
+
+#else /* no threads, so nothing in the background */
+static int updasync_busy( struct stuff *st ) { return 0; }
+#endif /*HAVE_PTHREAD_H*/
+
+/*
+ * Bring sl's chain up to date with st's thresh, color and size settings.
+ * Returns once it's done.
+ */
+void specks_reupdate( struct stuff *st, struct specklist *sl )
+{
+  struct updplan *plans;
+  struct updjob *jobs;
+  int k, nplans, njobs, total;
+
+#ifdef HAVE_PTHREAD_H
+  updasync_finish( st, sl );
+#endif
+  plans = updplans_prep( st, sl, 0, &nplans );
+  if(plans != NULL) {
+    njobs = updjobs_make( plans, nplans, &jobs, &total );
+    if(njobs > 0) {
+	updjobs_run( jobs, njobs, total );
+	updjobs_collect( jobs, njobs );
+	Free(jobs);
+    }
+    for(k = 0; k < nplans; k++) {
+	if(plans[k].dothresh)
+	    thresh_finish( st, &plans[k] );
+	updplan_cols_done( &plans[k] );
+    }
+    Free(plans);
+  }
+
+  specks_repalette( st );
+}
+
+/*
+ * specks_reupdate() for the display, which would rather not wait:
+ * big updates of lists from anima[][] go on in the background,
+ * and the lists are drawn as they were till they're done.
+ */
+static void specks_reupdate_async( struct stuff *st, struct specklist *sl )
+{
+#ifdef HAVE_PTHREAD_H
+  struct updasync *ua = st->updasync;
+
+  if(ua != NULL && ua->sl != NULL) {
+    if(!updasync_current( st, sl )) {
+	updasync_end( st, 0 );
+    } else if(ua->left > 0) {
+	return;			/* still at it */
+    } else if(!updasync_end( st, 1 )) {
+	specks_reupdate( st, sl );	/* lists changed meanwhile; catch up now */
+	return;
+    }
+  }
+  if(updasync_start( st, sl ))
+    return;
+#endif
+  specks_reupdate( st, sl );
+}
+
+static int specks_nonempty_timestep( struct stuff *st, int timestep ) {
+  
+  if(specks_timespecks( st, st->curdata, timestep ) != NULL)
+    return 1;
+
+  if((st->datafile[st->curdata] != NULL &&
+		st->datafile[st->curdata][timestep] != NULL))
+    return 1;
+
+  if(timestep >= 0 && timestep < st->ntimes &&
+		st->meshes[st->curdata][timestep] != NULL)
+    return 1;
+
+  if(timestep >= 0 && timestep < st->boxtimes &&
+		st->boxes[timestep] != NULL)
+    return 1;
+
+  return 0;
 }
 
 
@@ -1787,7 +2950,7 @@ void specks_set_time( struct stuff *st, double newtime )
 
   IFCAVEMENU( partimenu_setpeak( st ) );
 
-  specks_reupdate( st, st->sl );
+  specks_reupdate_async( st, st->sl );
 
   IFCAVEMENU( partimenu_refresh( st ) );
 }
@@ -1803,7 +2966,14 @@ void specks_current_frame( struct stuff *st, struct specklist *sl )
   st->frame_time = st->curtime;
   st->frame_data = st->curdata;
   st->frame_annotation = st->annotation;
-  specks_reupdate( st, sl );
+  specks_reupdate_async( st, sl );
+}
+
+/* Bring the current frame fully up to date, as for a snapshot. */
+void specks_sync_frame( struct stuff *st )
+{
+  specks_set_timestep( st );
+  specks_reupdate( st, st->sl );
 }
 
 #define	MAXXYFAN 16
@@ -1811,13 +2981,17 @@ void specks_current_frame( struct stuff *st, struct specklist *sl )
 extern void specks_draw_boxes( struct stuff *st, struct AMRbox *boxes, int levelmask, Matrix Ttext, int oriented );
 
 extern void specks_draw_mesh( struct stuff *st, struct mesh *m, int *texturing );
+extern void mesh_prepare_elements( struct mesh *m );
 extern void specks_draw_ellipsoid( struct stuff *st, struct ellipsoid *e );
+static void ellipsoids_draw_arrays( struct stuff *st );
 
 struct cpoint {
     int rgba;
     Point p;
 };
 
+#define MAXPTSIZE 32	/* in half-point units */
+
 static int oldopengl = -1;
 
 static void init_opengl(void)
@@ -1831,6 +3005,134 @@ static void init_opengl(void)
     }
 }
 
+/*
+ * ElementSets: geometry laid out once in glInterleavedArrays() form,
+ * drawn with glDrawElements().  The first draw in each GL context compiles
+ * those calls into a display list there, so later frames just replay
+ * geometry the GL already has.
+ */
+static int elements_stride( GLenum eltype )
+{
+  switch(eltype) {
+  case GL_N3F_V3F:	return 6;
+  case GL_T2F_V3F:	return 5;
+  case GL_T2F_N3F_V3F:	return 8;
+  case GL_T4F_V4F:	return 8;
+  default:		return 3;	/* GL_V3F */
+  }
+}
+
+ElementSet *elements_create( GLenum eltype, int nverts, int nelem, int nindices )
+{
+  ElementSet *es = NewN( ElementSet, 1 );
+
+  memset( es, 0, sizeof(*es) );
+  es->eltype = eltype;
+  es->nverts = nverts;
+  es->elarrays = NewN( float, elements_stride(eltype) * nverts + 1 );
+  es->nelem = 0;		/* elements_add() fills them in */
+  es->elem = NewN( Elements, nelem + 1 );
+  memset( es->elem, 0, (nelem+1) * sizeof(Elements) );
+  es->nindices = nindices;
+  es->elindices = NewN( int, nindices + 1 );
+  return es;
+}
+
+void elements_setvert( ElementSet *es, int i, CONST Point *tx, CONST Point *norm, CONST Point *v )
+{
+  float *a = &es->elarrays[ i * elements_stride(es->eltype) ];
+
+  switch(es->eltype) {
+  case GL_T4F_V4F:
+    a[0] = tx->x[0]; a[1] = tx->x[1]; a[2] = tx->x[2]; a[3] = 1;
+    a[4] = v->x[0]; a[5] = v->x[1]; a[6] = v->x[2]; a[7] = 1;
+    return;
+  case GL_T2F_N3F_V3F:
+  case GL_T2F_V3F:
+    *a++ = tx->x[0];
+    *a++ = tx->x[1];
+    if(es->eltype == GL_T2F_V3F)
+	break;
+    /* fall into ... */
+  case GL_N3F_V3F:
+    *a++ = norm->x[0];
+    *a++ = norm->x[1];
+    *a++ = norm->x[2];
+    break;
+  default:
+    break;
+  }
+  a[0] = v->x[0];
+  a[1] = v->x[1];
+  a[2] = v->x[2];
+}
+
+static int ndeadlists[MAXDSPCTX], deadlistroom[MAXDSPCTX];
+static GLuint *deadlists[MAXDSPCTX];	/* display lists to delete next time we draw in each context */
+
+/* Draw es.  Returns 0 if we can't (no vertex arrays), so caller should do it the old way. */
+int elements_draw( ElementSet *es, int flags )
+{
+  int i, ctx;
+
+  if(oldopengl < 0) init_opengl();
+  if(oldopengl)
+    return 0;
+
+  ctx = get_dsp_context();
+  while(ndeadlists[ctx] > 0)
+    glDeleteLists( deadlists[ctx][--ndeadlists[ctx]], 1 );
+
+  if(es->dlist[ctx] != 0 && es->dlistflags[ctx] == flags) {
+    glCallList( es->dlist[ctx] );
+    return 1;
+  }
+
+  glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+  glInterleavedArrays( es->eltype, 0, es->elarrays );
+  if(flags & ELEM_NOTX)
+    glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+  if(flags & ELEM_NONORM)
+    glDisableClientState( GL_NORMAL_ARRAY );
+
+  if(es->dlist[ctx] == 0)
+    es->dlist[ctx] = glGenLists( 1 );
+  es->dlistflags[ctx] = flags;
+  if(es->dlist[ctx] != 0)
+    glNewList( es->dlist[ctx], GL_COMPILE_AND_EXECUTE );
+  for(i = 0; i < es->nelem; i++) {
+    Elements *el = &es->elem[i];
+    if(el->count > 0)
+	glDrawElements( el->prim, el->count, GL_UNSIGNED_INT, &es->elindices[el->base] );
+  }
+  if(es->dlist[ctx] != 0)
+    glEndList();
+  glPopClientAttrib();
+  return 1;
+}
+
+void elements_free( ElementSet *es )
+{
+  int ctx;
+
+  if(es == NULL)
+    return;
+  for(ctx = 0; ctx < MAXDSPCTX; ctx++) {
+    if(es->dlist[ctx] == 0)
+	continue;
+    /* each list belongs to its own context, which might not be current now */
+    if(ndeadlists[ctx] >= deadlistroom[ctx]) {
+	deadlistroom[ctx] = 2*deadlistroom[ctx] + 16;
+	deadlists[ctx] = RenewN( deadlists[ctx], GLuint, deadlistroom[ctx] );
+    }
+    deadlists[ctx][ndeadlists[ctx]++] = es->dlist[ctx];
+  }
+  Free( es->elarrays );
+  Free( es->elem );
+  Free( es->elindices );
+  Free( es );
+}
+
 #ifdef DEBUG
 static void glcheck(char *where) {
     int e;
@@ -1872,6 +3174,53 @@ void dumpcpointsarray( struct cpoint *cp, int n )
    glcheck("post-dumpcpointsarray");
 }
 
+/*
+ * Points sorted by size, so each size takes just one glPointSize()
+ * and one draw call.  We collect (size, point) pairs, count how many
+ * there are of each size, then scatter them into one array.
+ * Storage is kept from frame to frame.
+ */
+struct ptsort {
+  int n, room;
+  unsigned char *sz;	/* each point's size bucket */
+  struct cpoint *in;	/* points, in the order they came */
+  struct cpoint *out;	/* ... and grouped by size */
+  int count[MAXPTSIZE*2], start[MAXPTSIZE*2];
+};
+
+static struct ptsort sortedpts;
+
+static void ptsort_begin( struct ptsort *ps, int maxn )
+{
+  if(maxn > ps->room) {
+    ps->room = maxn + maxn/4 + 1024;
+    if(ps->sz) Free(ps->sz);
+    if(ps->in) Free(ps->in);
+    if(ps->out) Free(ps->out);
+    ps->sz = NewN( unsigned char, ps->room );
+    ps->in = NewN( struct cpoint, ps->room );
+    ps->out = NewN( struct cpoint, ps->room );
+  }
+  ps->n = 0;
+}
+
+static void ptsort_scatter( struct ptsort *ps )
+{
+  int i, k, off;
+
+  memset( ps->count, 0, sizeof(ps->count) );
+  for(i = 0; i < ps->n; i++)
+    ps->count[ ps->sz[i] ]++;
+  for(k = off = 0; k < MAXPTSIZE*2; k++) {
+    ps->start[k] = off;
+    off += ps->count[k];
+  }
+  for(i = 0; i < ps->n; i++)
+    ps->out[ ps->start[ ps->sz[i] ]++ ] = ps->in[i];
+  for(k = 0; k < MAXPTSIZE*2; k++)
+    ps->start[k] -= ps->count[k];
+}
+
 static Point depth_fwd;
 static float depth_d;
 
@@ -1879,6 +3228,7 @@ struct order {
   float z;
   struct speck *sp;
   struct specklist *sl;
+  int speckno;
 };
 
 static int depthcmp( const void *a, const void *b )
@@ -1970,6 +3320,7 @@ void sortedpolys( struct stuff *st, struct specklist *slhead, Matrix *Tc2wp, flo
 	op->z = dist;
 	op->sp = sp;
 	op->sl = sl;
+	op->speckno = ((char *)sp - (char *)sl->specks) / sl->bytesperspeck;
 	op++;
     }
   }
@@ -2012,7 +3363,7 @@ void sortedpolys( struct stuff *st, struct specklist *slhead, Matrix *Tc2wp, flo
     if(size > dist * polymaxrad)
 	size = dist * polymaxrad;
 
-    rgba = sp->rgba & RGBBITS;
+    rgba = SPECKRGB( st, op->sl, sp, op->speckno ) & RGBBITS;
     if(rgba != prevrgba) {
 	prevrgba = rgba;
 	rgba = RGBALPHA( prevrgba, alpha );
@@ -2077,15 +3428,711 @@ void sortedpolys( struct stuff *st, struct specklist *slhead, Matrix *Tc2wp, flo
 		    sp->p.x[2] + size*sfan[k].x[2] );
 	    }
 	}
-	glEnd();
+	glEnd();
+    }
+  }
+  free(obase);
+  if(texturing > 0)
+    txbind( NULL, NULL );
+}
+  
+  
+
+/*
+ * Velocity vectors, as GL_LINES vertex and color arrays.
+ * Shafts (and colors) are rebuilt only when the data, selection, colors
+ * or vector parameters change; arrowheads depend on the eye point,
+ * so they're recomputed each frame.  Both are done in parallel.
+ */
+#define VECCHUNK	16384	/* specks per job */
+
+struct vecsig {		/* what we built from, per specklist */
+  struct specklist *sl;
+  struct speck *specks;
+  int nspecks, speckseq, dataseq, selseq, colorseq, cmapseq;
+  int sizeseq, sizedby;
+};
+
+struct vecjob {
+  struct specklist *sl;
+  int i0, i1;		/* speck range */
+  int out, count;	/* vector range */
+};
+
+struct veccache {
+  int nsig, sigroom;
+  struct vecsig *sig;
+  int vecvar0, skip, doarrow, alphabits;
+  float vscl;
+  SelOp seesel;
+
+  int njobs, jobroom;
+  struct vecjob *jobs;
+
+  int n, room;		/* number of vectors, and room for */
+  int per;		/* vertices per vector: 2, or 6 with arrowheads */
+  Point *v;		/* n*per vertices */
+  int *rgba;		/* ... and their colors */
+  Point *vec;		/* with arrowheads, each vector's val[vecvar0..+2] */
+
+  struct stuff *st;	/* scratch for the job functions */
+  Point eye;
+  float varrow;
+};
+
+static int veccache_stale( struct stuff *st, struct veccache *vc, struct specklist *slhead,
+		int vecvar0, float vscl, int skip, int doarrow, int alphabits, SelOp *seesel )
+{
+  struct specklist *sl;
+  int k;
+
+  if(vc->vecvar0 != vecvar0 || vc->vscl != vscl || vc->skip != skip
+	|| vc->doarrow != doarrow || vc->alphabits != alphabits
+	|| memcmp( &vc->seesel, seesel, sizeof(*seesel) ))
+    return 1;
+  for(sl = slhead, k = 0; sl != NULL; sl = sl->next, k++) {
+    struct vecsig *sg;
+    if(k >= vc->nsig)
+	return 1;
+    sg = &vc->sig[k];
+    if(sg->sl != sl || sg->specks != sl->specks
+	|| sg->nspecks != sl->nspecks || sg->speckseq != sl->speckseq
+	|| sg->dataseq != sl->dataseq || sg->selseq != sl->selseq
+	|| sg->colorseq != sl->colorseq || sg->cmapseq != sl->cmapseq)
+	return 1;
+  }
+  return k != vc->nsig;
+}
+
+static void vecjob_count( void *arg, int jobno )
+{
+  struct veccache *vc = (struct veccache *)arg;
+  struct vecjob *j = &vc->jobs[jobno];
+  struct specklist *sl = j->sl;
+  int i, count = 0;
+
+  for(i = (j->i0 + vc->skip-1) / vc->skip * vc->skip; i < j->i1; i += vc->skip)
+    if(SELECTED(sl->sel[i], &vc->seesel))
+	count++;
+  j->count = count;
+}
+
+static void vecjob_fill( void *arg, int jobno )
+{
+  struct veccache *vc = (struct veccache *)arg;
+  struct vecjob *j = &vc->jobs[jobno];
+  struct specklist *sl = j->sl;
+  struct stuff *st = vc->st;
+  int i, k, per = vc->per;
+  int o = j->out;
+  struct speck *p;
+
+  i = (j->i0 + vc->skip-1) / vc->skip * vc->skip;
+  for(p = NextSpeck( sl->specks, sl, i ); i < j->i1; i += vc->skip, p = NextSpeck( p, sl, vc->skip )) {
+    Point *vec = (Point *)&p->val[vc->vecvar0];
+    Point *v = &vc->v[o*per];
+    int rgba;
+
+    if(!SELECTED(sl->sel[i], &vc->seesel))
+	continue;
+
+    rgba = (SPECKRGB(st, sl, p, i) & RGBWHITE) | vc->alphabits;
+    v[0] = p->p;
+    vsadd( &v[1], &p->p, vc->vscl, vec );
+    if(per > 2) {
+	v[2] = v[3] = v[4] = v[5] = v[1];	/* barbs filled in by vecjob_arrows() */
+	vc->vec[o] = *vec;
+    }
+    for(k = 0; k < per; k++)
+	vc->rgba[o*per + k] = rgba;
+    o++;
+  }
+}
+
+static void vecjob_arrows( void *arg, int jobno )
+{
+  struct veccache *vc = (struct veccache *)arg;
+  struct vecjob *j = &vc->jobs[jobno];
+  int o;
+
+  for(o = j->out; o < j->out + j->count; o++) {
+    Point *v = &vc->v[o*6];
+    Point *vec = &vc->vec[o];
+    Point *head = &v[1];
+    Point heye, uvec, vvec;
+    float larrow = vc->varrow * vlength( vec );
+
+    vsub( &heye, head, &vc->eye );
+    vcross( &vvec, &heye, vec );
+    vunit( &vvec, &vvec );
+    vcross( &uvec, &heye, &vvec );
+    vunit( &uvec, &uvec );
+
+    vsadd( &v[2], head, larrow, &uvec );
+    vsadd( &v[2], &v[2], -0.6f*larrow, &vvec );
+
+    vsadd( &v[4], head,  larrow, &uvec );
+    vsadd( &v[4], &v[4], 0.6f*larrow, &vvec );
+  }
+}
+
+static void veccache_build( struct stuff *st, struct veccache *vc, struct specklist *slhead,
+		int vecvar0, float vscl, int skip, int doarrow, int alphabits, SelOp *seesel )
+{
+  struct specklist *sl;
+  int k, i0, nsl, total;
+
+  vc->vecvar0 = vecvar0;
+  vc->vscl = vscl;
+  vc->skip = skip;
+  vc->doarrow = doarrow;
+  vc->alphabits = alphabits;
+  vc->seesel = *seesel;
+  vc->per = doarrow ? 6 : 2;
+  vc->st = st;
+
+  for(sl = slhead, nsl = 0; sl != NULL; sl = sl->next)
+    nsl++;
+  if(nsl > vc->sigroom) {
+    vc->sigroom = nsl + 16;
+    vc->sig = RenewN( vc->sig, struct vecsig, vc->sigroom );
+  }
+  vc->njobs = 0;
+  total = 0;
+  for(sl = slhead, k = 0; sl != NULL; sl = sl->next, k++) {
+    struct vecsig *sg = &vc->sig[k];
+    sg->sl = sl;
+    sg->specks = sl->specks;
+    sg->nspecks = sl->nspecks;
+    sg->speckseq = sl->speckseq;
+    sg->dataseq = sl->dataseq;
+    sg->selseq = sl->selseq;
+    sg->colorseq = sl->colorseq;
+    sg->cmapseq = sl->cmapseq;
+    sg->sizeseq = sl->sizeseq;
+    sg->sizedby = sl->sizedby;
+
+    if(sl->bytesperspeck < SMALLSPECKSIZE(vecvar0+3) || sl->specks == NULL
+		|| sl->sel == NULL || sl->nsel < sl->nspecks)
+	continue;
+    for(i0 = 0; i0 < sl->nspecks; i0 += VECCHUNK) {
+	struct vecjob *j;
+	if(vc->njobs >= vc->jobroom) {
+	    vc->jobroom = 2*vc->jobroom + 64;
+	    vc->jobs = RenewN( vc->jobs, struct vecjob, vc->jobroom );
+	}
+	j = &vc->jobs[vc->njobs++];
+	j->sl = sl;
+	j->i0 = i0;
+	j->i1 = (i0 + VECCHUNK < sl->nspecks) ? i0 + VECCHUNK : sl->nspecks;
+    }
+    total += sl->nspecks;
+  }
+  vc->nsig = nsl;
+
+  specks_parallel( vecjob_count, vc, vc->njobs, total );
+
+  for(k = 0, vc->n = 0; k < vc->njobs; k++) {
+    vc->jobs[k].out = vc->n;
+    vc->n += vc->jobs[k].count;
+  }
+  if(vc->n > vc->room) {
+    vc->room = vc->n + vc->n/4 + 64;
+    if(vc->v) Free(vc->v);
+    if(vc->rgba) Free(vc->rgba);
+    if(vc->vec) Free(vc->vec);
+    vc->v = NewN( Point, 6*vc->room );
+    vc->rgba = NewN( int, 6*vc->room );
+    vc->vec = NewN( Point, vc->room );
+  }
+
+  specks_parallel( vecjob_fill, vc, vc->njobs, total );
+}
+
+static void vectors_draw_arrays( struct stuff *st, struct specklist *slhead,
+		int skip, SelOp *seesel, Point *eyepoint )
+{
+  struct veccache *vc = st->veccache;
+  float vscl = st->vecscale;
+  float varrow = st->vecarrowscale * vscl;
+  int doarrow = (st->usevec == VEC_ARROW && varrow != 0);
+  int ialpha = (st->vecalpha>1 ? 0xFF : st->vecalpha<0 ? 0 : (int)(255*st->vecalpha));
+  int alphabits = RGBALPHA(0, ialpha);
+
+  if(vc == NULL) {
+    vc = st->veccache = NewN( struct veccache, 1 );
+    memset( vc, 0, sizeof(*vc) );
+    vc->nsig = -1;
+  }
+  if(veccache_stale( st, vc, slhead, st->vecvar0, vscl, skip, doarrow, alphabits, seesel ))
+    veccache_build( st, vc, slhead, st->vecvar0, vscl, skip, doarrow, alphabits, seesel );
+
+  if(vc->n == 0)
+    return;
+
+  if(doarrow) {
+    vc->eye = *eyepoint;
+    vc->varrow = varrow;
+    specks_parallel( vecjob_arrows, vc, vc->njobs, vc->n );
+  }
+
+  glEnableClientState( GL_VERTEX_ARRAY );
+  glEnableClientState( GL_COLOR_ARRAY );
+  glVertexPointer( 3, GL_FLOAT, sizeof(Point), vc->v );
+  glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof(int), vc->rgba );
+  glDrawArrays( GL_LINES, 0, vc->n * vc->per );
+  glDisableClientState( GL_COLOR_ARRAY );
+  glDisableClientState( GL_VERTEX_ARRAY );
+}
+
+/*
+ * View-independent point preparation.  Selection, clipping, subsampling
+ * and color don't depend on where we look from, so we gather the specks
+ * that survive them (with their colors) once, and reuse that list for
+ * every eye and subcam until the data or the settings change.
+ * Each view then only computes distances, brightness and point sizes.
+ */
+struct prepspeck {
+  Point p;
+  float size;
+  int rgb;		/* SPECKRGB() & RGBBITS */
+  int i;		/* speck index, for picking faint points */
+};
+
+struct speckprep {
+  int nsig, sigroom;
+  struct vecsig *sig;	/* same per-specklist signature as the vector cache */
+  int skip, useclip;
+  Point clipp0, clipp1;
+  SelOp seesel;
+  int *palette;
+
+  int njobs, jobroom;
+  struct vecjob *jobs;
+
+  int n, room;
+  struct prepspeck *ps;
+
+  float gamma;		/* for which we built invgamma[] */
+  unsigned char invgamma[256];
+
+  struct stuff *st;	/* scratch for the job functions */
+};
+
+static int speckprep_keep( struct speckprep *pp, struct specklist *sl, int i )
+{
+  struct speck *p = NextSpeck( sl->specks, sl, i );
+
+  if(!SELECTED(sl->sel[i], &pp->seesel))
+    return 0;
+  if(pp->useclip &&
+	  (p->p.x[0] < pp->clipp0.x[0] ||
+	   p->p.x[0] > pp->clipp1.x[0] ||
+	   p->p.x[1] < pp->clipp0.x[1] ||
+	   p->p.x[1] > pp->clipp1.x[1] ||
+	   p->p.x[2] < pp->clipp0.x[2] ||
+	   p->p.x[2] > pp->clipp1.x[2]))
+    return 0;
+  return 1;
+}
+
+static void prepjob_count( void *arg, int jobno )
+{
+  struct speckprep *pp = (struct speckprep *)arg;
+  struct vecjob *j = &pp->jobs[jobno];
+  int i, count = 0;
+
+  for(i = (j->i0 + pp->skip-1) / pp->skip * pp->skip; i < j->i1; i += pp->skip)
+    if(speckprep_keep( pp, j->sl, i ))
+	count++;
+  j->count = count;
+}
+
+static void prepjob_fill( void *arg, int jobno )
+{
+  struct speckprep *pp = (struct speckprep *)arg;
+  struct vecjob *j = &pp->jobs[jobno];
+  struct specklist *sl = j->sl;
+  struct prepspeck *q = &pp->ps[j->out];
+  int i;
+
+  for(i = (j->i0 + pp->skip-1) / pp->skip * pp->skip; i < j->i1; i += pp->skip) {
+    struct speck *p;
+    if(!speckprep_keep( pp, sl, i ))
+	continue;
+    p = NextSpeck( sl->specks, sl, i );
+    q->p = p->p;
+    q->size = p->size;
+    q->rgb = SPECKRGB(pp->st, sl, p, i) & RGBBITS;
+    q->i = i;
+    q++;
+  }
+}
+
+static int speckprep_stale( struct stuff *st, struct speckprep *pp,
+			struct specklist *slhead, int skip )
+{
+  struct specklist *sl;
+  int k;
+
+  if(pp->skip != skip || pp->palette != st->palette
+	|| pp->useclip != (st->clipbox.level != 0)
+	|| memcmp( &pp->seesel, &st->seesel, sizeof(SelOp) ))
+    return 1;
+  if(pp->useclip && (memcmp( &pp->clipp0, &st->clipbox.p0, sizeof(Point) )
+		  || memcmp( &pp->clipp1, &st->clipbox.p1, sizeof(Point) )))
+    return 1;
+  for(sl = slhead, k = 0; sl != NULL; sl = sl->next, k++) {
+    struct vecsig *sg;
+    if(k >= pp->nsig)
+	return 1;
+    sg = &pp->sig[k];
+    if(sg->sl != sl || sg->specks != sl->specks
+	|| sg->nspecks != sl->nspecks || sg->speckseq != sl->speckseq
+	|| sg->dataseq != sl->dataseq || sg->selseq != sl->selseq
+	|| sg->colorseq != sl->colorseq || sg->cmapseq != sl->cmapseq
+	|| sg->sizeseq != sl->sizeseq || sg->sizedby != sl->sizedby)
+	return 1;
+  }
+  return k != pp->nsig;
+}
+
+static void speckprep_build( struct stuff *st, struct speckprep *pp,
+			struct specklist *slhead, int skip )
+{
+  struct specklist *sl;
+  int k, i0, nsl, total;
+
+  pp->skip = skip;
+  pp->palette = st->palette;
+  pp->useclip = (st->clipbox.level != 0);
+  pp->clipp0 = st->clipbox.p0;
+  pp->clipp1 = st->clipbox.p1;
+  pp->seesel = st->seesel;
+  pp->st = st;
+
+  for(sl = slhead, nsl = 0; sl != NULL; sl = sl->next)
+    nsl++;
+  if(nsl > pp->sigroom) {
+    pp->sigroom = nsl + 16;
+    pp->sig = RenewN( pp->sig, struct vecsig, pp->sigroom );
+  }
+  pp->njobs = 0;
+  total = 0;
+  for(sl = slhead, k = 0; sl != NULL; sl = sl->next, k++) {
+    struct vecsig *sg = &pp->sig[k];
+    sg->sl = sl;
+    sg->specks = sl->specks;
+    sg->nspecks = sl->nspecks;
+    sg->speckseq = sl->speckseq;
+    sg->dataseq = sl->dataseq;
+    sg->selseq = sl->selseq;
+    sg->colorseq = sl->colorseq;
+    sg->cmapseq = sl->cmapseq;
+    sg->sizeseq = sl->sizeseq;
+    sg->sizedby = sl->sizedby;
+
+    if(sl->text != NULL || sl->special != SPECKS || sl->specks == NULL
+		|| sl->sel == NULL || sl->nsel < sl->nspecks)
+	continue;
+    for(i0 = 0; i0 < sl->nspecks; i0 += VECCHUNK) {
+	struct vecjob *j;
+	if(pp->njobs >= pp->jobroom) {
+	    pp->jobroom = 2*pp->jobroom + 64;
+	    pp->jobs = RenewN( pp->jobs, struct vecjob, pp->jobroom );
+	}
+	j = &pp->jobs[pp->njobs++];
+	j->sl = sl;
+	j->i0 = i0;
+	j->i1 = (i0 + VECCHUNK < sl->nspecks) ? i0 + VECCHUNK : sl->nspecks;
+    }
+    total += sl->nspecks;
+  }
+  pp->nsig = nsl;
+
+  specks_parallel( prepjob_count, pp, pp->njobs, total );
+
+  for(k = 0, pp->n = 0; k < pp->njobs; k++) {
+    pp->jobs[k].out = pp->n;
+    pp->n += pp->jobs[k].count;
+  }
+  if(pp->n > pp->room) {
+    pp->room = pp->n + pp->n/4 + 64;
+    if(pp->ps) Free(pp->ps);
+    pp->ps = NewN( struct prepspeck, pp->room );
+  }
+
+  specks_parallel( prepjob_fill, pp, pp->njobs, total );
+}
+
+/* Bring st->speckprep up to date for this frame's specks; cheap if nothing changed. */
+static struct speckprep *speckprep_get( struct stuff *st, struct specklist *slhead, int skip )
+{
+  struct speckprep *pp = st->speckprep;
+  int i;
+
+  if(pp == NULL) {
+    pp = st->speckprep = NewN( struct speckprep, 1 );
+    memset( pp, 0, sizeof(*pp) );
+    pp->nsig = -1;
+    pp->gamma = -1;
+  }
+  if(speckprep_stale( st, pp, slhead, skip ))
+    speckprep_build( st, pp, slhead, skip );
+
+  if(pp->gamma != st->gamma) {
+    float invgam = (st->gamma <= 0) ? 0 : 1/st->gamma;
+    pp->gamma = st->gamma;
+    for(i = 0; i < 256; i++)
+	pp->invgamma[i] = (int) (255.99 * pow( i/255., invgam ));
+  }
+  return pp;
+}
+
+/*
+ * Batched label drawing.  Each label list keeps its labels' strokes
+ * (struct labelgeom), laid out once; each frame we cull by k-d tree node,
+ * then just transform the surviving strokes into one big GL_LINES array.
+ */
+#define LABELLEAF 32	/* labels per k-d tree leaf */
+
+static struct specklist *lblsl;	/* for lblcmp() */
+static int lblaxis;
+
+static int lblcmp( const void *a, const void *b )
+{
+  float va = NextSpeck( lblsl->specks, lblsl, *(int *)a )->p.x[lblaxis];
+  float vb = NextSpeck( lblsl->specks, lblsl, *(int *)b )->p.x[lblaxis];
+  return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+static void labeltree_build( struct specklist *sl, struct labelgeom *lg,
+			int nodeno, int first, int n )
+{
+  struct labelnode *nd = &lg->node[nodeno];
+  int i, k;
+
+  for(i = first; i < first+n; i++) {
+    struct speck *p = NextSpeck( sl->specks, sl, lg->order[i] );
+    if(i == first) {
+	nd->lo = nd->hi = p->p;
+	nd->maxsize = p->size;
+    }
+    for(k = 0; k < 3; k++) {
+	if(nd->lo.x[k] > p->p.x[k]) nd->lo.x[k] = p->p.x[k];
+	if(nd->hi.x[k] < p->p.x[k]) nd->hi.x[k] = p->p.x[k];
+    }
+    if(nd->maxsize < p->size) nd->maxsize = p->size;
+  }
+  nd->first = first;
+  nd->n = n;
+  nd->kid = 0;
+  if(n <= LABELLEAF)
+    return;
+
+  /* Split at the median along the longest axis */
+  lblaxis = 0;
+  for(k = 1; k < 3; k++)
+    if(nd->hi.x[k] - nd->lo.x[k] > nd->hi.x[lblaxis] - nd->lo.x[lblaxis])
+	lblaxis = k;
+  lblsl = sl;
+  qsort( &lg->order[first], n, sizeof(int), lblcmp );
+
+  nd->kid = lg->nnodes;
+  lg->nnodes += 2;
+  labeltree_build( sl, lg, nd->kid, first, n/2 );
+  labeltree_build( sl, lg, nd->kid+1, first + n/2, n - n/2 );
+}
+
+static struct labelgeom *label_geom( struct specklist *sl )
+{
+  struct labelgeom *lg = sl->lgeom;
+  int i, nv;
+
+  if(lg != NULL && lg->nlabels != sl->nspecks)
+    specks_free_labelgeom( sl );
+
+  if((lg = sl->lgeom) == NULL) {
+    lg = sl->lgeom = NewN( struct labelgeom, 1 );
+    memset( lg, 0, sizeof(*lg) );
+    lg->nlabels = sl->nspecks;
+    lg->first = NewN( int, sl->nspecks+1 );
+    lg->nverts = NewN( int, sl->nspecks+1 );
+    lg->width = NewN( float, sl->nspecks+1 );
+    for(i = nv = 0; i < sl->nspecks; i++) {
+	lg->first[i] = nv;
+	lg->nverts[i] = sfStrStrokeCount( SPECKTEXT(sl, i) );
+	lg->width[i] = sfStrWidth( SPECKTEXT(sl, i) );
+	nv += lg->nverts[i];
+    }
+    lg->xy = NewN( float, 2*nv+1 );
+    for(i = 0; i < sl->nspecks; i++)
+	sfStrStrokes( SPECKTEXT(sl, i), &lg->xy[ 2*lg->first[i] ] );
+    lg->order = NewN( int, sl->nspecks+1 );
+    lg->node = NewN( struct labelnode, 2*(sl->nspecks/(LABELLEAF/2) + 1) + 1 );
+  }
+
+  if(lg->nnodes == 0 && sl->nspecks > 0) {
+    for(i = 0; i < sl->nspecks; i++)
+	lg->order[i] = i;
+    lg->nnodes = 1;
+    labeltree_build( sl, lg, 0, 0, sl->nspecks );
+  }
+  return lg;
+}
+
+void specks_free_labelgeom( struct specklist *sl )
+{
+  struct labelgeom *lg = sl->lgeom;
+  if(lg == NULL)
+    return;
+  Free(lg->first);
+  Free(lg->nverts);
+  Free(lg->width);
+  Free(lg->xy);
+  Free(lg->order);
+  Free(lg->node);
+  Free(lg);
+  sl->lgeom = NULL;
+}
+
+struct lblbatch {
+  int n, room;
+  Point *v;
+  int *rgba;
+};
+
+static void lblbatch_room( struct lblbatch *b, int more )
+{
+  if(b->n + more > b->room) {
+    b->room = 2*(b->n + more) + 1024;
+    b->v = RenewN( b->v, Point, b->room );
+    b->rgba = RenewN( b->rgba, int, b->room );
+  }
+}
+
+static void lblbatch_seg( struct lblbatch *b, CONST Point *p0, CONST Point *p1, int rgba )
+{
+  lblbatch_room( b, 2 );
+  b->v[b->n] = *p0;
+  b->rgba[b->n++] = rgba;
+  b->v[b->n] = *p1;
+  b->rgba[b->n++] = rgba;
+}
+
+struct lblview {
+  struct stuff *st;
+  Point fwd;
+  float fwdd;
+  float minscale;	/* radperpix * textmin: a label smaller than minscale*dist isn't drawn */
+  int stubs;
+  Point xdir, ydir;	/* screen-space unit X and Y, in world coords */
+  struct lblbatch b;
+};
+
+static void labels_batch_node( struct lblview *lv, struct specklist *sl,
+				struct labelgeom *lg, struct labelnode *nd )
+{
+  struct stuff *st = lv->st;
+  float dmin = lv->fwdd, dmax = lv->fwdd;
+  int i, k;
+
+  for(k = 0; k < 3; k++) {
+    float a = lv->fwd.x[k] * nd->lo.x[k], b = lv->fwd.x[k] * nd->hi.x[k];
+    dmin += (a < b ? a : b);
+    dmax += (a < b ? b : a);
+  }
+  if(dmax <= 0)
+    return;		/* all behind us */
+  if(!lv->stubs && st->textsize > 0 && dmin > 0
+		&& st->textsize * nd->maxsize < dmin * lv->minscale)
+    return;		/* all too small to see */
+
+  if(nd->kid != 0) {
+    labels_batch_node( lv, sl, lg, &lg->node[nd->kid] );
+    labels_batch_node( lv, sl, lg, &lg->node[nd->kid+1] );
+    return;
+  }
+
+  for(i = nd->first; i < nd->first + nd->n; i++) {
+    int li = lg->order[i];
+    struct speck *p = NextSpeck( sl->specks, sl, li );
+    float dist = VDOT( &p->p, &lv->fwd ) + lv->fwdd;
+    float tsize = st->textsize * p->size;
+    int rgb = ((unsigned int)p->rgba >= st->textncmap)
+		? RGBWHITE : st->textcmap[ p->rgba ].cooked;
+    float *xy;
+    Point *v;
+
+    if(dist <= 0)
+	continue;
+
+    if(tsize < dist * lv->minscale) {
+	if(lv->stubs) {
+	    Point ep;
+	    vcomb( &ep, p->size * lg->width[li], &lv->xdir, 1, &p->p );
+	    lblbatch_seg( &lv->b, &p->p, &ep, rgb );
+	}
+	continue;
+    }
+
+    if(st->usetextaxes) {
+	static int axcol[3] = { PACKRGBA(255,0,0,0), PACKRGBA(0,255,0,0), PACKRGBA(0,0,255,0) };
+	for(k = 0; k < 3; k++) {
+	    Point ep = p->p;
+	    ep.x[k] += tsize;
+	    lblbatch_seg( &lv->b, &p->p, &ep, axcol[k] );
+	}
     }
+
+    lblbatch_room( &lv->b, lg->nverts[li] );
+    xy = &lg->xy[ 2*lg->first[li] ];
+    v = &lv->b.v[ lv->b.n ];
+    for(k = 0; k < lg->nverts[li]; k++, xy += 2, v++) {
+	float x = p->size * xy[0], y = p->size * xy[1];
+	v->x[0] = p->p.x[0] + x*lv->xdir.x[0] + y*lv->ydir.x[0];
+	v->x[1] = p->p.x[1] + x*lv->xdir.x[1] + y*lv->ydir.x[1];
+	v->x[2] = p->p.x[2] + x*lv->xdir.x[2] + y*lv->ydir.x[2];
+	lv->b.rgba[ lv->b.n + k ] = rgb;
+    }
+    lv->b.n += lg->nverts[li];
   }
-  free(obase);
-  if(texturing > 0)
-    txbind( NULL, NULL );
 }
-  
-  
+
+/* Draw all label lists' labels in one glDrawArrays(). */
+static void labels_draw_batched( struct stuff *st, struct specklist *slhead,
+			Matrix *Ttext, Point *fwd, float fwdd, float radperpix )
+{
+  static struct lblview lv;	/* keep lv.b's storage from frame to frame */
+  struct specklist *sl;
+
+  lv.st = st;
+  lv.fwd = *fwd;
+  lv.fwdd = fwdd;
+  lv.minscale = radperpix * abs(st->textmin);
+  lv.stubs = (st->textmin < 0);
+  memcpy( &lv.xdir, &Ttext->m[0], sizeof(Point) );
+  memcpy( &lv.ydir, &Ttext->m[4], sizeof(Point) );
+  lv.b.n = 0;
+
+  for(sl = slhead; sl != NULL; sl = sl->next) {
+    struct labelgeom *lg;
+    if(sl->text == NULL || sl->specks == NULL || sl->nspecks <= 0)
+	continue;
+    lg = label_geom( sl );
+    labels_batch_node( &lv, sl, lg, &lg->node[0] );
+  }
+
+  if(lv.b.n == 0)
+    return;
+  glEnableClientState( GL_VERTEX_ARRAY );
+  glEnableClientState( GL_COLOR_ARRAY );
+  glVertexPointer( 3, GL_FLOAT, sizeof(Point), lv.b.v );
+  glColorPointer( 3, GL_UNSIGNED_BYTE, sizeof(int), lv.b.rgba );
+  glDrawArrays( GL_LINES, 0, lv.b.n );
+  glDisableClientState( GL_COLOR_ARRAY );
+  glDisableClientState( GL_VERTEX_ARRAY );
+}
 
 void drawspecks( struct stuff *st )
 {
@@ -2115,10 +4162,6 @@ void drawspecks( struct stuff *st )
 #endif
   SelOp seesel = st->seesel;
   float polyminrad, polymaxrad;
-  int useclip = (st->clipbox.level != 0);
-  Point clipp0 = st->clipbox.p0;
-  Point clipp1 = st->clipbox.p1;
-
   float plum = st->psize;
 
   float knee1dist2 = st->fadeknee1 * st->fadeknee1;
@@ -2143,6 +4186,8 @@ void drawspecks( struct stuff *st )
 
   if(oldopengl < 0) init_opengl();
 
+  specks_repalette( st );
+
   switch(fademodel) {
   case F_CONSTANT:
 	if(orthodist2 <= 0)
@@ -2316,7 +4361,11 @@ void drawspecks( struct stuff *st )
 
   if(inpick) glLoadName(0);
   
-  if(st->usevec != VEC_OFF && st->vecscale != 0) {
+  if(st->usevec != VEC_OFF && st->vecscale != 0 && !inpick && !oldopengl) {
+      vectors_draw_arrays( st, slhead, skip, &seesel, &eyepoint );
+
+  } else if(st->usevec != VEC_OFF && st->vecscale != 0) {
+      /* picking wants a name per vector, so draw them one at a time */
       int vecvar0 = st->vecvar0;
       float vscl = st->vecscale;
       float varrow = st->vecarrowscale * vscl;
@@ -2345,7 +4394,7 @@ void drawspecks( struct stuff *st )
 	    if(inpick)
 		glLoadName( i );
 
-	    rgba = (p->rgba & RGBWHITE) | alphabits;
+	    rgba = (SPECKRGB(st, sl, p, i) & RGBWHITE) | alphabits;
 	    glColor4ubv( (GLubyte *)&rgba );
 
 	    if(doarrow) {
@@ -2495,7 +4544,7 @@ void drawspecks( struct stuff *st )
 		    cindex = lastchroma;
 		rgba = chromacm[cindex].cooked & RGBBITS;
 	    } else
-		rgba = p->rgba & RGBBITS;
+		rgba = SPECKRGB(st, sl, p, i) & RGBBITS;
 
 	    if(rgba != prevrgba) {
 		prevrgba = rgba;
@@ -2569,16 +4618,14 @@ void drawspecks( struct stuff *st )
 
   if(st->usepoint && !(st->useboxes == 2)) {
 
-#define MAXPTSIZE 32	/* in half-point units */
-#define PERBUCKET 320	/* max points per bucket */
-
-    struct cpoint sized[MAXPTSIZE*2][PERBUCKET];
-    int nsized[MAXPTSIZE*2];
-    unsigned char invgamma[256];
-    float invgam = (st->gamma <= 0) ? 0 : 1/st->gamma;
+    struct ptsort *ps = &sortedpts;
+    struct speckprep *pp;
+    struct prepspeck *q, *qend;
+    unsigned char *invgamma;
 
-    for(i = 0; i < 256; i++)
-	invgamma[i] = (int) (255.99 * pow( i/255., invgam ));
+    /* Per-view work only; what's common to all views is in pp */
+    pp = inpick ? NULL : speckprep_get( st, slhead, skip );
+    invgamma = pp ? pp->invgamma : NULL;
 
     if(inpick) {
 	for(sl = slhead, slno = 1; sl != NULL; sl = sl->next, slno++) {
@@ -2600,7 +4647,7 @@ void drawspecks( struct stuff *st )
     } else if(fast) {
 	static unsigned char apxsize[MAXPTSIZE*MAXPTSIZE];
 	unsigned char faintrand[256];
-	int pxsize, oldpxsize;
+	int pxsize;
 	int pxmin, pxmax;
 
 	pxmin = 256 * st->pfaint;
@@ -2619,151 +4666,79 @@ void drawspecks( struct stuff *st )
 	glEnable( GL_BLEND );
 	glBlendFunc( GL_SRC_ALPHA, additive_blend ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA );
 
-	prevrgba = 0;
-	prevsize = 0;
-
-	sl = slhead;
-
-	pxsize = oldpxsize = 1;
-	glPointSize( pxsize );
-	glColor4ubv( (GLubyte *)&rgba );
-
-	for(i = 0; i < MAXPTSIZE*2; i++)
-	    nsized[i] = 0;
-
-	if(oldopengl) {
-	    glBegin( GL_POINTS );
-	} else {
-	    glEnableClientState( GL_COLOR_ARRAY );
-	    glEnableClientState( GL_VERTEX_ARRAY );
-	}
-	for(sl = slhead; sl != NULL; sl = sl->next) {
-	    if(sl->text != NULL || sl->special != SPECKS) continue;
-	    for(i = 0, p = sl->specks; i < sl->nspecks; i+=skip, p= NextSpeck(p, sl, skip)) {
-		int lum, myalpha;
-		float dist = VDOT( &p->p, &fwd ) + fwdd;
-		if(dist <= 0)	/* Behind eye plane */
-		    continue;
+	ptsort_begin( ps, pp->n );
+	for(q = pp->ps, qend = q + pp->n; q < qend; q++) {
+	    int lum, myalpha;
+	    float dist = VDOT( &q->p, &fwd ) + fwdd;
+	    if(dist <= 0)   /* Behind eye plane */
+		continue;
 
-		if(!SELECTED(sl->sel[i], &seesel))
-		    continue;
+	    lum = 256 * plum * q->size / (dist*dist);
 
-		if(useclip &&
-		  (p->p.x[0] < clipp0.x[0] ||
-		   p->p.x[0] > clipp1.x[0] ||
-		   p->p.x[1] < clipp0.x[1] ||
-		   p->p.x[1] > clipp1.x[1] ||
-		   p->p.x[2] < clipp0.x[2] ||
-		   p->p.x[2] > clipp1.x[2]))
+	    if(lum < pxmin) {
+		if(lum <= faintrand[(q->i*q->i+q->i) /*randix++*/ & 0xFF])
 		    continue;
-
-
-		lum = 256 * plum * p->size / (dist*dist);
-
-		if(lum < pxmin) {
-		    if(lum <= faintrand[(i*i+i) /*randix++*/ & 0xFF])
-			continue;
-		    pxsize = 1;
-		    myalpha = pxmin;
-		} else if(lum < 256) {
-		    pxsize = 1;
-		    myalpha = lum;
-		} else if(lum < pxmax) {
-		    pxsize = apxsize[lum>>8];
-		    myalpha = lum / (pxsize*pxsize);
-		} else {
-		    /* Could use a polygon here, instead. */
-		    pxsize = st->plarge;
-		    myalpha = 255;
-		}
+		pxsize = 1;
+		myalpha = pxmin;
+	    } else if(lum < 256) {
+		pxsize = 1;
+		myalpha = lum;
+	    } else if(lum < pxmax) {
+		pxsize = apxsize[lum>>8];
+		myalpha = lum / (pxsize*pxsize);
+	    } else {
+		/* Could use a polygon here, instead. */
+		pxsize = st->plarge < 1 ? 1 : st->plarge;
+		myalpha = 255;
+	    }
 #ifdef USE_PTRACK
-		if(useptrack) printf("pfast %d %d %d %d\n", lum, pxsize, myalpha, invgamma[myalpha] & 0xFC);
+	    if(useptrack) printf("pfast %d %d %d %d\n", lum, pxsize, myalpha, invgamma[myalpha] & 0xFC);
 #endif
 
 #ifdef DEBUG
-		if(pxsize < 1 || pxsize > 6 || myalpha <= 0 || myalpha > 255) {
-		    static int oops;
-		    oops++;
-		}
-		if((unsigned int)myalpha > 255 || (unsigned int)invgamma[myalpha]  > 255) {
-		    static int oops2;
-		    oops2++;
-		}
+	    if(pxsize < 1 || pxsize > 6 || myalpha <= 0 || myalpha > 255) {
+		static int oops;
+		oops++;
+	    }
+	    if((unsigned int)myalpha > 255 || (unsigned int)invgamma[myalpha]  > 255) {
+		static int oops2;
+		oops2++;
+	    }
 #endif
 
-		if (use_chromadepth) {
-		  int cindex;
-		  cindex = (dist - chromaslidestart) * chromadistscale;
-		  if (cindex < 0)
-			cindex = 0;
-		  else if (cindex > lastchroma)
-			cindex = lastchroma;
-		  rgba = RGBALPHA(chromacm[cindex].cooked, invgamma[myalpha] & 0xFC);
-		}
-		else
-		  rgba = RGBALPHA( p->rgba&RGBBITS, invgamma[myalpha] & 0xFC );
-
-		if(oldopengl) {
-		    /* we're in a glBegin(GL_POINTS) */
-		    if(pxsize != oldpxsize) {
-			if(nsized[pxsize] >= PERBUCKET) {
-			    glEnd();
-			    glPointSize(pxsize);
-			    dumpcpoints( &sized[pxsize][0], PERBUCKET );
-			    nsized[pxsize] = 0;
-			    oldpxsize = pxsize;
-			    glBegin( GL_POINTS );
-			    glColor4ubv( (GLubyte *)&rgba );
-			    prevrgba = rgba;
-			    glVertex3fv( &p->p.x[0] );
-
-			} else {
-			    struct cpoint *cp = &sized[pxsize][nsized[pxsize]];
-			    cp->rgba = rgba;
-			    cp->p = p->p;
-			    nsized[pxsize]++;
-			}
-		    } else {
-			/* same as current pointsize */
-			if(rgba != prevrgba) {
-			    glColor4ubv( (GLubyte *)&rgba );
-			    prevrgba = rgba;
-			}
-
-			glVertex3fv( &p->p.x[0] );
-		    }
-		} else {
-		    /* !oldopengl => OpenGL >=1.1 */
-		    struct cpoint *cp;
-		    if(nsized[pxsize] >= PERBUCKET) {
-			glPointSize( pxsize );
-			dumpcpointsarray( &sized[pxsize][0], PERBUCKET );
-			cp = &sized[pxsize][0];
-			nsized[pxsize] = 1;
-		    } else {
-			cp = &sized[pxsize][nsized[pxsize]];
-			nsized[pxsize]++;
-		    }
-		    cp->rgba = rgba;
-		    cp->p = p->p;
-		}
+	    if (use_chromadepth) {
+	      int cindex;
+	      cindex = (dist - chromaslidestart) * chromadistscale;
+	      if (cindex < 0)
+		    cindex = 0;
+	      else if (cindex > lastchroma)
+		    cindex = lastchroma;
+	      rgba = RGBALPHA(chromacm[cindex].cooked, invgamma[myalpha] & 0xFC);
 	    }
+	    else
+	      rgba = RGBALPHA( q->rgb, invgamma[myalpha] & 0xFC );
+
+	    ps->sz[ps->n] = pxsize;
+	    ps->in[ps->n].rgba = rgba;
+	    ps->in[ps->n].p = q->p;
+	    ps->n++;
 	}
-	if(oldopengl) {
-	    glEnd();
-	    for(i = 0; i < MAXPTSIZE; i++) {
-		if(nsized[i] > 0) {
-		    glPointSize( i );
-		    dumpcpoints( &sized[i][0], nsized[i] );
-		}
-	    }
-	} else {
-	    for(i = 0; i < MAXPTSIZE; i++) {
-		if(nsized[i] > 0) {
-		    glPointSize( i );
-		    dumpcpointsarray( &sized[i][0], nsized[i] );
-		}
+	ptsort_scatter( ps );
+
+	if(!oldopengl) {
+	    glEnableClientState( GL_COLOR_ARRAY );
+	    glEnableClientState( GL_VERTEX_ARRAY );
+	}
+	for(i = 0; i < MAXPTSIZE*2; i++) {
+	    if(ps->count[i] > 0) {
+		glPointSize( i );
+		if(oldopengl)
+		    dumpcpoints( &ps->out[ps->start[i]], ps->count[i] );
+		else
+		    dumpcpointsarray( &ps->out[ps->start[i]], ps->count[i] );
 	    }
+	}
+	if(!oldopengl) {
 	    glDisableClientState( GL_COLOR_ARRAY );
 	    glDisableClientState( GL_VERTEX_ARRAY );
 	}
@@ -2777,7 +4752,7 @@ void drawspecks( struct stuff *st )
 	unsigned char faintrand[256];
 	static float percoverage[MAXPTSIZE*2];
 	static int needMesaHack = 0;
-	int pxsize, oldpxsize;
+	int pxsize;
 	int pxmin, pxmax;
 	int minsize, minalpha;
 
@@ -2833,191 +4808,117 @@ void drawspecks( struct stuff *st )
 	glEnable( GL_BLEND );
 	glBlendFunc( GL_SRC_ALPHA, additive_blend ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA );
 
-	prevrgba = 0;
-	prevsize = 0;
-
-	sl = slhead;
+	ptsort_begin( ps, pp->n );
+	for(q = pp->ps, qend = q + pp->n; q < qend; q++) {
+	    int lum, myalpha;
+	    float dist, dist2, dx, dy, dz;
 
-	pxsize = 2;
-	oldpxsize = 99;
-	glPointSize( pxsize );
-	glColor4ubv( (GLubyte *)&rgba );
-
-	for(i = 0; i < MAXPTSIZE*2; i++)
-	    nsized[i] = 0;
-
-	if(oldopengl) {
-	    glBegin( GL_POINTS );
-	} else {
-	    glEnableClientState( GL_COLOR_ARRAY );
-	    glEnableClientState( GL_VERTEX_ARRAY );
-	}
-
-	for(sl = slhead; sl != NULL; sl = sl->next) {
-	    if(sl->text != NULL || sl->special != SPECKS) continue;
-	    for(i = 0, p = sl->specks; i < sl->nspecks; i+=skip, p=NextSpeck(p,sl,skip)) {
-		int lum, myalpha;
-		float dist, dist2, dx, dy, dz;
+	    switch(fademodel) {
+	    case F_PLANAR:
+		dist = VDOT( &q->p, &fwd ) + fwdd;
+		if(dist <= 0)       /* Behind eye plane */
+		    continue;
+		dist2 = dist*dist;
+		break;
+	    case F_CONSTANT:
+		dist2 = orthodist2;
+		break;
+	    case F_SPHERICAL:
+		dx = q->p.x[0]-eyepoint.x[0];
+		dy = q->p.x[1]-eyepoint.x[1];
+		dz = q->p.x[2]-eyepoint.x[2];
+		dist2 = dx*dx + dy*dy + dz*dz;
+		break;
 
-		if(!SELECTED(sl->sel[i], &seesel))
+	    case F_LREGION: /* not impl yet */
+		dist = VDOT( &q->p, &fwd ) + fwdd;
+		if(dist <= 0)       /* Behind eye plane */
 		    continue;
-		if(useclip &&
-		  (p->p.x[0] < clipp0.x[0] ||
-		   p->p.x[0] > clipp1.x[0] ||
-		   p->p.x[1] < clipp0.x[1] ||
-		   p->p.x[1] > clipp1.x[1] ||
-		   p->p.x[2] < clipp0.x[2] ||
-		   p->p.x[2] > clipp1.x[2]))
+		dx = q->p.x[0] - fadecen.x[0];
+		dy = q->p.x[1] - fadecen.x[1];
+		dz = q->p.x[2] - fadecen.x[2];
+		dist2 = dist * st->fadeknee2
+			    / (1 + (dx*dx + dy*dy + dz*dz) * faderball2);
+		break;
+	    case F_LINEAR:
+		dist = VDOT( &q->p, &fwd ) + fwdd;
+		if(dist <= 0)       /* Behind eye plane */
 		    continue;
-
-
-		switch(fademodel) {
-		case F_PLANAR:
-		    dist = VDOT( &p->p, &fwd ) + fwdd;
-		    if(dist <= 0)	/* Behind eye plane */
-			continue;
-		    dist2 = dist*dist;
-		    break;
-		case F_CONSTANT:
-		    dist2 = orthodist2;
-		    break;
-		case F_SPHERICAL:
-		    dx = p->p.x[0]-eyepoint.x[0];
-		    dy = p->p.x[1]-eyepoint.x[1];
-		    dz = p->p.x[2]-eyepoint.x[2];
-		    dist2 = dx*dx + dy*dy + dz*dz;
-		    break;
-
-		case F_LREGION:	/* not impl yet */
-		    dist = VDOT( &p->p, &fwd ) + fwdd;
-		    if(dist <= 0)	/* Behind eye plane */
-			continue;
-		    dx = p->p.x[0] - fadecen.x[0];
-		    dy = p->p.x[1] - fadecen.x[1];
-		    dz = p->p.x[2] - fadecen.x[2];
-		    dist2 = dist * st->fadeknee2
-				/ (1 + (dx*dx + dy*dy + dz*dz) * faderball2);
-		    break;
-		case F_LINEAR:
-		    dist = VDOT( &p->p, &fwd ) + fwdd;
-		    if(dist <= 0)	/* Behind eye plane */
-			continue;
-		    dist2 = dist * st->fadeknee2;
-		    break;
+		dist2 = dist * st->fadeknee2;
+		break;
 			
-		case F_KNEE2:
-		    dx = p->p.x[0]-eyepoint.x[0];
-		    dy = p->p.x[1]-eyepoint.x[1];
-		    dz = p->p.x[2]-eyepoint.x[2];
-		    dist2 = dx*dx + dy*dy + dz*dz;
-		    if(dist2 > knee2dist2)
-			dist2 *= 1 + steep2knee2 * (dist2 - knee2dist2);
-		    break;
-		case F_KNEE12:
-		    dx = p->p.x[0]-eyepoint.x[0];
-		    dy = p->p.x[1]-eyepoint.x[1];
-		    dz = p->p.x[2]-eyepoint.x[2];
-		    dist2 = dx*dx + dy*dy + dz*dz;
-		    if(dist2 < knee1dist2)
-			dist2 = knee1dist2;
-		    else if(dist2 > knee2dist2)
-			dist2 *= 1 + steep2knee2 * (dist2 - knee2dist2);
-		    break;
-		}
+	    case F_KNEE2:
+		dx = q->p.x[0]-eyepoint.x[0];
+		dy = q->p.x[1]-eyepoint.x[1];
+		dz = q->p.x[2]-eyepoint.x[2];
+		dist2 = dx*dx + dy*dy + dz*dz;
+		if(dist2 > knee2dist2)
+		    dist2 *= 1 + steep2knee2 * (dist2 - knee2dist2);
+		break;
+	    case F_KNEE12:
+		dx = q->p.x[0]-eyepoint.x[0];
+		dy = q->p.x[1]-eyepoint.x[1];
+		dz = q->p.x[2]-eyepoint.x[2];
+		dist2 = dx*dx + dy*dy + dz*dz;
+		if(dist2 < knee1dist2)
+		    dist2 = knee1dist2;
+		else if(dist2 > knee2dist2)
+		    dist2 *= 1 + steep2knee2 * (dist2 - knee2dist2);
+		break;
+	    }
 
-		lum = (256 * (2*2)) * plum * p->size / dist2;
+	    lum = (256 * (2*2)) * plum * q->size / dist2;
 
-		if(lum <= pxmin) {
-		    if(lum <= faintrand[(i*i+i) /*randix++*/ & 0xFF])
-			continue;
-		    pxsize = minsize;
-		    myalpha = minalpha;
-		} else if(lum < pxmax) {
-		    pxsize = apxsize[lum>>8];
-		    myalpha = lum * percoverage[pxsize];
-		} else {
-		    /* Could use a polygon here, instead. */
-		    pxsize = 2 * st->plarge;
-		    myalpha = 255;
-		}
+	    if(lum <= pxmin) {
+		if(lum <= faintrand[(q->i*q->i+q->i) /*randix++*/ & 0xFF])
+		    continue;
+		pxsize = minsize;
+		myalpha = minalpha;
+	    } else if(lum < pxmax) {
+		pxsize = apxsize[lum>>8];
+		myalpha = lum * percoverage[pxsize];
+	    } else {
+		/* Could use a polygon here, instead. */
+		pxsize = 2 * st->plarge;
+		myalpha = 255;
+	    }
 #ifdef USE_PTRACK
-		if(useptrack) printf("paa %d %d/2 %d %d\n", lum, pxsize, myalpha, invgamma[myalpha] & 0xFC);
+	    if(useptrack) printf("paa %d %d/2 %d %d\n", lum, pxsize, myalpha, invgamma[myalpha] & 0xFC);
 #endif
 
-		if(pxsize < 1 || pxsize >= MAXPTSIZE*2 || myalpha <= 0 || myalpha > 255) {
-		    static int oops;
-		    oops++;
-		    pxsize = MAXPTSIZE*2 - 1;
-		    myalpha = 255;
-		}
+	    if(pxsize < 1 || pxsize >= MAXPTSIZE*2 || myalpha <= 0 || myalpha > 255) {
+		static int oops;
+		oops++;
+		pxsize = MAXPTSIZE*2 - 1;
+		myalpha = 255;
+	    }
 
-		if (use_chromadepth) {
-		  int cindex;
-		  dist = VDOT( &p->p, &fwd ) + fwdd;
-		  if (dist <= 0)
-		    continue;
-		  cindex = (dist - chromaslidestart) * chromadistscale;
-		  if (cindex < 0)
-			cindex = 0;
-		  else if (cindex > lastchroma)
-		    cindex = lastchroma;
-		  rgba = RGBALPHA(chromacm[cindex].cooked, invgamma[myalpha] & 0xFC);
-		}
-		else
-		  rgba = RGBALPHA( p->rgba&RGBBITS, invgamma[myalpha] & 0xFC );
-
-		if(oldopengl) {
-		    if(pxsize != oldpxsize) {
-			if(nsized[pxsize] >= PERBUCKET) {
-			    if(needMesaHack>0 && (pxsize <= 4) != (oldpxsize <= 4)) {
-				if(pxsize <= 4) glDisable( GL_POINT_SMOOTH );
-				else glEnable( GL_POINT_SMOOTH );
-			    }
-			    glEnd();
-			    glPointSize(0.5f*pxsize);
-			    dumpcpoints( &sized[pxsize][0], PERBUCKET );
-			    nsized[pxsize] = 0;
-			    oldpxsize = pxsize;
-			    glBegin( GL_POINTS );
-			    glColor4ubv( (GLubyte *)&rgba );
-			    prevrgba = rgba;
-			    glVertex3fv( &p->p.x[0] );
-
-			} else {
-			    struct cpoint *cp = &sized[pxsize][nsized[pxsize]];
-			    cp->rgba = rgba;
-			    cp->p = p->p;
-			    nsized[pxsize]++;
-			}
-		    } else {
-			/* same as current pointsize */
-			if(rgba != prevrgba) {
-			    glColor4ubv( (GLubyte *)&rgba );
-			    prevrgba = rgba;
-			}
+	    if (use_chromadepth) {
+	      int cindex;
+	      dist = VDOT( &q->p, &fwd ) + fwdd;
+	      if (dist <= 0)
+		continue;
+	      cindex = (dist - chromaslidestart) * chromadistscale;
+	      if (cindex < 0)
+		    cindex = 0;
+	      else if (cindex > lastchroma)
+		cindex = lastchroma;
+	      rgba = RGBALPHA(chromacm[cindex].cooked, invgamma[myalpha] & 0xFC);
+	    }
+	    else
+	      rgba = RGBALPHA( q->rgb, invgamma[myalpha] & 0xFC );
 
-			glVertex3fv( &p->p.x[0] );
-		    }
-		} else {
-		    /* !oldopengl => OpenGL >=1.1 */
-		    struct cpoint *cp;
-		    if(nsized[pxsize] >= PERBUCKET) {
-			glPointSize( 0.5f*pxsize );
-			dumpcpointsarray( &sized[pxsize][0], PERBUCKET );
-			cp = &sized[pxsize][0];
-			nsized[pxsize] = 1;
-		    } else {
-			cp = &sized[pxsize][nsized[pxsize]];
-			nsized[pxsize]++;
-		    }
-		    cp->rgba = rgba;
-		    cp->p = p->p;
-		}
+	    ps->sz[ps->n] = pxsize;
+	    ps->in[ps->n].rgba = rgba;
+	    ps->in[ps->n].p = q->p;
+	    ps->n++;
+	}
+	ptsort_scatter( ps );
 
-	    }
+	if(!oldopengl) {
+	    glEnableClientState( GL_COLOR_ARRAY );
+	    glEnableClientState( GL_VERTEX_ARRAY );
 	}
-	if(oldopengl)
-	    glEnd();
 
 	if(needMesaHack>0)
 	    glDisable( GL_POINT_SMOOTH );
@@ -3025,13 +4926,12 @@ void drawspecks( struct stuff *st )
 	for(i = 0; i < MAXPTSIZE*2; i++) {
 	    if(needMesaHack>0 && i == 4)
 		glEnable( GL_POINT_SMOOTH );
-	    if(nsized[i] > 0) {
+	    if(ps->count[i] > 0) {
 		glPointSize( 0.5f*i );
-		if(oldopengl) {
-		    dumpcpoints( &sized[i][0], nsized[i] );
-		} else {
-		    dumpcpointsarray( &sized[i][0], nsized[i] );
-		}
+		if(oldopengl)
+		    dumpcpoints( &ps->out[ps->start[i]], ps->count[i] );
+		else
+		    dumpcpointsarray( &ps->out[ps->start[i]], ps->count[i] );
 	    }
 	}
 	if(!oldopengl) {
@@ -3042,21 +4942,36 @@ void drawspecks( struct stuff *st )
     }
   }
 
-  if(st->usetext && st->textsize != 0) {
+  if(st->usetext && st->textsize != 0 && !inpick && !oldopengl) {
+    labels_draw_batched( st, slhead, &Ttext, &fwd, fwdd, radperpix );
+
+  } else if(st->usetext && st->textsize != 0) {
+    /* picking needs a name per label, so draw them one by one */
     int cment = -1;
     int textmin = abs(st->textmin);
     int label_stubs = (st->textmin < 0);
     glColor3f(1,1,1);
 
     for(sl = slhead, slno = 1; sl != NULL; sl = sl->next, slno++) {
-	if(sl->text != NULL && (p = sl->specks) != NULL) {
+	int li;
+
+	if(sl->text == NULL || sl->specks == NULL)
+	    continue;
+
+	if(inpick) {
+	    glLoadName(slno);
+	    glPushName(0);
+	}
+
+	for(li = 0, p = sl->specks; li < sl->nspecks; li++, p = NextSpeck(p, sl, 1)) {
 	    float dist = VDOT( &p->p, &fwd ) + fwdd;
 	    float tsize;
+	    char *text = SPECKTEXT( sl, li );
 
 	    if(dist <= 0)
 		continue;
 
-	    if(inpick) glLoadName(slno);
+	    if(inpick) glLoadName(li);
 
 	    tsize = st->textsize * p->size;
 	    if(tsize < dist * (radperpix * textmin)) {
@@ -3070,7 +4985,7 @@ void drawspecks( struct stuff *st )
 		     * Scale to suit.
 		     */
 		    vcomb( &ep,
-			p->size * sfStrWidth(sl->text), (Point *)&Ttext.m[0],
+			p->size * sfStrWidth(text), (Point *)&Ttext.m[0],
 			1, &p->p );
 
 		    if(p->rgba != cment) {
@@ -3109,8 +5024,10 @@ void drawspecks( struct stuff *st )
 		    glColor3ubv( (GLubyte *)&st->textcmap[ p->rgba ].cooked );
 		cment = p->rgba;
 	    }
-	    sfStrDrawTJ( sl->text, p->size, &p->p, &Ttext, NULL );
+	    sfStrDrawTJ( text, p->size, &p->p, &Ttext, NULL );
 	}
+
+	if(inpick) glPopName();
     }
   }
 
@@ -3146,8 +5063,12 @@ void drawspecks( struct stuff *st )
 	glDisable( GL_BLEND );
     }
     glColor4f(1, 1, 1, st->alpha);
-    for(e = st->staticellipsoids; e != NULL; e = e->next)
-	specks_draw_ellipsoid(st, e);
+    if(!inpick && !oldopengl) {
+	ellipsoids_draw_arrays( st );
+    } else {
+	for(e = st->staticellipsoids; e != NULL; e = e->next)
+	    specks_draw_ellipsoid(st, e);
+    }
   }
 
 
@@ -3251,19 +5172,296 @@ void specks_draw_ellipsoid( struct stuff *st, struct ellipsoid *e )
     glEnd();
     break;
 
-  case S_POINT:
-    glPointSize( 1.0 );
-    glBegin( GL_POINTS );
-    glVertex3f( 0,0,1 );
-    glVertex3f( 0,0,-1 );
-    for(v = 1; v < nv-1; v++) {
-	for(u = 0; u < nu; u++)
-	    glVertex3f( cu[u]*sv[v], su[u]*sv[v], cv[v] );
+  case S_POINT:
+    glPointSize( 1.0 );
+    glBegin( GL_POINTS );
+    glVertex3f( 0,0,1 );
+    glVertex3f( 0,0,-1 );
+    for(v = 1; v < nv-1; v++) {
+	for(u = 0; u < nu; u++)
+	    glVertex3f( cu[u]*sv[v], su[u]*sv[v], cv[v] );
+    }
+    glEnd();
+    break;
+  }
+  glPopMatrix();
+}
+
+/*
+ * Ellipsoids, drawn as transformed copies of a unit-sphere mesh.
+ * Each (nu, nv, style) mesh is tessellated once.  The ellipsoid list is
+ * flattened into an array sorted by mesh, level and line width, so
+ * levels hidden by boxlevelmask are skipped a whole run at a time, and
+ * each mesh's vertex array is bound once per frame.
+ */
+struct ellmesh {
+  int nu, nv;
+  enum SurfStyle style;
+  GLenum prim;
+  int nverts, nidx;
+  Point *v;
+  GLuint *idx;
+};
+
+struct ellinst {
+  float m[16];		/* unit sphere -> world: pos * ori * size */
+  int mesh;		/* index into ellcache's meshes[] */
+  int level;
+  int cindex;
+  float linewidth;
+};
+
+struct ellgroup {	/* run of ellinsts with the same mesh, level and linewidth */
+  int first, n;
+  int mesh, level;
+  float linewidth;
+};
+
+struct ellcache {
+  int seq;		/* st->ellipsoidseq when built */
+  int n;
+  struct ellinst *inst;
+  int ngroups;
+  struct ellgroup *groups;
+  int nmeshes, meshroom;
+  struct ellmesh *meshes;
+};
+
+static void ellvert( Point *p, float x, float y, float z )
+{
+  p->x[0] = x;
+  p->x[1] = y;
+  p->x[2] = z;
+}
+
+static void ellmesh_build( struct ellmesh *em )
+{
+  int nu = em->nu, nv = em->nv;
+  int u, v, k;
+  Point *p;
+  GLuint *ix;
+
+  em->nverts = nu*nv;
+  switch(em->style) {
+  case S_SOLID: em->prim = GL_TRIANGLES; em->nidx = 6*nu*(nv-1); break;
+  case S_LINE:	em->prim = GL_LINES; em->nidx = 2*nu*(nv-2) + 2*nu*(nv-1); break;
+  case S_PLANE: em->prim = GL_LINES; em->nidx = 2*3*nu; em->nverts = 3*nu; break;
+  case S_POINT: em->prim = GL_POINTS; em->nidx = 2 + nu*(nv-2); break;
+  default:	em->nverts = em->nidx = 0; break;	/* not drawn */
+  }
+  em->v = p = NewN( Point, em->nverts+1 );
+  em->idx = ix = NewN( GLuint, em->nidx+1 );
+
+  if(em->style == S_PLANE) {
+    for(u = 0; u < nu; u++) {
+	float tu = 2*M_PI*u/nu;
+	float cu = cos(tu), su = sin(tu);
+	ellvert( &p[u], cu, su, 0 );
+	ellvert( &p[nu+u], cu, 0, su );
+	ellvert( &p[2*nu+u], 0, cu, su );
+    }
+    for(k = 0; k < 3; k++) {
+	for(u = 0; u < nu; u++) {
+	    *ix++ = k*nu + u;
+	    *ix++ = k*nu + (u+1)%nu;
+	}
+    }
+    return;
+  }
+
+  /* vertex v*nu+u is at longitude u, latitude v; v=0 is the +Z pole */
+  for(v = 0; v < nv; v++) {
+    float tv = M_PI*v/(nv-1);
+    float sv = sin(tv), cv = cos(tv);
+    for(u = 0; u < nu; u++) {
+	float tu = 2*M_PI*u/nu;
+	ellvert( &p[v*nu+u], cos(tu)*sv, sin(tu)*sv, cv );
+    }
+  }
+
+  switch(em->style) {
+  case S_SOLID:
+    for(v = 1; v < nv; v++) {
+	for(u = 0; u < nu; u++) {
+	    int a = (v-1)*nu + u, b = v*nu + u;
+	    int c = v*nu + (u+1)%nu, d = (v-1)*nu + (u+1)%nu;
+	    *ix++ = a; *ix++ = b; *ix++ = c;
+	    *ix++ = a; *ix++ = c; *ix++ = d;
+	}
+    }
+    break;
+
+  case S_LINE:
+    for(v = 1; v < nv-1; v++) {
+	for(u = 0; u < nu; u++) {
+	    *ix++ = v*nu + u;
+	    *ix++ = v*nu + (u+1)%nu;
+	}
+    }
+    for(u = 0; u < nu; u++) {
+	for(v = 1; v < nv; v++) {
+	    *ix++ = (v-1)*nu + u;
+	    *ix++ = v*nu + u;
+	}
+    }
+    break;
+
+  case S_POINT:
+    *ix++ = 0;
+    *ix++ = (nv-1)*nu;
+    for(k = nu; k < (nv-1)*nu; k++)
+	*ix++ = k;
+    break;
+
+  default:
+    break;
+  }
+}
+
+static int ellcache_mesh( struct ellcache *ec, int nu, int nv, enum SurfStyle style )
+{
+  struct ellmesh *em;
+  int k;
+
+  if(nu == 0 && nv == 0) {
+    nu = 15;
+    nv = 10;
+  }
+  if(nu < 1) nu = 1;
+  if(nv < 2) nv = 2;
+  for(k = 0; k < ec->nmeshes; k++) {
+    em = &ec->meshes[k];
+    if(em->nu == nu && em->nv == nv && em->style == style)
+	return k;
+  }
+  if(ec->nmeshes >= ec->meshroom) {
+    ec->meshroom = 2*ec->meshroom + 8;
+    ec->meshes = RenewN( ec->meshes, struct ellmesh, ec->meshroom );
+  }
+  em = &ec->meshes[ec->nmeshes];
+  memset( em, 0, sizeof(*em) );
+  em->nu = nu;
+  em->nv = nv;
+  em->style = style;
+  ellmesh_build( em );
+  return ec->nmeshes++;
+}
+
+static int ellinstcmp( const void *a, const void *b )
+{
+  const struct ellinst *ea = (const struct ellinst *)a;
+  const struct ellinst *eb = (const struct ellinst *)b;
+  if(ea->mesh != eb->mesh) return ea->mesh - eb->mesh;
+  if(ea->level != eb->level) return ea->level - eb->level;
+  return ea->linewidth < eb->linewidth ? -1 : ea->linewidth > eb->linewidth ? 1 : 0;
+}
+
+static void ellcache_build( struct stuff *st, struct ellcache *ec )
+{
+  struct ellipsoid *e;
+  int i, j, r, n;
+
+  for(n = 0, e = st->staticellipsoids; e != NULL; e = e->next)
+    n++;
+  if(ec->inst) Free(ec->inst);
+  if(ec->groups) Free(ec->groups);
+  ec->inst = NewN( struct ellinst, n+1 );
+  ec->groups = NewN( struct ellgroup, n+1 );
+
+  for(i = 0, e = st->staticellipsoids; e != NULL; i++, e = e->next) {
+    struct ellinst *ei = &ec->inst[i];
+    float *m = ei->m;
+
+    /* m = translate(pos) * ori * scale(size), column-major as for glMultMatrixf() */
+    if(e->hasori)
+	memcpy( m, &e->ori.m[0], 16*sizeof(float) );
+    else
+	memcpy( m, &Tidentity.m[0], 16*sizeof(float) );
+    for(j = 0; j < 3; j++)
+	for(r = 0; r < 4; r++)
+	    m[j*4+r] *= e->size.x[j];
+    for(j = 0; j < 4; j++)
+	for(r = 0; r < 3; r++)
+	    m[j*4+r] += e->pos.x[r] * m[j*4+3];
+
+    ei->mesh = ellcache_mesh( ec, e->nu, e->nv, e->style );
+    ei->level = e->level;
+    ei->cindex = e->cindex;
+    ei->linewidth = e->linewidth > 0 ? e->linewidth : 1.0f;
+  }
+  ec->n = n;
+  qsort( ec->inst, n, sizeof(struct ellinst), ellinstcmp );
+
+  ec->ngroups = 0;
+  for(i = 0; i < n; i++) {
+    struct ellinst *ei = &ec->inst[i];
+    struct ellgroup *g = ec->ngroups > 0 ? &ec->groups[ec->ngroups-1] : NULL;
+    if(g == NULL || g->mesh != ei->mesh || g->level != ei->level
+		 || g->linewidth != ei->linewidth) {
+	g = &ec->groups[ec->ngroups++];
+	g->first = i;
+	g->n = 0;
+	g->mesh = ei->mesh;
+	g->level = ei->level;
+	g->linewidth = ei->linewidth;
     }
-    glEnd();
-    break;
+    g->n++;
   }
-  glPopMatrix();
+  ec->seq = st->ellipsoidseq;
+}
+
+/* Draw st->staticellipsoids, as specks_draw_ellipsoid() would, from the cache. */
+static void ellipsoids_draw_arrays( struct stuff *st )
+{
+  struct ellcache *ec = st->ellcache;
+  int white = RGBALPHA( RGBWHITE, (int)(st->alpha * 255) );
+  int k, i, curmesh = -1, rgba = white;
+
+  if(ec == NULL) {
+    ec = st->ellcache = NewN( struct ellcache, 1 );
+    memset( ec, 0, sizeof(*ec) );
+    ec->seq = st->ellipsoidseq - 1;
+  }
+  if(ec->seq != st->ellipsoidseq)
+    ellcache_build( st, ec );
+
+  if(ec->n == 0 || st->boxlevelmask == 0)
+    return;
+
+  glEnableClientState( GL_VERTEX_ARRAY );
+  glPointSize( 1.0 );
+  for(k = 0; k < ec->ngroups; k++) {
+    struct ellgroup *g = &ec->groups[k];
+    struct ellmesh *em = &ec->meshes[g->mesh];
+
+    if(g->level >= 0 && ((1 << g->level) & st->boxlevelmask) == 0)
+	continue;	/* whole level hidden */
+    if(em->nidx == 0)
+	continue;
+    if(g->mesh != curmesh) {
+	glVertexPointer( 3, GL_FLOAT, sizeof(Point), em->v );
+	curmesh = g->mesh;
+    }
+    glLineWidth( g->linewidth );
+
+    for(i = g->first; i < g->first + g->n; i++) {
+	struct ellinst *ei = &ec->inst[i];
+	int c = white;
+	if(ei->cindex >= 0)
+	    c = RGBALPHA(
+		   RGBWHITE & st->cmap[(ei->cindex < st->ncmap) ? ei->cindex : st->ncmap-1].cooked,
+		   (int)(st->alpha * 255));
+	if(c != rgba) {
+	    glColor4ubv( (GLubyte *)&c );
+	    rgba = c;
+	}
+	glPushMatrix();
+	glMultMatrixf( ei->m );
+	glDrawElements( em->prim, em->nidx, GL_UNSIGNED_INT, em->idx );
+	glPopMatrix();
+    }
+  }
+  glDisableClientState( GL_VERTEX_ARRAY );
 }
 
 void specks_draw_mesh( struct stuff *st, register struct mesh *m, int *texturing )
@@ -3310,6 +5508,10 @@ void specks_draw_mesh( struct stuff *st, register struct mesh *m, int *texturing
     glColor4f( vd->cmin, vd->cmax, vd->mean, st->alpha );
   }
 
+  if(m->els != NULL && !(usemullions && m->type == POLYMESH)
+	&& elements_draw( m->els, (usetx ? 0 : ELEM_NOTX) | (unlit ? ELEM_NONORM : 0) )) {
+    /* drawn from mesh_prepare_elements()' arrays */
+  } else
   switch(m->type) {
   case MODEL:
     if(m->objrender)
@@ -3618,6 +5820,384 @@ void specks_draw_mesh( struct stuff *st, register struct mesh *m, int *texturing
   }
 }
 
+/*
+ * AMR boxes, cached per box array (st->boxcache[t] for st->boxes[t], and
+ * st->staticboxcache), dropped whenever that array changes:  boxes sorted by level,
+ * each level's boxes ordered by a bounding-volume hierarchy, with their
+ * corners in one vertex array and their edges in one GL_LINES index array.
+ * Each frame we cull whole levels by boxlevelmask and BVH nodes by the
+ * view frustum, and draw what's left as a few index ranges per level.
+ * The cache also keeps a boxno -> box index for "gobox".
+ */
+#define BOXLEAF 64	/* boxes per BVH leaf */
+
+struct boxnode {
+  Point lo, hi;
+  int first, n;		/* slots first..first+n-1 */
+  int kid;		/* children are node[kid], node[kid+1]; 0 if leaf */
+};
+
+struct boxcache {
+  struct AMRbox *boxes;	/* what we're a cache for */
+  int n;
+  int *order;		/* slot -> index into boxes[]; slots sorted by level */
+  int nlevels;
+  int *levfirst, *levn, *levroot;	/* per level: slots, BVH root node */
+  int nnodes;
+  struct boxnode *node;
+  Point *v;		/* 8 corners per slot */
+  GLuint *idx;		/* 24 per slot: 12 edges */
+  float vscale[MAXBOXLEV];	/* st->boxscale[] that v[] was made with */
+  int vvalid;
+
+  int count, bmin, bmax;	/* boxno index, built on demand by boxcache_index() */
+  int *byno;		/* byno[boxno-bmin] = index into boxes[], or -1 ... */
+  int nbyno;
+  int *sorted;		/* ... or, if boxnos are sparse, indices sorted by boxno */
+};
+
+static void boxcache_free( struct boxcache *bc )
+{
+  if(bc->order) Free(bc->order);
+  if(bc->levfirst) Free(bc->levfirst);
+  if(bc->levn) Free(bc->levn);
+  if(bc->levroot) Free(bc->levroot);
+  if(bc->node) Free(bc->node);
+  if(bc->v) Free(bc->v);
+  if(bc->idx) Free(bc->idx);
+  if(bc->byno) Free(bc->byno);
+  if(bc->sorted) Free(bc->sorted);
+  memset( bc, 0, sizeof(*bc) );
+}
+
+/* Forget the cache for a box array that's changed or gone. */
+static void boxcache_drop( struct boxcache **bcp )
+{
+  if(*bcp != NULL) {
+    boxcache_free( *bcp );
+    Free( *bcp );
+    *bcp = NULL;
+  }
+}
+
+static struct boxcache **boxcache_slot( struct stuff *st, struct AMRbox *boxes )
+{
+  int t;
+
+  if(boxes == st->staticboxes)
+    return &st->staticboxcache;
+  if(st->boxcache != NULL)
+    for(t = 0; t < st->boxtimes; t++)
+	if(st->boxes[t] == boxes)
+	    return &st->boxcache[t];
+  return NULL;
+}
+
+static struct AMRbox *bxboxes;	/* for bxcmp(), bxnocmp() */
+static int bxaxis;
+
+static int bxcmp( const void *a, const void *b )
+{
+  struct AMRbox *ba = &bxboxes[*(int *)a], *bb = &bxboxes[*(int *)b];
+  float va = ba->p0.x[bxaxis] + ba->p1.x[bxaxis];
+  float vb = bb->p0.x[bxaxis] + bb->p1.x[bxaxis];
+  return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+static int bxlevcmp( const void *a, const void *b )
+{
+  int la = bxboxes[*(int *)a].level, lb = bxboxes[*(int *)b].level;
+  return la != lb ? la - lb : *(int *)a - *(int *)b;
+}
+
+static int bxnocmp( const void *a, const void *b )
+{
+  int na = bxboxes[*(int *)a].boxno, nb = bxboxes[*(int *)b].boxno;
+  return na != nb ? (na < nb ? -1 : 1) : *(int *)a - *(int *)b;
+}
+
+static void boxtree_build( struct boxcache *bc, int nodeno, int first, int n )
+{
+  struct boxnode *nd = &bc->node[nodeno];
+  int i, k;
+
+  for(i = first; i < first+n; i++) {
+    struct AMRbox *box = &bc->boxes[ bc->order[i] ];
+    for(k = 0; k < 3; k++) {
+	float lo = box->p0.x[k] < box->p1.x[k] ? box->p0.x[k] : box->p1.x[k];
+	float hi = box->p0.x[k] < box->p1.x[k] ? box->p1.x[k] : box->p0.x[k];
+	if(i == first || nd->lo.x[k] > lo) nd->lo.x[k] = lo;
+	if(i == first || nd->hi.x[k] < hi) nd->hi.x[k] = hi;
+    }
+  }
+  nd->first = first;
+  nd->n = n;
+  nd->kid = 0;
+  if(n <= BOXLEAF)
+    return;
+
+  /* Split at the median along the longest axis */
+  bxaxis = 0;
+  for(k = 1; k < 3; k++)
+    if(nd->hi.x[k] - nd->lo.x[k] > nd->hi.x[bxaxis] - nd->lo.x[bxaxis])
+	bxaxis = k;
+  bxboxes = bc->boxes;
+  qsort( &bc->order[first], n, sizeof(int), bxcmp );
+
+  nd->kid = bc->nnodes;
+  bc->nnodes += 2;
+  boxtree_build( bc, nd->kid, first, n/2 );
+  boxtree_build( bc, nd->kid+1, first + n/2, n - n/2 );
+}
+
+static struct boxcache *boxcache_get( struct stuff *st, struct AMRbox *boxes )
+{
+  static struct boxcache spare;	/* for an array that isn't ours; rebuilt each time */
+  struct boxcache **bcp = boxcache_slot( st, boxes );
+  struct boxcache *bc;
+  int k, i, lev;
+
+  if(bcp != NULL && *bcp != NULL && (*bcp)->boxes == boxes)
+    return *bcp;
+
+  if(bcp == NULL) {
+    bc = &spare;
+    boxcache_free( bc );
+  } else {
+    boxcache_drop( bcp );
+    bc = *bcp = NewN( struct boxcache, 1 );
+    memset( bc, 0, sizeof(*bc) );
+  }
+  bc->boxes = boxes;
+
+  /* The array's end is marked with a box at level < 0. */
+  for(bc->n = 0; boxes[bc->n].level >= 0; bc->n++)
+    if(bc->nlevels <= boxes[bc->n].level)
+	bc->nlevels = boxes[bc->n].level + 1;
+
+  bc->order = NewN( int, bc->n+1 );
+  for(i = 0; i < bc->n; i++)
+    bc->order[i] = i;
+  bxboxes = boxes;
+  qsort( bc->order, bc->n, sizeof(int), bxlevcmp );
+
+  bc->levfirst = NewN( int, bc->nlevels+1 );
+  bc->levn = NewN( int, bc->nlevels+1 );
+  bc->levroot = NewN( int, bc->nlevels+1 );
+  bc->node = NewN( struct boxnode, 2*(bc->n/(BOXLEAF/2) + bc->nlevels) + 1 );
+  bc->nnodes = 0;
+  for(lev = 0, i = 0; lev < bc->nlevels; lev++) {
+    bc->levfirst[lev] = i;
+    while(i < bc->n && boxes[ bc->order[i] ].level == lev)
+	i++;
+    bc->levn[lev] = i - bc->levfirst[lev];
+    bc->levroot[lev] = -1;
+    if(bc->levn[lev] > 0) {
+	bc->levroot[lev] = bc->nnodes++;
+	boxtree_build( bc, bc->levroot[lev], bc->levfirst[lev], bc->levn[lev] );
+    }
+  }
+
+  bc->v = NewN( Point, 8*bc->n+1 );
+  bc->idx = NewN( GLuint, 24*bc->n+1 );
+  for(i = 0; i < bc->n; i++) {
+    static short edges[24] = {
+	5,4, 4,6, 6,2, 2,3, 3,1, 1,5, 5,7, 7,6,  7,3, 0,1, 0,2, 0,4
+    };
+    for(k = 0; k < 24; k++)
+	bc->idx[24*i + k] = 8*i + edges[k];
+  }
+  bc->vvalid = 0;
+  bc->byno = bc->sorted = NULL;
+  return bc;
+}
+
+/* (Re)compute box corners, shrunk by st->boxscale[] as specks_draw_boxes() does. */
+static void boxcache_verts( struct stuff *st, struct boxcache *bc )
+{
+  int i, k, vert;
+
+  if(bc->vvalid && !memcmp( bc->vscale, st->boxscale, sizeof(bc->vscale) ))
+    return;
+  for(i = 0; i < bc->n; i++) {
+    struct AMRbox *box = &bc->boxes[ bc->order[i] ];
+    float boxscale = st->boxscale[ box->level>=MAXBOXLEV ? MAXBOXLEV-1 : box->level ];
+    float s0 = 1, s1 = 0;
+    if(boxscale != 0 && boxscale != 1) {
+	s0 = .5*(1 + boxscale);
+	s1 = .5*(1 - boxscale);
+    }
+    for(vert = 0; vert < 8; vert++) {
+	Point *v = &bc->v[8*i + vert];
+	for(k = 0; k < 3; k++)
+	    v->x[k] = (vert & (1<<k))
+			? s0*box->p1.x[k] + s1*box->p0.x[k]
+			: s1*box->p1.x[k] + s0*box->p0.x[k];
+    }
+  }
+  memcpy( bc->vscale, st->boxscale, sizeof(bc->vscale) );
+  bc->vvalid = 1;
+}
+
+static void boxcache_index( struct boxcache *bc )
+{
+  int i, span;
+
+  if(bc->byno != NULL || bc->sorted != NULL)
+    return;
+  bc->count = bc->n;
+  bc->bmin = 1<<30, bc->bmax = -1<<30;
+  for(i = 0; i < bc->n; i++) {
+    if(bc->bmin > bc->boxes[i].boxno) bc->bmin = bc->boxes[i].boxno;
+    if(bc->bmax < bc->boxes[i].boxno) bc->bmax = bc->boxes[i].boxno;
+  }
+  span = bc->bmax - bc->bmin + 1;
+  if(bc->n > 0 && span > 0 && span <= 4*bc->n + 1024) {
+    bc->nbyno = span;
+    bc->byno = NewN( int, span );
+    for(i = 0; i < span; i++)
+	bc->byno[i] = -1;
+    for(i = bc->n; --i >= 0; )	/* first of any duplicates wins */
+	bc->byno[ bc->boxes[i].boxno - bc->bmin ] = i;
+  } else {
+    bc->sorted = NewN( int, bc->n+1 );
+    for(i = 0; i < bc->n; i++)
+	bc->sorted[i] = i;
+    bxboxes = bc->boxes;
+    qsort( bc->sorted, bc->n, sizeof(int), bxnocmp );
+  }
+}
+
+static struct AMRbox *boxcache_find( struct boxcache *bc, int boxno )
+{
+  int lo, hi;
+
+  boxcache_index( bc );
+  if(bc->byno != NULL) {
+    if(boxno < bc->bmin || boxno > bc->bmax || bc->byno[boxno - bc->bmin] < 0)
+	return NULL;
+    return &bc->boxes[ bc->byno[boxno - bc->bmin] ];
+  }
+  for(lo = 0, hi = bc->n; lo < hi; ) {
+    int mid = (lo + hi) / 2;
+    if(bc->boxes[ bc->sorted[mid] ].boxno < boxno)
+	lo = mid+1;
+    else
+	hi = mid;
+  }
+  return (lo < bc->n && bc->boxes[ bc->sorted[lo] ].boxno == boxno)
+	? &bc->boxes[ bc->sorted[lo] ] : NULL;
+}
+
+struct boxview {
+  float plane[6][4];	/* view frustum, in object coords: inside if ax+by+cz+d >= 0 */
+  int nranges, rangeroom;
+  int *range;		/* pairs of (first slot, count) to draw */
+};
+
+static void boxview_frustum( struct boxview *bv )
+{
+  float P[16], M[16], C[16];
+  int r, c, k, i;
+
+  glGetFloatv( GL_PROJECTION_MATRIX, P );
+  glGetFloatv( GL_MODELVIEW_MATRIX, M );
+  for(c = 0; c < 4; c++)
+    for(r = 0; r < 4; r++)
+	for(C[c*4+r] = 0, k = 0; k < 4; k++)
+	    C[c*4+r] += P[k*4+r] * M[c*4+k];
+  for(i = 0; i < 6; i++)
+    for(c = 0; c < 4; c++)
+	bv->plane[i][c] = C[c*4+3] + ((i&1) ? -C[c*4+i/2] : C[c*4+i/2]);
+}
+
+static void boxview_add( struct boxview *bv, int first, int n )
+{
+  if(bv->nranges > 0 && bv->range[2*bv->nranges-2] + bv->range[2*bv->nranges-1] == first) {
+    bv->range[2*bv->nranges-1] += n;	/* extends the previous range */
+    return;
+  }
+  if(bv->nranges >= bv->rangeroom) {
+    bv->rangeroom = 2*bv->rangeroom + 64;
+    bv->range = RenewN( bv->range, int, 2*bv->rangeroom );
+  }
+  bv->range[2*bv->nranges] = first;
+  bv->range[2*bv->nranges+1] = n;
+  bv->nranges++;
+}
+
+static void boxview_cull( struct boxview *bv, struct boxcache *bc, struct boxnode *nd, int inside )
+{
+  int i, k;
+
+  for(i = 0; i < 6 && !inside; i++) {
+    float *pl = bv->plane[i];
+    float far = pl[3], near = pl[3];
+    for(k = 0; k < 3; k++) {
+	float a = pl[k] * nd->lo.x[k], b = pl[k] * nd->hi.x[k];
+	far += (a > b ? a : b);
+	near += (a > b ? b : a);
+    }
+    if(far < 0)
+	return;		/* entirely outside this plane */
+    if(near < 0)
+	break;		/* straddles it */
+  }
+  if(i == 6)
+    inside = 1;		/* inside all planes; don't test descendants */
+
+  if(nd->kid != 0 && !inside) {
+    boxview_cull( bv, bc, &bc->node[nd->kid], 0 );
+    boxview_cull( bv, bc, &bc->node[nd->kid+1], 0 );
+  } else {
+    boxview_add( bv, nd->first, nd->n );
+  }
+}
+
+static void boxes_draw_batched( struct stuff *st, struct AMRbox *boxes, int boxlevelmask, Matrix Ttext )
+{
+  static struct boxview bv;	/* keep bv.range from frame to frame */
+  struct boxcache *bc = boxcache_get( st, boxes );
+  int lev, r, i;
+
+  boxcache_verts( st, bc );
+  boxview_frustum( &bv );
+
+  glEnableClientState( GL_VERTEX_ARRAY );
+  glVertexPointer( 3, GL_FLOAT, sizeof(Point), bc->v );
+  for(lev = 0; lev < bc->nlevels && lev < 32; lev++) {
+    int cval;
+
+    if(bc->levroot[lev] < 0 || ((1 << lev) & boxlevelmask) == 0)
+	continue;
+    bv.nranges = 0;
+    boxview_cull( &bv, bc, &bc->node[ bc->levroot[lev] ], 0 );
+    if(bv.nranges == 0)
+	continue;
+
+    cval = RGBALPHA(st->boxcmap[ lev>=st->boxncmap ? st->boxncmap-1 : lev ].cooked, 0xFF);
+    glColor4ubv( (GLubyte *)&cval );
+    for(r = 0; r < bv.nranges; r++)
+	glDrawElements( GL_LINES, 24*bv.range[2*r+1], GL_UNSIGNED_INT,
+			&bc->idx[ 24*bv.range[2*r] ] );
+
+    if(st->boxlabels && st->boxlabelscale != 0) {
+	for(r = 0; r < bv.nranges; r++) {
+	    for(i = bv.range[2*r]; i < bv.range[2*r] + bv.range[2*r+1]; i++) {
+		struct AMRbox *box = &boxes[ bc->order[i] ];
+		float sz = .16 * vdist( &box->p0, &box->p1 ) / st->textsize;
+		Point mid;
+		char lbl[16];
+		vlerp( &mid, .5, &box->p0, &box->p1 );
+		sprintf(lbl, "%d", box->boxno);
+		sfStrDrawTJ( lbl, sz, &mid, &Ttext, "c" );
+	    }
+	}
+    }
+  }
+  glDisableClientState( GL_VERTEX_ARRAY );
+}
+
 void specks_draw_boxes( struct stuff *st, struct AMRbox *boxes, int boxlevelmask, Matrix Ttext, int oriented )
 {
   static short arcs[] = {
@@ -3638,6 +6218,12 @@ void specks_draw_boxes( struct stuff *st, struct AMRbox *boxes, int boxlevelmask
   glEnable( GL_BLEND );
   glDisable( GL_LINE_SMOOTH );
 
+  if(!oriented && !st->inpick && !oldopengl) {
+    boxes_draw_batched( st, boxes, boxlevelmask, Ttext );
+    glLineWidth( 1 );
+    return;
+  }
+
   /* Scan through the array, whose end is marked with a box at level -1. */
   for(box = boxes; box->level >= 0; box++) {
     boxscale = (box->level < 0) ? 1.0
@@ -4098,8 +6684,15 @@ SpecksPickFunc specks_all_picks( struct stuff *st, SpecksPickFunc func, void *ar
 }
 
 
+/*
+ * Add nsp specks to the current dataset and datatime.
+ * If strs holds anything, the new specklist takes it over, along with
+ * a copy of stroff[nsp]: as labels (making a label list) if "labels",
+ * otherwise as per-speck titles.
+ */
 static void addchunk( struct stuff *st, int nsp, int bytesperspeck,
-			float scaledby, struct speck *sp, char *text,
+			float scaledby, struct speck *sp,
+			struct strtab *strs, int *stroff, int labels,
 			int outbytesperspeck )
 {
     struct specklist **slp, *sl = NewN( struct specklist, 1 );
@@ -4111,11 +6704,18 @@ static void addchunk( struct stuff *st, int nsp, int bytesperspeck,
     sl->specks = NewNSpeck( sl, nsp );
     sl->nspecks = nsp;
     sl->scaledby = scaledby;
-    if(text) {
-	sl->text = NewN( char, strlen(text)+1 );
-	strcpy(sl->text, text);
-    } else {
-	sl->text = NULL;
+    if(strs != NULL && strs->len > 0) {
+	int *offs = NewN( int, nsp );
+	memcpy( offs, stroff, nsp*sizeof(int) );
+	if(labels) {
+	    sl->text = strs->buf;
+	    sl->textoff = offs;
+	} else {
+	    sl->titles = strs->buf;
+	    sl->titleoff = offs;
+	}
+	strs->buf = NULL;	/* it's ours now */
+	strs->len = strs->room = 0;
     }
     if(bytesperspeck == outbytesperspeck) {
 	memcpy( sl->specks, sp, nsp*sl->bytesperspeck );
@@ -4136,6 +6736,54 @@ static void addchunk( struct stuff *st, int nsp, int bytesperspeck,
     sl->sizeseq = -1;		/* Force recomputing sizes */
 }
 
+/*
+ * Text labels read from a file, gathered into one label list
+ * per dataset and timestep.
+ */
+struct labeltab {
+  int n, room;
+  char *specks;		/* n specks of SMALLSPECKSIZE(0) bytes */
+  int *off;		/* label offsets in strs */
+  struct strtab strs;
+  float scaledby;
+};
+
+static void labels_flush( struct stuff *st, struct labeltab *lt )
+{
+  if(lt->n > 0)
+    addchunk( st, lt->n, SMALLSPECKSIZE(0), lt->scaledby,
+		(struct speck *)lt->specks, &lt->strs, lt->off, 1,
+		SMALLSPECKSIZE(0) );
+  lt->n = 0;
+  strtab_free( &lt->strs );
+}
+
+static void labels_add( struct stuff *st, struct labeltab *lt,
+			struct speck *sp, float scaledby, char *text )
+{
+  if(lt->n > 0 && lt->scaledby != scaledby)
+    labels_flush( st, lt );
+  if(lt->n >= lt->room) {
+    lt->room = 2*lt->room + 64;
+    lt->specks = RenewN( lt->specks, char, lt->room * SMALLSPECKSIZE(0) );
+    lt->off = RenewN( lt->off, int, lt->room );
+  }
+  memcpy( lt->specks + lt->n * SMALLSPECKSIZE(0), sp, SMALLSPECKSIZE(0) );
+  lt->off[lt->n] = strtab_add( &lt->strs, text, -1 );
+  lt->scaledby = scaledby;
+  lt->n++;
+}
+
+static void labels_done( struct stuff *st, struct labeltab *lt )
+{
+  labels_flush( st, lt );
+  if(lt->specks) Free(lt->specks);
+  if(lt->off) Free(lt->off);
+  lt->specks = NULL;
+  lt->off = NULL;
+  lt->room = 0;
+}
+
 int specks_count( struct specklist *sl ) {
     int n;
     for(n = 0; sl != NULL; sl = sl->next)
@@ -4254,11 +6902,67 @@ void specks_read_ellipsoid( struct stuff *st, Point *pos, int argc, char **argv,
   if(e.title) ep->title = shmstrdup(e.title);
   ep->next = st->staticellipsoids;
   st->staticellipsoids = ep;
+  st->ellipsoidseq++;
+}
+
+
+/*
+ * Mesh blocks within a data file are cached (see geomcache.h) by their
+ * offset in the file: the vertices, and where the block ends.
+ */
+static int mesh_readcache( GeomCache *gc, FILE *f, long off, struct mesh *m, int havetx )
+{
+  char sname[32];
+  long long *hdr;
+  Point *pts, *tx = NULL;
+  int n, npts, ntx = 0;
+
+  sprintf(sname, "m%ld", off);
+  hdr = (long long *)geomcache_get( gc, sname, sizeof(long long), &n );
+  if(hdr == NULL || n != 4 || hdr[2] != havetx)
+    return 0;
+  sprintf(sname, "m%ld.pts", off);
+  pts = (Point *)geomcache_get( gc, sname, sizeof(Point), &npts );
+  if(havetx) {
+    sprintf(sname, "m%ld.tx", off);
+    tx = (Point *)geomcache_get( gc, sname, sizeof(Point), &ntx );
+  }
+  if(pts == NULL || npts != hdr[0]*hdr[1] || (havetx && ntx != npts)
+		|| fseek( f, (long)hdr[3], SEEK_SET ) != 0)
+    return 0;
+  m->nu = hdr[0];
+  m->nv = hdr[1];
+  m->nverts = npts;
+  m->pts = pts;
+  m->tx = tx;
+  return 1;
 }
 
+static void mesh_savecache( GeomCache *gc, FILE *f, long off, struct mesh *m, int havetx )
+{
+  char sname[32];
+  long long hdr[4];
+
+  if(gc == NULL)
+    return;
+  hdr[0] = m->nu;
+  hdr[1] = m->nv;
+  hdr[2] = havetx;
+  hdr[3] = ftell(f);
+  sprintf(sname, "m%ld.pts", off);
+  geomcache_put( gc, sname, m->pts, sizeof(Point), m->nverts );
+  if(havetx) {
+    sprintf(sname, "m%ld.tx", off);
+    geomcache_put( gc, sname, m->tx, sizeof(Point), m->nverts );
+  }
+  sprintf(sname, "m%ld", off);
+  geomcache_put( gc, sname, hdr, sizeof(long long), 4 );
+}
 
-void specks_read_mesh( struct stuff *st, FILE *f, int argc, char **argv, char *buf )
+void specks_read_mesh( struct stuff *st, FILE *f, int argc, char **argv, char *buf,
+			GeomCache *crd, GeomCache *cwr )
 {
+  long off;
   char *cp, *ep;
   int i, count, alloced, err = 0;
   int havetx = 0;
@@ -4296,6 +7000,10 @@ void specks_read_mesh( struct stuff *st, FILE *f, int argc, char **argv, char *b
     }
   }
 
+  off = ftell(f);
+  if(crd != NULL && mesh_readcache( crd, f, off, m, havetx ))
+    goto placeit;
+
   if(m->type == QUADMESH) {
     get_line(f, buf);
     if(sscanf(buf, "%d%d", &m->nu, &m->nv) != 2
@@ -4366,7 +7074,9 @@ void specks_read_mesh( struct stuff *st, FILE *f, int argc, char **argv, char *b
     Free(m);
     return;
   }
+  mesh_savecache( cwr, f, off, m, havetx );
 
+ placeit:
   if(timestep >= 0) {
     if(timestep >= st->ntimes)
 	specks_ensuretime( st, st->curdata, timestep );
@@ -4376,44 +7086,259 @@ void specks_read_mesh( struct stuff *st, FILE *f, int argc, char **argv, char *b
     m->next = st->staticmeshes;
     st->staticmeshes = m;
   }
+
+  mesh_prepare_elements( m );
+}
+
+/* Append a group of "count" indices, drawn as prim, to es; return where they go. */
+int *elements_add( ElementSet *es, GLenum prim, int count )
+{
+  Elements *el = &es->elem[ es->nelem++ ];
+  el->prim = prim;
+  el->eltype = es->eltype;
+  el->base = (es->nelem > 1) ? el[-1].base + el[-1].count : 0;
+  el->count = count;
+  el->ixmin = 0;
+  el->ixmax = es->nverts - 1;
+  return &es->elindices[ el->base ];
+}
+
+static void quadmesh_prepare_elements( struct mesh *m )
+{
+  static Point zero;
+  int nu = m->nu, nv = m->nv;
+  int u, v, k, n;
+  int *ix;
+  ElementSet *es;
+
+  switch(m->style) {
+  case S_SOLID: n = 4*(nu-1)*(nv-1); break;
+  case S_LINE:	n = 2*nv*(nu-1) + 2*nu*(nv-1); break;
+  case S_POINT: n = nu*nv; break;
+  case S_PLANE: n = 2*(2*nu + 2*nv - 4); break;
+  default:	return;
+  }
+  if(n <= 0)
+    return;
+
+  es = elements_create( m->tx ? GL_T4F_V4F : GL_V3F, nu*nv, 1, n );
+  for(k = 0; k < nu*nv; k++)
+    elements_setvert( es, k, m->tx ? &m->tx[k] : &zero, NULL, &m->pts[k] );
+
+  switch(m->style) {
+  case S_SOLID:		/* each GL_QUAD_STRIP row, as quads */
+    ix = elements_add( es, GL_QUADS, n );
+    for(v = 1; v < nv; v++) {
+	for(u = 0; u < nu-1; u++) {
+	    *ix++ = (v-1)*nu + u;
+	    *ix++ = v*nu + u;
+	    *ix++ = v*nu + u+1;
+	    *ix++ = (v-1)*nu + u+1;
+	}
+    }
+    break;
+
+  case S_LINE:
+    ix = elements_add( es, GL_LINES, n );
+    for(v = 0; v < nv; v++) {
+	for(u = 1; u < nu; u++) {
+	    *ix++ = v*nu + u-1;
+	    *ix++ = v*nu + u;
+	}
+    }
+    for(u = 0; u < nu; u++) {
+	for(v = 1; v < nv; v++) {
+	    *ix++ = (v-1)*nu + u;
+	    *ix++ = v*nu + u;
+	}
+    }
+    break;
+
+  case S_POINT:
+    ix = elements_add( es, GL_POINTS, n );
+    for(k = 0; k < n; k++)
+	*ix++ = k;
+    break;
+
+  case S_PLANE: {	/* the boundary, as a loop of GL_LINES */
+    int *loop = NewA( int, n/2 + 1 );
+    int nloop = 0;
+    for(u = 0; u < nu; u++)
+	loop[nloop++] = u;
+    for(v = 1; v < nv; v++)
+	loop[nloop++] = v*nu + nu-1;
+    for(u = nu-1; --u >= 0; )
+	loop[nloop++] = (nv-1)*nu + u;
+    for(v = nv-1; --v > 0; )
+	loop[nloop++] = v*nu;
+    ix = elements_add( es, GL_LINES, 2*nloop );
+    for(k = 0; k < nloop; k++) {
+	*ix++ = loop[k];
+	*ix++ = loop[(k+1) % nloop];
+    }
+    break;
+    }
+
+  default:
+    break;
+  }
+  m->els = es;
 }
 
+/*
+ * Lay out a mesh's faces for glDrawElements(): one vertex per face-vertex,
+ * and one group of indices per primitive type.  Triangle strips and
+ * polygons are split into triangles.
+ */
 void mesh_prepare_elements( struct mesh *m )
 {
-  static GLenum prim[6] = { GL_TRIANGLE_STRIP, GL_POINTS, GL_LINES, GL_TRIANGLES, GL_QUADS, GL_TRIANGLE_FAN };
-  Elements els[6];
-  int tristrips=0, trifans=0;
-  int i, n, base;
+  static Point zero;
+  ElementSet *es;
+  int nlines = 0, ntris = 0, nquads = 0;
+  int f, k, fvn, nv;
+  int *lix, *tix, *qix;
+  Point *tx, *norm;
  
+  elements_free( m->els );
+  m->els = NULL;
+
+  if(m->type == QUADMESH) {
+    quadmesh_prepare_elements( m );
+    return;
+  }
   if(m->type != POLYMESH)
     return;
 
-  memset( els, 0, sizeof(els) );
-
   /* how many of each type? */
-  for(i = 0; i < m->nfaces; i++) {
-    int n = m->fvn[i];
-    if(n < 0) {
-	els[0].count += -n;
-	tristrips++;
-    } else if(n >= 5) {
-	els[5].count += n;
-	trifans++;
-    } else {
-	els[n].count += n;
+  for(f = 0, nv = 0; f < m->nfaces; f++) {
+    fvn = m->fvn[f];
+    if(fvn < 0) {
+	if(-fvn >= 3) ntris += -fvn - 2;
+	fvn = -fvn;
+    } else if(fvn == 2) {
+	nlines++;
+    } else if(fvn == 4) {
+	nquads++;
+    } else if(fvn >= 3) {
+	ntris += fvn - 2;
+    }
+    nv += fvn;
+  }
+
+  es = elements_create( m->tx && m->fnorms ? GL_T2F_N3F_V3F
+			: m->tx ? GL_T2F_V3F
+			: m->fnorms ? GL_N3F_V3F : GL_V3F,
+			nv, 3, 2*nlines + 3*ntris + 4*nquads );
+  lix = elements_add( es, GL_LINES, 2*nlines );
+  tix = elements_add( es, GL_TRIANGLES, 3*ntris );
+  qix = elements_add( es, GL_QUADS, 4*nquads );
+
+  /* Faces without texture coords inherit the last ones, as they did with glTexCoord() */
+  tx = &zero;
+  norm = &zero;
+  for(f = 0, nv = 0; f < m->nfaces; f++) {
+    int *fvs0 = &m->fvs[ m->fv0[f] ];
+    int usevn = (FVNORM(0) >= 0);
+    int v0 = nv;
+
+    fvn = m->fvn[f] < 0 ? -m->fvn[f] : m->fvn[f];
+    for(k = 0; k < fvn; k++, nv++) {
+	int *fvs = &fvs0[k*FVSTEP];
+	if(m->tx && fvs[FVS_TX] >= 0)
+	    tx = &m->tx[ fvs[FVS_TX] ];
+	if(m->fnorms)
+	    norm = (usevn && m->vnorms) ? &m->vnorms[ fvs[FVS_VNORM] ] : &m->fnorms[f];
+	elements_setvert( es, nv, tx, norm, &m->pts[ fvs[FVS_VERT] ] );
+    }
+
+    if(m->fvn[f] < 0) {			/* triangle strip */
+	for(k = 2; k < fvn; k++) {
+	    *tix++ = v0 + ((k&1) ? k-1 : k-2);
+	    *tix++ = v0 + ((k&1) ? k-2 : k-1);
+	    *tix++ = v0 + k;
+	}
+    } else if(fvn == 2) {
+	*lix++ = v0;
+	*lix++ = v0+1;
+    } else if(fvn == 4) {
+	for(k = 0; k < 4; k++)
+	    *qix++ = v0 + k;
+    } else if(fvn >= 3) {		/* triangle, or polygon as a fan */
+	for(k = 2; k < fvn; k++) {
+	    *tix++ = v0;
+	    *tix++ = v0 + k-1;
+	    *tix++ = v0 + k;
+	}
     }
   }
-  /* starting positions */
-  base = 0;
-  for(i = 0; i <= 5; i++) {
-    els[i].base = base;
-    base += els[i].count;
+  m->els = es;
+}
+
+/* Cached .obj meshes (see geomcache.h): the parsed arrays, used in place. */
+static void *waveobj_cached( GeomCache *gc, char *name, int elsize, int count )
+{
+  int n;
+  void *p = geomcache_get( gc, name, elsize, &n );
+  return (p != NULL && n == count) ? p : NULL;
+}
+
+static int waveobj_readcache( struct mesh *m, char *fullname )
+{
+  GeomCache *gc = geomcache_open( fullname, "waveobj" );
+  int *cnt, ok;
+
+  if(gc == NULL)
+    return 0;
+  cnt = (int *)waveobj_cached( gc, "counts", sizeof(int), 6 );
+  ok = (cnt != NULL
+	&& (m->pts = (Point *)waveobj_cached( gc, "pts", sizeof(Point), cnt[0] )) != NULL
+	&& (m->tx = (Point *)waveobj_cached( gc, "tx", sizeof(Point), cnt[1] )) != NULL
+	&& (m->vnorms = (Point *)waveobj_cached( gc, "vnorms", sizeof(Point), cnt[2] )) != NULL
+	&& (m->fv0 = (int *)waveobj_cached( gc, "fv0", sizeof(int), cnt[3] )) != NULL
+	&& (m->fvn = (int *)waveobj_cached( gc, "fvn", sizeof(int), cnt[3] )) != NULL
+	&& (m->fvs = (int *)waveobj_cached( gc, "fvs", sizeof(int), cnt[4] )) != NULL);
+  if(ok) {
+    m->nverts = cnt[0];
+    m->ntx = cnt[1];
+    m->nvnorms = cnt[2];
+    m->nfaces = cnt[3];
+    m->nfv = cnt[4];
+    m->fnorms = cnt[5] ? (Point *)waveobj_cached( gc, "fnorms", sizeof(Point), cnt[3] ) : NULL;
+  } else {
+    m->pts = m->tx = m->vnorms = NULL;
+    m->fv0 = m->fvn = m->fvs = NULL;
   }
-  /* allocate memory, copy fields into glInterleavedArrays form */
+  geomcache_close( gc );
+  return ok;
+}
+
+static void waveobj_savecache( GeomCache *gc, struct mesh *m )
+{
+  int cnt[6];
+
+  if(gc == NULL)
+    return;
+  cnt[0] = m->nverts;
+  cnt[1] = m->ntx;
+  cnt[2] = m->nvnorms;
+  cnt[3] = m->nfaces;
+  cnt[4] = m->nfv;
+  cnt[5] = (m->fnorms != NULL);
+  geomcache_put( gc, "counts", cnt, sizeof(int), 6 );
+  geomcache_put( gc, "pts", m->pts, sizeof(Point), m->nverts );
+  geomcache_put( gc, "tx", m->tx, sizeof(Point), m->ntx );
+  geomcache_put( gc, "vnorms", m->vnorms, sizeof(Point), m->nvnorms );
+  geomcache_put( gc, "fv0", m->fv0, sizeof(int), m->nfaces );
+  geomcache_put( gc, "fvn", m->fvn, sizeof(int), m->nfaces );
+  geomcache_put( gc, "fvs", m->fvs, sizeof(int), m->nfv );
+  if(m->fnorms)
+    geomcache_put( gc, "fnorms", m->fnorms, sizeof(Point), m->nfaces );
+  geomcache_save( gc );
 }
 
 void specks_read_waveobj( struct stuff *st, int argc, char **argv, char *line, char *infname )
 {
+  GeomCache *gc;
   struct mesh *m = NewN( struct mesh, 1 );
   int lno;
   int i, f;
@@ -4464,10 +7389,13 @@ void specks_read_waveobj( struct stuff *st, int argc, char **argv, char *line, c
 
   fname = argv[i];
   fullname = findfile( infname, fname );
+  if(fullname != NULL && waveobj_readcache( m, fullname ))
+    goto placeit;
   if(fullname == NULL || (inf = fopen(fullname, "r")) == NULL) {
     msg("waveobj: can't find .obj file %s", fname);
     return;
   }
+  gc = geomcache_create( fullname, "waveobj" );
 
 #define VINIT(what) c##what = NULL, k##what = n##what = 0
 #define VTOTAL(what) (k##what + n##what)
@@ -4647,7 +7575,10 @@ void specks_read_waveobj( struct stuff *st, int argc, char **argv, char *line, c
 	vunit( &m->fnorms[f], &normal );
       }
   }
+  waveobj_savecache( gc, m );
+  geomcache_close( gc );
 
+ placeit:
   if(timestep >= 0) {
     if(timestep >= st->ntimes)
 	specks_ensuretime( st, st->curdata, timestep );
@@ -4686,6 +7617,11 @@ void specks_read( struct stuff **stp, char *fname )
   int ignorefirst = 0;
   int lno = 0;
   char *comment;
+  struct strtab titles;
+  int titleoff[2*SPECKCHUNK];
+  struct labeltab labels;
+  GeomCache *meshcrd = NULL, *meshcwr = NULL;
+  int meshcached = 0;
 
   if(fname == NULL) return;
 
@@ -4698,21 +7634,26 @@ void specks_read( struct stuff **stp, char *fname )
     return;
   }
 
-  tsl.bytesperspeck = (st->maxcomment+1 +
-			(sizeof(s) - sizeof(s.title)) + 3) & ~3;
+  /* Titles go into a string table, so specks needn't carry title[]s */
+  tsl.bytesperspeck = SMALLSPECKSIZE(MAXVAL);
   s.rgba = 0;
   s.size = 1;
   nsp = 0;
   sp = speckbuf;
   maxnsp = sizeof(speckbuf) / tsl.bytesperspeck;
+  if(maxnsp > COUNT(titleoff))
+    maxnsp = COUNT(titleoff);
+  memset( &titles, 0, sizeof(titles) );
+  memset( &labels, 0, sizeof(labels) );
 
 #define SPFLUSH() \
     if(nsp > 0) {					\
 	addchunk( st, nsp, tsl.bytesperspeck,		\
-		speckscale, speckbuf, NULL,		\
+		speckscale, speckbuf, &titles, titleoff, 0, \
 		maxfields >= MAXVAL ? tsl.bytesperspeck \
 			: SMALLSPECKSIZE(maxfields) );	\
     }							\
+    strtab_free( &titles );				\
     nsp = maxfields = 0;				\
     sp = speckbuf;
 
@@ -4747,6 +7688,7 @@ void specks_read( struct stuff **stp, char *fname )
 
     if(!strcmp(argv[0], "include") || !strcmp(argv[0], "read")) {
 	float oldscale = speckscale;
+	labels_flush( st, &labels );
 	char *infname = argv[1];
 	char *realfile = findfile( fname, infname );
 	if(realfile == NULL) {
@@ -5107,6 +8049,7 @@ void specks_read( struct stuff **stp, char *fname )
 	    continue;
 	}
 	strncpyt(st->dataname[indexno], name, sizeof(st->dataname[indexno]));
+	labels_flush( st, &labels );
 	st->curdata = indexno;
 
     } else if(!strncmp(argv[0], "datavar", 7) && argc > 2) {
@@ -5136,11 +8079,17 @@ void specks_read( struct stuff **stp, char *fname )
 	if(newt == st->datatime)	/* no need to change anything */
 	    continue;
 	SPFLUSH();
+	labels_flush( st, &labels );
 	st->datatime = newt;
 
     } else if(!strcmp(argv[0], "mesh") || !strcmp(argv[0], "tstrip")
 					|| !strcmp(argv[0], "tfan")) {
-	specks_read_mesh(st, f, argc, argv, line);
+	if(!meshcached) {
+	    meshcrd = geomcache_open( fname, "mesh" );
+	    meshcwr = meshcrd ? NULL : geomcache_create( fname, "mesh" );
+	    meshcached = 1;
+	}
+	specks_read_mesh(st, f, argc, argv, line, meshcrd, meshcwr);
 	
     } else if(!strcmp(argv[0], "waveobj")) {
 	specks_read_waveobj(st, argc, argv, line, fname);
@@ -5150,15 +8099,7 @@ void specks_read( struct stuff **stp, char *fname )
 	sscanf(argv[1], "%d", &s.rgba);
 
     } else if(!strcmp(argv[0], "maxcomment") && argc==2) {
-	int newmax = st->maxcomment;
-	sscanf(argv[1], "%d", &newmax);
-	if(newmax != st->maxcomment) {
-	    SPFLUSH();
-	    st->maxcomment = newmax;
-	    tsl.bytesperspeck =
-		(st->maxcomment+1 + (sizeof(s) - sizeof(s.title)) + 3) & ~3;
-	    maxnsp = sizeof(speckbuf) / tsl.bytesperspeck;
-	}
+	sscanf(argv[1], "%d", &st->maxcomment);
 
     } else {
 	struct valdesc *vdp;
@@ -5194,30 +8135,29 @@ void specks_read( struct stuff **stp, char *fname )
 		    sscanf(argv[m+1], "%f", &s.size);
 		    m += 2;
 		}
-		addchunk( st, 1, SMALLSPECKSIZE(0),
-			speckscale, &s,
-			rejoinargs(m, argc, argv),
-			SMALLSPECKSIZE(0) );
+		labels_add( st, &labels, &s, speckscale,
+			rejoinargs(m, argc, argv) );
 	    }
 	    else if(!strcmp(argv[m], "ellipsoid")) {
 		specks_read_ellipsoid( st, &s.p, argc-m, argv+m, comment );
 
 	    } else {
-		*sp = s;
+		memcpy( sp, &s, tsl.bytesperspeck );
+		titleoff[nsp] = -1;
 		nsp++;
 		sp = NextSpeck( speckbuf, &tsl, nsp );
 	    }
 
 	} else if(comment) {
 	    char *title = comment + (comment[1] == ' ' ? 2 : 1);
-	    *sp = s;
-	    strncpyt(sp->title, title, st->maxcomment+1);
-	    maxfields = MAXVAL+1;	/* "keep titles too" */
+	    memcpy( sp, &s, tsl.bytesperspeck );
+	    titleoff[nsp] = strtab_add( &titles, title, st->maxcomment );
 	    nsp++;
 	    sp = NextSpeck( speckbuf, &tsl, nsp );
 
 	} else {
-	    *sp = s;
+	    memcpy( sp, &s, tsl.bytesperspeck );
+	    titleoff[nsp] = -1;
 	    nsp++;
 	    sp = NextSpeck( speckbuf, &tsl, nsp );
 	}
@@ -5225,6 +8165,10 @@ void specks_read( struct stuff **stp, char *fname )
   }
   fclose(f);
   SPFLUSH();
+  labels_done( st, &labels );
+  geomcache_save( meshcwr );
+  geomcache_close( meshcwr );
+  geomcache_close( meshcrd );
   *stp = st;
 }
 
@@ -5232,6 +8176,7 @@ void specks_read( struct stuff **stp, char *fname )
 int specks_add_box( struct stuff *st, struct AMRbox *box, int timestep )
 {
   int i;
+  boxcache_drop( &st->staticboxcache );
   if(box->level >= 0 && st->boxlevels <= box->level)
     st->boxlevels = box->level+1;
   for(i = 0; i < st->staticboxroom && st->staticboxes[i].level >= 0; i++) {
@@ -5297,6 +8242,9 @@ void specks_read_boxes( struct stuff *st, char *fname, int timebase )
 	    st->boxes = RenewN( st->boxes, struct AMRbox *, needtimes );
 	    memset( &st->boxes[st->boxtimes], 0,
 			(needtimes - st->boxtimes) * sizeof(struct AMRbox *) );
+	    st->boxcache = RenewN( st->boxcache, struct boxcache *, needtimes );
+	    memset( &st->boxcache[st->boxtimes], 0,
+			(needtimes - st->boxtimes) * sizeof(struct boxcache *) );
 	    if(st->boxtimes < ntimes+timebase)
 		st->boxtimes = ntimes+timebase;
 	}
@@ -5322,6 +8270,7 @@ void specks_read_boxes( struct stuff *st, char *fname, int timebase )
 		fname, lno, curtime);
 	    Free( st->boxes[curtime+timebase] );
 	}
+	boxcache_drop( &st->boxcache[curtime+timebase] );
 	boxes = NewN( struct AMRbox, maxbox+1 );
 	for(curbox = 0; curbox <= maxbox; curbox++)
 	    boxes[curbox].level = -(maxbox+1);
@@ -5350,17 +8299,17 @@ void specks_read_boxes( struct stuff *st, char *fname, int timebase )
    */
 }
 
-static struct AMRbox *findboxno( struct AMRbox *box, int boxno, int *count, int *bmin, int *bmax ) {
-  if(box == NULL) return NULL;
-  while(box->level >= 0) {
-    if(box->boxno == boxno)
-	return box;
-    if(*bmin > box->boxno) *bmin = box->boxno;
-    if(*bmax < box->boxno) *bmax = box->boxno;
-    ++*count;
-    box++;
-  } 
-  return NULL;
+static struct AMRbox *findboxno( struct stuff *st, struct AMRbox *boxes, int boxno, int *count, int *bmin, int *bmax ) {
+  struct boxcache *bc;
+  if(boxes == NULL) return NULL;
+  bc = boxcache_get( st, boxes );
+  boxcache_index( bc );
+  *count += bc->count;
+  if(bc->count > 0) {
+    if(*bmin > bc->bmin) *bmin = bc->bmin;
+    if(*bmax < bc->bmax) *bmax = bc->bmax;
+  }
+  return boxcache_find( bc, boxno );
 }
 
 int specks_gobox( struct stuff *st, int boxno, int argc, char *argv[] )
@@ -5371,9 +8320,9 @@ int specks_gobox( struct stuff *st, int boxno, int argc, char *argv[] )
   struct AMRbox *box = NULL;
 
   if(st->boxes && st->curtime < st->boxtimes)
-    box = findboxno( st->boxes[st->curtime], boxno, &count, &bmin, &bmax );
+    box = findboxno( st, st->boxes[st->curtime], boxno, &count, &bmin, &bmax );
   if(box == NULL)
-    box = findboxno( st->staticboxes, boxno, &count, &bmin, &bmax );
+    box = findboxno( st, st->staticboxes, boxno, &count, &bmin, &bmax );
 
   if(box == NULL) {
     if(count == 0)
@@ -5781,7 +8730,7 @@ specks_parse_args( struct stuff **stp, int argc, char *argv[] )
     return 0;
 
   if( st->dyn.enabled && st->dyn.ctlcmd &&
-		(*st->dyn.ctlcmd)( &st->dyn, st, argc, argv ) ) {
+		specks_dyn_ctlcmd( st, argc, argv ) ) {
     /* OK, dyn command handled it */
 
   } else if(!strcmp( argv[0], "?" ) || !strcmp( argv[0], "help" )) {
@@ -6140,6 +9089,39 @@ specks_parse_args( struct stuff **stp, int argc, char *argv[] )
 	if(argc > 1) st->depthsort = getbool(argv[1], st->depthsort);
 	msg("depthsort %s", st->depthsort ? "on" : "off" );
 
+  } else if(!strcmp( argv[0], "speckcols" )) {
+	if(argc > 1) st->usecols = getbool(argv[1], st->usecols);
+	if(!st->usecols) {
+	    struct specklist *sl;
+	    for(sl = st->sl; sl != NULL; sl = sl->next)
+		specks_free_cols( sl );
+	}
+	msg("speckcols %s (column-wise copies of data for recolor/resize/thresh)",
+		st->usecols ? "on" : "off");
+
+  } else if(!strcmp( argv[0], "dynasync" )) {
+#ifdef HAVE_PTHREAD_H
+	if(argc > 1) {
+	    if(!getbool(argv[1], 0))
+		dynasync_stop( st );
+	    else if(st->dyn.getspecks == NULL || !st->dyn.async)
+		msg("dynasync: no dynamic data here that can be computed in the background");
+	    else
+		dynasync_start( st );
+	}
+	msg("dynasync %s (compute dynamic data ahead, in background)",
+		st->dynasync != NULL && st->dynasync->on ? "on" : "off");
+#else
+	msg("dynasync: not available, no threads");
+#endif
+
+  } else if(!strcmp( argv[0], "updthreads" )) {
+	int nworkers;
+	if(argc > 1) updthreads = (argv[1][0] == 'a') ? -1 : atoi(argv[1]);
+	nworkers = taskpool_threads( updthreads < 0 ? -1 : updthreads - 1 );
+	msg("updthreads %d%s (threads for recolor/resize/rethresh; task pool has %d workers)",
+		specks_updthreads(), updthreads < 0 ? " (auto)" : "", nworkers);
+
   } else if(!strcmp( argv[0], "fade" )) {
 	char *fmt = "fade what?";
 	if(argc>1) {
@@ -6484,12 +9466,20 @@ specks_parse_args( struct stuff **stp, int argc, char *argv[] )
 	st->sl = NULL;
 	for(m = st->staticmeshes, st->staticmeshes = NULL; m; m = nm) {
 	    nm = m->next;
+	    elements_free( m->els );
 	    Free(m);
 	}
 	for(e = st->staticellipsoids, st->staticellipsoids = NULL; e; e = ne) {
 	    ne = e->next;
 	    Free(e);
 	}
+	st->ellipsoidseq++;
+
+  } else if(!strcmp( argv[0], "geomcache" )) {
+	if(argc>1) geomcache_enabled = getbool(argv[1], geomcache_active());
+	msg("geomcache %s (%s cache parsed .obj models and meshes)",
+		geomcache_active() ? "on" : "off",
+		geomcache_active() ? "do" : "don't");
 
   } else if(!strcmp( argv[0], "every" )) {
 	if(argc>1) sscanf(argv[1], "%d", &st->subsample);
@@ -6657,8 +9647,12 @@ specks_parse_args( struct stuff **stp, int argc, char *argv[] )
 		  specks_read_cmap( st, realfile, &st->nchromacm, &st->chromacm );
 		}
 		else {
+		    int oldncmap = st->ncmap;
 		    specks_read_cmap( st, realfile, &st->ncmap, &st->cmap );
-		    st->colorseq++; /* Must recompute particle coloring */
+		    if(st->ncmap == oldncmap)
+			st->cmapseq++;	/* same indices, new colors */
+		    else
+			st->colorseq++; /* Must recompute particle coloring */
 		}
 	    } else {
 		msg("%s: can't find \"%s\" nor ....cmap", argv[0], argv[1]);
@@ -6693,8 +9687,12 @@ specks_parse_args( struct stuff **stp, int argc, char *argv[] )
 		realfile = findfile( NULL, tfname );
 	    }
 	    if(realfile != NULL) {
+		int oldncmap = vd->vncmap;
 		specks_read_cmap( st, realfile, &vd->vncmap, &vd->vcmap );
-		st->colorseq++; /* Must recompute particle coloring */
+		if(vd->vncmap == oldncmap)
+		    st->cmapseq++;	/* same indices, new colors */
+		else
+		    st->colorseq++; /* Must recompute particle coloring */
 	    } else {
 		msg("vcmap: can't find \"%s\" nor ....cmap", argv[k]);
 	    }
@@ -6721,7 +9719,7 @@ specks_parse_args( struct stuff **stp, int argc, char *argv[] )
 		if(argc>2) {
 		    char *colorstr = rejoinargs( 2, argc, argv );
 		    editcmap( st, ncmap, cmap, argv[1], argv[0], colorstr );
-		    if(st->sl) st->colorseq++;	/* force recolor */
+		    if(st->sl) st->cmapseq++;	/* force recolor */
 		}
 		cvp = (unsigned char *)&cmap[i].raw;
 		msg( "%scment %d  %.3f %.3f %.3f  (of cmap 0..%d",
@@ -6948,9 +9946,10 @@ specks_parse_args( struct stuff **stp, int argc, char *argv[] )
 		for(j = 0; j < sl->nspecks; j++) {
 		    struct speck *sp = NextSpeck(sl->specks, sl, j);
 		    if(all) {
+			int rgb = SPECKRGB(st, sl, sp, j);
 			fprintf(f, "%.8g %.8g %.8g\t%02x%02x%02x\t%g",
 			    sp->p.x[0],sp->p.x[1],sp->p.x[2],
-			    RGBA_R(sp->rgba), RGBA_G(sp->rgba), RGBA_B(sp->rgba),
+			    RGBA_R(rgb), RGBA_G(rgb), RGBA_B(rgb),
 			    sp->size);
 		    }
 		    if(nmine > 0)
@@ -7257,6 +10256,8 @@ specks_parse_args( struct stuff **stp, int argc, char *argv[] )
   } else if(!strncmp( argv[0], "texture", 7 ) || !strcmp( argv[0], "tx" )) {
 	if(argc > 1 && !strcmp(argv[1], "preload")) {
 	    msg("Preloading textures...");
+	    for(i = 0; i < st->ntextures; i++)
+		if(st->textures[i]) txprefetch( st->textures[i] );
 	    for(i = 0; i < st->ntextures; i++)
 		if(st->textures[i]) txload( st->textures[i] );
 	} else if(argc > 1 && !strncmp(argv[1], "report", 3)) {
@@ -7377,6 +10378,7 @@ specks_parse_args( struct stuff **stp, int argc, char *argv[] )
 		    p->p.x[0] *= s; p->p.x[1] *= s; p->p.x[2] *= s;
 		}
 		sl->scaledby = v;
+		specks_moved( sl );
 	    }
 	}
   } else if(!strcmp( argv[0], "where" ) || !strcmp( argv[0], "w" )) {
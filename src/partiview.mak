@@ -25,7 +25,7 @@ LINK        = link
 LIBS        = $(KIRA_LIB) $(SPICLOPS_LIB) $(FLTK_LIB) $(GL_LIB) $(SYS_LIB)
 
 APP_CSRCS   = geometry.c partibrains.c mgtexture.c textures.c \
-		findfile.c sfont.c version.c shmem.c \
+		findfile.c geomcache.c sfont.c version.c shmem.c \
 		winjunk.c \
 		plugins.c warp.c async.c
 APP_CXXSRCS = partiview.cc partiviewc.cc partipanel.cc Gview.cc Hist.cc \
@@ -36,7 +36,7 @@ APP_CXXSRCS = partiview.cc partiviewc.cc partipanel.cc Gview.cc Hist.cc \
 APP_OBJS    = partiview.obj partiviewc.obj partipanel.obj Gview.obj Hist.obj \
 		Plot.obj geometry.obj partibrains.obj \
 		genericslider.obj Fl_Scroll_Thin.obj \
-		mgtexture.obj textures.obj futil.obj findfile.obj sfont.obj \
+		mgtexture.obj textures.obj futil.obj geomcache.obj findfile.obj sfont.obj \
 		sclock.obj notify.obj async.obj Fl_Log_Slider.obj \
 		version.obj winjunk.obj shmem.obj \
 		plugins.obj warp.obj # parti_model.obj cat_model.obj cat_modelutil.obj
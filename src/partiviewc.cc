@@ -84,7 +84,8 @@ void specks_picker( Fl_Gl_Window *junk, int nhits, int nents, GLuint *hitbuf, vo
 	wpostr[0] = '\0';
     }
     vtfmpoint( &cpos, &wpos, view->Tw2c() );
-    strcpy(fmt, bestsl->bytesperspeck <= SMALLSPECKSIZE(MAXVAL)
+    char *title = specks_speck_title( bestsl, bestspeckno );
+    strcpy(fmt, title == NULL || bestsl->text != NULL
 		? "[g%d]%sPicked %g %g %g%s%.0s @%g (of %d)%s"
 		: "[g%d]%sPicked %g %g %g%s \"%s\" @%g (of %d)%s");
     attrs[0] = '\0';
@@ -99,18 +100,18 @@ void specks_picker( Fl_Gl_Window *junk, int nhits, int nents, GLuint *hitbuf, vo
     }
     if(bestsl->text != NULL) {
 	snprintf(attrs+strlen(attrs), sizeof(attrs)-strlen(attrs),
-		" \"%s\"", bestsl->text);
+		" \"%s\"", title);
     }
 #ifdef FLHACK
     _pview_pickmsg(fmt, bestid, centerit?"*":"",
 	bestpos.x[0],bestpos.x[1],bestpos.x[2], wpostr,
-	bestsl->text ? bestsl->text : sp->title,
+	title ? title : "",
 	vlength( &cpos ), nhits,
 	attrs );
 #else
     msg(fmt, bestid, centerit?"*":"",
 	bestpos.x[0],bestpos.x[1],bestpos.x[2], wpostr,
-	bestsl->text ? bestsl->text : sp->title,
+	title ? title : "",
 	vlength( &cpos ), nhits,
 	attrs );
 #endif
@@ -793,6 +794,11 @@ int parti_snapshot( char *snapinfo )
   enum Gv_Stereo stereowas = ppui.view->stereo();
   char *tfcmd = snapstereo ? tfcmd2 : tfcmd1;
 
+  // Don't catch a recolor/resize still running in the background
+  for(int i = 0; i < MAXSTUFF; i++)
+    if(stuffs[i] && stuffs[i]->useme)
+	specks_sync_frame( stuffs[i] );
+
   int y, h = ppui.view->h(), w = ppui.view->w();
   char *buf = (char *)malloc(w*h*3);
 
@@ -1327,9 +1333,13 @@ static void fd_got_data( int fd, void * ) {
 #ifndef FLHACK
 void parti_asyncfd(int fd) { Fl::add_fd( fd, fd_got_data ); }
 void parti_unasyncfd(int fd) { Fl::remove_fd(fd); }
+void parti_watchfd(int fd, void (*func)(int, void *), void *arg) { Fl::add_fd( fd, func, arg ); }
+void parti_unwatchfd(int fd) { Fl::remove_fd(fd); }
 #else
 void parti_asyncfd(int fd) { }
 void parti_unasyncfd(int fd) { }
+void parti_watchfd(int fd, void (*func)(int, void *), void *arg) { }
+void parti_unwatchfd(int fd) { }
 #endif
 
 static void playidle( void * ) {
@@ -103,6 +103,8 @@ extern int getfloats( float *v, int nfloats, int arg0, int argc, char **argv );
 #ifndef CAVEMENU
 extern void parti_asyncfd( int fd );
 extern void parti_unasyncfd( int fd );
+extern void parti_watchfd( int fd, void (*func)(int fd, void *arg), void *arg );
+extern void parti_unwatchfd( int fd );
 extern int  parti_snapset( char *basename, char *frameno, char *imgsize );
 extern int  parti_snapshot( char *snapinfo );
 extern float parti_pickrange( char *newrange );
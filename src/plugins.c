@@ -44,6 +44,10 @@ void plugin_init() {
 #ifdef USE_CONSTE
   conste_init();
 #endif
+#ifdef HAVE_THREADS
+  stream_init();
+  shmfeed_init();
+#endif
 }
 
 static struct parser *parsers = NULL;   /* PJT: double declared ?? */
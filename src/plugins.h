@@ -16,6 +16,8 @@ extern void warp_init(void);
 extern void parti_ieee_init(void);
 extern void parti_model_init(void);
 extern void conste_init(void);
+extern void stream_init(void);
+extern void shmfeed_init(void);
 
 extern void pp_spi_init(void);
 extern void nethack_init(void);
@@ -8,6 +8,7 @@
  */
 #include <stdio.h>
 #include <math.h>
+#include <stdlib.h>
 
 #ifdef WIN32
 # include <windows.h>
@@ -369,3 +370,98 @@ float sfStrDrawTJ( CONST char *str, float height, CONST Point *base, CONST Matri
     }
     return at.x[0] - atx0;
 }
+
+/*
+ * Glyph strokes as GL_LINES vertex pairs, in units where the font
+ * height is 1.0, built from sfont[] once on first use.
+ */
+static float *sfsegs;			/* x,y of each vertex */
+static int sfglyph0[128+96], sfglyphn[128+96];	/* first vertex, how many */
+
+static void sfGlyphsInit( void )
+{
+    const unsigned char *fs;
+    int c, pass, n, xoff, pen;
+    float x = 0, y = 0, px = 0, py = 0;
+
+    if(sfsegs != NULL)
+	return;
+
+    for(pass = 0; pass < 2; pass++) {	/* count, then fill in */
+	n = 0;
+	for(c = 0; c < sfontchars; c++) {
+	    sfglyph0[c] = n;
+	    sfglyphn[c] = 0;
+	    if((fs = (unsigned char *)sfont[c]) == NULL)
+		continue;
+	    xoff = -82+fs[0];
+	    pen = 0;
+	    for(fs += 2; *fs != '\0' && fs[1] != '\0'; fs++) {
+		if(*fs == ' ') {
+		    pen = 0;
+		    continue;
+		}
+		x = (fs[0]+xoff) / SFONTSCALE;
+		y = (91-fs[1]) / SFONTSCALE;
+		fs++;
+		if(pen) {
+		    if(pass) {
+			sfsegs[2*n] = px;   sfsegs[2*n+1] = py;
+			sfsegs[2*n+2] = x;  sfsegs[2*n+3] = y;
+		    }
+		    n += 2;
+		}
+		px = x, py = y;
+		pen = 1;
+	    }
+	    sfglyphn[c] = n - sfglyph0[c];
+	}
+	if(pass == 0)
+	    sfsegs = (float *)malloc( (2*n+1) * sizeof(float) );
+    }
+}
+
+static int sfGlyphOf( int ch )
+{
+    return (ch >= ' ' && ch < ' '+sfontchars) ? ch - ' ' : 0;
+}
+
+int sfStrStrokeCount( CONST char *str )
+{
+    const unsigned char *s;
+    int n = 0;
+
+    if(str == NULL)
+	return 0;
+    sfGlyphsInit();
+    for(s = (const unsigned char *)str; *s != '\0'; s++)
+	n += sfglyphn[ sfGlyphOf(*s) ];
+    return n;
+}
+
+/*
+ * Lay out str as GL_LINES vertex pairs, writing x,y for each vertex
+ * into xy[] (room for 2*sfStrStrokeCount(str) floats).
+ * Same geometry as sfStrDraw(str, 1.0, NULL).  Returns number of vertices.
+ */
+int sfStrStrokes( CONST char *str, float *xy )
+{
+    const unsigned char *s, *fs;
+    float atx = 0;
+    int c, k, n = 0;
+
+    if(str == NULL)
+	return 0;
+    sfGlyphsInit();
+    for(s = (const unsigned char *)str; *s != '\0'; s++) {
+	c = sfGlyphOf(*s);
+	if((fs = (unsigned char *)sfont[c]) == NULL)
+	    continue;
+	for(k = sfglyph0[c]; k < sfglyph0[c] + sfglyphn[c]; k++, n++) {
+	    xy[2*n] = sfsegs[2*k] + atx;
+	    xy[2*n+1] = sfsegs[2*k+1];
+	}
+	atx += (fs[0] + fs[1]) / SFONTSCALE;
+    }
+    return n;
+}
@@ -21,6 +21,10 @@ extern float sfStrDraw( CONST char *str, float height, CONST Point *base );
 extern float sfStrDrawTJ( CONST char *str, float height, CONST Point *base,
 					CONST Matrix *tfm, CONST char *just );
 
+	/* Cached stroke layout, for drawing many labels at once */
+extern int sfStrStrokeCount( CONST char *str );	/* GL_LINES vertices */
+extern int sfStrStrokes( CONST char *str, float *xy );	/* height=1.0 */
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,436 @@
+/*
+ * Shared-memory particle feed from a co-located simulation; see shmfeed.h.
+ *
+ *   shmfeed PATH	  map the segment a producer made with shmfeed_create(),
+ *			  and show its newest frame, as dynamic data
+ *   shmfeed stop
+ *   shmfeed		  report frames taken, missed and drawn, and latency
+ *			  from producer's publish to frame drawn
+ *
+ * Specks are used in place: each specklist's specks point into the buffer
+ * we currently own, which the producer won't touch until we hand it back.
+ * A watcher thread polls the segment and wakes the display when a new
+ * frame is published, or when the producer re-creates the file.
+ *
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "specks.h"
+#include "partiviewc.h"
+#include "plugins.h"
+
+#if defined(HAVE_THREADS) && defined(HAVE_PTHREAD_H) && !defined(WIN32)
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+#include "shmem.h"
+#include "shmfeed.h"
+
+struct shmfeed_view {
+  char *path;
+  struct shmfeed_head *head;	/* current mapping, or NULL */
+  long long maplen;
+  dev_t dev;
+  ino_t ino;			/* of the file we mapped */
+  struct shmfeed_head *oldhead;	/* previous mapping, unmapped once no longer drawn */
+  long long oldmaplen;
+  int front;			/* buffer we own */
+  int took;			/* have we taken any frame from this mapping? */
+  struct specklist *sl[SHMFEED_NBUF];
+  struct specklist *cur;	/* newest frame we've taken ... */
+  struct shmfeed_head *curhead;	/* ... from this mapping ... */
+  double curpub;		/* ... published then */
+
+  unsigned int lastframe;
+  long taken, missed, drawn, reopened;
+  double lat, latsum, latmax;	/* publish -> drawn, seconds */
+  struct specklist *drawnsl;
+  int drawnseq;
+
+  struct stuff *st;
+  pthread_t th;
+  pthread_mutex_t mut;		/* watcher vs. remapping */
+  int wake[2];
+  volatile int stop, poked, reopen;
+};
+
+static double shmfeed_now()
+{
+  struct timeval tv;
+  gettimeofday( &tv, NULL );
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+static void shmfeed_unmap( struct shmfeed_view *sv )
+{
+  if(sv->head == NULL)
+    return;
+  if(sv->head == sv->curhead) {
+    /* We may still be drawing from it; unmap it once we're not */
+    if(sv->oldhead != NULL)
+	munmap( (void *)sv->oldhead, sv->oldmaplen );
+    sv->oldhead = sv->head;
+    sv->oldmaplen = sv->maplen;
+  } else {
+    munmap( (void *)sv->head, sv->maplen );
+  }
+  sv->head = NULL;
+}
+
+/* Map the segment at sv->path; on success the previous mapping becomes oldhead. */
+static int shmfeed_map( struct shmfeed_view *sv, int complain )
+{
+  struct shmfeed_head *h;
+  struct stat fst;
+  int i, fd;
+
+  if((fd = open( sv->path, O_RDWR )) < 0 || fstat( fd, &fst ) < 0) {
+    if(complain) msg("shmfeed: %s: %s", sv->path, strerror(errno));
+    if(fd >= 0) close( fd );
+    return 0;
+  }
+  if(fst.st_size < (off_t)sizeof(struct shmfeed_head)) {
+    close( fd );
+    if(complain) msg("shmfeed: %s: too short to be a shmfeed segment", sv->path);
+    return 0;
+  }
+  h = (struct shmfeed_head *)mmap( NULL, fst.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if((void *)h == MAP_FAILED) {
+    if(complain) msg("shmfeed: %s: mmap: %s", sv->path, strerror(errno));
+    return 0;
+  }
+  if(memcmp( h->magic, SHMFEED_MAGIC, sizeof(h->magic) ) != 0
+	|| h->order != SHMFEED_ORDER || h->version != SHMFEED_VERSION
+	|| h->maplen > fst.st_size)
+    goto bad;
+  for(i = 0; i < SHMFEED_NBUF; i++) {
+    struct shmfeed_buf *b = &h->buf[i];
+    if(b->offset < (long long)sizeof(*h) || b->room < 0 || b->offset + b->room > h->maplen
+		|| b->ncols < 0 || b->ncols > MAXVAL
+		|| SMALLSPECKSIZE(b->ncols) != SHMFEED_RECBYTES(b->ncols))
+	goto bad;
+  }
+
+  pthread_mutex_lock( &sv->mut );
+  shmfeed_unmap( sv );
+  sv->head = h;
+  sv->maplen = fst.st_size;
+  sv->dev = fst.st_dev;
+  sv->ino = fst.st_ino;
+  sv->front = 2;		/* by convention; see shmfeed_create() */
+  sv->took = 0;
+  sv->reopen = 0;
+  sv->poked = 0;
+  pthread_mutex_unlock( &sv->mut );
+  h->consumer_pid = getpid();
+  return 1;
+
+ bad:
+  if(complain) msg("shmfeed: %s isn't a (version %d) shmfeed segment with our byte order",
+			sv->path, SHMFEED_VERSION);
+  munmap( (void *)h, fst.st_size );
+  return 0;
+}
+
+static void shmfeed_poke( struct shmfeed_view *sv )
+{
+  char c = 0;
+  if(write( sv->wake[1], &c, 1 ) < 0 && errno != EAGAIN)
+    perror("shmfeed: write");
+}
+
+static void *shmfeed_watch( void *arg )
+{
+  struct shmfeed_view *sv = (struct shmfeed_view *)arg;
+  double nextstat = 0;
+
+  while(!sv->stop) {
+    pthread_mutex_lock( &sv->mut );
+    if(sv->head != NULL && (sv->head->mid & SHMFEED_DIRTY) && !sv->poked) {
+	sv->poked = 1;
+	shmfeed_poke( sv );
+    }
+    pthread_mutex_unlock( &sv->mut );
+
+    if(shmfeed_now() >= nextstat) {
+	/* Did the producer start over, with a new file? */
+	struct stat fst;
+	pthread_mutex_lock( &sv->mut );
+	if(stat( sv->path, &fst ) == 0 && !sv->reopen
+		&& (sv->head == NULL || fst.st_ino != sv->ino || fst.st_dev != sv->dev)) {
+	    sv->reopen = 1;
+	    shmfeed_poke( sv );
+	}
+	pthread_mutex_unlock( &sv->mut );
+	nextstat = shmfeed_now() + 0.1;
+    }
+    usleep( 1000 );
+  }
+  return NULL;
+}
+
+#if !CAVEMENU
+static void shmfeed_woke( int fd, void *arg )
+{
+  struct shmfeed_view *sv = (struct shmfeed_view *)arg;
+  char buf[256];
+  while(read( fd, buf, sizeof(buf) ) > 0)
+    ;
+  sv->st->dyn.slvalid = 0;	/* so specks_set_timestep() asks us again */
+  parti_redraw();
+}
+#endif
+
+/* Take the newest published buffer, if any, giving ours back. */
+static struct specklist *shmfeed_get_parti( struct dyndata *dd, struct stuff *st, double realtime )
+{
+  struct shmfeed_view *sv = (struct shmfeed_view *)dd->data;
+  struct shmfeed_buf *b;
+  struct specklist *sl;
+  int old, k, maxspecks;
+
+  if(sv->oldhead != NULL && sv->oldhead != sv->curhead) {	/* nothing points into it now */
+    munmap( (void *)sv->oldhead, sv->oldmaplen );
+    sv->oldhead = NULL;
+  }
+  if(sv->reopen) {
+    if(shmfeed_map( sv, 0 ))
+	sv->reopened++;
+    else
+	sv->reopen = 0;		/* not ready yet?  watcher will notice again */
+  }
+
+  if(sv->head == NULL || !(sv->head->mid & SHMFEED_DIRTY))
+    return sv->cur;
+
+  __sync_synchronize();		/* done with our old front buffer */
+  old = __sync_lock_test_and_set( &sv->head->mid, sv->front );
+  sv->front = old & ~SHMFEED_DIRTY;
+  sv->poked = 0;
+
+  b = &sv->head->buf[sv->front];
+  if(sv->sl[sv->front] == NULL) {
+    sv->sl[sv->front] = NewN( struct specklist, 1 );
+    memset( sv->sl[sv->front], 0, sizeof(struct specklist) );
+  }
+  sl = sv->sl[sv->front];
+  specks_free_derived( sl );
+  sl->bytesperspeck = SHMFEED_RECBYTES(b->ncols);
+  maxspecks = b->room / sl->bytesperspeck;
+  sl->nspecks = (b->nspecks < 0) ? 0 : (b->nspecks > maxspecks) ? maxspecks : b->nspecks;
+  sl->specks = (struct speck *)((char *)sv->head + b->offset);
+  sl->scaledby = 1;
+  sl->speckseq = ++st->speckseq;
+  sl->colorseq = sl->sizeseq = sl->threshseq = -1;
+  if(sl->nsel < sl->nspecks) {
+    if(sl->sel) Free( sl->sel );
+    sl->sel = NewN( SelMask, sl->nspecks + sl->nspecks/4 + 1 );
+    sl->nsel = sl->nspecks + sl->nspecks/4 + 1;
+  }
+  memset( sl->sel, 0, sl->nspecks*sizeof(SelMask) );
+  sl->selseq++;
+
+  if(sv->taken > 0 && b->frameno > sv->lastframe + 1)
+    sv->missed += b->frameno - sv->lastframe - 1;
+  sv->lastframe = b->frameno;
+  sv->taken++;
+
+  for(k = 0; k < b->ncols; k++) {
+    struct valdesc *vdp = &st->vdesc[st->curdata][k];
+    if(vdp->name[0] == '\0' && b->name[k][0] != '\0') {
+	strncpy( vdp->name, b->name[k], sizeof(vdp->name)-1 );
+	vdp->name[sizeof(vdp->name)-1] = '\0';
+    }
+  }
+  if(!sv->took && sl->nspecks > 0) {
+    /* Set data ranges from the first frame, as if we'd read it from a file */
+    struct speck *p;
+    int i;
+    for(k = 0; k < b->ncols; k++) {
+	struct valdesc *vdp = &st->vdesc[st->curdata][k];
+	float min, max, sum = 0;
+	min = max = sl->specks->val[k];
+	for(i = 0, p = sl->specks; i < sl->nspecks; i++, p = NextSpeck(p, sl, 1)) {
+	    if(min > p->val[k]) min = p->val[k];
+	    else if(max < p->val[k]) max = p->val[k];
+	    sum += p->val[k];
+	}
+	vdp->min = min;
+	vdp->max = max;
+	vdp->sum = sum;
+	vdp->nsamples = sl->nspecks;
+	vdp->mean = sum / sl->nspecks;
+    }
+  }
+  sv->took = 1;
+  sv->cur = sl;
+  sv->curhead = sv->head;
+  sv->curpub = b->pubtime;
+  return sl;
+}
+
+/* Called just before drawing: note how long this frame took to get here. */
+static int shmfeed_draw( struct dyndata *dd, struct stuff *st, struct specklist *slhead,
+			Matrix *Tc2w, float radperpix )
+{
+  struct shmfeed_view *sv = (struct shmfeed_view *)dd->data;
+
+  if(slhead != NULL && slhead == sv->cur
+		&& (sv->drawnsl != slhead || sv->drawnseq != slhead->speckseq)) {
+    sv->lat = shmfeed_now() - sv->curpub;
+    sv->latsum += sv->lat;
+    if(sv->latmax < sv->lat) sv->latmax = sv->lat;
+    sv->drawn++;
+    sv->drawnsl = slhead;
+    sv->drawnseq = slhead->speckseq;
+  }
+  return 0;
+}
+
+static void shmfeed_free( struct dyndata *dd, struct stuff *st )
+{
+  struct shmfeed_view *sv = (struct shmfeed_view *)dd->data;
+  int i;
+
+  sv->stop = 1;
+  pthread_join( sv->th, NULL );
+#if !CAVEMENU
+  parti_unwatchfd( sv->wake[0] );
+#endif
+  close( sv->wake[0] );
+  close( sv->wake[1] );
+  if(st->sl != NULL && st->sl == sv->cur)
+    st->sl = NULL;
+  if(st->frame_sl != NULL && st->frame_sl == sv->cur)
+    st->frame_sl = NULL;
+  sv->cur = NULL;
+  sv->curhead = NULL;
+  for(i = 0; i < SHMFEED_NBUF; i++) {
+    struct specklist *sl = sv->sl[i];
+    if(sl == NULL)
+	continue;
+    specks_free_derived( sl );
+    if(sl->sel) Free( sl->sel );
+    Free( sl );
+  }
+  if(sv->head) sv->head->consumer_pid = 0;
+  shmfeed_unmap( sv );
+  if(sv->oldhead) munmap( (void *)sv->oldhead, sv->oldmaplen );
+  pthread_mutex_destroy( &sv->mut );
+  Free( sv->path );
+  Free( sv );
+  memset( dd, 0, sizeof(*dd) );
+}
+
+static void shmfeed_report( struct shmfeed_view *sv )
+{
+  msg("shmfeed %s (%s): %ld frames taken, %ld missed, %ld drawn; latency %.2f ms, mean %.2f, max %.2f%s",
+	sv->path,
+	sv->head == NULL ? "not mapped"
+	  : sv->head->producer_pid > 0 && kill( sv->head->producer_pid, 0 ) == 0 ? "producer running"
+	  : "no producer",
+	sv->taken, sv->missed, sv->drawn,
+	1000*sv->lat, sv->drawn ? 1000*sv->latsum/sv->drawn : 0.0, 1000*sv->latmax,
+	sv->reopened ? "; producer restarted" : "");
+}
+
+static int shmfeed_ctlcmd( struct dyndata *dd, struct stuff *st, int argc, char **argv );
+
+static int shmfeed_parse_args( struct stuff **stp, int argc, char *argv[], char *fname, void *etc )
+{
+  struct stuff *st = *stp;
+  struct shmfeed_view *sv;
+
+  if(argc < 1 || strcmp( argv[0], "shmfeed" ) != 0)
+    return 0;
+  if(st->dyn.ctlcmd == shmfeed_ctlcmd)
+    return shmfeed_ctlcmd( &st->dyn, st, argc, argv );
+  if(argc < 2 || !strcmp( argv[1], "stop" )) {
+    msg("shmfeed: not running.  Usage: shmfeed SEGMENTFILE | stop");
+    return 1;
+  }
+
+  sv = NewN( struct shmfeed_view, 1 );
+  memset( sv, 0, sizeof(*sv) );
+  sv->path = shmstrdup( argv[1] );
+  sv->st = st;
+  pthread_mutex_init( &sv->mut, NULL );
+  if(!shmfeed_map( sv, 1 ) || pipe( sv->wake ) < 0) {
+    shmfeed_unmap( sv );
+    pthread_mutex_destroy( &sv->mut );
+    Free( sv->path );
+    Free( sv );
+    return 1;
+  }
+  fcntl( sv->wake[0], F_SETFL, fcntl( sv->wake[0], F_GETFL ) | O_NONBLOCK );
+  fcntl( sv->wake[1], F_SETFL, fcntl( sv->wake[1], F_GETFL ) | O_NONBLOCK );
+  if(pthread_create( &sv->th, NULL, shmfeed_watch, sv ) != 0) {
+    msg("shmfeed: pthread_create: %s", strerror(errno));
+    close( sv->wake[0] );
+    close( sv->wake[1] );
+    shmfeed_unmap( sv );
+    pthread_mutex_destroy( &sv->mut );
+    Free( sv->path );
+    Free( sv );
+    return 1;
+  }
+
+  if(st->dyn.free)
+    (*st->dyn.free)( &st->dyn, st );
+  memset( &st->dyn, 0, sizeof(st->dyn) );
+  st->dyn.data = sv;
+  st->dyn.getspecks = shmfeed_get_parti;
+  st->dyn.draw = shmfeed_draw;
+  st->dyn.ctlcmd = shmfeed_ctlcmd;
+  st->dyn.free = shmfeed_free;
+  st->dyn.async = 0;		/* we hand buffers back to the producer as we take new ones */
+  st->dyn.enabled = 1;
+#if !CAVEMENU
+  parti_watchfd( sv->wake[0], shmfeed_woke, sv );
+#endif
+  return 1;
+}
+
+static int shmfeed_ctlcmd( struct dyndata *dd, struct stuff *st, int argc, char **argv )
+{
+  struct shmfeed_view *sv = (struct shmfeed_view *)dd->data;
+
+  if(argc < 1 || strcmp( argv[0], "shmfeed" ) != 0)
+    return 0;
+  if(argc == 1) {
+    shmfeed_report( sv );
+  } else if(!strcmp( argv[1], "stop" ) || !strcmp( argv[1], "off" )) {
+    shmfeed_free( dd, st );
+  } else {
+    /* a different segment: start over */
+    shmfeed_free( dd, st );
+    return shmfeed_parse_args( &st, argc, argv, NULL, NULL );
+  }
+  return 1;
+}
+
+void shmfeed_init() {
+  parti_add_reader( shmfeed_parse_args, "shmfeed", NULL );
+  parti_add_commands( shmfeed_parse_args, "shmfeed", NULL );
+}
+
+#else /* no threads, or no mmap */
+
+void shmfeed_init() { }
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _SHMFEED_H
+#define _SHMFEED_H
+/*
+ * Shared-memory particle feed: layout of the segment, and the producer's
+ * side of it (shmfeedput.c), for a simulation running on the same host
+ * as partiview.  partiview's "shmfeed" command (shmfeed.c) is the consumer.
+ *
+ * The segment is a file (best on tmpfs, e.g. /dev/shm/...) holding a
+ * header and three particle buffers, triple-buffered:  the producer
+ * always owns one ("back"), the consumer owns one ("front"), and the
+ * third is handed between them by atomic exchange of head->mid.
+ * Neither side ever waits for the other.  A frame the consumer never
+ * took is simply replaced by the next one.
+ *
+ * Particle records use partiview's own speck layout, so the consumer can
+ * draw them in place, without copying:
+ *	float x, y, z;  int rgba;  float size;  float val[ncols];
+ * rgba and size are scratch space: partiview computes them from val[].
+ *
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHMFEED_MAGIC	"PVSHMF\n"
+#define SHMFEED_VERSION	1
+#define SHMFEED_ORDER	0x01020304	/* tells us if the segment has our byte order */
+#define SHMFEED_NBUF	3
+#define SHMFEED_DIRTY	0x4		/* in head->mid: published, not yet taken */
+#define SHMFEED_MAXCOLS	29
+#define SHMFEED_NAMELEN	16
+
+#define SHMFEED_RECBYTES(ncols)	( (5 + (ncols)) * 4 )
+
+struct shmfeed_buf {
+  long long offset;		/* of particle records, from start of segment */
+  long long room;		/* bytes there */
+  int nspecks, ncols;
+  unsigned int frameno;		/* producer's, counting from 0 */
+  int unused;
+  double time;			/* simulation time */
+  double pubtime;		/* gettimeofday() seconds when published, for latency */
+  char name[SHMFEED_MAXCOLS][SHMFEED_NAMELEN];	/* of val[] fields */
+};
+
+struct shmfeed_head {
+  char magic[8];
+  int version, order;
+  long long maplen;
+  int producer_pid, consumer_pid;
+  volatile int mid;		/* buffer in the middle, | SHMFEED_DIRTY.  Only exchanged atomically. */
+  int unused;
+  struct shmfeed_buf buf[SHMFEED_NBUF];
+};
+
+	/* Producer side */
+typedef struct shmfeed ShmFeed;
+
+	/* Create (or re-create) the segment, with room for maxspecks
+	 * particles of ncols values each in each buffer.
+	 */
+extern ShmFeed *shmfeed_create( const char *path, int maxspecks, int ncols );
+extern void  shmfeed_name( ShmFeed *sf, int col, const char *name );
+	/* Records to fill in for the next frame: maxspecks*SHMFEED_RECBYTES(ncols) bytes */
+extern float *shmfeed_frame( ShmFeed *sf );
+	/* Hand the filled-in frame to the consumer.  Never blocks. */
+extern void  shmfeed_publish( ShmFeed *sf, int nspecks, double time );
+extern void  shmfeed_close( ShmFeed *sf );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_SHMFEED_H*/
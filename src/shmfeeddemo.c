@@ -0,0 +1,103 @@
+/*
+ * Test producer for partiview's "shmfeed" command: publishes frames of a
+ * synthetic, differentially-rotating disk through a shared-memory segment.
+ *
+ *   shmfeeddemo [options] [segmentfile]	then in partiview:  shmfeed segmentfile
+ *
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "shmfeed.h"
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday( &tv, NULL );
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+int main( int argc, char *argv[] )
+{
+  int nspecks = 100000, ncols = 3, nframes = -1;
+  double fps = 30, dt = 0.01, t0;
+  char *path = "/dev/shm/partiview.shm";
+  ShmFeed *sf;
+  float *r, *th;
+  int c, i, k, frameno, nf;
+
+  while((c = getopt( argc, argv, "n:r:f:c:t:" )) != EOF) {
+    switch(c) {
+    case 'n': nspecks = atoi(optarg); break;
+    case 'r': fps = atof(optarg); break;
+    case 'f': nframes = atoi(optarg); break;
+    case 'c': ncols = atoi(optarg); break;
+    case 't': dt = atof(optarg); break;
+    default: optind = argc+1; break;
+    }
+  }
+  if(optind < argc)
+    path = argv[optind++];
+  if(optind != argc || nspecks < 0 || ncols < 0 || ncols > SHMFEED_MAXCOLS) {
+    fprintf(stderr, "Usage: %s [options] [segmentfile]\n\
+Publishes frames of a rotating disk to partiview's \"shmfeed segmentfile\".\n\
+Options:\n\
+   -n nspecks	particles per frame (default 100000)\n\
+   -r fps	frames per second, 0 => as fast as possible (default 30)\n\
+   -f nframes	stop after that many (default: run forever)\n\
+   -c ncols	data columns per particle, up to %d (default 3: radius speed id)\n\
+   -t dt	simulated time per frame (default 0.01)\n\
+segmentfile defaults to /dev/shm/partiview.shm\n", argv[0], SHMFEED_MAXCOLS);
+    exit(1);
+  }
+
+  if((sf = shmfeed_create( path, nspecks, ncols )) == NULL)
+    exit(1);
+  for(k = 0; k < ncols; k++) {
+    char name[SHMFEED_NAMELEN];
+    if(k < 3) strcpy( name, k==0 ? "radius" : k==1 ? "speed" : "id" );
+    else sprintf( name, "col%d", k );
+    shmfeed_name( sf, k, name );
+  }
+
+  r = (float *)malloc( (nspecks+1) * sizeof(float) );
+  th = (float *)malloc( (nspecks+1) * sizeof(float) );
+  srand48( 1 );
+  for(i = 0; i < nspecks; i++) {
+    r[i] = 0.1 + 10*drand48();
+    th[i] = 2*M_PI*drand48();
+  }
+
+  nf = 5 + ncols;		/* floats per record */
+  t0 = now();
+  for(frameno = 0; nframes < 0 || frameno < nframes; frameno++) {
+    double t = frameno * dt;
+    float *rec = shmfeed_frame( sf );
+    for(i = 0; i < nspecks; i++, rec += nf) {
+	float speed = 1 / sqrt( r[i] );
+	float a = th[i] + t * speed / r[i] * 20;
+	rec[0] = r[i] * cos(a);
+	rec[1] = r[i] * sin(a);
+	rec[2] = 0.2 * sin( 3*a + r[i] );
+	/* rec[3], rec[4]: rgba and size, partiview's to fill in */
+	for(k = 0; k < ncols; k++)
+	    rec[5+k] = (k == 0) ? r[i] : (k == 1) ? speed : (k == 2) ? i : k;
+    }
+    shmfeed_publish( sf, nspecks, t );
+    if(fps > 0) {
+	double wait = t0 + (frameno+1) / fps - now();
+	if(wait > 0)
+	    usleep( (int)(wait * 1e6) );
+    }
+  }
+  shmfeed_close( sf );
+  fprintf(stderr, "%s: published %d frames in %.3g sec\n", argv[0], frameno, now() - t0);
+  return 0;
+}
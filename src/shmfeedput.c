@@ -0,0 +1,122 @@
+/*
+ * Producer side of the shared-memory particle feed; see shmfeed.h.
+ * Needs nothing else from partiview, so a simulation can just compile it in.
+ *
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+#include "shmfeed.h"
+
+#define SHMFEEDALIGN	4096
+
+struct shmfeed {
+  struct shmfeed_head *head;
+  long long maplen;
+  int back;			/* buffer we're filling */
+  unsigned int frameno;
+  char names[SHMFEED_MAXCOLS][SHMFEED_NAMELEN];
+};
+
+ShmFeed *shmfeed_create( const char *path, int maxspecks, int ncols )
+{
+  struct shmfeed_head *h;
+  long long room, off;
+  ShmFeed *sf;
+  int fd, i;
+
+  if(maxspecks < 0 || ncols < 0 || ncols > SHMFEED_MAXCOLS) {
+    fprintf(stderr, "shmfeed_create(%s): can't handle %d particles of %d values\n",
+	path, maxspecks, ncols);
+    return NULL;
+  }
+  room = ((long long)maxspecks * SHMFEED_RECBYTES(ncols) + SHMFEEDALIGN-1) & ~(long long)(SHMFEEDALIGN-1);
+  off = (sizeof(struct shmfeed_head) + SHMFEEDALIGN-1) & ~(long long)(SHMFEEDALIGN-1);
+
+  /* A fresh file, so a consumer still mapping an old one isn't confused */
+  unlink( path );
+  fd = open( path, O_RDWR|O_CREAT|O_TRUNC, 0666 );
+  if(fd < 0 || ftruncate( fd, off + SHMFEED_NBUF*room ) < 0) {
+    fprintf(stderr, "shmfeed_create(%s): %s\n", path, strerror(errno));
+    if(fd >= 0) close(fd);
+    return NULL;
+  }
+  h = (struct shmfeed_head *)mmap( NULL, off + SHMFEED_NBUF*room,
+			PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if((void *)h == MAP_FAILED) {
+    fprintf(stderr, "shmfeed_create(%s): mmap: %s\n", path, strerror(errno));
+    return NULL;
+  }
+
+  memset( h, 0, sizeof(*h) );
+  h->version = SHMFEED_VERSION;
+  h->order = SHMFEED_ORDER;
+  h->maplen = off + SHMFEED_NBUF*room;
+  h->producer_pid = getpid();
+  for(i = 0; i < SHMFEED_NBUF; i++) {
+    h->buf[i].offset = off + i*room;
+    h->buf[i].room = room;
+    h->buf[i].ncols = ncols;
+  }
+  h->mid = 1;			/* we start with buffer 0; consumer with 2 */
+  __sync_synchronize();
+  memcpy( h->magic, SHMFEED_MAGIC, sizeof(h->magic) );	/* last: now it's valid */
+
+  sf = (ShmFeed *)malloc( sizeof(ShmFeed) );
+  memset( sf, 0, sizeof(*sf) );
+  sf->head = h;
+  sf->maplen = h->maplen;
+  sf->back = 0;
+  return sf;
+}
+
+void shmfeed_name( ShmFeed *sf, int col, const char *name )
+{
+  if(col >= 0 && col < SHMFEED_MAXCOLS)
+    strncpy( sf->names[col], name, SHMFEED_NAMELEN-1 );
+}
+
+float *shmfeed_frame( ShmFeed *sf )
+{
+  return (float *)((char *)sf->head + sf->head->buf[sf->back].offset);
+}
+
+void shmfeed_publish( ShmFeed *sf, int nspecks, double time )
+{
+  struct shmfeed_buf *b = &sf->head->buf[sf->back];
+  struct timeval tv;
+  int old;
+
+  if((long long)nspecks * SHMFEED_RECBYTES(b->ncols) > b->room)
+    nspecks = b->room / SHMFEED_RECBYTES(b->ncols);
+  b->nspecks = nspecks;
+  b->frameno = sf->frameno++;
+  b->time = time;
+  memcpy( b->name, sf->names, sizeof(b->name) );
+  gettimeofday( &tv, NULL );
+  b->pubtime = tv.tv_sec + 1e-6*tv.tv_usec;
+
+  __sync_synchronize();		/* all of the above, before the consumer can see it */
+  old = __sync_lock_test_and_set( &sf->head->mid, sf->back | SHMFEED_DIRTY );
+  sf->back = old & ~SHMFEED_DIRTY;
+}
+
+void shmfeed_close( ShmFeed *sf )
+{
+  if(sf == NULL)
+    return;
+  sf->head->producer_pid = 0;
+  munmap( (void *)sf->head, sf->maplen );
+  free( sf );
+}
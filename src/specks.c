@@ -7,8 +7,41 @@
 #include <string.h>
 #include "partiviewc.h"		/* for msg() */
 
-	/* only safe if lock held */
-static struct specklist **specks_timespecksptr( struct stuff *, int dataset, int timestep );
+/*
+ * anima[][] slots are published without locks.  Readers -- the display
+ * thread, or any thread between specks_pin() and specks_unpin() -- just
+ * load the slot.  Writers swap a slot's list with compare-and-swap.
+ * st->smut only serializes specks_ensuretime(), which moves every slot
+ * of a row into a larger one:  it marks each old slot SLOT_MOVED, so
+ * writers wait for the new row, while readers still see the old value.
+ *
+ * Nothing taken out of a slot (nor an outgrown row) is freed at once.
+ * It's retired, stamped with the current epoch, and freed by
+ * specks_reclaim() once the display thread has started a later epoch
+ * and no pinned thread entered at or before that one.
+ */
+
+struct specksretired {
+  struct specksretired *next;
+  unsigned int epoch;		/* st->epoch when retired */
+  struct specklist *sl;		/* list to free, or NULL */
+  void *mem;			/* or old anima[] row */
+};
+
+#define SLOT_MOVED	((size_t)1)	/* low bit of a slot in an outgrown row */
+#define SLOT(row, t)	(((struct specklist * volatile *)(row))[t])
+#define ISMOVED(sl)	((size_t)(sl) & SLOT_MOVED)
+
+#ifdef HAVE_PTHREAD_H
+# include <sched.h>
+# define MEMBAR()		__sync_synchronize()
+# define CAS(p, old, new)	__sync_bool_compare_and_swap( (p), (old), (new) )
+# define YIELD()		sched_yield()
+#else
+# define MEMBAR()
+# define CAS(p, old, new)	(*(p) == (old) ? (*(p) = (new), 1) : 0)
+# define YIELD()
+#endif
 
 #ifdef HAVE_PTHREAD_H
 void specks_lock_init( struct stuff *st )
@@ -18,6 +51,7 @@ void specks_lock_init( struct stuff *st )
     pthread_mutexattr_settype( &ma, PTHREAD_MUTEX_ERRORCHECK );
     pthread_mutex_init( &st->smut, &ma );
     pthread_mutexattr_destroy( &ma );
+    st->epoch = 1;		/* 0 in st->pinned[] means "not pinned" */
 }
 
 void specks_lock( struct stuff *st )
@@ -36,81 +70,195 @@ void specks_unlock( struct stuff *st )
     }
 }
 #else /* no pthreads */
-void specks_lock_init( struct stuff *st ) {}
+void specks_lock_init( struct stuff *st ) { st->epoch = 1; }
 void specks_lock( struct stuff *st ) {}
 void specks_unlock( struct stuff *st ) {}
 #endif
 
+static struct specklist **anima_row( struct stuff *st, int dataset )
+{
+    struct specklist **row = ((struct specklist ** volatile *)st->anima)[dataset];
+    MEMBAR();
+    return row;
+}
+
 struct specklist *specks_timespecks( struct stuff *st, int dataset, int timestep )
 {
-    struct specklist *sl;
-    specks_lock( st );
-    sl = (timestep >= 0 && timestep < st->ntimes &&
-			dataset >= 0 && dataset < st->ndata)
-	? st->anima[dataset][timestep] : NULL;
-    specks_unlock( st );
-    return sl;
+    struct specklist **row;
+    int ntimes = *(volatile int *)&st->ntimes;
+    int ndata = *(volatile int *)&st->ndata;
+
+    if(timestep < 0 || timestep >= ntimes || dataset < 0 || dataset >= ndata)
+	return NULL;
+    MEMBAR();	/* rows are published before the counts that admit us to them */
+    row = anima_row( st, dataset );
+    if(row == NULL)
+	return NULL;
+    return (struct specklist *)((size_t)SLOT(row, timestep) & ~SLOT_MOVED);
+}
+
+static void specks_retire( struct stuff *st, struct specklist *sl, void *mem )
+{
+    struct specksretired *r, *old;
+
+    if(sl == NULL && mem == NULL)
+	return;
+    r = NewN( struct specksretired, 1 );
+    r->sl = sl;
+    r->mem = mem;
+    MEMBAR();	/* unlinked before we read the epoch */
+    r->epoch = st->epoch;
+    do {
+	old = st->retired;
+	r->next = old;
+    } while(!CAS( &st->retired, old, r ));
 }
 
 void specks_insertspecks( struct stuff *st, int dataset, int timestep, struct specklist *sl )
 {
-    struct specklist **slp;
+    struct specklist **row, *head;
 
-    if(dataset < 0 || timestep < 0)
+    int pin;
+
+    if(dataset < 0 || dataset >= MAXFILES || timestep < 0)
 	return;
     specks_ensuretime( st, dataset, timestep );
 
-    specks_lock( st );
-    slp = &st->anima[dataset][timestep];
-    sl->next = *slp;
-    *slp = sl;
-    specks_unlock( st );
+    pin = specks_pin( st );	/* so the row we look at can't be freed */
+    for(;;) {
+	row = anima_row( st, dataset );
+	head = SLOT(row, timestep);
+	if(ISMOVED(head)) {	/* row being regrown; wait for the new one */
+	    YIELD();
+	    continue;
+	}
+	sl->next = head;
+	if(CAS( &row[timestep], head, sl ))
+	    break;
+    }
+    specks_unpin( st, pin );
 }
 
 
 static void specks_freenow( struct specklist **slp )
 {
   struct specklist *sl, **sprev;
-  int any = 0;
 
   for(sprev = slp; (sl = *sprev) != NULL; ) {
     *sprev = sl->next;
     if(sl->specks != NULL)
 	Free(sl->specks);
+    if(sl->sel != NULL)
+	Free(sl->sel);
+    specks_free_strings( sl );
+    specks_free_derived( sl );
     Free(sl);
   }
 }
 
-static int specks_freeoldscrap( struct specklist **slp, int maxage )
+static int specks_ondisplay( struct stuff *st, struct specklist *sl )
 {
-  struct specklist *sl, **sprev;
-  int any = 0;
-
-  for(sprev = slp; (sl = *sprev) != NULL && sl->used <= maxage; ) {
-    if(sl->used <= maxage) {
-	*sprev = sl->freelink;
-	if(sl->specks != NULL)
-	    Free(sl->specks);
-	Free(sl);
+  for( ; sl != NULL; sl = sl->next)
+    if(sl == st->sl || sl == st->frame_sl)
+	return 1;
+  return 0;
+}
+
+/*
+ * Free whatever was retired before every epoch still in use.
+ * Returns the number of things freed.
+ */
+static int specks_freeretired( struct stuff *st )
+{
+  struct specksretired *r, *rnext, *keep = NULL, *last = NULL, *old;
+  unsigned int oldest = st->epoch;
+  int i, any = 0;
+
+  if(!CAS( &st->reclaiming, 0, 1 ))
+    return 0;			/* someone else is at it */
+
+  for(i = 0; i < MAXPINS; i++) {
+    unsigned int p = st->pinned[i];
+    if(p != 0 && (int)(p - oldest) < 0)
+	oldest = p;
+  }
+  do {
+    r = st->retired;
+  } while(!CAS( &st->retired, r, NULL ));
+
+  for( ; r != NULL; r = rnext) {
+    rnext = r->next;
+    if((int)(r->epoch - oldest) < 0 && !specks_ondisplay( st, r->sl )) {
+	specks_freenow( &r->sl );
+	if(r->mem != NULL)
+	    Free(r->mem);
+	Free(r);
 	any++;
     } else {
-	/* too recent - might still be in use */
-	sprev = &sl->freelink;
+	/* might still be in use */
+	if(keep == NULL) last = r;
+	r->next = keep;
+	keep = r;
     }
   }
+  if(keep != NULL) {
+    do {
+	old = st->retired;
+	last->next = old;
+    } while(!CAS( &st->retired, old, keep ));
+  }
+  MEMBAR();
+  st->reclaiming = 0;
   return any;
 }
 
-void specks_discard( struct stuff *st, struct specklist **slp )
+/*
+ * Display thread, once per frame, when it holds nothing from anima[][]
+ * but st->sl and st->frame_sl:  start a new epoch, and free what's safe.
+ */
+void specks_reclaim( struct stuff *st )
 {
-  struct specklist *sl, *slnext;
+  unsigned int e = st->epoch + 1;
+
+  st->epoch = (e == 0) ? 1 : e;
+  MEMBAR();
+  specks_freeretired( st );
+}
 
-  for(sl = *slp; sl != NULL; sl = slnext) {
-    slnext = sl->next;
-    sl->freelink = st->scrap;
-    st->scrap = sl;
+/*
+ * Other threads, around any use of anima[][] or lists from it
+ * (specks_timespecks() etc.).  Keep it short: nothing retired
+ * from then on can be freed until unpinned.
+ */
+int specks_pin( struct stuff *st )
+{
+  int i;
+
+  for(;;) {
+    for(i = 0; i < MAXPINS; i++) {
+	unsigned int e = st->epoch;
+	if(st->pinned[i] == 0 && CAS( &st->pinned[i], 0, e )) {
+	    MEMBAR();
+	    return i;
+	}
+    }
+    YIELD();		/* all MAXPINS in use */
   }
+}
+
+void specks_unpin( struct stuff *st, int pin )
+{
+  MEMBAR();
+  if(pin >= 0 && pin < MAXPINS)
+    st->pinned[pin] = 0;
+}
+
+void specks_discard( struct stuff *st, struct specklist **slp )
+{
+  struct specklist *sl = *slp;
+
   *slp = NULL;
+  specks_retire( st, sl, NULL );
 }
 
 int specks_purge( void *vst, int nbytes, void *aarena )
@@ -118,7 +266,7 @@ int specks_purge( void *vst, int nbytes, void *aarena )
   struct stuff *st = (struct stuff *)vst;
   int oldused = st->used;
   int oldtime = -1, oldds = -1;
-  int t, ds;
+  int t, ds, pin;
   struct specklist *sl;
 
 #ifdef sgi
@@ -133,17 +281,16 @@ int specks_purge( void *vst, int nbytes, void *aarena )
   }
 #endif
 
-  /* Free any known scrap first */
-
-#define OLD_ENOUGH  4
+  /* Free anything retired that's now safe first */
 
-  if(specks_freeoldscrap( &st->scrap, st->used - OLD_ENOUGH ) > 0)
+  if(specks_freeretired( st ) > 0)
     return 1;
 
+  pin = specks_pin( st );	/* we may be on any thread */
   for(t = 0; t < st->ntimes; t++) {
     if(t == st->curtime) continue;
     for(ds = 0; ds < st->ndata; ds++) {
-	sl = st->anima[ds][t];
+	sl = specks_timespecks( st, ds, t );
 	if(sl != NULL && sl != st->sl && sl->used < oldused) {
 	    oldused = st->used;
 	    oldtime = t;
@@ -151,9 +298,10 @@ int specks_purge( void *vst, int nbytes, void *aarena )
 	}
     }
   }
+  specks_unpin( st, pin );
   if(oldtime >= 0) {
-    specks_discard( st, &st->anima[oldds][oldtime] );
-    specks_freeoldscrap( &st->scrap, oldtime );
+    /* Retired, it'll be freed as soon as that's safe */
+    specks_clearspecks( st, oldds, oldtime );
     return 1;	/* We freed something, so try allocating again */
   } else {
     msg("Ran out of shmem, couldn't find anything more to purge");
@@ -166,46 +314,43 @@ int specks_purge( void *vst, int nbytes, void *aarena )
   }
 }
 
-static struct specklist **specks_scraptail( struct stuff *st )
-{
-  struct specklist **slp = &st->scrap;
-  while(*slp)
-    slp = &(*slp)->freelink;
-  return slp;
-}
-
 void specks_clearspecks( struct stuff *st, int dataset, int timestep )
 {
-    struct specklist **slp;
+    struct specklist **row, *head;
+    int pin;
 
-    if(st->anima == NULL || st->anima[dataset] == NULL)
+    if(dataset < 0 || dataset >= st->ndata || timestep < 0 || timestep >= st->ntimes)
 	return;
 
-    specks_lock(st);
-    slp = &st->anima[dataset][timestep];
-    if(*slp == st->frame_sl) {
-	/* in use -- add to purge-list */
-	specks_discard( st, slp );
-    } else {
-	specks_freenow( slp );
+    pin = specks_pin( st );
+    for(;;) {
+	row = anima_row( st, dataset );
+	head = (row == NULL) ? NULL : SLOT(row, timestep);
+	if(ISMOVED(head)) {
+	    YIELD();
+	    continue;
+	}
+	if(head == NULL || CAS( &row[timestep], head, NULL ))
+	    break;
     }
-    specks_unlock(st);
+    specks_unpin( st, pin );
+    specks_retire( st, head, NULL );
 }
 
 void specks_ensuretime( struct stuff *st, int dataset, int timestep )
 {
-  int d, needroom;
-  struct specklist **na, **nan;
+  int d, t, needroom;
+  struct specklist **na, **nan, **oa;
   void **ndf;
   char **nfn;
   struct mesh **nmesh;
 
-  if(timestep < st->ntimes)
+  if(timestep < st->ntimes && dataset < st->ndata)
 	return;
 
   specks_lock( st );
 
-  if((timestep >= st->ntimes || dataset >= st->ndata)) {
+  if((timestep >= st->ntimes || (dataset >= st->ndata && dataset < MAXFILES))) {
     needroom = st->timeroom;
     if(timestep >= st->timeroom)
 	needroom = 2*timestep + 15;
@@ -225,8 +370,19 @@ void specks_ensuretime( struct stuff *st, int dataset, int timestep )
 	memset(ndf, 0, needroom * sizeof(*ndf));
 	memset(nfn, 0, needroom * sizeof(*nfn));
 	memset(nmesh, 0, needroom * sizeof(*nmesh));
-	if(d < st->ndata && st->anima[d])
-	    memcpy( na, st->anima[d], st->ntimes * sizeof(*na) );
+
+	oa = (d < st->ndata) ? st->anima[d] : NULL;
+	if(oa != NULL) {
+	    /* Freeze each old slot, keeping its value for readers */
+	    for(t = 0; t < st->timeroom; t++) {
+#ifdef HAVE_PTHREAD_H
+		na[t] = (struct specklist *)__sync_fetch_and_or( (size_t *)&oa[t], SLOT_MOVED );
+#else
+		na[t] = oa[t];
+		oa[t] = (struct specklist *)((size_t)oa[t] | SLOT_MOVED);
+#endif
+	    }
+	}
 
 	if(d < st->ndata && st->annot[d])
 	    memcpy( nan, st->annot[d], st->ntimes * sizeof(*nan) );
@@ -240,8 +396,11 @@ void specks_ensuretime( struct stuff *st, int dataset, int timestep )
 	if(d < st->ndata && st->meshes[d])
 	    memcpy( nmesh, st->meshes[d], st->ntimes * sizeof(*nfn) );
 
-	/* Don't free old pointers, just in case they're in use. */
+	MEMBAR();
 	st->anima[d] = na;
+	specks_retire( st, NULL, oa );	/* freed once no reader can hold it */
+
+	/* Don't free the others, just in case they're in use. */
 	st->annot[d] = nan;
 	st->datafile[d] = ndf;
 	st->fname[d] = nfn;
@@ -249,6 +408,7 @@ void specks_ensuretime( struct stuff *st, int dataset, int timestep )
     }
     st->timeroom = needroom;
 
+    MEMBAR();	/* new rows before the counts that admit readers to them */
     if(timestep >= st->ntimes)
 	st->ntimes = timestep + 1;
     if(dataset >= st->ndata && dataset < MAXFILES)
@@ -256,3 +416,419 @@ void specks_ensuretime( struct stuff *st, int dataset, int timestep )
   }
   specks_unlock( st );
 }
+
+/*
+ * Column-wise copies of specklist fields -- see struct speckcols.
+ */
+
+void specks_free_cols( struct specklist *sl )
+{
+  struct speckcols *sc = sl->cols;
+  int k;
+
+  if(sc == NULL)
+    return;
+  for(k = 0; k < NSPECKCOLS; k++)
+    if(sc->mem[k] != NULL)
+	Free(sc->mem[k]);
+  Free(sc);
+  sl->cols = NULL;
+}
+
+/* Specks' positions changed in place: drop whatever depended on them. */
+void specks_moved( struct specklist *sl )
+{
+  if(sl->lgeom != NULL)
+    sl->lgeom->nnodes = 0;
+  sl->dataseq++;
+}
+
+/* Specks' contents (any fields) were rewritten in place. */
+void specks_changed( struct specklist *sl )
+{
+  specks_cols_invalidate( sl );
+  specks_moved( sl );
+}
+
+void specks_cols_invalidate( struct specklist *sl )
+{
+  if(sl->cols != NULL)
+    memset( sl->cols->valid, 0, sizeof(sl->cols->valid) );
+}
+
+void specks_col_invalidate( struct specklist *sl, int col )
+{
+  if(sl->cols != NULL && col >= 0 && col < NSPECKCOLS)
+    sl->cols->valid[col] = 0;
+}
+
+static int specks_col_fits( struct specklist *sl, int col )
+{
+  if(col < 0 || col >= NSPECKCOLS || sl->specks == NULL || sl->nspecks <= 0)
+    return 0;
+  return SMALLSPECKSIZE(col - SPECKCOL_VAL(0) + 1) <= sl->bytesperspeck;
+}
+
+/* Column, valid or not, or NULL if sl can't have one. */
+static float *specks_col_get( struct specklist *sl, int col )
+{
+  struct speckcols *sc = sl->cols;
+  int k;
+
+  if(!specks_col_fits( sl, col ))
+    return NULL;
+
+  if(sc == NULL) {
+    sc = sl->cols = NewN( struct speckcols, 1 );
+    memset( sc, 0, sizeof(*sc) );
+  }
+  if(sc->specks != sl->specks || sc->nspecks != sl->nspecks
+		|| sc->bytesperspeck != sl->bytesperspeck) {
+    /* specks reallocated or resized under us */
+    memset( sc->valid, 0, sizeof(sc->valid) );
+    if(sc->room < sl->nspecks) {
+	for(k = 0; k < NSPECKCOLS; k++) {
+	    if(sc->mem[k] != NULL)
+		Free(sc->mem[k]);
+	    sc->mem[k] = NULL;
+	    sc->col[k] = NULL;
+	}
+	sc->room = sl->nspecks;
+    }
+    sc->specks = sl->specks;
+    sc->nspecks = sl->nspecks;
+    sc->bytesperspeck = sl->bytesperspeck;
+  }
+  if(sc->mem[col] == NULL) {
+    char *mem = NewN( char, sc->room*sizeof(float) + SPECKCOLALIGN );
+    sc->mem[col] = mem;
+    sc->col[col] = (float *)(mem + (SPECKCOLALIGN - (long)mem % SPECKCOLALIGN) % SPECKCOLALIGN);
+  }
+  return sc->col[col];
+}
+
+/* Column if it's currently valid, else NULL.  Never gathers. */
+float *specks_col_valid( struct specklist *sl, int col )
+{
+  struct speckcols *sc = sl->cols;
+  if(sc == NULL || !specks_col_fits( sl, col )
+	|| sc->specks != sl->specks || sc->nspecks != sl->nspecks
+	|| sc->bytesperspeck != sl->bytesperspeck || !sc->valid[col])
+    return NULL;
+  return sc->col[col];
+}
+
+/*
+ * Column for the caller to read, or, if *fillp comes back nonzero,
+ * to fill in (perhaps in pieces, on several threads) before calling
+ * specks_col_done().
+ */
+float *specks_col_begin( struct specklist *sl, int col, int *fillp )
+{
+  float *c = specks_col_get( sl, col );
+  *fillp = (c != NULL && !sl->cols->valid[col]);
+  return c;
+}
+
+void specks_col_done( struct specklist *sl, int col )
+{
+  if(sl->cols != NULL && col >= 0 && col < NSPECKCOLS && sl->cols->col[col] != NULL)
+    sl->cols->valid[col] = 1;
+}
+
+/* Valid column, gathered from sl->specks[] if need be; NULL if impossible. */
+float *specks_col( struct specklist *sl, int col )
+{
+  int i, fill;
+  float *c = specks_col_begin( sl, col, &fill );
+  struct speck *sp = sl->specks;
+
+  if(c == NULL || !fill)
+    return c;
+
+  for(i = 0; i < sl->nspecks; i++, sp = NextSpeck(sp, sl, 1))
+	c[i] = sp->val[col - SPECKCOL_VAL(0)];
+  specks_col_done( sl, col );
+  return c;
+}
+
+/*
+ * String tables, for speck titles and labels.
+ */
+
+/* Append str (at most maxlen chars of it, if maxlen >= 0); return its offset. */
+int strtab_add( struct strtab *tab, char *str, int maxlen )
+{
+  int len = strlen(str);
+  int off = tab->len;
+
+  if(maxlen >= 0 && len > maxlen)
+    len = maxlen;
+  if(tab->len + len + 1 > tab->room) {
+    tab->room = 2*tab->room + len + 256;
+    tab->buf = RenewN( tab->buf, char, tab->room );
+  }
+  memcpy( tab->buf + off, str, len );
+  tab->buf[off + len] = '\0';
+  tab->len += len + 1;
+  return off;
+}
+
+void strtab_free( struct strtab *tab )
+{
+  if(tab->buf != NULL)
+    Free(tab->buf);
+  tab->buf = NULL;
+  tab->len = tab->room = 0;
+}
+
+/* Label or title of speck #speckno, or NULL if it has none. */
+char *specks_speck_title( struct specklist *sl, int speckno )
+{
+  if(sl == NULL || speckno < 0 || speckno >= sl->nspecks)
+    return NULL;
+  if(sl->text != NULL)
+    return SPECKTEXT( sl, speckno );
+  if(sl->titleoff != NULL)
+    return sl->titleoff[speckno] >= 0 ? sl->titles + sl->titleoff[speckno] : NULL;
+  if(sl->bytesperspeck > SMALLSPECKSIZE(MAXVAL))	/* old-style, with title[] */
+    return NextSpeck( sl->specks, sl, speckno )->title;
+  return NULL;
+}
+
+void specks_free_strings( struct specklist *sl )
+{
+  if(sl->text != NULL) Free(sl->text);
+  if(sl->textoff != NULL) Free(sl->textoff);
+  if(sl->titles != NULL) Free(sl->titles);
+  if(sl->titleoff != NULL) Free(sl->titleoff);
+  sl->text = sl->titles = NULL;
+  sl->textoff = sl->titleoff = NULL;
+}
+
+static char *strtab_dup( char *buf, int *offs, int n, int **newoffs )
+{
+  int i, len = 0;
+  char *nbuf;
+
+  if(buf == NULL)
+    return NULL;
+  if(offs == NULL) {
+    len = strlen(buf) + 1;
+  } else {
+    for(i = 0; i < n; i++)
+	if(offs[i] >= 0 && offs[i] + (int)strlen(buf + offs[i]) + 1 > len)
+	    len = offs[i] + strlen(buf + offs[i]) + 1;
+    *newoffs = NewN( int, n );
+    memcpy( *newoffs, offs, n*sizeof(int) );
+  }
+  nbuf = NewN( char, len+1 );
+  memcpy( nbuf, buf, len );
+  return nbuf;
+}
+
+/* Give dst its own copies of src's labels and titles. */
+void specks_copy_strings( struct specklist *dst, struct specklist *src )
+{
+  dst->textoff = dst->titleoff = NULL;
+  dst->text = strtab_dup( src->text, src->textoff, src->nspecks, &dst->textoff );
+  dst->titles = strtab_dup( src->titles, src->titleoff, src->nspecks, &dst->titleoff );
+}
+
+/* Copy src's selection bits into dst's own sel[], allocating it if need be. */
+void specks_copy_sel( struct specklist *dst, struct specklist *src )
+{
+  if(src->sel == NULL || src->nsel <= 0) {
+    if(dst->sel != NULL)
+	Free( dst->sel );
+    dst->sel = NULL;
+    dst->nsel = 0;
+  } else {
+    if(dst->sel == NULL || dst->nsel != src->nsel) {
+	if(dst->sel != NULL)
+	    Free( dst->sel );
+	dst->sel = NewN( SelMask, src->nsel );
+	dst->nsel = src->nsel;
+    }
+    memcpy( dst->sel, src->sel, src->nsel * sizeof(SelMask) );
+  }
+  dst->selseq = src->selseq;
+  dst->threshseq = src->threshseq;
+}
+
+/*
+ * Specklist buffer pool, for dynamic-data providers (DynData.pool).
+ * A provider acquires a buffer for each specklist it's about to compute,
+ * fills it, and publishes the finished chain; getspecks() returns it.
+ * When the display moves on to a newer chain, it releases the old one,
+ * whose buffers then get recycled -- so the provider can fill frame N+1
+ * while frame N is still on screen, without allocating anything.
+ * Each buffer owns its strings and sel[] (see specks_copy_strings(),
+ * specks_copy_sel()), never sharing them with the list it was made from.
+ * Buffers are reused only once released:  a published chain may still
+ * be on screen, or cached by its provider (check specks_pool_current()).
+ */
+enum { SLP_FREE, SLP_FILLING, SLP_PUBLISHED };
+
+struct slpoolent {
+  struct specklist *sl;
+  int state;
+  int key;		/* provider's tag for what's in it */
+  int gen;		/* generation when published */
+  int room;		/* bytes allocated at sl->specks */
+};
+
+struct slpool {
+  int gen;
+  int nent, entroom;
+  struct slpoolent *ent;
+};
+
+struct slpool *specks_pool_new( void )
+{
+  struct slpool *pool = NewN( struct slpool, 1 );
+  memset( pool, 0, sizeof(*pool) );
+  return pool;
+}
+
+static struct slpoolent *specks_pool_find( struct slpool *pool, struct specklist *sl )
+{
+  int i;
+  for(i = 0; i < pool->nent; i++)
+    if(pool->ent[i].sl == sl)
+	return &pool->ent[i];
+  return NULL;
+}
+
+/*
+ * Get a specklist with room for nspecks specks of bytesperspeck each.
+ * If it still holds what was last put there under this key, *samekey is set
+ * and its contents (and derived data) are untouched; otherwise it's cleared,
+ * except for sl->specks.  Either way, sl->nspecks and sl->bytesperspeck are set.
+ */
+struct specklist *specks_pool_acquire( struct slpool *pool, int key,
+			int nspecks, int bytesperspeck, int *samekey )
+{
+  struct slpoolent *e = NULL;
+  struct specklist *sl;
+  int i, need = nspecks * bytesperspeck;
+
+  for(i = 0; i < pool->nent; i++) {
+    if(pool->ent[i].state == SLP_FREE) {
+	if(pool->ent[i].key == key && pool->ent[i].room >= need) {
+	    e = &pool->ent[i];
+	    break;
+	}
+	if(e == NULL || (pool->ent[i].room >= need && e->room < need))
+	    e = &pool->ent[i];
+    }
+  }
+
+  if(e == NULL) {
+    if(pool->nent >= pool->entroom) {
+	pool->entroom = 2*pool->entroom + 4;
+	pool->ent = RenewN( pool->ent, struct slpoolent, pool->entroom );
+    }
+    e = &pool->ent[pool->nent++];
+    memset( e, 0, sizeof(*e) );
+    e->sl = NewN( struct specklist, 1 );
+    memset( e->sl, 0, sizeof(*e->sl) );
+    e->key = ~key;
+  }
+  sl = e->sl;
+
+  *samekey = (e->key == key && e->room >= need && sl->nspecks == nspecks
+		&& sl->bytesperspeck == bytesperspeck);
+  if(!*samekey) {
+    struct speck *specks = sl->specks;
+    specks_free_strings( sl );
+    specks_free_derived( sl );
+    if(sl->sel != NULL)
+	Free( sl->sel );
+    memset( sl, 0, sizeof(*sl) );
+    if(need > e->room || specks == NULL) {
+	if(specks != NULL)
+	    Free( specks );
+	e->room = need + need/8;
+	specks = (struct speck *)NewN( char, e->room + 1 );
+    }
+    sl->specks = specks;
+    e->key = key;
+  }
+  sl->nspecks = nspecks;
+  sl->bytesperspeck = bytesperspeck;
+  sl->next = NULL;
+  e->state = SLP_FILLING;
+  return sl;
+}
+
+/* Mark the chain at head as done, and current.  Returns its generation. */
+int specks_pool_publish( struct slpool *pool, struct specklist *head )
+{
+  struct slpoolent *e;
+
+  pool->gen++;
+  for( ; head != NULL; head = head->next) {
+    if((e = specks_pool_find( pool, head )) != NULL) {
+	e->state = SLP_PUBLISHED;
+	e->gen = pool->gen;
+    }
+  }
+  return pool->gen;
+}
+
+/* Is the chain at head still just as it was published as generation gen?
+ * Not if any of it has been released (and maybe refilled) since.
+ */
+int specks_pool_current( struct slpool *pool, struct specklist *head, int gen )
+{
+  struct slpoolent *e;
+
+  if(pool == NULL || head == NULL)
+    return 0;
+  for( ; head != NULL; head = head->next) {
+    e = specks_pool_find( pool, head );
+    if(e == NULL || e->state != SLP_PUBLISHED || e->gen != gen)
+	return 0;
+  }
+  return 1;
+}
+
+/* Is sl one of the pool's buffers? */
+int specks_pool_has( struct slpool *pool, struct specklist *sl )
+{
+  return pool != NULL && sl != NULL && specks_pool_find( pool, sl ) != NULL;
+}
+
+/* Nobody's looking at the chain at head any more; recycle it. */
+void specks_pool_release( struct slpool *pool, struct specklist *head )
+{
+  struct slpoolent *e;
+
+  if(pool == NULL)
+    return;
+  for( ; head != NULL; head = head->next)
+    if((e = specks_pool_find( pool, head )) != NULL)
+	e->state = SLP_FREE;
+}
+
+void specks_pool_free( struct slpool *pool )
+{
+  int i;
+
+  if(pool == NULL)
+    return;
+  for(i = 0; i < pool->nent; i++) {
+    struct specklist *sl = pool->ent[i].sl;
+    if(sl->specks != NULL)
+	Free( sl->specks );
+    if(sl->sel != NULL)
+	Free( sl->sel );
+    specks_free_strings( sl );
+    specks_free_derived( sl );
+    Free( sl );
+  }
+  if(pool->ent != NULL)
+    Free( pool->ent );
+  Free( pool );
+}
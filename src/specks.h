@@ -43,7 +43,18 @@ extern "C" {
 #define MAXVAL  29
 #define CONSTVAL  MAXVAL
 
+#define MAXPALETTE 65536	/* palette indices (sl->cix[]) are unsigned shorts */
+
 struct stuff;
+struct veccache;
+struct speckprep;
+struct dynasync;
+struct updasync;
+struct livestream;
+struct specksretired;
+struct slpool;
+struct ellcache;
+struct boxcache;
 
 struct speck {
   Point p;
@@ -57,6 +68,8 @@ struct speck {
 #define  SPECKMAXVAL(sl)	 ( (float *)(((char *)0) + sl->bytesperspeck) - (float *)0 )
 #define  NewNSpeck(sl, nspecks)  ( (struct speck *)NewN( char, (sl)->bytesperspeck*nspecks ) )
 #define  NextSpeck(sp, sl, skip)	 ( (struct speck *) (((char *)sp) + (skip)*(sl)->bytesperspeck ) )
+	/* RGB of speck #i (== sp) of sl.  Alpha byte is not meaningful. */
+#define  SPECKRGB(st, sl, sp, i)  ( (sl)->cix != NULL ? (st)->palette[(sl)->cix[i]] : (sp)->rgba )
 
 enum Lop { L_LIN, L_ABS, L_LOG, L_EXP, L_POW };
 
@@ -104,6 +117,21 @@ typedef struct {	/* for glDrawElements() */
   int ixmin, ixmax;	/* range of indices -- range of elarrays[] referenced by elindices[base .. base+count-1] */
 } Elements;
 
+typedef struct elementset {	/* vertex arrays + Elements, built once, drawn by elements_draw() */
+  GLenum eltype;	/* glInterleavedArrays() format of elarrays[] */
+  int nverts;
+  float *elarrays;
+  int nelem;
+  Elements *elem;
+  int nindices;
+  int *elindices;
+  GLuint dlist[MAXDSPCTX];	/* display list compiled from the above, per GL context, or 0 */
+  int dlistflags[MAXDSPCTX];	/* ... with these ELEM_* flags */
+} ElementSet;
+
+#define ELEM_NOTX	0x1	/* elements_draw(): ignore texture coords */
+#define ELEM_NONORM	0x2	/* ... or normals */
+
 struct mesh {
   struct mesh *next;
   enum MeshType type;
@@ -136,11 +164,7 @@ struct mesh {
   int usettfm;		/* non-identity ttfm */
   Matrix ttfm;		/* texture transform */
 
-		/* for glDrawElements() */
-  Elements *elem;
-  int nelem;
-  int *elindices;
-  float *elarrays;
+  ElementSet *els;	/* for glDrawElements(), from mesh_prepare_elements() */
 };
 
 struct ellipsoid {
@@ -212,6 +236,87 @@ typedef struct _selfunc {
 
 #define SELMASK(bitno)		(((SelMask)1) << ((bitno)-1))
 
+  /*
+   * Remembers how a specklist was last thresholded, so that when only
+   * the thresh[] bounds move, specks_rethresh() need only visit the specks
+   * whose values lie between the old and new bounds.
+   * order[] is built lazily, the second time we threshold on the same variable.
+   */
+struct threshindex {
+  int by;		/* val[] index we thresholded on */
+  int usemin, usemax;	/* whether min/max bounds were applied */
+  float tmin, tmax;	/* ... and their values */
+  SelOp dest;		/* threshsel used */
+  int threshseq, selseq; /* sl->threshseq and sl->selseq as we left them */
+  int nspecks;
+  int nsorted;		/* number of entries in order[] (NaN values omitted) */
+  int *order;		/* order[nsorted]: speck indices, ascending by val[by] */
+};
+
+  /*
+   * Optional column-wise copy of a specklist's val[]s, for the recolor,
+   * resize and thresh loops, which each read just one of them per speck.
+   * The struct speck array stays authoritative: columns are gathered from
+   * it on demand (specks_col()), and must be invalidated by anyone who
+   * changes specks in place.  Column k holds nspecks floats, aligned on
+   * SPECKCOLALIGN bytes.
+   */
+#define SPECKCOL_VAL(by) (by)
+#define NSPECKCOLS	SPECKCOL_VAL(MAXVAL)
+#define SPECKCOLALIGN	32
+
+struct speckcols {
+  struct speck *specks;	/* sl->specks, nspecks, bytesperspeck as of gathering */
+  int nspecks, bytesperspeck;
+  int room;		/* allocated length of each column */
+  char valid[NSPECKCOLS];
+  void *mem[NSPECKCOLS];	/* as allocated */
+  float *col[NSPECKCOLS];	/* aligned, within mem[] */
+};
+
+	/* Value of speck #i (== sp) field "by", from column col if any.
+	 * If fill is set, copy the value into the column too.
+	 */
+#define  SPECKCOLVAL(col, fill, sp, by, i) \
+	( (col) == NULL ? (sp)->val[by] : (fill) ? ((col)[i] = (sp)->val[by]) : (col)[i] )
+
+  /*
+   * Strings packed end to end, each '\0'-terminated, known by offset.
+   * Speck titles and text labels live in these, rather than in
+   * fixed-size title[]s or in one specklist per label.
+   */
+struct strtab {
+  char *buf;
+  int len, room;
+};
+
+  /*
+   * drawspecks()' cache for a label list: each label's strokes, laid out
+   * once as GL_LINES vertex pairs (x,y in units of label height), and
+   * a k-d tree over label positions, for culling labels which are behind
+   * us or too small before looking at their text.
+   * The tree must be rebuilt (nnodes = 0) if specks move; see specks_moved().
+   */
+struct labelnode {
+  Point lo, hi;		/* bounding box of labels' positions */
+  float maxsize;	/* largest speck size within */
+  int kid;		/* node[kid], node[kid+1] are children; 0 if leaf */
+  int first, n;		/* leaf: labels order[first .. first+n-1] */
+};
+
+struct labelgeom {
+  int nlabels;
+  int *first, *nverts;	/* label i's vertices are xy[2*first[i] ...] */
+  float *width;		/* label i's width, at height 1.0 */
+  float *xy;
+  int *order;		/* label numbers, grouped by tree leaf */
+  int nnodes;		/* 0 => tree needs (re)building */
+  struct labelnode *node;
+};
+
+	/* Label text for speck #i of a label list (sl->text != NULL) */
+#define  SPECKTEXT(sl, i)  ( (sl)->textoff != NULL ? (sl)->text + (sl)->textoff[i] : (sl)->text )
+
 struct specklist {
   struct specklist *next;
   int nspecks;
@@ -223,15 +328,24 @@ struct specklist {
   int colorseq, sizeseq, threshseq;
   Point center, radius;	/* of bounding box, after scaling to world space */
   Point interest;	/* point-of-interest, if any */
-  char *text;
+  char *text;		/* if non-NULL, this is a list of text labels */
+  int *textoff;		/* textoff[nspecks]: offsets into text, or NULL if just one label */
+  char *titles;		/* per-speck titles (comments from data file), if any */
+  int *titleoff;	/* titleoff[nspecks]: offsets into titles, or -1 if none */
   int subsampled;	/* subsampling ("every") factor applied already */
   int used;		/* "used" clock, for mem purges */
   int speckseq;		/* sequence number, for tracking derived specklists */
   int nsel;
   unsigned int *sel;	/* selection bitmasks per particle */
   int selseq;
+  struct threshindex *thix; /* for incremental thresholding, or NULL */
+  unsigned short *cix;	/* cix[nspecks]: index into st->palette[], or NULL if colored directly */
+  int ncix;		/* room in cix[] */
+  int cmapseq;
+  struct speckcols *cols; /* column-wise copy of some fields, or NULL */
+  struct labelgeom *lgeom; /* cached label layout, for label lists */
+  int dataseq;		/* bumped by specks_changed(), specks_moved() */
   enum SpecialSpeck special;
-  struct specklist *freelink; /* link on free/scrap list */
 };
 
 struct specktree {	/* Not used yet, if ever */
@@ -283,6 +397,8 @@ typedef struct dyndata {
     int (*draw)( struct dyndata *, struct stuff *, struct specklist *head, Matrix *Tc2w, float radperpix );
     int (*help)( struct dyndata *, struct stuff *, int verbose );
     void (*free)( struct dyndata *, struct stuff * );
+    struct slpool *pool;	/* if getspecks() output comes from one, we release it when done */
+    int async;			/* getspecks() may run on another thread ("dynasync") */
 } DynData;
 
 
@@ -292,6 +408,7 @@ typedef int (*SpecksPickFunc)( struct stuff *, GLuint *hit, struct specklist *,
 
 
 #define MAXFILES 8
+#define MAXPINS  8	/* threads at once between specks_pin() and specks_unpin() */
 
 struct stuff {
 	/* owned by display thread: */
@@ -300,8 +417,12 @@ struct stuff {
 	/* shared with possible reader threads: */
   struct specklist **anima[MAXFILES];	/* anima[ndata][ntimes]: All data.  Shared with reader threads. */
 #ifdef HAVE_PTHREAD_H
-  pthread_mutex_t smut;
+  pthread_mutex_t smut;		/* only for growing anima[] etc. */
 #endif
+  volatile unsigned int epoch;	/* bumped by display thread each frame */
+  volatile unsigned int pinned[MAXPINS]; /* epoch each pinned thread entered, or 0 */
+  struct specksretired *volatile retired; /* taken out of anima[][], not yet freed */
+  volatile int reclaiming;
 
   char dataname[MAXFILES][12];
   int ntimes, ndata;
@@ -347,6 +468,16 @@ struct stuff {
   float spacescale;
   int sizedby, coloredby;		
   int sizeseq, colorseq;
+  int cmapseq;			/* bumped when colormap entries change, but not their indices */
+  int *palette;			/* palette[MAXPALETTE]: cooked colors for sl->cix[] */
+  int npalette;			/* how many palette[] entries have ever been filled */
+  int palcolorseq, palcmapseq;	/* colorseq, cmapseq when palette[] was last built */
+  int usecols;			/* keep column-wise copies of val[]s (sl->cols)? */
+  struct veccache *veccache;	/* drawspecks()' velocity-vector arrays */
+  struct speckprep *speckprep;	/* drawspecks()' view-independent point list */
+  struct dynasync *dynasync;	/* background getspecks() thread, if any */
+  struct updasync *updasync;	/* background recolor/resize/rethresh, if any */
+  struct livestream *stream;	/* live TCP feed ("stream" command), if any */
 
   int usesee;
   SelOp seesel;		/* bitmask of desired features in sl->sel[] */
@@ -456,6 +587,8 @@ struct stuff {
 
   int staticboxroom;
   struct AMRbox *staticboxes;	/* another array of permanent boxes */
+  struct boxcache **boxcache;	/* boxcache[t]: drawing and boxno lookup cache for boxes[t], or NULL */
+  struct boxcache *staticboxcache;	/* ... and for staticboxes */
 
   int usemeshes;
   struct mesh *staticmeshes;
@@ -463,6 +596,8 @@ struct stuff {
   float mullions;
   int useellipsoids;
   struct ellipsoid *staticellipsoids;
+  int ellipsoidseq;		/* bumped when staticellipsoids changes */
+  struct ellcache *ellcache;	/* flattened ellipsoids, for drawing */
 
   char vdcmd[128];
 
@@ -486,7 +621,6 @@ struct stuff {
   volatile int fetchdata, fetchtime; /* data and timestep being fetched */
 
   int used;		/* global "used" clock, for LRU purging */
-  struct specklist *scrap; /* stuff to be deleted when it's safe */
   int nghosts;		/* keep recent ghost snapshots of dynamic data */
 
   int usertrange;
@@ -538,8 +672,44 @@ extern int   specks_get_datastep( struct stuff * );
 extern void  specks_set_speed( struct stuff *, double newspeed );
 extern void  specks_set_timebase( struct stuff *, double newbase );
 extern void  specks_discard( struct stuff *, struct specklist **slist );  /* Free later */
+extern void  specks_free_threshindex( struct specklist *sl );
+extern void  specks_free_derived( struct specklist *sl );
+extern void  specks_repalette( struct stuff * );
+
+extern int   strtab_add( struct strtab *tab, char *str, int maxlen );
+extern void  strtab_free( struct strtab *tab );
+extern char *specks_speck_title( struct specklist *sl, int speckno );
+extern void  specks_free_strings( struct specklist *sl );
+extern void  specks_copy_strings( struct specklist *dst, struct specklist *src );
+extern void  specks_copy_sel( struct specklist *dst, struct specklist *src );
+
+extern struct slpool *specks_pool_new( void );
+extern struct specklist *specks_pool_acquire( struct slpool *, int key, int nspecks, int bytesperspeck, int *samekey );
+extern int   specks_pool_publish( struct slpool *, struct specklist *head );
+extern int   specks_pool_current( struct slpool *, struct specklist *head, int gen );
+extern void  specks_pool_release( struct slpool *, struct specklist *head );
+extern int   specks_pool_has( struct slpool *, struct specklist *sl );
+extern void  specks_pool_free( struct slpool * );
+
+extern float *specks_col( struct specklist *sl, int col );
+extern float *specks_col_valid( struct specklist *sl, int col );
+extern float *specks_col_begin( struct specklist *sl, int col, int *fillp );
+extern void  specks_col_done( struct specklist *sl, int col );
+extern void  specks_col_invalidate( struct specklist *sl, int col );
+extern void  specks_cols_invalidate( struct specklist *sl );
+extern void  specks_free_cols( struct specklist *sl );
+extern void  specks_free_labelgeom( struct specklist *sl );
+extern void  specks_moved( struct specklist *sl );
+extern void  specks_changed( struct specklist *sl );
+
+extern ElementSet *elements_create( GLenum eltype, int nverts, int nelem, int nindices );
+extern int  *elements_add( ElementSet *es, GLenum prim, int count );
+extern void  elements_setvert( ElementSet *es, int i, CONST Point *tx, CONST Point *norm, CONST Point *v );
+extern int   elements_draw( ElementSet *es, int flags );
+extern void  elements_free( ElementSet *es );
 
 extern int   specks_check_async( struct stuff ** );
+extern void  specks_stream_frame( struct stuff * );	/* take frames from live stream */
 extern int   specks_add_async( struct stuff *st, char *cmdstr, int replytoo );
 
 extern void specks_read_cmap( struct stuff *st, char *fname, int *ncmapp, struct cment **cmapp );
@@ -547,18 +717,23 @@ extern void specks_read_cmap( struct stuff *st, char *fname, int *ncmapp, struct
 extern void  specks_set_annotation( struct stuff *, CONST char *str );
 
 extern void  specks_current_frame( struct stuff *, struct specklist *sl );
+extern void  specks_sync_frame( struct stuff * );
 extern void  specks_reupdate( struct stuff *, struct specklist *sl );
+extern void  specks_parallel( void (*func)( void *, int ), void *arg, int njobs, int nitems );
 extern void  specks_datawait( struct stuff * );
 
 extern void  specks_lock_init( struct stuff * );
 extern void  specks_lock( struct stuff * );
 extern void  specks_unlock( struct stuff * );
 
-	/* uses locking: */
+	/* lock-free; off the display thread, use lists only while pinned: */
 extern struct specklist * specks_timespecks( struct stuff *, int dataset, int timestep );
 extern void specks_ensuretime( struct stuff *, int dataset, int timestep );
 extern void specks_insertspecks( struct stuff *, int dataset, int timestep, struct specklist * );
 extern void specks_clearspecks( struct stuff *, int dataset, int timestep );
+extern int  specks_pin( struct stuff * );
+extern void specks_unpin( struct stuff *, int pin );
+extern void specks_reclaim( struct stuff * );	/* display thread, per frame */
 
 
 
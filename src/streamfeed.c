@@ -0,0 +1,229 @@
+/*
+ * Test producer for partiview's "stream" command (see livestream.c):
+ * sends frames of a synthetic, differentially-rotating disk.
+ *
+ *   streamfeed [options] host:port	connect to "stream :port" in partiview
+ *   streamfeed [options] -l port	wait for "stream host:port"
+ *
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define STREAMVERSION	1
+#define STREAMEND	0x1
+#define STREAMNAMELEN	16
+#define MAXCOLS		29
+
+static char *progname;
+
+static void putu32( unsigned char *b, unsigned int v )
+{
+  b[0] = v >> 24;
+  b[1] = v >> 16;
+  b[2] = v >> 8;
+  b[3] = v;
+}
+
+static int writeall( int fd, const void *buf, int n )
+{
+  const char *p = (const char *)buf;
+  while(n > 0) {
+    int w = write( fd, p, n );
+    if(w < 0 && errno == EINTR)
+	continue;
+    if(w <= 0)
+	return 0;
+    p += w;
+    n -= w;
+  }
+  return 1;
+}
+
+static int sendframe( int fd, int frameno, int nspecks, int ncols, int flags, double t,
+			float **col )
+{
+  unsigned char h[32];
+  char names[MAXCOLS][STREAMNAMELEN];
+  static const char *colname[] = { "radius", "speed", "id" };
+  unsigned long long tbits;
+  int i, k;
+
+  memcpy( h, "PVSF", 4 );
+  putu32( h+4, STREAMVERSION );
+  putu32( h+8, frameno );
+  putu32( h+12, nspecks );
+  putu32( h+16, ncols );
+  putu32( h+20, flags );
+  memcpy( &tbits, &t, sizeof(tbits) );
+  putu32( h+24, (unsigned int)(tbits >> 32) );
+  putu32( h+28, (unsigned int)tbits );
+  if(!writeall( fd, h, sizeof(h) ))
+    return 0;
+  if(flags & STREAMEND)
+    return 1;
+
+  memset( names, 0, sizeof(names) );
+  for(k = 0; k < ncols; k++) {
+    if(k < 3) strcpy( names[k], colname[k] );
+    else sprintf( names[k], "col%d", k );
+  }
+  if(ncols > 0 && !writeall( fd, names, ncols*STREAMNAMELEN ))
+    return 0;
+
+  for(k = 0; k < 3+ncols; k++) {
+    unsigned int *u = (unsigned int *)col[k];
+    for(i = 0; i < nspecks; i++)
+	u[i] = htonl( u[i] );
+    if(!writeall( fd, col[k], nspecks*sizeof(float) ))
+	return 0;
+  }
+  return 1;
+}
+
+static int dial( char *where )
+{
+  char *colon = strrchr( where, ':' );
+  struct sockaddr_in sin;
+  struct hostent *hp;
+  int fd;
+
+  if(colon == NULL) {
+    fprintf(stderr, "%s: expected host:port, not %s\n", progname, where);
+    return -1;
+  }
+  *colon = '\0';
+  memset( &sin, 0, sizeof(sin) );
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons( atoi(colon+1) );
+  if(*where == '\0') {
+    sin.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+  } else if(!inet_aton( where, &sin.sin_addr )) {
+    if((hp = gethostbyname( where )) == NULL) {
+	fprintf(stderr, "%s: %s: unknown host\n", progname, where);
+	return -1;
+    }
+    memcpy( &sin.sin_addr, hp->h_addr, sizeof(sin.sin_addr) );
+  }
+  fd = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP );
+  if(fd < 0 || connect( fd, (struct sockaddr *)&sin, sizeof(sin) ) < 0) {
+    fprintf(stderr, "%s: %s:%s: %s\n", progname, where, colon+1, strerror(errno));
+    return -1;
+  }
+  return fd;
+}
+
+static int answer( int port )
+{
+  struct sockaddr_in sin;
+  int one = 1, lfd, fd;
+
+  memset( &sin, 0, sizeof(sin) );
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = INADDR_ANY;
+  sin.sin_port = htons( port );
+  lfd = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP );
+  setsockopt( lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+  if(lfd < 0 || bind( lfd, (struct sockaddr *)&sin, sizeof(sin) ) < 0 || listen( lfd, 1 ) < 0) {
+    fprintf(stderr, "%s: port %d: %s\n", progname, port, strerror(errno));
+    return -1;
+  }
+  fd = accept( lfd, NULL, NULL );
+  close( lfd );
+  return fd;
+}
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday( &tv, NULL );
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+int main( int argc, char *argv[] )
+{
+  int nspecks = 10000, ncols = 3, nframes = -1, port = 0;
+  double fps = 30, dt = 0.01, t0;
+  float *col[3+MAXCOLS], *r, *th;
+  int c, i, k, frameno, fd;
+
+  progname = argv[0];
+  while((c = getopt( argc, argv, "n:r:f:c:t:l:" )) != EOF) {
+    switch(c) {
+    case 'n': nspecks = atoi(optarg); break;
+    case 'r': fps = atof(optarg); break;
+    case 'f': nframes = atoi(optarg); break;
+    case 'c': ncols = atoi(optarg); break;
+    case 't': dt = atof(optarg); break;
+    case 'l': port = atoi(optarg); break;
+    default: optind = argc+1; break;
+    }
+  }
+  if((port > 0) != (optind == argc) || optind > argc || nspecks < 0 || ncols < 0 || ncols > MAXCOLS) {
+    fprintf(stderr, "Usage: %s [options] host:port    (or -l port)\n\
+Sends frames of a rotating disk to partiview's \"stream\" command.\n\
+Options:\n\
+   -n nspecks	particles per frame (default 10000)\n\
+   -r fps	frames per second, 0 => as fast as the receiver takes them (default 30)\n\
+   -f nframes	stop after that many (default: run forever)\n\
+   -c ncols	data columns per particle, up to %d (default 3: radius speed id)\n\
+   -t dt	simulated time per frame (default 0.01)\n\
+   -l port	listen on port, rather than connecting\n", progname, MAXCOLS);
+    exit(1);
+  }
+
+  signal( SIGPIPE, SIG_IGN );
+  fd = (port > 0) ? answer( port ) : dial( argv[optind] );
+  if(fd < 0)
+    exit(1);
+
+  for(k = 0; k < 3+ncols; k++)
+    col[k] = (float *)malloc( (nspecks+1) * sizeof(float) );
+  r = (float *)malloc( (nspecks+1) * sizeof(float) );
+  th = (float *)malloc( (nspecks+1) * sizeof(float) );
+  srand48( 1 );
+  for(i = 0; i < nspecks; i++) {
+    r[i] = 0.1 + 10*drand48();
+    th[i] = 2*M_PI*drand48();
+  }
+
+  t0 = now();
+  for(frameno = 0; nframes < 0 || frameno < nframes; frameno++) {
+    double t = frameno * dt;
+    for(i = 0; i < nspecks; i++) {
+	float speed = 1 / sqrt( r[i] );		/* flat-ish rotation curve */
+	float a = th[i] + t * speed / r[i] * 20;
+	col[0][i] = r[i] * cos(a);
+	col[1][i] = r[i] * sin(a);
+	col[2][i] = 0.2 * sin( 3*a + r[i] );
+	for(k = 0; k < ncols; k++)
+	    col[3+k][i] = (k == 0) ? r[i] : (k == 1) ? speed : (k == 2) ? i : k;
+    }
+    if(!sendframe( fd, frameno, nspecks, ncols, 0, t, col )) {
+	fprintf(stderr, "%s: frame %d: %s\n", progname, frameno, strerror(errno));
+	exit(1);
+    }
+    if(fps > 0) {
+	double wait = t0 + (frameno+1) / fps - now();
+	if(wait > 0)
+	    usleep( (int)(wait * 1e6) );
+    }
+  }
+  sendframe( fd, frameno, 0, 0, STREAMEND, frameno * dt, col );
+  close( fd );
+  fprintf(stderr, "%s: sent %d frames in %.3g sec\n", progname, frameno, now() - t0);
+  return 0;
+}
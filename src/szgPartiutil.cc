@@ -68,7 +68,8 @@ void specks_picker( void *view, int nhits, int nents, GLuint *hitbuf, void *vvie
 	wpostr[0] = '\0';
     }
     vtfmpoint( &cpos, &wpos, view->Tw2c() );
-    strcpy(fmt, bestsl->bytesperspeck <= SMALLSPECKSIZE(MAXVAL)
+    char *title = specks_speck_title( bestsl, bestspeckno );
+    strcpy(fmt, title == NULL || bestsl->text != NULL
 		? "[g%d]%sPicked %g %g %g%s%.0s @%g (of %d)%s"
 		: "[g%d]%sPicked %g %g %g%s \"%s\" @%g (of %d)%s");
     attrs[0] = '\0';
@@ -83,11 +84,11 @@ void specks_picker( void *view, int nhits, int nents, GLuint *hitbuf, void *vvie
     }
     if(bestsl->text != NULL) {
 	snprintf(attrs+strlen(attrs), sizeof(attrs)-strlen(attrs),
-		" \"%s\"", bestsl->text);
+		" \"%s\"", title);
     }
     msg(fmt, bestid, centerit?"*":"",
 	bestpos.x[0],bestpos.x[1],bestpos.x[2], wpostr,
-	bestsl->text ? bestsl->text : sp->title,
+	title ? title : "",
 	vlength( &cpos ), nhits,
 	attrs );
 
@@ -557,6 +557,11 @@ void parti_asyncfd( int fd ) {
 void parti_unasyncfd( int fd ) {
     // XXX
 }
+void parti_watchfd( int fd, void (*func)(int, void *), void *arg ) {
+    msg("IGNORING parti_watchfd(%d)", fd);
+}
+void parti_unwatchfd( int fd ) {
+}
 
 typedef enum { REMARK, WARN } MsgLevel;
 
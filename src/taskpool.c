@@ -0,0 +1,353 @@
+/*
+ * Shared work-stealing pool of worker threads; see taskpool.h.
+ *
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD_H
+# include <unistd.h>
+# include <pthread.h>
+#endif
+
+#include "shmem.h"
+#include "taskpool.h"
+
+#define MAXTASKTHREADS	32
+
+struct task {
+  void (*func)( void * );
+  void *arg;
+  TaskGroup *g;
+};
+
+struct taskgroup {
+  volatile int pending;		/* submitted, not yet finished */
+  volatile int cancelled;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t mut;
+  pthread_cond_t done;		/* pending reached 0, or something new was queued */
+  int waiters;
+  int submits;
+#endif
+};
+
+TaskGroup *taskgroup_new( void )
+{
+  TaskGroup *g = NewN( TaskGroup, 1 );
+
+  memset( g, 0, sizeof(*g) );
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init( &g->mut, NULL );
+  pthread_cond_init( &g->done, NULL );
+#endif
+  return g;
+}
+
+void taskgroup_free( TaskGroup *g )
+{
+  if(g == NULL)
+    return;
+  taskgroup_wait( g );
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_destroy( &g->mut );
+  pthread_cond_destroy( &g->done );
+#endif
+  Free( g );
+}
+
+void taskgroup_cancel( TaskGroup *g )
+{
+  g->cancelled = 1;
+}
+
+int taskgroup_cancelled( TaskGroup *g )
+{
+  return g != NULL && g->cancelled;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+struct taskq {			/* t[head .. head+n-1], mod room */
+  struct task *t;
+  int head, n, room;
+};
+
+struct taskworker {
+  pthread_t th;
+  pthread_mutex_t mut;		/* on q[] */
+  struct taskq q[TASK_NPRIO];
+};
+
+static struct taskpool {
+  int nth;			/* workers started; only grows */
+  int limit;			/* workers 0..limit-1 may run tasks */
+  volatile int queued;		/* tasks waiting in all queues */
+  int sleeping;			/* idle workers, waiting on work */
+  unsigned int next;		/* round-robin for submissions from outside */
+  pthread_mutex_t mut;
+  pthread_cond_t work, parked;
+  pthread_key_t self;		/* 1 + worker index, in worker threads */
+  struct taskworker w[MAXTASKTHREADS];
+} tp;
+
+static pthread_once_t tp_once = PTHREAD_ONCE_INIT;
+
+static void taskpool_init( void )
+{
+  pthread_mutex_init( &tp.mut, NULL );
+  pthread_cond_init( &tp.work, NULL );
+  pthread_cond_init( &tp.parked, NULL );
+  pthread_key_create( &tp.self, NULL );
+}
+
+static void q_push( struct taskq *q, struct task *t )
+{
+  if(q->n == q->room) {
+    int room = q->room ? 2*q->room : 64, k;
+    struct task *nt = NewN( struct task, room );
+    for(k = 0; k < q->n; k++)
+	nt[k] = q->t[ (q->head + k) % q->room ];
+    if(q->t != NULL)
+	Free( q->t );
+    q->t = nt;
+    q->head = 0;
+    q->room = room;
+  }
+  q->t[ (q->head + q->n) % q->room ] = *t;
+  q->n++;
+}
+
+/* Owner takes the newest task; thieves take the oldest. */
+static int q_pop( struct taskq *q, int newest, struct task *t )
+{
+  if(q->n == 0)
+    return 0;
+  if(newest) {
+    *t = q->t[ (q->head + q->n - 1) % q->room ];
+  } else {
+    *t = q->t[ q->head ];
+    q->head = (q->head + 1) % q->room;
+  }
+  q->n--;
+  return 1;
+}
+
+static int q_takegroup( struct taskq *q, TaskGroup *g, struct task *t )
+{
+  int i, k;
+
+  for(i = 0; i < q->n; i++) {
+    if(q->t[ (q->head + i) % q->room ].g == g) {
+	*t = q->t[ (q->head + i) % q->room ];
+	for(k = i+1; k < q->n; k++)
+	    q->t[ (q->head + k - 1) % q->room ] = q->t[ (q->head + k) % q->room ];
+	q->n--;
+	return 1;
+    }
+  }
+  return 0;
+}
+
+/* Highest priority first:  our own queue, then steal from the others'. */
+static int task_find( int self, struct task *t )
+{
+  int p, k, nth = tp.nth;
+
+  for(p = 0; p < TASK_NPRIO; p++) {
+    for(k = 0; k < nth; k++) {
+	struct taskworker *w = &tp.w[ (self + k) % nth ];
+	int got;
+	if(w->q[p].n == 0)
+	    continue;
+	pthread_mutex_lock( &w->mut );
+	got = q_pop( &w->q[p], k == 0, t );
+	pthread_mutex_unlock( &w->mut );
+	if(got) {
+	    __sync_sub_and_fetch( &tp.queued, 1 );
+	    return 1;
+	}
+    }
+  }
+  return 0;
+}
+
+/* Any queued task of g's, wherever it is. */
+static int task_take( TaskGroup *g, struct task *t )
+{
+  int p, k, nth = tp.nth;
+
+  for(p = 0; p < TASK_NPRIO; p++) {
+    for(k = 0; k < nth; k++) {
+	struct taskworker *w = &tp.w[k];
+	int got;
+	if(w->q[p].n == 0)
+	    continue;
+	pthread_mutex_lock( &w->mut );
+	got = q_takegroup( &w->q[p], g, t );
+	pthread_mutex_unlock( &w->mut );
+	if(got) {
+	    __sync_sub_and_fetch( &tp.queued, 1 );
+	    return 1;
+	}
+    }
+  }
+  return 0;
+}
+
+static void task_run( struct task *t )
+{
+  TaskGroup *g = t->g;
+
+  if(!g->cancelled)
+    (*t->func)( t->arg );
+
+  pthread_mutex_lock( &g->mut );
+  if(__sync_sub_and_fetch( &g->pending, 1 ) == 0 && g->waiters > 0)
+    pthread_cond_broadcast( &g->done );
+  pthread_mutex_unlock( &g->mut );
+}
+
+static void *task_worker( void *vself )
+{
+  int self = (int)(long)vself;
+  struct task t;
+
+  pthread_setspecific( tp.self, (void *)(long)(self + 1) );
+  for(;;) {
+    if(self >= tp.limit) {
+	pthread_mutex_lock( &tp.mut );
+	while(self >= tp.limit)
+	    pthread_cond_wait( &tp.parked, &tp.mut );
+	pthread_mutex_unlock( &tp.mut );
+    }
+    if(task_find( self, &t )) {
+	task_run( &t );
+	continue;
+    }
+    pthread_mutex_lock( &tp.mut );
+    tp.sleeping++;
+    while(tp.queued == 0 && self < tp.limit)
+	pthread_cond_wait( &tp.work, &tp.mut );
+    tp.sleeping--;
+    pthread_mutex_unlock( &tp.mut );
+  }
+  return NULL;
+}
+
+int taskpool_threads( int want )
+{
+  pthread_once( &tp_once, taskpool_init );
+
+#ifdef _SC_NPROCESSORS_ONLN
+  if(want < 0)
+    want = sysconf( _SC_NPROCESSORS_ONLN ) - 1;	/* leave one for the display */
+#endif
+  if(want < 1) want = 1;
+  if(want > MAXTASKTHREADS) want = MAXTASKTHREADS;
+
+  pthread_mutex_lock( &tp.mut );
+  while(tp.nth < want) {
+    struct taskworker *w = &tp.w[tp.nth];
+    pthread_mutex_init( &w->mut, NULL );
+    if(pthread_create( &w->th, NULL, task_worker, (void *)(long)tp.nth ) != 0) {
+	perror("taskpool: pthread_create");
+	break;
+    }
+    __sync_synchronize();
+    tp.nth++;
+  }
+  tp.limit = (want < tp.nth) ? want : tp.nth;
+  pthread_cond_broadcast( &tp.parked );
+  pthread_mutex_unlock( &tp.mut );
+  return tp.limit;
+}
+
+void task_submit( TaskGroup *g, int prio, void (*func)( void * ), void *arg )
+{
+  struct task t;
+  struct taskworker *w;
+  int self;
+
+  t.func = func;
+  t.arg = arg;
+  t.g = g;
+  if(prio < 0) prio = 0;
+  if(prio >= TASK_NPRIO) prio = TASK_NPRIO-1;
+
+  __sync_add_and_fetch( &g->pending, 1 );
+  if(g->cancelled || (tp.limit == 0 && taskpool_threads( -1 ) == 0)) {
+    task_run( &t );
+    return;
+  }
+
+  self = (int)(long)pthread_getspecific( tp.self ) - 1;
+  if(self < 0)
+    self = __sync_fetch_and_add( &tp.next, 1 ) % tp.limit;
+  w = &tp.w[self];
+  pthread_mutex_lock( &w->mut );
+  q_push( &w->q[prio], &t );
+  pthread_mutex_unlock( &w->mut );
+
+  __sync_add_and_fetch( &tp.queued, 1 );
+  pthread_mutex_lock( &tp.mut );
+  if(tp.sleeping > 0)
+    pthread_cond_signal( &tp.work );
+  pthread_mutex_unlock( &tp.mut );
+
+  pthread_mutex_lock( &g->mut );
+  g->submits++;
+  if(g->waiters > 0)
+    pthread_cond_broadcast( &g->done );
+  pthread_mutex_unlock( &g->mut );
+}
+
+void taskgroup_wait( TaskGroup *g )
+{
+  struct task t;
+  int seen, done;
+
+  for(;;) {
+    pthread_mutex_lock( &g->mut );
+    seen = g->submits;
+    pthread_mutex_unlock( &g->mut );
+
+    while(task_take( g, &t ))
+	task_run( &t );
+
+    pthread_mutex_lock( &g->mut );
+    g->waiters++;
+    while(g->pending > 0 && g->submits == seen)
+	pthread_cond_wait( &g->done, &g->mut );
+    g->waiters--;
+    done = (g->pending == 0);
+    pthread_mutex_unlock( &g->mut );
+    if(done)
+	return;
+  }
+}
+
+#else /* no threads: everything runs right away */
+
+int taskpool_threads( int want )
+{
+  return 0;
+}
+
+void task_submit( TaskGroup *g, int prio, void (*func)( void * ), void *arg )
+{
+  if(!g->cancelled)
+    (*func)( arg );
+}
+
+void taskgroup_wait( TaskGroup *g )
+{
+}
+
+#endif /*HAVE_PTHREAD_H*/
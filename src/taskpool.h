@@ -0,0 +1,60 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+/*
+ * One pool of worker threads, sized to the machine, shared by everything
+ * that works in the background:  frame preparation (recolor/resize/
+ * rethresh passes, warps -- see specks_parallel()) and texture prefetch.
+ * Tasks should run to completion without blocking; readers that may wait
+ * on I/O indefinitely (Threader<T>, the stream and shmfeed receivers)
+ * keep threads of their own.
+ *
+ * Each worker keeps its own queue per priority, and steals from the
+ * others' when it runs dry.  Higher priorities always go first, though
+ * a task once started runs to completion.  A thread waiting on a group
+ * runs that group's queued tasks itself, so frame preparation can't be
+ * held up behind background work.
+ *
+ * This file is part of partiview, released under the
+ * Illinois Open Source License; see the file LICENSE.partiview for details.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum taskprio {
+  TASK_FRAME,		/* interactive: the display is waiting for it */
+  TASK_PREFETCH,	/* wanted soon */
+  TASK_BACKGROUND,	/* conversions: whenever there's time */
+  TASK_NPRIO
+};
+
+typedef struct taskgroup TaskGroup;
+
+extern TaskGroup *taskgroup_new( void );
+extern void  taskgroup_free( TaskGroup * );	/* waits for its tasks first */
+
+	/* Queue func(arg).  Without threads, it's just called now. */
+extern void  task_submit( TaskGroup *, int prio, void (*func)( void * ), void *arg );
+
+	/* Wait until all of the group's tasks are done, running any
+	 * that haven't started yet in the calling thread.
+	 */
+extern void  taskgroup_wait( TaskGroup * );
+
+	/* Cooperative cancellation:  tasks not yet started are dropped,
+	 * and running ones should poll taskgroup_cancelled().
+	 */
+extern void  taskgroup_cancel( TaskGroup * );
+extern int   taskgroup_cancelled( TaskGroup * );
+
+	/* Use at most "want" worker threads (< 0: one fewer than CPUs).
+	 * Returns the number now in use.
+	 */
+extern int   taskpool_threads( int want );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*TASKPOOL_H*/
@@ -60,10 +60,10 @@ void TCPsocket::connectwith( const char *name, int port, bool nonblock )
 
     } else if(s != NULL) {
 	char *ts = new char[ s - name + 1 ];
-	memcpy( ts, s, s - name );
+	memcpy( ts, name, s - name );
 	ts[s-name] = '\0';
 	connectwith( ts, atoi(s+1), nonblock );
-	delete ts;
+	delete [] ts;
 	return;
     }
 	
@@ -85,7 +85,7 @@ void TCPsocket::connectwith( const char *name, int port, bool nonblock )
 	    fprintf(stderr, "TCPsocket(\"%s\") -- %s\n", name, s);
 	    return;
 	}
-	memcpy(&sin_.sin_addr, &hp->h_addr, sizeof(struct in_addr));
+	memcpy(&sin_.sin_addr, hp->h_addr, sizeof(struct in_addr));
     }
 
     if(!mksock( name, nonblock ))
@@ -288,15 +288,15 @@ int   tcpvalid( struct TCPsocket *ts ) {
 }
 
 int   tcpconnected( struct TCPsocket *ts ) {
-    return ts && ts->state_ == CONNECTED;
+    return ts && ts->connected();
 }
 
 int   tcplistening( struct TCPsocket *ts ) {
-    return ts && ts->state_ == LISTENING;
+    return ts && ts->listening();
 }
 
 void  tcpnonblock( struct TCPsocket *ts, int nonblock ) {
-    return ts && ts->nonblock_;
+    if(ts) ts->nonblock( nonblock );
 }
 
 int   tcpbe_connected( struct TCPsocket *ts ) {
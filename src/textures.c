@@ -6,6 +6,8 @@
  * This file is part of partiview, released under the
  * Illinois Open Source License; see the file LICENSE.partiview for details.
  */
+#include "config.h"
+
 #ifdef WIN32
 # include "winjunk.h"
 #else /*unix?*/
@@ -28,6 +30,8 @@
 #include "textures.h"
 #include "shmem.h"
 #include "findfile.h"
+#include "geomcache.h"
+#include "taskpool.h"
 
 #if sgi && mips
 # define glBindTexture  glBindTextureEXT
@@ -39,6 +43,9 @@
 #endif
 
 extern int mg_inhaletexture( Texture *tx, int rgba );
+extern int mg_texture_native( char *fname );
+
+#define TXROWSIZE(xsize, channels)  (((xsize)*(channels) + 3) & ~3)
 
 static int dspcontext = 0;
 
@@ -63,6 +70,52 @@ int get_dsp_context(void)
 #endif
 }
 
+/*
+ * With TXF_INTENSITY, add an alpha channel computed from the colors.
+ * Returns a malloc()ed copy, or just data if there's nothing to do.
+ */
+static unsigned char *txintensity( Texture *tx, unsigned char *data,
+				int xsize, int nrows, int *channelsp )
+{
+  int channels = *channelsp;
+  int irow, orow, y, k;
+  unsigned char *txdata, *ip, *op;
+
+  if(!(tx->flags&TXF_INTENSITY) || (channels != 1 && channels != 3))
+    return data;
+
+  irow = TXROWSIZE( xsize, channels );
+  channels++;
+  orow = TXROWSIZE( xsize, channels );
+  txdata = (unsigned char *)malloc( orow * nrows );
+  for(y = 0; y < nrows; y++) {
+    ip = data + y*irow;
+    op = txdata + y*orow;
+    k = xsize;
+    switch(channels) {
+    case 2:
+	do {
+	    op[1] = *ip++;
+	    op[0] = 255;
+	    op += 2;
+	} while(--k > 0);
+	break;
+    case 4:
+	do {
+	    op[3] = 77*ip[0] + 150*ip[1] + 28*ip[2];
+	    op[0] = ip[0]>=op[3] ? 255 : ip[0]/op[3];
+	    op[1] = ip[1]>=op[3] ? 255 : ip[0]/op[3];
+	    op[2] = ip[2]>=op[3] ? 255 : ip[2]/op[3];
+	    ip += 3;
+	    op += 4;
+	} while(--k > 0);
+	break;
+    }
+  }
+  *channelsp = channels;
+  return txdata;
+}
+
 #define TEXTURENO(enab)  ((enab) & 0xFFFFFF)
 #define	BLEND_ON	 0x40000000
 #define	BLEND_OFF	 0x20000000
@@ -175,46 +228,15 @@ int txbind( Texture *tx, int *enabled )
 
     if(wanted) {
 	static float black[4] = {0,0,0,0};
-	unsigned char *txdata = (unsigned char *)tx->data;
+	unsigned char *txdata;
 	int channels = tx->channels;
 
-	if((tx->flags&TXF_INTENSITY) && (channels == 1 || channels == 3)) {
-	    int npix = tx->xsize * tx->ysize;
-	    int k;
-	    unsigned char *ip, *op;
-	    channels++;
-	    txdata = (unsigned char *)malloc( npix * channels );
-	    k = npix;
-	    ip = (unsigned char *)tx->data;
-	    op = txdata;
-	    switch(channels) {
-	    case 2:
-		do {
-		    op[1] = *ip++;
-		    op[0] = 255;
-		    op += 2;
-		} while(--k > 0);
-		break;
-	    case 4:
-		do {
-		    op[3] = 77*ip[0] + 150*ip[1] + 28*ip[2];
-		    op[0] = ip[0]>=op[3] ? 255 : ip[0]/op[3];
-		    op[1] = ip[1]>=op[3] ? 255 : ip[0]/op[3];
-		    op[2] = ip[2]>=op[3] ? 255 : ip[2]/op[3];
-		    ip += 3;
-		    op += 4;
-		} while(--k > 0);
-		break;
-	    }
-	}
-
-	if(tx->xsize % 4 != 0)
-	    glPixelStorei( GL_PACK_ALIGNMENT, 1 );
-
 	if(tx->flags & TXF_3D) {
 #ifdef USE_GL_TEXTURE_3D
 
 	    tx->qualflags &= ~TXQ_MIPMAP;
+	    txdata = txintensity( tx, (unsigned char *)tx->data,
+				tx->xsize, tx->ysize*tx->zsize, &channels );
 	    glTexImage3D( GL_TEXTURE_3D, 0, channels,
 		    tx->xsize, tx->ysize, tx->zsize, 
 		    0, /* border */
@@ -222,25 +244,36 @@ int txbind( Texture *tx, int *enabled )
 			? GL_ALPHA : format[channels],
 		    GL_UNSIGNED_BYTE,
 		    txdata );
+	    if(txdata != (unsigned char *)tx->data)
+		free(txdata);
 #endif
 
 	} else {
-
-	    gluBuild2DMipmaps( GL_TEXTURE_2D, channels,
-		    tx->xsize, tx->ysize,
+	    /* Load prebuilt mipmaps, starting with the biggest level GL can take */
+	    GLint maxsize = 0;
+	    int lev, k;
+
+	    glGetIntegerv( GL_MAX_TEXTURE_SIZE, &maxsize );
+	    for(lev = 0; lev < tx->nmip-1 && maxsize > 0
+			&& (tx->mip[lev].xsize > maxsize || tx->mip[lev].ysize > maxsize); )
+		lev++;
+	    for(k = lev; k < tx->nmip; k++) {
+		struct txmip *m = &tx->mip[k];
+		channels = tx->channels;
+		txdata = txintensity( tx, (unsigned char *)m->data, m->xsize, m->ysize, &channels );
+		glTexImage2D( GL_TEXTURE_2D, k - lev, channels,
+		    m->xsize, m->ysize, 0, /* border */
 		    channels==1 && (tx->flags&TXF_ALPHA)
 			? GL_ALPHA : format[channels],
 		    GL_UNSIGNED_BYTE,
-		    txdata);
-
+		    txdata );
+		if(txdata != (unsigned char *)m->data)
+		    free(txdata);
+		if(!(tx->qualflags & TXQ_MIPMAP))
+		    break;		/* don't need the rest */
+	    }
 	}
 
-	if(tx->xsize % 4 != 0)
-	    glPixelStorei( GL_PACK_ALIGNMENT, 4 ); /* restore default */
-
-	if(txdata != (unsigned char *)tx->data)
-	    free(txdata);
-
 	glTexParameterfv(txtarget, GL_TEXTURE_BORDER_COLOR,
 	    black);
 	glTexParameterf(txtarget, GL_TEXTURE_WRAP_S,
@@ -306,13 +339,230 @@ Texture *txmake( char *fname, int apply, int txflags, int qualflags )
   return tx; 
 }
 
+/* "Nearest" power of 2, as gluBuild2DMipmaps() would choose */
+static int txpow2( int v )
+{
+  int p = 1;
+
+  if(v <= 1)
+    return 1;
+  for(;;) {
+    if(v == 1) return p;
+    if(v == 3) return p*4;
+    v >>= 1;
+    p *= 2;
+  }
+}
+
+/*
+ * Build a 2-D texture's mipmaps: resize (bilinearly) to powers of 2
+ * if need be, then average 2x2 blocks down to 1x1.
+ */
+static void txbuildmips( Texture *tx )
+{
+  int ch = tx->channels;
+  int xs = txpow2( tx->xsize ), ys = txpow2( tx->ysize );
+  int n, k, x, y, c;
+
+  for(n = 1; (xs >> (n-1)) > 1 || (ys >> (n-1)) > 1; n++)
+    ;
+  tx->nmip = n;
+  tx->mip = NewN( struct txmip, n );
+
+  if(xs != tx->xsize || ys != tx->ysize) {
+    int irow = TXROWSIZE( tx->xsize, ch ), orow = TXROWSIZE( xs, ch );
+    unsigned char *in = (unsigned char *)tx->data;
+    unsigned char *out = NewN( unsigned char, orow * ys );
+
+    for(y = 0; y < ys; y++) {
+	float fy = (y + .5f) * tx->ysize / ys - .5f;
+	int y0 = fy < 0 ? 0 : (int)fy;
+	int y1 = y0+1 < tx->ysize ? y0+1 : y0;
+	float wy = fy < 0 ? 0 : fy - y0;
+	for(x = 0; x < xs; x++) {
+	    float fx = (x + .5f) * tx->xsize / xs - .5f;
+	    int x0 = fx < 0 ? 0 : (int)fx;
+	    int x1 = x0+1 < tx->xsize ? x0+1 : x0;
+	    float wx = fx < 0 ? 0 : fx - x0;
+	    unsigned char *p00 = &in[y0*irow + x0*ch], *p01 = &in[y0*irow + x1*ch];
+	    unsigned char *p10 = &in[y1*irow + x0*ch], *p11 = &in[y1*irow + x1*ch];
+	    for(c = 0; c < ch; c++)
+		out[y*orow + x*ch + c] = (int)(
+			(1-wy) * ((1-wx)*p00[c] + wx*p01[c])
+			+ wy * ((1-wx)*p10[c] + wx*p11[c]) + .5f );
+	}
+    }
+    Free( tx->data );
+    tx->data = (char *)out;
+    tx->xsize = xs;
+    tx->ysize = ys;
+  }
+  tx->mip[0].xsize = xs;
+  tx->mip[0].ysize = ys;
+  tx->mip[0].data = tx->data;
+
+  for(k = 1; k < n; k++) {
+    struct txmip *a = &tx->mip[k-1], *m = &tx->mip[k];
+    int arow = TXROWSIZE( a->xsize, ch ), mrow;
+    int dx = (a->xsize > 1) ? ch : 0, dy = (a->ysize > 1) ? arow : 0;
+
+    m->xsize = a->xsize > 1 ? a->xsize/2 : 1;
+    m->ysize = a->ysize > 1 ? a->ysize/2 : 1;
+    mrow = TXROWSIZE( m->xsize, ch );
+    m->data = NewN( char, mrow * m->ysize );
+    for(y = 0; y < m->ysize; y++) {
+	unsigned char *ip = (unsigned char *)a->data + (dy ? 2*y*arow : 0);
+	unsigned char *op = (unsigned char *)m->data + y*mrow;
+	for(x = 0; x < m->xsize; x++, ip += 2*dx) {
+	    for(c = 0; c < ch; c++)
+		*op++ = (ip[c] + ip[c+dx] + ip[c+dy] + ip[c+dx+dy] + 2) >> 2;
+	}
+    }
+  }
+}
+
+/*
+ * Decoded 2-D textures, with their mipmaps, are kept in a cache file
+ * (see geomcache.h), so next time we just map them.
+ */
+static int txreadcache( Texture *tx )
+{
+  GeomCache *gc;
+  int *hdr;
+  int n, k, ch;
+  char sname[16];
+  struct txmip *mip;
+
+  if(tx->alphafilename != NULL
+		|| (gc = geomcache_open( tx->filename, "tex" )) == NULL)
+    return 0;
+  hdr = (int *)geomcache_get( gc, "hdr", sizeof(int), &n );
+  if(hdr == NULL || n != 4 || hdr[0] < 1 || hdr[0] > 4 || hdr[3] < 1 || hdr[3] > 32) {
+    geomcache_close( gc );
+    return 0;
+  }
+  ch = hdr[0];
+  mip = NewN( struct txmip, hdr[3] );
+  for(k = 0; k < hdr[3]; k++) {
+    mip[k].xsize = (hdr[1] >> k) > 1 ? hdr[1] >> k : 1;
+    mip[k].ysize = (hdr[2] >> k) > 1 ? hdr[2] >> k : 1;
+    sprintf(sname, "mip%d", k);
+    mip[k].data = (char *)geomcache_get( gc, sname, 1, &n );
+    if(mip[k].data == NULL || n != TXROWSIZE(mip[k].xsize, ch) * mip[k].ysize) {
+	Free( mip );
+	geomcache_close( gc );
+	return 0;
+    }
+  }
+  geomcache_close( gc );
+
+  tx->channels = ch;
+  tx->xsize = hdr[1];
+  tx->ysize = hdr[2];
+  tx->zsize = 1;
+  tx->nmip = hdr[3];
+  tx->mip = mip;
+  tx->data = mip[0].data;
+  tx->flags |= TXF_LOADED | TXF_RGBA | TXF_CACHED;
+  return 1;
+}
+
+static void txsavecache( GeomCache *gc, Texture *tx )
+{
+  int hdr[4], k;
+  char sname[16];
+
+  if(gc == NULL || tx->nmip <= 0)
+    return;
+  hdr[0] = tx->channels;
+  hdr[1] = tx->mip[0].xsize;
+  hdr[2] = tx->mip[0].ysize;
+  hdr[3] = tx->nmip;
+  geomcache_put( gc, "hdr", hdr, sizeof(int), 4 );
+  for(k = 0; k < tx->nmip; k++) {
+    sprintf(sname, "mip%d", k);
+    geomcache_put( gc, sname, tx->mip[k].data, 1,
+		TXROWSIZE(tx->mip[k].xsize, tx->channels) * tx->mip[k].ysize );
+  }
+  geomcache_save( gc );
+}
+
+/* Read tx's image file(s), or its cache.  May be called in a worker thread. */
+static int txdecode( Texture *tx )
+{
+  GeomCache *gc = NULL;
+
+  if(txreadcache( tx ))
+    return 1;
+  if(tx->alphafilename == NULL)
+    gc = geomcache_create( tx->filename, "tex" );	/* before we read it */
+  if(mg_inhaletexture( tx, TXF_RGBA ) <= 0) {
+    geomcache_close( gc );
+    return 0;
+  }
+  if(!(tx->flags & TXF_3D)) {
+    txbuildmips( tx );
+    txsavecache( gc, tx );
+  }
+  geomcache_close( gc );
+  return 1;
+}
+
+/*
+ * Background decoding.  txprefetch() queues a texture on the shared task
+ * pool (taskpool.c) at TASK_PREFETCH priority; txload() on a queued texture
+ * waits for it, or just decodes it itself if no worker has started on it yet.
+ * Only the calling thread changes tx->loaded; workers report through
+ * tx->decoded.  Images needing outside programs (tifftopnm etc.) aren't queued.
+ */
+#if defined(HAVE_PTHREAD_H) && !CAVE
+# define TXTHREADS 1
+#endif
+
+#if TXTHREADS
+
+static void txdecode_task( void *vtx )
+{
+  Texture *tx = (Texture *)vtx;
+
+  tx->decoded = txdecode( tx ) ? 1 : -1;
+}
+
+static int txwait( Texture *tx )
+{
+  taskgroup_wait( tx->prefetch );	/* runs it right here if not started yet */
+  tx->loaded = tx->decoded;
+  return tx->loaded == 1;
+}
+
+#endif /*TXTHREADS*/
+
+void txprefetch( Texture *tx )
+{
+#if TXTHREADS
+  if(tx == NULL || tx->loaded != 0
+		|| !mg_texture_native( tx->filename )
+		|| !mg_texture_native( tx->alphafilename ))
+    return;
+
+  if(tx->prefetch == NULL)
+    tx->prefetch = taskgroup_new();
+  tx->decoded = 0;
+  tx->loaded = 3;
+  task_submit( tx->prefetch, TASK_PREFETCH, txdecode_task, tx );
+#endif
+}
+
 int txload( Texture *tx )
 {
   if(tx == NULL || tx->loaded < 0) return 0;
   if(tx->loaded == 1) return 1; /* already loaded */
+#if TXTHREADS
+  if(tx->loaded == 3) return txwait( tx );	/* queued for a worker */
+#endif
   if(tx->loaded == 2) return 0;	/* busy loading now! */
   tx->loaded = 2;	/* set this to make multiprocess collisions unlikely */
-  if(mg_inhaletexture( tx, TXF_RGBA ) <= 0) {
+  if(txdecode( tx ) <= 0) {
     tx->loaded = -1;
     return 0;
   }
@@ -347,5 +597,6 @@ int txaddentry( Texture ***tp, int *ntextures, char *fromfile,
     memset(&(*tp)[ontex], 0, (*ntextures - ontex) * sizeof(Texture *));
   }
   (*tp)[txno] = txmake( shmstrdup(realfname), apply, txflags, qualflags );
+  txprefetch( (*tp)[txno] );
   return txno;
 }
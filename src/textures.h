@@ -21,6 +21,7 @@ typedef struct { float r,g,b,a; } ColorA;
 Texture * txmake( char *fname, int apply, int txflags, int qualflags );
 int       txload( Texture *tx );
 int	  txbind( Texture *tx, int *enabled );
+void	  txprefetch( Texture *tx );	/* start decoding tx in the background */
 
 int	  txaddentry( Texture ***tp, int *ntextures, char *fromfile,
 		int txno, char *txfname, int apply, int txflags, int qualflags );
@@ -32,6 +33,11 @@ void	  set_dsp_context(int ctxno);
 
 #define MAXDSPCTX 18
 
+struct txmip {			/* one level of a 2-D texture's mipmaps */
+    int xsize, ysize;		/* powers of 2; rows are padded to 4 bytes */
+    char *data;
+};
+
 struct Texture {
     char *filename;		/* ppm or pgm (.Z) file */
     char *alphafilename;	/* If present, this is a .pgm (.Z) file */
@@ -40,13 +46,17 @@ struct Texture {
     int channels;
     unsigned int flags;		/* clamp, etc. */
     int apply;			/* Application style (TXF_DECAL, TXF_MODULATE, TXF_BLEND) */
-    int loaded;			/* 0: not yet; 1: yes; -1: error */
+    int loaded;			/* 0: not yet; 1: yes; -1: error; 2: loading; 3: queued */
+    int decoded;		/* if queued: 1 or -1 once a worker has decoded it */
+    struct taskgroup *prefetch;	/* txprefetch()'s decoding task, once queued */
     int coords;			/* Texture-coord auto generation (not used) */
     int qualflags;		/* APF_TX{MIPMAP,MIPINTERP,LINEAR}: if loaded, how? */
     int report;
     ColorA background;		/* background color: outside of clamped texture */
     Matrix tfm;			/* texture-coord transformation */
     int txid[MAXDSPCTX];	/* OpenGL texture-object id's */
+    int nmip;			/* 2-D: mip[0] is data, resized to a power of 2 */
+    struct txmip *mip;
     struct Texture *next;	/* Link in list of all loaded textures */
 };
 
@@ -68,6 +78,7 @@ extern Texture *AllLoadedTextures;	/* List of em */
 #define	  TXF_OVER	  0x100	/* always use "over" compositing */
 
 #define	  TXF_3D	  0x200	/* 3-D texture */
+#define	  TXF_CACHED	  0x400	/* data and mip[] are mapped from the texture cache */
 
 #define	TX_APPLY	451	/* Interpret texture values to... */
 #define	  TXF_MODULATE	  0
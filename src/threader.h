@@ -6,6 +6,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <pthread.h>
 #include <errno.h>
 
@@ -46,6 +47,8 @@ template <class T> class Threader {
 
   public:
 
+    // func() may block indefinitely (e.g. reading a socket), so it gets
+    // a thread of its own rather than a worker from the task pool.
     void start( T *inst, void *(T::*func)(void) ) {
 
 	threaded_ = true;
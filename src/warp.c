@@ -52,6 +52,11 @@
 
 #include "textures.h"		/* for get_dsp_context() */
 
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define WARP_SSE 1
+#endif
+
 #ifndef __linux__
 /* MacOSX and MinGW don't have this */
 static void my_sincosf(float x, float *sinp, float *cosp)
@@ -68,6 +73,7 @@ struct speckcache {
     float tfrac;
     double realtime;
     struct specklist *sl;
+    int gen;		/* pool generation sl was published as */
 };
 
 #define COORD_DISK   0
@@ -139,10 +145,16 @@ struct warpstuff {
     float fixomega;
 
     struct speckcache slc[MAXDSPCTX];
+    struct slpool *pool;	/* buffers for slc[].sl */
 };
 
 static float fastsin2pi( float v );
-static void inittables(void);
+
+/* Taylor coefficients for sin(y), |y| <= pi/2 */
+#define SIN_C3	(-1.0f/6)
+#define SIN_C5	(1.0f/120)
+#define SIN_C7	(-1.0f/5040)
+#define SIN_C9	(1.0f/362880)
 static struct specklist *warp_get_parti( struct dyndata *dd, struct stuff *st, double realtime );
 static int warp_get_trange( struct dyndata *dd, struct stuff *st, double *tminp, double *tmaxp, int ready );
 static int warp_parse_args( struct dyndata *dd, struct stuff *st, int argc, char **argv );
@@ -366,8 +378,6 @@ struct warpstuff *warp_setup( struct stuff *st, struct warpstuff *oldws, int arg
 
   if(optindp) *optindp = 0;
 
-  inittables();
-
   if(oldws)
     tws = *oldws;
   else
@@ -739,50 +749,207 @@ void animgalaxy_o2d( struct warpstuff *ws, Point *out, struct speck *sp )
     dvtfmpoint( out, &tout, ws->d2o );
 }
 
-void warpspecks( struct warpstuff *ws,
-		 struct stuff *st,
-		 struct specklist *osl,
-		 struct specklist *sl )
+/*
+ * Warping is split into jobs of WARPCHUNK specks, run on the worker
+ * pool by specks_parallel().  Within a job, DIFFROT and PROJECT
+ * work on batches of specks, four at a time with SSE when we have it.
+ */
+#define WARPCHUNK	16384	/* specks per job */
+#define WARPBATCH	64	/* specks per DIFFROT batch; multiple of 4 */
+
+struct projcol {	/* PROJECT: one input field, and its weight in each of x,y,z */
+    float f[4];
+    int c;
+};
+
+struct warpwork {
+    struct warpstuff *ws;
+    struct specklist *osl, *sl;
+    int n;
+    int deg;		/* EXTRAPOLATE */
+    int project;	/* PROJECT: 0 => just copy positions */
+    int ncols;
+    struct projcol *cols;
+    float add[4];
+};
+
+#ifdef WARP_SSE
+
+/* four fastsin2pi()s at once */
+static __m128 fastsin2pi4( __m128 v )
 {
-  struct speck *osp, *sp;
-  int i, n;
+    __m128 half = _mm_set1_ps( 0.5f );
+    __m128 quarter = _mm_set1_ps( 0.25f );
+    __m128 signbit = _mm_set1_ps( -0.0f );
+    __m128 u = _mm_add_ps( v, half );
+    __m128 fl = _mm_cvtepi32_ps( _mm_cvttps_epi32( u ) );
+    __m128 t, big, y, y2, p;
+
+    fl = _mm_sub_ps( fl, _mm_and_ps( _mm_cmpgt_ps( fl, u ), _mm_set1_ps( 1.0f ) ) );
+    t = _mm_sub_ps( v, fl );				/* -.5 .. .5 */
+    big = _mm_cmpgt_ps( _mm_andnot_ps( signbit, t ), quarter );
+    t = _mm_or_ps( _mm_andnot_ps( big, t ),		/* fold into -.25 .. .25 */
+		   _mm_and_ps( big, _mm_sub_ps( _mm_or_ps( _mm_and_ps( signbit, t ), half ), t ) ) );
+    y = _mm_mul_ps( t, _mm_set1_ps( 2*M_PI ) );
+    y2 = _mm_mul_ps( y, y );
+    p = _mm_add_ps( _mm_set1_ps( SIN_C7 ), _mm_mul_ps( y2, _mm_set1_ps( SIN_C9 ) ) );
+    p = _mm_add_ps( _mm_set1_ps( SIN_C5 ), _mm_mul_ps( y2, p ) );
+    p = _mm_add_ps( _mm_set1_ps( SIN_C3 ), _mm_mul_ps( y2, p ) );
+    p = _mm_add_ps( _mm_set1_ps( 1.0f ), _mm_mul_ps( y2, p ) );
+    return _mm_mul_ps( y, p );
+}
 
-  if(osl->specks == NULL) return;
-  n = osl->nspecks;
-  /* memcpy( sl->specks, osl->specks, osl->bytesperspeck * n ); */
-  osp = osl->specks;
-  sp = sl->specks;
-  switch(ws->style) {
-  case EXTRAPOLATE: {
-	int deg = ws->degree;
-	int excess = SMALLSPECKSIZE( ws->degree*3 + ws->coef0 ) - sl->bytesperspeck;
-	if(excess > 0)
-	    deg -= (excess+2) / 3;
-	    
-	for(i = 0; i < n; i++) {
+/* windup() on n (a multiple of 4) points, in place.  y is unchanged. */
+static void windup_batch( struct warpstuff *ws, float *x, float *y, float *z, int n )
+{
+    __m128 rc = _mm_set1_ps( ws->rcoredisk );
+    __m128 ro = _mm_set1_ps( ws->routercoredisk );
+    __m128 invspan = _mm_set1_ps( 1 / (ws->routercoredisk - ws->rcoredisk) );
+    __m128 one = _mm_set1_ps( 1.0f );
+    __m128 zero = _mm_setzero_ps();
+    __m128 fixomega = _mm_set1_ps( ws->fixomega );
+    __m128 tfrac = _mm_set1_ps( ws->tfrac );
+    __m128 rigidrot = _mm_set1_ps( ws->rigidrot );
+    __m128 quarter = _mm_set1_ps( 0.25f );
+    int j;
+
+    for(j = 0; j < n; j += 4) {
+	__m128 vx = _mm_loadu_ps( &x[j] );
+	__m128 vz = _mm_loadu_ps( &z[j] );
+	__m128 r = _mm_sqrt_ps( _mm_add_ps( _mm_mul_ps( vx, vx ), _mm_mul_ps( vz, vz ) ) );
+	__m128 ror = _mm_div_ps( ro, r );
+	__m128 f, sl, inner, outer, omega, theta, s, c;
+
+	/* slerp( 1+(r-ro)/(ro-rc), 1, ro/r ) */
+	f = _mm_add_ps( one, _mm_mul_ps( _mm_sub_ps( r, ro ), invspan ) );
+	f = _mm_min_ps( _mm_max_ps( f, zero ), one );
+	sl = _mm_mul_ps( _mm_mul_ps( f, f ), _mm_sub_ps( _mm_set1_ps( 3.0f ), _mm_add_ps( f, f ) ) );
+	sl = _mm_add_ps( one, _mm_mul_ps( sl, _mm_sub_ps( ror, one ) ) );
+
+	inner = _mm_cmple_ps( r, rc );
+	outer = _mm_andnot_ps( inner, _mm_cmpge_ps( r, ro ) );
+	omega = _mm_or_ps( _mm_and_ps( inner, one ),
+		_mm_or_ps( _mm_and_ps( outer, ror ),
+			   _mm_andnot_ps( _mm_or_ps( inner, outer ), sl ) ) );
+
+	theta = _mm_add_ps( _mm_mul_ps( _mm_sub_ps( omega, fixomega ), tfrac ), rigidrot );
+	s = fastsin2pi4( theta );
+	c = fastsin2pi4( _mm_add_ps( theta, quarter ) );
+
+	_mm_storeu_ps( &x[j], _mm_sub_ps( _mm_mul_ps( vx, c ), _mm_mul_ps( vz, s ) ) );
+	_mm_storeu_ps( &z[j], _mm_add_ps( _mm_mul_ps( vx, s ), _mm_mul_ps( vz, c ) ) );
+    }
+}
+
+static void project1( struct warpwork *w, Point *out, CONST float *oval )
+{
+    __m128 acc = _mm_loadu_ps( w->add );
+    float v[4];
+    int m;
+
+    for(m = 0; m < w->ncols; m++)
+	acc = _mm_add_ps( acc, _mm_mul_ps( _mm_set1_ps( oval[ w->cols[m].c ] ),
+					   _mm_loadu_ps( w->cols[m].f ) ) );
+    _mm_storeu_ps( v, acc );
+    out->x[0] = v[0];
+    out->x[1] = v[1];
+    out->x[2] = v[2];
+}
+
+#else /* !WARP_SSE */
+
+static void windup_batch( struct warpstuff *ws, float *x, float *y, float *z, int n )
+{
+    Point in, out;
+    int j;
+
+    for(j = 0; j < n; j++) {
+	in.x[0] = x[j];  in.x[1] = y[j];  in.x[2] = z[j];
+	windup( ws, &out, &in );
+	x[j] = out.x[0];
+	z[j] = out.x[2];
+    }
+}
+
+static void project1( struct warpwork *w, Point *out, CONST float *oval )
+{
+    float v0 = w->add[0], v1 = w->add[1], v2 = w->add[2];
+    int m;
+
+    for(m = 0; m < w->ncols; m++) {
+	float val = oval[ w->cols[m].c ];
+	v0 += val * w->cols[m].f[0];
+	v1 += val * w->cols[m].f[1];
+	v2 += val * w->cols[m].f[2];
+    }
+    out->x[0] = v0;
+    out->x[1] = v1;
+    out->x[2] = v2;
+}
+
+#endif /* !WARP_SSE */
+
+static void windup_range( struct warpstuff *ws, struct specklist *osl, struct specklist *sl, int i0, int i1 )
+{
+    float x[WARPBATCH], y[WARPBATCH], z[WARPBATCH];
+    struct speck *osp = NextSpeck( osl->specks, osl, i0 );
+    struct speck *sp = NextSpeck( sl->specks, sl, i0 );
+    struct speck *op;
+    int i, j, nb;
+    Point t;
+
+    for(i = i0; i < i1; i += nb) {
+	nb = (i1 - i < WARPBATCH) ? i1 - i : WARPBATCH;
+	for(j = 0, op = osp; j < nb; j++, op = NextSpeck(op, osl, 1)) {
+	    if(ws->has_o2d)
+		dvtfmpoint( &t, &op->p, ws->o2d );
+	    else
+		t = op->p;
+	    x[j] = t.x[0];  y[j] = t.x[1];  z[j] = t.x[2];
+	}
+	for( ; j & 3; j++)
+	    x[j] = y[j] = z[j] = 0;
+
+	windup_batch( ws, x, y, z, j );
+
+	for(j = 0; j < nb; j++) {
+	    t.x[0] = x[j];  t.x[1] = y[j];  t.x[2] = z[j];
 	    if(ws->has_o2d)
-		extrap_o2d( ws, &sp->p, osp, deg );
+		dvtfmpoint( &sp->p, &t, ws->d2o );
 	    else
-		extrap( ws, &sp->p, &osp->p, osp, deg );
-	    osp = NextSpeck(osp, osl, 1);
+		sp->p = t;
 	    sp = NextSpeck(sp, sl, 1);
 	}
+	osp = op;
     }
-    break;
+}
 
-  case DIFFROT:
-    for(i = 0; i < n; i++) {
+static void warprange( struct warpwork *w, int i0, int i1 )
+{
+  struct warpstuff *ws = w->ws;
+  struct specklist *osl = w->osl, *sl = w->sl;
+  struct speck *osp = NextSpeck( osl->specks, osl, i0 );
+  struct speck *sp = NextSpeck( sl->specks, sl, i0 );
+  int i;
+
+  switch(ws->style) {
+  case EXTRAPOLATE:
+    for(i = i0; i < i1; i++) {
 	if(ws->has_o2d)
-	    windup_o2d( ws, &sp->p, &osp->p );
+	    extrap_o2d( ws, &sp->p, osp, w->deg );
 	else
-	    windup( ws, &sp->p, &osp->p );
+	    extrap( ws, &sp->p, &osp->p, osp, w->deg );
 	osp = NextSpeck(osp, osl, 1);
 	sp = NextSpeck(sp, sl, 1);
     }
     break;
 
+  case DIFFROT:
+    windup_range( ws, osl, sl, i0, i1 );
+    break;
+
   case SHEETWARP:
-    for(i = 0; i < n; i++) {
+    for(i = i0; i < i1; i++) {
 	if(ws->has_o2d)
 	    sheetwarp_o2d( ws, &sp->p, &osp->p );
 	else
@@ -793,57 +960,124 @@ void warpspecks( struct warpstuff *ws,
     break;
 
   case GALAXYRIDE:
-    if(ws->coef0 >= 0 && ws->coef0 + 8 <= SPECKMAXVAL(osl)) {
-	for(i = 0; i < n; i++) { 
-	    if(ws->has_o2d)
-		animgalaxy_o2d( ws, &sp->p, osp );
-	    else
-		animgalaxy( ws, &sp->p, &osp->p, osp );
-	    osp = NextSpeck(osp, osl, 1);
-	    sp = NextSpeck(sp, sl, 1);
+    for(i = i0; i < i1; i++) { 
+	if(ws->has_o2d)
+	    animgalaxy_o2d( ws, &sp->p, osp );
+	else
+	    animgalaxy( ws, &sp->p, &osp->p, osp );
+	osp = NextSpeck(osp, osl, 1);
+	sp = NextSpeck(sp, sl, 1);
+    }
+    break;
+
+  case PROJECT:
+    for(i = i0; i < i1; i++) {
+	if(w->project)
+	    project1( w, &sp->p, &osp->val[0] );
+	else
+	    sp->p = osp->p;	/* Can't transform, or identity tfm */
+	osp = NextSpeck(osp, osl, 1);
+	sp = NextSpeck(sp, sl, 1);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+static void warpjob( void *arg, int jobno )
+{
+  struct warpwork *w = (struct warpwork *)arg;
+  int i0 = jobno * WARPCHUNK;
+  int i1 = (i0 + WARPCHUNK < w->n) ? i0 + WARPCHUNK : w->n;
+
+  warprange( w, i0, i1 );
+}
+
+/* Gather PROJECT's sparse rows into one weight vector per input field */
+static void projcols( struct warpwork *w, struct warpstuff *ws )
+{
+  int xindex = &(((struct speck *)0)->p.x[0]) - &(((struct speck *)0)->val[0]);
+  int k, m, room = 3;
+
+  for(k = 0; k < 3; k++)
+    room += ws->sproj[k].len;
+  w->cols = NewN( struct projcol, room );
+  w->ncols = 0;
+  for(k = 0; k < 3; k++) {
+    struct svvec *sproj = &ws->sproj[k];
+    w->add[k] = ws->sfadd[k];
+    for(m = 0; m < (sproj->len == 0 ? 1 : sproj->len); m++) {
+	int c = sproj->len == 0 ? xindex + k : sproj->v[m].c;
+	float f = sproj->len == 0 ? 1 : sproj->v[m].f;
+	int j;
+	for(j = 0; j < w->ncols && w->cols[j].c != c; j++)
+	    ;
+	if(j == w->ncols) {
+	    memset( &w->cols[j], 0, sizeof(w->cols[j]) );
+	    w->cols[j].c = c;
+	    w->ncols++;
 	}
+	w->cols[j].f[k] += f;
+    }
+  }
+  w->add[3] = 0;
+}
+
+void warpspecks( struct warpstuff *ws,
+		 struct stuff *st,
+		 struct specklist *osl,
+		 struct specklist *sl )
+{
+  struct warpwork w;
+
+  if(osl->specks == NULL) return;
+
+  memset( &w, 0, sizeof(w) );
+  w.ws = ws;
+  w.osl = osl;
+  w.sl = sl;
+  w.n = osl->nspecks;
+
+  switch(ws->style) {
+  case EXTRAPOLATE: {
+	int excess = SMALLSPECKSIZE( ws->degree*3 + ws->coef0 ) - sl->bytesperspeck;
+	w.deg = ws->degree;
+	if(excess > 0)
+	    w.deg -= (excess+2) / 3;
     }
     break;
 
+  case DIFFROT:
+  case SHEETWARP:
+    break;
+
+  case GALAXYRIDE:
+    if(!(ws->coef0 >= 0 && ws->coef0 + 8 <= SPECKMAXVAL(osl)))
+	return;
+    break;
+
   case PROJECT: {
-	int k;
 	int maxval = SPECKMAXVAL(osl);
 	int maxcoef = ws->sproj[0].maxc > ws->sproj[1].maxc ? ws->sproj[0].maxc : ws->sproj[1].maxc;
 	if(maxcoef < ws->sproj[2].maxc)
 	    maxcoef = ws->sproj[2].maxc;
-
-	if(maxcoef >= maxval) {
-	    /* Can't transform, or identity tfm */
-	    for(i = 0; i < n; i++) {
-		sp->p = osp->p;
-		osp = NextSpeck(osp, osl, 1);
-		sp = NextSpeck(sp, sl, 1);
-	    }
-	} else {
-	    for(i = 0; i < n; i++) {
-		for(k = 0; k < 3; k++) {
-		    struct svvec *sproj = &ws->sproj[k];
-		    float *oval = &osp->val[0];
-		    float v = ws->sfadd[k];
-		    if(sproj->len == 0) {
-			v += osp->p.x[k];
-		    } else {
-			int m;
-			for(m = 0; m < sproj->len; m++)
-			    v += osp->val[ sproj->v[m].c ] * sproj->v[m].f;
-		    }
-		    sp->p.x[k] = v;
-		}
-		osp = NextSpeck(osp, osl, 1);
-		sp = NextSpeck(sp, sl, 1);
-	    }
-	}
+	w.project = (maxcoef < maxval);
+	if(w.project)
+	    projcols( &w, ws );
     }
     break;
 
   default:
     msg("warp: warped style %d", ws->style);
+    return;
   }
+
+  specks_parallel( warpjob, &w, (w.n + WARPCHUNK-1) / WARPCHUNK, w.n );
+
+  if(w.cols)
+    Free(w.cols);
 }
 
 static float warpfrac( struct warpstuff *ws, double time )
@@ -960,27 +1194,18 @@ static void setup_coords( struct stuff *st, struct warpstuff *ws ) {
 }
 
 
-#define MAXINTERP 1024
-
-float sintbl[MAXINTERP+1];
-
-static void inittables(void) {
-  int i;
-
-  for(i = 0; i <= MAXINTERP; i++)
-    sintbl[i] = sinf(2*M_PI*i / MAXINTERP);
-}
-
 /* fastsin2pi( x ) returns approximately sin( 2*pi*x ),
  * i.e. sin(x) if x is given as a fraction of a full 360-degree turn.
+ * Polynomial, rather than table lookup, so fastsin2pi4() can do the same.
  */
 static float fastsin2pi( float v ) {
-  int i;
-  while(v < 0) v += 1;
-  while(v > 1) v -= 1;
-  v *= MAXINTERP;
-  i = (int)v;
-  return sintbl[i] + (v - i)*(sintbl[i+1]-sintbl[i]);
+  float t = v - floorf( v + 0.5f );	/* -.5 .. .5 */
+  float y, y2;
+  if(t > 0.25f) t = 0.5f - t;		/* fold into -.25 .. .25 */
+  else if(t < -0.25f) t = -0.5f - t;
+  y = t * (float)(2*M_PI);
+  y2 = y*y;
+  return y * (1 + y2*(SIN_C3 + y2*(SIN_C5 + y2*(SIN_C7 + y2*SIN_C9))));
 }
 
 void deucinv( double dst[16], CONST double src[16] )
@@ -1113,19 +1338,6 @@ int warp_get_trange( struct dyndata *dd, struct stuff *st, double *tminp, double
   return 1;
 }
 
-static void scrapsl( struct specklist **slp ) {
-  struct specklist *sl, *slnext;
-  if(slp == NULL) return;
-  sl = *slp;
-  *slp = NULL;
-  for( ; sl; sl = slnext) {
-    slnext = sl->next;
-    if(sl->specks) Free(sl->specks);
-    Free(sl);
-  }
-}
-
-
 int warp_read( struct stuff **stp, int argc, char *argv[], char *fname, void *etc ) {
     struct stuff *st = *stp;
     struct warpstuff *ws;
@@ -1150,6 +1362,8 @@ int warp_read( struct stuff **stp, int argc, char *argv[], char *fname, void *et
     st->dyn.ctlcmd = warp_parse_args;
     st->dyn.draw = NULL;
     st->dyn.free = NULL;
+    st->dyn.pool = ws->pool;
+    st->dyn.async = 1;		/* warp_get_parti() only touches ws and its own buffers */
     st->dyn.enabled = 1;
     warp_invalidate( st, ws );
     return 1;
@@ -1159,15 +1373,29 @@ void warp_init() {
     parti_add_reader( warp_read, "warp", NULL );
 }
 
+/*
+ * Our copies keep a sel[] of their own, since the source list may be
+ * retired and freed while a copy is still on screen.  Selection edits
+ * land in whichever was changed last (higher selseq), and are copied
+ * across to the other.
+ */
+static void warp_syncsel( struct specklist *sl, struct specklist *osl )
+{
+  if(sl->sel == NULL || sl->nsel != osl->nsel || sl->selseq < osl->selseq)
+    specks_copy_sel( sl, osl );
+  else if(sl->selseq > osl->selseq && osl->sel != NULL)
+    specks_copy_sel( osl, sl );
+}
+
 struct specklist *
 warp_get_parti( struct dyndata *dd, struct stuff *st, double arealtime )
 {
   struct warpstuff *ws = (struct warpstuff *)dd->data;
   int ctx = get_dsp_context();
   struct speckcache *sc = &ws->slc[ctx];
-  struct specklist *sl, *osl, **slp;
+  struct specklist *sl, *osl, *head, **slp;
   static int once = 1;
-  int stepno;
+  int stepno, pin, cached;
   double realtime = arealtime;
 
 #if unix
@@ -1177,7 +1405,12 @@ warp_get_parti( struct dyndata *dd, struct stuff *st, double arealtime )
   }
 #endif
 
-  if(ws->locked && ws->valid && sc != NULL)
+  /* Our cached chain is only good while the display still holds it;
+   * once released, its buffers may be refilled under us.
+   */
+  cached = sc->sl != NULL && specks_pool_current( ws->pool, sc->sl, sc->gen );
+
+  if(ws->locked && ws->valid && cached)
     return sc->sl;
 
   setup_coords( st, ws );	/* bind coordsys-related stuff now */
@@ -1206,29 +1439,66 @@ warp_get_parti( struct dyndata *dd, struct stuff *st, double arealtime )
 
   if(getenv("WDBG")) printf("%g %g %g # rt frac frac(rt)\n", realtime, ws->tfrac, warpfrac(ws, realtime*ws->tunit));
 
-  if(sc->sl != NULL && sc->tfrac == ws->tfrac && sc->realtime == arealtime)
+  if(cached && sc->tfrac == ws->tfrac && sc->realtime == arealtime)
     return sc->sl;
 
+  pin = specks_pin( st );	/* we may be on the dynasync thread */
   osl = specks_timespecks( st, 0, stepno );
-  slp = &sc->sl;
+
+  /* Warp into recycled buffers, leaving the chain on display alone.
+   * A buffer last filled from this same source keeps its copy of
+   * everything but the positions.
+   */
+  if(ws->pool == NULL)
+    ws->pool = specks_pool_new();
+  dd->pool = ws->pool;
 
   prewarpspecklist( ws, st, osl );
-  for(sl = *slp; osl != NULL; osl = osl->next, slp = &sl->next, sl = *slp) {
-    if(sl == NULL || sl->speckseq != osl->speckseq) {
-	scrapsl(slp);
-	sl = NewN( struct specklist, 1 );
+
+  /* Selection commands act on st->sl, which may be a copy we handed out
+   * from another buffer; carry what they did back to the source first.
+   */
+  if(specks_pool_has( ws->pool, st->sl )) {
+    struct specklist *dsl, *tsl;
+    for(dsl = st->sl, tsl = osl; dsl != NULL && tsl != NULL; dsl = dsl->next, tsl = tsl->next)
+	if(dsl->speckseq == tsl->speckseq && dsl->nsel == tsl->nsel
+				&& dsl->selseq > tsl->selseq && tsl->sel != NULL)
+	    specks_copy_sel( tsl, dsl );
+  }
+
+  head = NULL;
+  for(slp = &head; osl != NULL; osl = osl->next, slp = &sl->next) {
+    int same;
+    sl = specks_pool_acquire( ws->pool, osl->speckseq, osl->nspecks, osl->bytesperspeck, &same );
+    if(!same) {
+	struct speck *specks = sl->specks;
 	*sl = *osl;
-	sl->specks = NULL;
+	sl->specks = specks;
 	sl->next = NULL;
-	if(osl->specks) {
-	    int len = osl->bytesperspeck * osl->nspecks;
-	    sl->specks = (struct speck *)NewN( char, len );
-	    memcpy( sl->specks, osl->specks, len );
+	sl->sel = NULL;
+	sl->nsel = 0;
+	sl->thix = NULL;
+	sl->cix = NULL;
+	sl->ncix = 0;
+	sl->cols = NULL;
+	sl->lgeom = NULL;
+	specks_copy_strings( sl, osl );
+	if(osl->specks)
+	    memcpy( sl->specks, osl->specks, osl->bytesperspeck * osl->nspecks );
+	if(osl->cix != NULL) {	/* rgba may predate colormap edits; cix doesn't */
+	    sl->cix = NewN( unsigned short, osl->nspecks+1 );
+	    sl->ncix = osl->nspecks;
+	    memcpy( sl->cix, osl->cix, osl->nspecks * sizeof(*sl->cix) );
 	}
-	*slp = sl;
     }
+    warp_syncsel( sl, osl );
+    *slp = sl;
     warpspecks( ws, st, osl, sl );
+    specks_moved( sl );
   }
+  specks_unpin( st, pin );
+  sc->gen = specks_pool_publish( ws->pool, head );
+  sc->sl = head;
 
   sc->tfrac = ws->tfrac;
   sc->realtime = arealtime;	/* remember original realtime so we
@@ -1255,6 +1525,12 @@ int msg( CONST char *fmt, ... ) {
   return fprintf(stderr, "%s\n", str);
 }
 
+void specks_parallel( void (*func)( void *, int ), void *arg, int njobs, int nitems ) {
+  int k;
+  for(k = 0; k < njobs; k++)
+    (*func)( arg, k );
+}
+
 int parti_idof( struct stuff *stjunk ) {
   return 1;
 }